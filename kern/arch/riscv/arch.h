@@ -159,4 +159,19 @@ static __inline void reboot(void)
 
 extern void cpu_halt(void);
 
+/* No MONITOR/MWAIT; idle cores that would MWAIT just halt. */
+static __inline bool cpu_has_mwait(void)
+{
+	return FALSE;
+}
+
+static __inline void cpu_monitor(void *addr)
+{
+}
+
+static __inline void cpu_mwait(void)
+{
+	cpu_halt();
+}
+
 #endif /* !ROS_INC_ARCH_H */
@@ -7,5 +7,6 @@
 void arch_init()
 {		
 	smp_boot();
+	topology_init();
 	proc_init();
 }
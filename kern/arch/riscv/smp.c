@@ -144,3 +144,13 @@ void __arch_pcpu_init(uint32_t coreid)
 	register uintptr_t sp asm ("sp");
 	set_stack_top(ROUNDUP(sp, PGSIZE));
 }
+
+/* We don't know anything about the topology, so every core is on its own. */
+void topology_init(void)
+{
+	for (int i = 0; i < num_cpus; i++) {
+		core_topo[i].socket = 0;
+		core_topo[i].llc = 0;
+		core_topo[i].phys_core = i;
+	}
+}
@@ -362,6 +362,12 @@ int register_irq(int irq, isr_t handler, void *irq_arg, uint32_t tbdf)
 	return -1;
 }
 
+int deregister_irq(int vector, isr_t handler, void *irq_arg)
+{
+	printk("%s not implemented\n", __FUNCTION);
+	return -1;
+}
+
 int route_irqs(int cpu_vec, int coreid)
 {
 	printk("%s not implemented\n", __FUNCTION);
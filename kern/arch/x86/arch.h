@@ -24,6 +24,9 @@ static inline void disable_irqsave(int8_t *state)
               __attribute__((always_inline));
 static inline void cpu_relax(void) __attribute__((always_inline));
 static inline void cpu_halt(void) __attribute__((always_inline));
+static inline bool cpu_has_mwait(void);
+static inline void cpu_monitor(void *addr) __attribute__((always_inline));
+static inline void cpu_mwait(void) __attribute__((always_inline));
 static inline void clflush(uintptr_t* addr) __attribute__((always_inline));
 static inline int irq_is_enabled(void) __attribute__((always_inline));
 static inline void cache_flush(void) __attribute__((always_inline));
@@ -130,6 +133,27 @@ static inline void cpu_halt(void)
 	asm volatile("sti; hlt" : : : "memory");
 }
 
+static inline bool cpu_has_mwait(void)
+{
+	uint32_t ecx;
+	cpuid(0x1, 0x0, 0, 0, &ecx, 0);
+	return ecx & CPUID_MONITOR_SUPPORT ? TRUE : FALSE;
+}
+
+/* Arms the monitor on addr's cache line.  A write to that line (or an
+ * interrupt) ends the next cpu_mwait(). */
+static inline void cpu_monitor(void *addr)
+{
+	asm volatile("monitor" : : "a"(addr), "c"(0), "d"(0) : "memory");
+}
+
+/* Like cpu_halt(), this atomically turns on interrupts and waits, since the sti
+ * shadow covers the mwait.  We ask for C1, which wakes about as fast as hlt. */
+static inline void cpu_mwait(void)
+{
+	asm volatile("sti; mwait" : : "a"(0), "c"(0) : "memory");
+}
+
 static inline void clflush(uintptr_t* addr)
 {
 	asm volatile("clflush %0" : : "m"(*addr));
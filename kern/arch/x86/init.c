@@ -89,6 +89,7 @@ void arch_init()
 	#else
 		smp_boot();
 	#endif
+	topology_init();
 	proc_init();
 
 	perfmon_init();
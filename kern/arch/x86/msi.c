@@ -317,6 +317,47 @@ static int __pci_msix_init(struct pci_device *p)
 	return 0;
 }
 
+/* Returns how many MSI-X vectors p's function has, or 0 if we won't be able to
+ * use MSI-X on it.  Drivers that want a vector per queue can check this before
+ * registering their IRQs, since once the table runs out, register_irq() falls
+ * back to MSI. */
+int pci_msix_nr_vecs(struct pci_device *p)
+{
+	unsigned int c;
+
+	if (p->msix_ready)
+		return p->msix_nr_vec;
+	if (p->msi_ready || msix_blacklist(p))
+		return 0;
+	c = msixcap(p);
+	if (c == 0)
+		return 0;
+	return (pcidev_read16(p, c + 2) & Msixtblsize) + 1;
+}
+
+/* Returns the index of p's MSI-X table entry that sends apic_vector, or -1.
+ * Devices like the 82574 map their interrupt causes to table entries, not to
+ * vectors, so their drivers need this after register_irq(). */
+int pci_msix_vec_entry(struct pci_device *p, int apic_vector)
+{
+	struct msix_entry *entry;
+	int ret = -1;
+
+	spin_lock_irqsave(&p->lock);
+	if (p->msix_ready) {
+		entry = (struct msix_entry*)p->msix_tbl_vaddr;
+		for (int i = 0; i < p->msix_nr_vec; i++, entry++) {
+			if ((read_mmreg32((uintptr_t)&entry->data) & 0xff) ==
+			    apic_vector) {
+				ret = i;
+				break;
+			}
+		}
+	}
+	spin_unlock_irqsave(&p->lock);
+	return ret;
+}
+
 /* Enables an MSI-X vector for a PCI device.  vec is formatted like an ioapic
  * route.  This should be able to handle multiple vectors for a device.  Returns
  * a msix_irq_vector linkage struct on success (the connection btw an irq_h and
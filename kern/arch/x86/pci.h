@@ -410,6 +410,8 @@ uintptr_t pci_get_membar(struct pci_device *pcidev, int bir);
 /* MSI functions, msi.c */
 int pci_msi_enable(struct pci_device *p, uint64_t vec);
 struct msix_irq_vector *pci_msix_enable(struct pci_device *p, uint64_t vec);
+int pci_msix_nr_vecs(struct pci_device *p);
+int pci_msix_vec_entry(struct pci_device *p, int apic_vector);
 void pci_msi_mask(struct pci_device *p);
 void pci_msi_unmask(struct pci_device *p);
 void pci_msi_route(struct pci_device *p, int dest);
@@ -100,7 +100,8 @@ void setup_default_mtrrs(barrier_t* smp_barrier)
 }
 
 /* Flushes a TLB, including global pages.  We should always have the CR4_PGE
- * flag set, but just in case, we'll check.  Toggling this bit flushes the TLB.
+ * flag set, but just in case, we'll check.  Toggling this bit flushes the TLB,
+ * for every PCID.
  */
 void tlb_flush_global(void)
 {
@@ -111,3 +112,96 @@ void tlb_flush_global(void)
 	} else 
 		lcr3(rcr3());
 }
+
+/* With PCIDs, the TLB keeps entries for a few address spaces at once, so
+ * switching cr3 doesn't have to flush.  PCID 0 is the kernel's (boot_cr3), and
+ * each core hands out the others to the last few procs it loaded.  A core's
+ * entries for a proc are stale if the proc's tlb_gen changed since the core
+ * flushed them, since there were shootdowns the core might have missed.
+ *
+ * PCIDs and the noflush bit only exist in long mode. */
+#ifdef CONFIG_X86_64
+
+#define NR_PCID_SLOTS			8
+
+struct pcid_cache {
+	struct pcid_slot {
+		unsigned long			ctx_id;		/* p->tlb_ctx_id, 0 if unused */
+		long					tlb_gen;	/* p->tlb_gen as of our last flush */
+	} slots[NR_PCID_SLOTS];
+	unsigned int				next_victim;
+	bool						pcide;		/* our CR4.PCIDE, so we don't rcr4 */
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+static struct pcid_cache pcid_caches[MAX_NUM_CPUS];
+
+/* Every core calls this while in boot_cr3 (PCIDE needs cr3's PCID to be 0).
+ * Each core checks the feature and sets its own CR4.PCIDE, and only uses
+ * PCIDs once it has. */
+void enable_pcid(void)
+{
+	uint32_t ecx;
+	cpuid(0x1, 0x0, 0, 0, &ecx, 0);
+	if (!(ecx & CPUID_PCID_SUPPORT))
+		return;
+	lcr4(rcr4() | X86_CR4_PCIDE);
+	pcid_caches[core_id()].pcide = TRUE;
+}
+
+void tlb_load_proc(struct proc *p)
+{
+	struct pcid_cache *pc;
+	struct pcid_slot *slot = 0;
+	unsigned long cr3;
+	long gen;
+	int8_t irq_state = 0;
+
+	disable_irqsave(&irq_state);
+	pc = &pcid_caches[core_id()];
+	/* Setting the noflush bit without CR4.PCIDE is a GPF */
+	if (!pc->pcide) {
+		lcr3(p ? p->env_cr3 : boot_cr3);
+		enable_irqsave(&irq_state);
+		return;
+	}
+	/* The kernel's mappings are global, or only change with a global flush */
+	if (!p) {
+		lcr3(boot_cr3 | X86_CR3_NOFLUSH);
+		enable_irqsave(&irq_state);
+		return;
+	}
+	gen = atomic_read(&p->tlb_gen);
+	for (int i = 0; i < NR_PCID_SLOTS; i++) {
+		if (pc->slots[i].ctx_id == p->tlb_ctx_id) {
+			slot = &pc->slots[i];
+			break;
+		}
+	}
+	if (slot && (slot->tlb_gen == gen)) {
+		cr3 = p->env_cr3 | (slot - pc->slots + 1) | X86_CR3_NOFLUSH;
+	} else {
+		if (!slot) {
+			slot = &pc->slots[pc->next_victim];
+			pc->next_victim = (pc->next_victim + 1) % NR_PCID_SLOTS;
+			slot->ctx_id = p->tlb_ctx_id;
+		}
+		/* Without the noflush bit, this flushes the PCID's old entries */
+		slot->tlb_gen = gen;
+		cr3 = p->env_cr3 | (slot - pc->slots + 1);
+	}
+	lcr3(cr3);
+	enable_irqsave(&irq_state);
+}
+
+#else /* CONFIG_X86_64 */
+
+void enable_pcid(void)
+{
+}
+
+void tlb_load_proc(struct proc *p)
+{
+	lcr3(p ? p->env_cr3 : boot_cr3);
+}
+
+#endif /* CONFIG_X86_64 */
@@ -3,5 +3,6 @@
 
 void x86_cleanup_bootmem(void);
 void setup_default_mtrrs(barrier_t *smp_barrier);
+void enable_pcid(void);
 
 #endif /* ROS_KERN_ARCH_PMAP_H */
@@ -484,6 +484,39 @@ int get_va_perms(pde_t *pgdir, const void *SNT va)
 	return the_pte & the_pde & (PTE_U | PTE_W | PTE_P);
 }
 
+/* No user jumbo pages (yet) on 32 bit x86; everyone gets little pages. */
+int pgdir_min_jumbo_shift(void)
+{
+	return PGSHIFT;
+}
+
+int pgdir_max_jumbo_shift(void)
+{
+	return PGSHIFT;
+}
+
+int pgdir_page_shift(pde_t *pgdir, const void *va)
+{
+	pte_t *pte = pgdir_walk(pgdir, va, 0);
+	return pte && (*pte & PTE_P) ? PGSHIFT : 0;
+}
+
+bool pgdir_jumbo_slot_empty(pde_t *pgdir, const void *va, int pml_shift)
+{
+	return FALSE;
+}
+
+int pgdir_map_jumbo(pde_t *pgdir, const void *va, physaddr_t pa, int perm,
+                    int pml_shift)
+{
+	return -EINVAL;
+}
+
+int env_split_jumbo(struct proc *p, const void *va)
+{
+	return 0;
+}
+
 void
 page_check(void)
 {
@@ -11,9 +11,9 @@
  * - mapping segments doesn't support having a PTE already present
  * - mtrrs break big machines
  * - jumbo pages are only supported at the VM layer, not PM (a jumbo is 2^9
- * little pages, for example)
- * - usermemwalk and freeing might need some help (in higher layers of the
- * kernel). */
+ * little pages, for example).  User jumbos work because each of their little
+ * pages has its own ref, so we can always break a jumbo back into little pages
+ * (demote) without touching the memory. */
 
 #include <arch/x86.h>
 #include <arch/arch.h>
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <kmalloc.h>
 #include <page_alloc.h>
+#include <process.h>
 
 extern char boot_pml4[], gdt64[], gdt64desc[];
 pde_t *boot_pgdir;
@@ -72,6 +73,55 @@ static pte_t *pte2pml(pte_t pte)
 	return (pte_t*)KADDR(PTE_ADDR(pte));
 }
 
+/* Helper: walks to va's final PTE without creating anything, stopping early at
+ * a jumbo or an unmapped PTE.  Reports the shift of the PML the PTE is in. */
+static pte_t *pml_walk_shift(pte_t *pml, uintptr_t va, int *shift_out)
+{
+	pte_t *pte;
+	int pml_shift = PML4_SHIFT;
+
+	while (1) {
+		pte = &pml[PMLx(va, pml_shift)];
+		if (!(*pte & PTE_P) || walk_is_complete(pte, pml_shift, PML1_SHIFT))
+			break;
+		pml = pte2pml(*pte);
+		pml_shift -= BITS_PER_PML;
+	}
+	*shift_out = pml_shift;
+	return pte;
+}
+
+/* Helper: replaces p's jumbo at pte, which maps va in a PML of pml_shift, with
+ * a page table of the next size down that maps the same memory with the same
+ * perms.  The translations don't change, but the page size does, and we can't
+ * leave TLB entries of both sizes around for the same address, so we shoot
+ * down the old jumbo. */
+static int demote_jumbo(struct proc *p, pte_t *pte, uintptr_t va,
+                        int pml_shift)
+{
+	int sub_shift = pml_shift - BITS_PER_PML;
+	uintptr_t jumbo_va = ROUNDDOWN(va, 1UL << pml_shift);
+	physaddr_t pa = *pte & ~PTE_HIGH_FLAGS & ~((1UL << pml_shift) - 1);
+	/* PTE_PS would be PTE_PAT in a PML1.  PTE_JPAT is above PGSIZE - 1. */
+	pte_t flags = *pte & ((PGSIZE - 1) | PTE_HIGH_FLAGS) & ~PTE_PS;
+	pte_t *new_pml;
+
+	assert((pml_shift != PML1_SHIFT) && (*pte & PTE_PS));
+	new_pml = kpage_alloc_addr();
+	if (!new_pml)
+		return -ENOMEM;
+	if (sub_shift != PML1_SHIFT)
+		flags |= PTE_PS;
+	if (*pte & PTE_JPAT)
+		flags |= sub_shift != PML1_SHIFT ? PTE_JPAT : PTE_PAT;
+	for (int i = 0; i < NPTENTRIES; i++)
+		new_pml[i] = (pa + ((uintptr_t)i << sub_shift)) | flags;
+	/* same as for any other intermediate PT, the perms are on the last PTE */
+	*pte = PADDR(new_pml) | PTE_P | PTE_U | PTE_W;
+	proc_tlbshootdown(p, jumbo_va, jumbo_va + (1UL << pml_shift));
+	return 0;
+}
+
 static pte_t *__pml_walk(pte_t *pml, uintptr_t va, int flags, int pml_shift)
 {
 	pte_t *pte;
@@ -351,6 +401,82 @@ int unmap_segment(pde_t *pgdir, uintptr_t va, size_t size)
 	return pml_for_each(pgdir, va, size, pt_free_cb, 0);
 }
 
+/* User jumbo pages.  A PML2 jumbo is the smallest, PML3 the largest, if the
+ * hardware supports 1GB pages. */
+int pgdir_min_jumbo_shift(void)
+{
+	return PML2_SHIFT;
+}
+
+int pgdir_max_jumbo_shift(void)
+{
+	return max_jumbo_shift;
+}
+
+/* Returns the shift of the page mapping va: PGSHIFT for a normal page, or the
+ * shift of a jumbo.  Returns 0 if va isn't mapped. */
+int pgdir_page_shift(pde_t *pgdir, const void *va)
+{
+	int pml_shift;
+	pte_t *pte = pml_walk_shift(pgdir, (uintptr_t)va, &pml_shift);
+
+	if (!(*pte & PTE_P))
+		return 0;
+	return pml_shift;
+}
+
+/* Returns TRUE if nothing is mapped at va's PTE in the PML of pml_shift, not
+ * even a page table, so a jumbo of that size could go there.  Once any little
+ * page in the range is mapped, there's a page table, and this stays FALSE.
+ * Hold the pte_lock. */
+bool pgdir_jumbo_slot_empty(pde_t *pgdir, const void *va, int pml_shift)
+{
+	pte_t *pte = pml_walk(pgdir, (uintptr_t)va, pml_shift);
+
+	/* no intermediate table means nothing is mapped anywhere near va */
+	return !pte || !*pte;
+}
+
+/* Maps the jumbo page at pa, of size 1 << pml_shift, at va.  Fails with -EEXIST
+ * if anything is already there, including an empty page table: replacing that
+ * would take a TLB shootdown before we could free it.  Hold the pte_lock. */
+int pgdir_map_jumbo(pde_t *pgdir, const void *va, physaddr_t pa, int perm,
+                    int pml_shift)
+{
+	pte_t *pte;
+
+	assert((pml_shift == PML2_SHIFT) || (pml_shift == max_jumbo_shift));
+	assert(!((uintptr_t)va & ((1UL << pml_shift) - 1)));
+	assert(!(pa & ((1UL << pml_shift) - 1)));
+	pte = pml_walk(pgdir, (uintptr_t)va, PG_WALK_CREATE | pml_shift);
+	if (!pte)
+		return -ENOMEM;
+	/* the walk might have stopped early, on a bigger jumbo */
+	if (*pte)
+		return -EEXIST;
+	*pte = pa | PTE_PS | PTE_P | perm;
+	return 0;
+}
+
+/* Breaks up whichever of p's jumbos spans va (if any), so that va is on a page
+ * boundary.  If va is already the start of a jumbo, it's left alone.  Hold the
+ * pte_lock. */
+int env_split_jumbo(struct proc *p, const void *va)
+{
+	int pml_shift, ret;
+	pte_t *pte;
+
+	while (1) {
+		pte = pml_walk_shift(p->env_pgdir, (uintptr_t)va, &pml_shift);
+		if (!(*pte & PTE_P) || (pml_shift == PML1_SHIFT))
+			return 0;
+		if (!((uintptr_t)va & ((1UL << pml_shift) - 1)))
+			return 0;
+		if ((ret = demote_jumbo(p, pte, (uintptr_t)va, pml_shift)))
+			return ret;
+	}
+}
+
 /* Older interface for page table walks - will return the PTE corresponding to
  * VA.  If create is 1, it'll create intermediate tables.  This can return jumbo
  * PTEs, but only if they already exist.  Otherwise, (with create), it'll walk
@@ -461,8 +587,9 @@ void x86_cleanup_bootmem(void)
 }
 
 /* Walks len bytes from start, executing 'callback' on every PTE, passing it a
- * specific VA and whatever arg is passed in.  Note, this cannot handle jumbo
- * pages.
+ * specific VA and whatever arg is passed in.  The callbacks only know about
+ * little pages, so we demote any jumbos we run into.  That needs memory for the
+ * new page tables; if we run out, we abort with -ENOMEM.
  *
  * This is just a clumsy wrapper around the more powerful pml_for_each, which
  * can handle jumbo and intermediate pages. */
@@ -473,13 +600,31 @@ int env_user_mem_walk(struct proc *p, void *start, size_t len,
 		struct proc *p;
 		mem_walk_callback_t cb;
 		void *cb_arg;
+		uintptr_t start;
+		uintptr_t end;
 	};
 	int trampoline_cb(pte_t *pte, uintptr_t kva, int shift, bool visited_subs,
 	                  void *data)
 	{
 		struct tramp_package *tp = (struct tramp_package*)data;
+		uintptr_t sub_start, sub_end;
+
 		assert(tp->cb);
-		/* memwalk CBs don't know how to handle intermediates or jumbos */
+		/* pml_for_each didn't descend into the jumbo, so we walk the PTEs of
+		 * its replacement ourselves. */
+		if ((shift != PML1_SHIFT) && (*pte & PTE_P) && (*pte & PTE_PS)) {
+			if (demote_jumbo(tp->p, pte, kva, shift)) {
+				warn("Couldn't demote a jumbo at %p for proc %d", kva,
+				     tp->p->pid);
+				return -ENOMEM;
+			}
+			sub_start = MAX(kva, tp->start);
+			sub_end = MIN(kva + (1UL << shift), tp->end);
+			return __pml_for_each(pte2pml(*pte), sub_start,
+			                      sub_end - sub_start, trampoline_cb, tp,
+			                      shift - BITS_PER_PML);
+		}
+		/* memwalk CBs don't know how to handle intermediates */
 		if (shift != PML1_SHIFT)
 			return 0;
 		return tp->cb(tp->p, pte, (void*)kva, tp->cb_arg);
@@ -489,6 +634,8 @@ int env_user_mem_walk(struct proc *p, void *start, size_t len,
 	local_tp.p = p;
 	local_tp.cb = callback;
 	local_tp.cb_arg = arg;
+	local_tp.start = (uintptr_t)start;
+	local_tp.end = (uintptr_t)start + len;
 	return pml_for_each(p->env_pgdir, (uintptr_t)start, len, trampoline_cb,
 	                    &local_tp);
 }
@@ -510,7 +657,7 @@ void env_pagetable_free(struct proc *p)
 		return 0;
 	}
 		
-	assert(p->env_cr3 != rcr3());
+	assert(p->env_cr3 != (rcr3() & ~X86_CR3_PCID_MASK));
 	pml_for_each(p->env_pgdir, 0, UVPT, pt_free_cb, 0);
 	/* the page directory is not a PTE, so it never was freed */
 	page_decref(pa2page(p->env_cr3));
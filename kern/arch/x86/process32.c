@@ -144,7 +144,7 @@ void __abandon_core(void)
 {
 	struct per_cpu_info *pcpui = &per_cpu_info[core_id()];
 	asm volatile ("movw %%ax,%%gs; lldt %%ax" :: "a"(0));
-	lcr3(boot_cr3);
+	proc_load_cr3(pcpui->cur_proc, 0);
 	proc_decref(pcpui->cur_proc);
 	pcpui->cur_proc = 0;
 }
@@ -274,6 +274,9 @@ typedef unsigned long pde_t;
 #define PTE_PAT			0x080	/* Page attribute table */
 #define PTE_G			0x100	/* Global Page */
 #define PTE_JPAT		0x800	/* Jumbo PAT */
+#define PTE_NX			0x8000000000000000	/* No Execute */
+/* NX, plus the bits below it that are ignored (or a protection key) */
+#define PTE_HIGH_FLAGS	0xfff0000000000000
 #define PTE_NOCACHE		(PTE_PWT | PTE_PCD)
 
 /* Permissions fields and common access modes.  These should be read as 'just
@@ -341,6 +341,7 @@ void __arch_pcpu_init(uint32_t coreid)
 	/* Flushes any potentially old mappings from smp_boot() (note the page table
 	 * removal) */
 	tlbflush();
+	enable_pcid();
 	/* Ensure the FPU units are initialized */
 	asm volatile ("fninit");
 
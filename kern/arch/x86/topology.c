@@ -0,0 +1,168 @@
+/* Copyright (c) 2014 The Regents of the University of California
+ * See LICENSE for details.
+ *
+ * CPU topology: which cores are hyperthreads of each other, which share a
+ * last-level cache, and which share a socket.
+ *
+ * The APIC ID of a core is made of bit fields: the low bits are the SMT
+ * thread, then the core within the package, then the package.  CPUID tells us
+ * how many bits to shift off to get to each level, and how many logical cores
+ * share each cache (which we round up to a power of two, like the APIC IDs
+ * are).  We assume every package looks like the one we boot on. */
+
+#include <arch/x86.h>
+#include <arch/arch.h>
+#include <smp.h>
+#include <stdio.h>
+#include <string.h>
+
+struct topo_shifts {
+	unsigned int				smt;	/* apic_id >> smt is the phys core */
+	unsigned int				llc;	/* apic_id >> llc is the LLC */
+	unsigned int				pkg;	/* apic_id >> pkg is the socket */
+};
+
+/* Leaf 0xb lists the levels from SMT on up, with the shift for each. */
+static bool leaf_b_shifts(struct topo_shifts *ts)
+{
+	uint32_t eax, ebx, ecx, edx;
+	bool found_smt = FALSE, found_core = FALSE;
+
+	for (int i = 0; i < 8; i++) {
+		cpuid(0xb, i, &eax, &ebx, &ecx, &edx);
+		if (!(ebx & 0xffff))
+			break;
+		switch ((ecx >> 8) & 0xff) {
+			case 1:
+				ts->smt = eax & 0x1f;
+				found_smt = TRUE;
+				break;
+			case 2:
+				ts->pkg = eax & 0x1f;
+				found_core = TRUE;
+				break;
+		}
+	}
+	if (!found_smt)
+		return FALSE;
+	if (!found_core)
+		ts->pkg = ts->smt;
+	return TRUE;
+}
+
+/* Older machines: leaf 1 has the logical cores per package, and either leaf 4
+ * (Intel) or 0x80000008 (AMD) has the cores per package. */
+static void legacy_shifts(struct topo_shifts *ts, uint32_t max_std,
+                          uint32_t max_extd)
+{
+	uint32_t eax, ebx, ecx, edx;
+	unsigned int nr_logical, nr_cores = 0;
+
+	cpuid(0x1, 0x0, 0, &ebx, 0, &edx);
+	if (!(edx & (1 << 28))) {
+		/* No HTT: one logical core per package */
+		ts->smt = 0;
+		ts->pkg = 0;
+		return;
+	}
+	nr_logical = MAX((ebx >> 16) & 0xff, 1);
+	if (max_std >= 4) {
+		cpuid(0x4, 0x0, &eax, 0, 0, 0);
+		if (eax & 0x1f)
+			nr_cores = (eax >> 26) + 1;
+	}
+	if (!nr_cores && max_extd >= 0x80000008) {
+		cpuid(0x80000008, 0x0, 0, 0, &ecx, 0);
+		nr_cores = (ecx & 0xff) + 1;
+	}
+	if (!nr_cores || nr_cores > nr_logical)
+		nr_cores = nr_logical;
+	ts->pkg = LOG2_UP(nr_logical);
+	ts->smt = LOG2_UP(nr_logical / nr_cores);
+}
+
+/* Returns the shift for the highest level cache described by the deterministic
+ * cache parameters leaf (4 on Intel, 0x8000001d on AMD), or -1. */
+static int cache_leaf_llc_shift(uint32_t leaf)
+{
+	uint32_t eax;
+	int shift = -1, max_level = 0, level;
+
+	for (int i = 0; i < 16; i++) {
+		cpuid(leaf, i, &eax, 0, 0, 0);
+		if (!(eax & 0x1f))
+			break;
+		level = (eax >> 5) & 0x7;
+		if (level >= max_level) {
+			max_level = level;
+			shift = LOG2_UP(((eax >> 14) & 0xfff) + 1);
+		}
+	}
+	return shift;
+}
+
+static void get_topo_shifts(struct topo_shifts *ts)
+{
+	uint32_t max_std, max_extd;
+	int llc_shift = -1;
+
+	cpuid(0x0, 0x0, &max_std, 0, 0, 0);
+	cpuid(0x80000000, 0x0, &max_extd, 0, 0, 0);
+	if (!(max_std >= 0xb && leaf_b_shifts(ts)))
+		legacy_shifts(ts, max_std, max_extd);
+	if (max_std >= 4)
+		llc_shift = cache_leaf_llc_shift(0x4);
+	if (llc_shift < 0 && max_extd >= 0x8000001d)
+		llc_shift = cache_leaf_llc_shift(0x8000001d);
+	/* No cache info: assume the whole socket shares the LLC */
+	if (llc_shift < 0)
+		llc_shift = ts->pkg;
+	ts->llc = MIN(MAX((unsigned int)llc_shift, ts->smt), ts->pkg);
+}
+
+/* Turns the raw IDs into dense ones, in order of first appearance. */
+static void densify(int *raw, size_t field_off)
+{
+	int next_id = 0;
+	int *dense;
+
+	for (int i = 0; i < num_cpus; i++) {
+		dense = (int*)((char*)&core_topo[i] + field_off);
+		*dense = -1;
+		for (int j = 0; j < i; j++) {
+			if (raw[j] == raw[i]) {
+				*dense = *(int*)((char*)&core_topo[j] + field_off);
+				break;
+			}
+		}
+		if (*dense == -1)
+			*dense = next_id++;
+	}
+}
+
+void topology_init(void)
+{
+	struct topo_shifts ts = {0};
+	int raw[MAX_NUM_CPUS];
+	int nr_sockets = 0, nr_llcs = 0, nr_phys = 0;
+
+	get_topo_shifts(&ts);
+	for (int i = 0; i < num_cpus; i++)
+		raw[i] = get_hw_coreid(i) >> ts.pkg;
+	densify(raw, offsetof(struct core_topo, socket));
+	/* The LLC and phys core fields don't include the socket bits, but we're
+	 * shifting the whole APIC ID, so they are still unique across sockets. */
+	for (int i = 0; i < num_cpus; i++)
+		raw[i] = get_hw_coreid(i) >> ts.llc;
+	densify(raw, offsetof(struct core_topo, llc));
+	for (int i = 0; i < num_cpus; i++)
+		raw[i] = get_hw_coreid(i) >> ts.smt;
+	densify(raw, offsetof(struct core_topo, phys_core));
+	for (int i = 0; i < num_cpus; i++) {
+		nr_sockets = MAX(nr_sockets, core_topo[i].socket + 1);
+		nr_llcs = MAX(nr_llcs, core_topo[i].llc + 1);
+		nr_phys = MAX(nr_phys, core_topo[i].phys_core + 1);
+	}
+	printk("Topology: %d sockets, %d LLCs, %d phys cores, %d logical cores\n",
+	       nr_sockets, nr_llcs, nr_phys, num_cpus);
+}
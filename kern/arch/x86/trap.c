@@ -440,6 +440,9 @@ static void abort_halt(struct hw_trapframe *hw_tf)
 	/* the halt instruction in is 0xf4, and it's size is 1 byte */
 	if (*(uint8_t*)x86_get_ip_hw(hw_tf) == 0xf4)
 		x86_advance_ip(hw_tf, 1);
+	/* Same deal for cpu_mwait(): mwait is 0f 01 c9 */
+	if (!memcmp((void*)x86_get_ip_hw(hw_tf), "\x0f\x01\xc9", 3))
+		x86_advance_ip(hw_tf, 3);
 }
 
 void trap(struct hw_trapframe *hw_tf)
@@ -546,6 +549,8 @@ out_no_eoi:
 	assert(0);
 }
 
+/* Returns the apic vector the IRQ was set up on, which callers can pass to
+ * route_irqs(), or -1 on failure. */
 int register_irq(int irq, isr_t handler, void *irq_arg, uint32_t tbdf)
 {
 	struct irq_handler *irq_h;
@@ -576,6 +581,32 @@ int register_irq(int irq, isr_t handler, void *irq_arg, uint32_t tbdf)
 	 * The lapic IRQs need to be unmasked on a per-core basis */
 	if (irq_h->unmask && strcmp(irq_h->type, "lapic"))
 		irq_h->unmask(irq_h, vector);
+	return vector;
+}
+
+/* Masks and removes the handler registered for vector with handler and irq_arg.
+ * There's no RCU for the readers yet, so only call this when the device can't
+ * be raising the IRQ, like when you never turned it on.  The vector itself
+ * isn't given back (same as when bus_irq_setup() fails).  Returns 0 on success,
+ * -1 if there was no such handler. */
+int deregister_irq(int vector, isr_t handler, void *irq_arg)
+{
+	struct irq_handler *irq_h, **pp;
+
+	spin_lock_irqsave(&irq_handler_wlock);
+	for (pp = &irq_handlers[vector]; (irq_h = *pp); pp = &irq_h->next) {
+		if ((irq_h->isr == handler) && (irq_h->data == irq_arg))
+			break;
+	}
+	if (!irq_h) {
+		spin_unlock_irqsave(&irq_handler_wlock);
+		return -1;
+	}
+	if (irq_h->mask)
+		irq_h->mask(irq_h, vector);
+	*pp = irq_h->next;
+	spin_unlock_irqsave(&irq_handler_wlock);
+	kfree(irq_h);
 	return 0;
 }
 
@@ -51,6 +51,8 @@
 
 /* CPUID */
 #define CPUID_PSE_SUPPORT			0x00000008
+#define CPUID_PCID_SUPPORT			0x00020000	/* ecx */
+#define CPUID_MONITOR_SUPPORT		0x00000008	/* ecx */
 
 /* Arch Constants */
 #define MAX_NUM_CPUS				255
@@ -122,6 +124,9 @@
 #define X86_CR3_PWT	0x00000008 /* Page Write Through */
 #define X86_CR3_PCD	0x00000010 /* Page Cache Disable */
 #define X86_CR3_PCID_MASK 0x00000fff /* PCID Mask */
+#ifdef CONFIG_X86_64
+#define X86_CR3_NOFLUSH	(1UL << 63) /* Keep the PCID's TLB entries */
+#endif
 
 /*
  * Intel CPU features in CR4
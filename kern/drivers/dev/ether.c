@@ -152,6 +152,7 @@ static void etherclose(struct chan *chan)
 		runlock(&ether->rwlock);
 		nexterror();
 	}
+	netmap_chan_closed(ether, chan);
 	netifclose(&ether->netif, chan);
 	poperror();
 	runlock(&ether->rwlock);
@@ -569,6 +570,7 @@ static struct ether *vlanalloc(struct ether *ether, int id)
 			error(Enovmem);
 		rwinit(&vlan->rwlock);
 		qlock_init(&vlan->vlq);
+		qlock_init(&vlan->nmlock);
 		netifinit(&vlan->netif, name, Ntypes, ether->netif.limit);
 		ether->vlans[fid] = vlan;	/* id is still zero, can't be matched */
 		ether->nvlan++;
@@ -649,6 +651,7 @@ static void etherreset(void)
 		memset(ether, 0, sizeof(struct ether));
 		rwinit(&ether->rwlock);
 		qlock_init(&ether->vlq);
+		qlock_init(&ether->nmlock);
 		ether->ctlrno = ctlrno;
 		ether->netif.mbps = 10;
 		ether->minmtu = ETHERMINTU;
@@ -29,6 +29,7 @@
 #include <cpio.h>
 #include <pmap.h>
 #include <smp.h>
+#include <schedule.h>
 
 enum {
 	Qdir,
@@ -74,6 +75,8 @@ enum {
 	CMwired,
 	CMtrace,
 	CMcore,
+	CMplacement,
+	CMnice,
 };
 
 enum {
@@ -130,6 +133,8 @@ struct cmdtab proccmd[] = {
 	{CMwired, "wired", 2},
 	{CMtrace, "trace", 0},
 	{CMcore, "core", 2},
+	{CMplacement, "placement", 2},
+	{CMnice, "nice", 2},
 };
 
 /*
@@ -1429,7 +1434,7 @@ static void procctlreq(struct proc *p, char *va, int n)
 {
 	ERRSTACK(2);
 	int8_t irq_state = 0;
-	int npc, pri, core;
+	int npc, pri, core, placement;
 	struct cmdbuf *cb;
 	struct cmdtab *ct;
 	int64_t time;
@@ -1456,6 +1461,22 @@ static void procctlreq(struct proc *p, char *va, int n)
 		case CMclosefiles:
 			procctlclosefiles(p, 1, 0);
 			break;
+		case CMplacement:
+			if (!strcmp(cb->f[1], "any"))
+				placement = CORE_PLACE_ANY;
+			else if (!strcmp(cb->f[1], "compact"))
+				placement = CORE_PLACE_COMPACT;
+			else if (!strcmp(cb->f[1], "compact_smt"))
+				placement = CORE_PLACE_COMPACT_SMT;
+			else
+				error("placement must be any, compact, or compact_smt");
+			sched_set_placement(p, placement);
+			break;
+		case CMnice:
+			if (sched_set_nice(p, strtol(cb->f[1], 0, 0)))
+				error("nice must be from %d to %d", SCHED_NICE_MIN,
+				      SCHED_NICE_MAX);
+			break;
 #if 0
 			we may want this.Let us pause a proc.case CMhang:p->hang = 1;
 			break;
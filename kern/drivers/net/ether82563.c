@@ -40,6 +40,9 @@
 #include <pmap.h>
 #include <smp.h>
 #include <ip.h>
+#include <trap.h>
+#include <schedule.h>
+#include <netmap.h>
 
 /*
  * note: the 82575, 82576 and 82580 are operated using registers aliased
@@ -77,6 +80,7 @@ enum {
 	Ics = 0x00c8,	/* Interrupt Cause Set */
 	Ims = 0x00d0,	/* Interrupt Mask Set/Read */
 	Imc = 0x00d8,	/* Interrupt mask Clear */
+	Eiac = 0x00dc,	/* Extended Interrupt Auto Clear (82574) */
 	Iam = 0x00e0,	/* Interrupt acknowledge Auto Mask */
 	Ivar = 0x00e4,	/* Ivar: interrupt allocation */
 	Eitr = 0x1680,	/* Extended itr; 82575/6 80 only */
@@ -111,6 +115,8 @@ enum {
 	Rah = 0x5404,	/* Receive Address High */
 	Vfta = 0x5600,	/* VLAN Filter Table Array */
 	Mrqc = 0x5818,	/* Multiple Receive Queues Command */
+	Reta = 0x5c00,	/* Redirection Table (82574) */
+	Rssrk = 0x5c80,	/* RSS Random Key (82574) */
 
 	/* Transmit */
 
@@ -126,6 +132,7 @@ enum {
 	Txdctl = 0x3828,	/* Descriptor Control */
 	Tadv = 0x382C,	/* Interrupt Absolute Delay Timer */
 	Tarc0 = 0x3840,	/* Arbitration Counter Queue 0 */
+	Qstride = 0x100,	/* queue n's R/Td*, [RT]xdctl and Tarc are n strides up */
 
 	/* Statistics */
 
@@ -277,6 +284,22 @@ enum {							/* Icr, Ics, Ims, Imc */
 	Rxcfgset = 0x00000400,	/* Receiving /C/ ordered sets */
 	Ack = 0x00020000,	/* Receive ACK frame */
 	Omed = 1 << 20,	/* media change; pcs interface */
+	Rxq0 = 1 << 20,	/* rx queue 0; 82574 msi-x only, queue 1 is << 1 */
+	Txq0 = 1 << 22,	/* tx queue 0; 82574 msi-x only, queue 1 is << 1 */
+	Other = 1 << 24,	/* any non-queue cause; 82574 msi-x only */
+};
+
+enum {							/* Ivar (82574), 4 bits per cause */
+	Ivalid = 1 << 3,			/* low 3 bits are the msi-x entry */
+	IvarRxq = 0,	/* shift of rx queue 0; queue 1 is 4 more */
+	IvarTxq = 8,	/* shift of tx queue 0; queue 1 is 4 more */
+	IvarOther = 16,	/* shift of the other causes */
+};
+
+enum {							/* Mrqc */
+	Rss2q = 1 << 0,				/* RSS over two queues (82574) */
+	Rsstcpip4 = 1 << 16,	/* hash TCP/IPv4 addresses and ports */
+	Rssip4 = 1 << 17,	/* hash other IPv4 addresses */
 };
 
 enum {							/* Txcw */
@@ -353,6 +376,10 @@ enum {							/* [RT]xdctl */
 	Enable = 0x02000000,
 };
 
+enum {							/* Tarc */
+	Tarcen = 1 << 10,			/* queue enable */
+};
+
 enum {							/* Rxcsum */
 	Ipofl = 0x0100,				/* IP Checksum Off-load Enable */
 	Tuofl = 0x0200,	/* TCP/UDP Checksum Off-load Enable */
@@ -453,6 +480,8 @@ enum {
 	Nrb = 3 * 512,	/* private receive buffers per Ctlr */
 	Rbalign = 16,	/* rx buffer alignment */
 	Npool = 10,
+	Nq = 2,	/* rx/tx queue pairs; only Fmq parts have more than 1 */
+	Nreta = 128,	/* redirection table entries */
 };
 
 enum {
@@ -487,6 +516,7 @@ enum {
 	Fflashea = 1 << 4,
 	F79phy = 1 << 5,
 	Fnofct = 1 << 6,
+	Fmq = 1 << 7,
 };
 
 typedef struct Ctlrtype Ctlrtype;
@@ -506,7 +536,7 @@ static Ctlrtype cttab[Nctlrtype] = {
 	{i82571, 9234, 1, "i82571", Fpba},
 	{i82572, 9234, 1, "i82572", Fpba},
 	{i82573, 8192, 1, "i82573", Fert},	/* terrible perf above 8k */
-	{i82574, 9018, 1, "i82574", 0},
+	{i82574, 9018, 1, "i82574", Fmq},
 	{i82575, 9728, 1, "i82575", F75 | Fflashea},
 	{i82576, 9728, 1, "i82576", F75},
 	{i82577, 4096, 2, "i82577", Fload | Fert},
@@ -523,6 +553,47 @@ static Ctlrtype cttab[Nctlrtype] = {
 
 typedef void (*Freefn) (struct block *);
 
+/* An rx ring and a tx ring, with their own buffer pool, and on parts with RSS
+ * and MSI-X, their own vector, routed to an LL core.  RSS picks the rx queue
+ * from the flow's addresses and ports, and the queue's rproc runs on its core.
+ * We send a flow's packets out on the same queue, but there's still one
+ * tproc for all of them: it fills the tx rings from whichever core last woke
+ * it, usually the sender's, and only moves to a queue's core while it waits on
+ * that queue's ring. */
+typedef struct Qpair Qpair;
+struct Qpair {
+	struct ctlr *ctlr;
+	struct ether *edev;
+	int idx;
+	int pool;
+	int vec;					/* our msi-x vector, or -1 if we share */
+	int coreid;					/* where vec goes, and so where we run */
+
+	struct rendez rrendez;
+	int rim;
+	int rdfree;
+	Rd *rdba;					/* receive descriptor base address */
+	struct block **rb;			/* receive buffers */
+	unsigned int rdh;			/* receive descriptor head */
+	unsigned int rdt;			/* receive descriptor tail */
+	unsigned int rsleep;
+	unsigned int rintr;
+
+	struct rendez trendez;
+	int tim;
+	Td *tdba;					/* transmit descriptor base address */
+	struct block **tb;			/* transmit buffers */
+	int tdh;					/* transmit descriptor head */
+	int tdt;					/* transmit descriptor tail */
+
+	/* With a netmap, the rings point at the process's buffers, and the rproc
+	 * and tproc leave them alone.  rlock and tlock keep them from changing
+	 * hands under the procs. */
+	struct netmap *nm;
+	qlock_t rlock;
+	qlock_t tlock;
+};
+
 typedef struct ctlr Ctlr;
 struct ctlr {
 	uintptr_t mmio_paddr;
@@ -530,7 +601,6 @@ struct ctlr {
 	struct ctlr *next;
 	int active;
 	int type;
-	int pool;
 	uint16_t eeprom[0x40];
 
 	qlock_t alock;				/* attach */
@@ -550,8 +620,6 @@ struct ctlr {
 	uint32_t statistics[Nstatistics];
 	unsigned int lsleep;
 	unsigned int lintr;
-	unsigned int rsleep;
-	unsigned int rintr;
 	unsigned int txdw;
 	unsigned int tintr;
 	unsigned int ixsm;
@@ -563,23 +631,13 @@ struct ctlr {
 	uint8_t ra[Eaddrlen];		/* receive address */
 	uint32_t mta[128];			/* multicast table array */
 
-	struct rendez rrendez;
-	int rim;
-	int rdfree;
-	Rd *rdba;					/* receive descriptor base address */
-	struct block **rb;			/* receive buffers */
-	unsigned int rdh;			/* receive descriptor head */
-	unsigned int rdt;			/* receive descriptor tail */
 	int rdtr;					/* receive delay timer ring value */
 	int radv;					/* receive interrupt absolute delay timer */
 
-	struct rendez trendez;
-	qlock_t tlock;
-	int tbusy;
-	Td *tdba;					/* transmit descriptor base address */
-	struct block **tb;			/* transmit buffers */
-	int tdh;					/* transmit descriptor head */
-	int tdt;					/* transmit descriptor tail */
+	int nq;
+	Qpair qp[Nq];
+	uint32_t ivar;				/* msi-x entries for each cause, if nq > 1 */
+	int nmqs;					/* queues with netmaps */
 
 	int fcrtl;
 	int fcrth;
@@ -616,6 +674,12 @@ static inline void csr32w(struct ctlr *c, uintptr_t reg, uint32_t val)
 	write_mmreg32((uintptr_t)(c->nic + (reg / 4)), val);
 }
 
+/* q's copy of a per-queue register */
+static inline uintptr_t qreg(Qpair *q, uintptr_t reg)
+{
+	return reg + q->idx * Qstride;
+}
+
 static struct ctlr *i82563ctlr;
 static Rbpool rbtab[Npool];
 
@@ -705,8 +769,10 @@ static long i82563ifstat(struct ether* edev, void* a, long n, uint32_t offset)
 	char *s, *p, *e, *stat;
 	int i, r;
 	uint64_t tuvl, ruvl;
+	unsigned int rintr, rsleep;
 	struct ctlr *ctlr;
 	Rbpool *b;
+	Qpair *q;
 
 	ctlr = edev->ctlr;
 	qlock(&ctlr->slock);
@@ -745,8 +811,13 @@ static long i82563ifstat(struct ether* edev, void* a, long n, uint32_t offset)
 		}
 	}
 
+	rintr = rsleep = 0;
+	for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+		rintr += q->rintr;
+		rsleep += q->rsleep;
+	}
 	p = seprintf(p, e, "lintr: %ud %ud\n", ctlr->lintr, ctlr->lsleep);
-	p = seprintf(p, e, "rintr: %ud %ud\n", ctlr->rintr, ctlr->rsleep);
+	p = seprintf(p, e, "rintr: %ud %ud\n", rintr, rsleep);
 	p = seprintf(p, e, "tintr: %ud %ud\n", ctlr->tintr, ctlr->txdw);
 	p = seprintf(p, e, "ixcs: %ud %ud %ud\n", ctlr->ixsm, ctlr->ipcs,
 				 ctlr->tcpcs);
@@ -759,10 +830,18 @@ static long i82563ifstat(struct ether* edev, void* a, long n, uint32_t offset)
 	p = seprintf(p, e, "txdctl: %.8ux\n", csr32r(ctlr, Txdctl));
 	p = seprintf(p, e, "pba: %.8ux\n", ctlr->pba);
 
-	b = rbtab + ctlr->pool;
-	p = seprintf(p, e,
-				 "pool: fast %ud slow %ud nstarve %ud nwakey %ud starve %ud\n",
-				 b->nfast, b->nslow, b->nstarve, b->nwakey, b->starve);
+	for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+		b = rbtab + q->pool;
+		p = seprintf(p, e,
+		             "pool: fast %ud slow %ud nstarve %ud nwakey %ud starve %ud\n",
+		             b->nfast, b->nslow, b->nstarve, b->nwakey, b->starve);
+		if (ctlr->nq > 1)
+			p = seprintf(p, e, "q%d: core %d vec %d rintr %ud %ud%s\n", q->idx,
+			             q->coreid, q->vec, q->rintr, q->rsleep,
+			             q->nm ? " netmap" : "");
+		else if (q->nm)
+			p = seprintf(p, e, "netmap\n");
+	}
 	p = seprintf(p, e, "speeds: 10:%ud 100:%ud 1000:%ud ?:%ud\n",
 				 ctlr->speeds[0], ctlr->speeds[1], ctlr->speeds[2],
 				 ctlr->speeds[3]);
@@ -947,17 +1026,28 @@ static Freefn freetab[Npool] = {
 	rbfree9,
 };
 
+/* Which of freetab's pools are taken.  Only pnp() hands them out. */
+static bool poolused[Npool];
+
 static int newpool(void)
 {
-	static int seq;
-
-	if (seq == ARRAY_SIZE(freetab))
-		return -1;
-	if (freetab[seq] == NULL) {
-		printd("82563: bad freetab\n");
-		return -1;
+	for (int i = 0; i < ARRAY_SIZE(freetab); i++) {
+		if (poolused[i])
+			continue;
+		if (freetab[i] == NULL) {
+			printd("82563: bad freetab\n");
+			return -1;
+		}
+		poolused[i] = TRUE;
+		return i;
 	}
-	return seq++;
+	return -1;
+}
+
+/* Gives back a pool that no buffers were ever put in */
+static void freepool(int pool)
+{
+	poolused[pool] = FALSE;
 }
 
 static void i82563im(struct ctlr *ctlr, int im)
@@ -968,69 +1058,166 @@ static void i82563im(struct ctlr *ctlr, int im)
 	spin_unlock_irqsave(&ctlr->imlock);
 }
 
+/* Unmasks q's causes in im.  When q has its own vector, its causes stay out of
+ * ctlr->im, so that i82563interrupt() leaves them alone. */
+static void i82563qim(Qpair *q, int im)
+{
+	if (q->vec < 0)
+		i82563im(q->ctlr, im);
+	else
+		csr32w(q->ctlr, Ims, im);
+}
+
 static void i82563txinit(struct ctlr *ctlr)
 {
 	int i;
 	uint32_t r;
 	struct block *b;
+	Qpair *q;
 
 	if (cttab[ctlr->type].flag & F75)
 		csr32w(ctlr, Tctl, 0x0F << CtSHIFT | Psp);
 	else
 		csr32w(ctlr, Tctl, 0x0F << CtSHIFT | Psp | 66 << ColdSHIFT | Mulr);
 	csr32w(ctlr, Tipg, 6 << 20 | 8 << 10 | 8);	/* yb sez: 0x702008 */
-	csr32w(ctlr, Tdbal, paddr_low32(ctlr->tdba));
-	csr32w(ctlr, Tdbah, paddr_high32(ctlr->tdba));
-	csr32w(ctlr, Tdlen, ctlr->ntd * sizeof(Td));
-	ctlr->tdh = PREV_RING(0, ctlr->ntd);
-	csr32w(ctlr, Tdh, 0);
-	ctlr->tdt = 0;
-	csr32w(ctlr, Tdt, 0);
-	for (i = 0; i < ctlr->ntd; i++) {
-		if ((b = ctlr->tb[i]) != NULL) {
-			ctlr->tb[i] = NULL;
-			freeb(b);
+	for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+		csr32w(ctlr, qreg(q, Tdbal), paddr_low32(q->tdba));
+		csr32w(ctlr, qreg(q, Tdbah), paddr_high32(q->tdba));
+		csr32w(ctlr, qreg(q, Tdlen), ctlr->ntd * sizeof(Td));
+		q->tdh = PREV_RING(0, ctlr->ntd);
+		csr32w(ctlr, qreg(q, Tdh), 0);
+		q->tdt = 0;
+		csr32w(ctlr, qreg(q, Tdt), 0);
+		for (i = 0; i < ctlr->ntd; i++) {
+			if ((b = q->tb[i]) != NULL) {
+				q->tb[i] = NULL;
+				freeb(b);
+			}
+			memset(&q->tdba[i], 0, sizeof(Td));
 		}
-		memset(&ctlr->tdba[i], 0, sizeof(Td));
+		if (ctlr->nq > 1)
+			csr32w(ctlr, qreg(q, Tarc0), csr32r(ctlr, qreg(q, Tarc0)) | Tarcen);
 	}
 	csr32w(ctlr, Tidv, 128);
 	csr32w(ctlr, Tadv, 64);
 	csr32w(ctlr, Tctl, csr32r(ctlr, Tctl) | Ten);
-	r = csr32r(ctlr, Txdctl) & ~WthreshMASK;
-	r |= 4 << WthreshSHIFT | 4 << PthreshSHIFT;
-	if (cttab[ctlr->type].flag & F75)
-		r |= Enable;
-	csr32w(ctlr, Txdctl, r);
+	for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+		r = csr32r(ctlr, qreg(q, Txdctl)) & ~WthreshMASK;
+		r |= 4 << WthreshSHIFT | 4 << PthreshSHIFT;
+		if (cttab[ctlr->type].flag & F75)
+			r |= Enable;
+		csr32w(ctlr, qreg(q, Txdctl), r);
+	}
 }
 
-static int i82563cleanup(struct ether *e)
+static int i82563cleanup(struct ether *e, Qpair *q)
 {
 	struct block *b;
 	struct ctlr *c;
 	int tdh, m, n;
 
 	c = e->ctlr;
-	tdh = c->tdh;
+	tdh = q->tdh;
 	m = c->ntd;
-	while (c->tdba[n = NEXT_RING(tdh, m)].status & Tdd) {
+	while (q->tdba[n = NEXT_RING(tdh, m)].status & Tdd) {
 		tdh = n;
-		if ((b = c->tb[tdh]) != NULL) {
-			c->tb[tdh] = NULL;
+		if ((b = q->tb[tdh]) != NULL) {
+			q->tb[tdh] = NULL;
 			freeb(b);
 		} else
 			printk("#l%d: %s tx underrun! %d\n", e->ctlrno, cname(c), n);
-		c->tdba[tdh].status = 0;
+		q->tdba[tdh].status = 0;
 	}
 
-	return c->tdh = tdh;
+	return q->tdh = tdh;
 }
 
-static int notrim(void *v)
+static int i82563tim(void *v)
 {
-	struct ctlr *c;
+	return ((Qpair *)v)->tim != 0;
+}
 
-	c = v;
-	return (c->im & Txdw) == 0;
+/* The Microsoft RSS verification key.  Any key works, so long as i82563txq()
+ * hashes with the one we gave the hardware. */
+static uint8_t rsskey[40] = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+	0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+	0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+	0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+/* Toeplitz hash of len bytes (at most 36), which is what RSS computes over a
+ * received packet's addresses and ports. */
+static uint32_t rsshash(uint8_t *in, int len)
+{
+	uint32_t h, v;
+	int i, b;
+
+	h = 0;
+	v = rsskey[0] << 24 | rsskey[1] << 16 | rsskey[2] << 8 | rsskey[3];
+	for (i = 0; i < len; i++) {
+		for (b = 7; b >= 0; b--) {
+			if (in[i] & 1 << b)
+				h ^= v;
+			v <<= 1;
+			if (rsskey[i + 4] & 1 << b)
+				v |= 1;
+		}
+	}
+	return h;
+}
+
+/*
+ * Picks the tx queue for bp: the one RSS sends the replies to.  The
+ * hardware hashes their source and destination, so we hash ours
+ * swapped.  Only IPv4 is hashed, and only TCP with ports; everything
+ * else goes to queue 0, like it does on the way in.
+ */
+static int i82563txq(struct ctlr *ctlr, struct block *bp)
+{
+	uint8_t in[12], *ip;
+	int hl, len;
+
+	if (ctlr->nq == 1)
+		return 0;
+	if (BLEN(bp) < ETHERHDRSIZE + 20 || nhgets(bp->rp + 2 * Eaddrlen) != 0x0800)
+		return 0;
+	ip = bp->rp + ETHERHDRSIZE;
+	hl = (ip[0] & 0x0f) << 2;
+	memmove(in, ip + 16, 4);
+	memmove(in + 4, ip + 12, 4);
+	len = 8;
+	if (ip[9] == TCP && (nhgets(ip + 6) & 0x3fff) == 0 &&
+	    BLEN(bp) >= ETHERHDRSIZE + hl + 4) {
+		memmove(in + 8, ip + hl + 2, 2);
+		memmove(in + 10, ip + hl, 2);
+		len = 12;
+	}
+	return (rsshash(in, len) & (Nreta - 1)) % ctlr->nq;
+}
+
+/*
+ * Locks and returns the queue to send bp on: its flow's, unless a
+ * process has that one, in which case the first one we still have.
+ * nil if we have none.
+ */
+static Qpair *i82563txlock(struct ctlr *ctlr, struct block *bp)
+{
+	Qpair *q;
+
+	q = &ctlr->qp[i82563txq(ctlr, bp)];
+	qlock(&q->tlock);
+	if (q->nm == NULL)
+		return q;
+	qunlock(&q->tlock);
+	for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+		qlock(&q->tlock);
+		if (q->nm == NULL)
+			return q;
+		qunlock(&q->tlock);
+	}
+	return NULL;
 }
 
 static void i82563tproc(void *v)
@@ -1039,24 +1226,16 @@ static void i82563tproc(void *v)
 	struct block *bp;
 	struct ether *edev;
 	struct ctlr *ctlr;
-	int tdh, tdt, m;
+	Qpair *q;
+	int m;
 
 	edev = v;
 	ctlr = edev->ctlr;
-	tdt = ctlr->tdt;
 	m = ctlr->ntd;
 
 	i82563txinit(ctlr);
 
 	for (;;) {
-		tdh = i82563cleanup(edev);
-
-		if (NEXT_RING(tdt, m) == tdh) {
-			ctlr->txdw++;
-			i82563im(ctlr, Txdw);
-			rendez_sleep(&ctlr->trendez, notrim, ctlr);
-			continue;
-		}
 		bp = qbread(edev->oq, 100000);
 		if (!bp) {
 			/* this only happens if the q is closed.  qbread can also throw,
@@ -1064,40 +1243,60 @@ static void i82563tproc(void *v)
 			warn("i350 tproc failed to get a block, aborting!");
 			return;
 		}
-		td = &ctlr->tdba[tdt];
+		for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+			qlock(&q->tlock);
+			if (q->nm == NULL)
+				i82563cleanup(edev, q);
+			qunlock(&q->tlock);
+		}
+		if ((q = i82563txlock(ctlr, bp)) == NULL) {
+			freeb(bp);
+			continue;
+		}
+		while (NEXT_RING(q->tdt, m) == q->tdh) {
+			ctlr->txdw++;
+			q->tim = 0;
+			i82563qim(q, q->vec < 0 ? Txdw : Txq0 << q->idx);
+			rendez_sleep(&q->trendez, i82563tim, q);
+			i82563cleanup(edev, q);
+		}
+		td = &q->tdba[q->tdt];
 		td->addr[0] = paddr_low32(bp->rp);
 		td->addr[1] = paddr_high32(bp->rp);
 		td->control = Ide | Rs | Ifcs | Teop | BLEN(bp);
-		ctlr->tb[tdt] = bp;
-		tdt = NEXT_RING(tdt, m);
+		q->tb[q->tdt] = bp;
+		q->tdt = NEXT_RING(q->tdt, m);
 		wmb_f();
-		csr32w(ctlr, Tdt, tdt);
+		csr32w(ctlr, qreg(q, Tdt), q->tdt);
+		qunlock(&q->tlock);
 	}
 }
 
-static int i82563replenish(struct ctlr *ctlr, int maysleep)
+static int i82563replenish(Qpair *q, int maysleep)
 {
 	unsigned int rdt, m;
 	struct block *bp;
+	struct ctlr *ctlr;
 	Rbpool *p;
 	Rd *rd;
 	int retval = 0;
 
-	rdt = ctlr->rdt;
+	ctlr = q->ctlr;
+	rdt = q->rdt;
 	m = ctlr->nrd;
-	p = rbtab + ctlr->pool;
-	for (; NEXT_RING(rdt, m) != ctlr->rdh; rdt = NEXT_RING(rdt, m)) {
-		rd = &ctlr->rdba[rdt];
-		if (ctlr->rb[rdt] != NULL) {
+	p = rbtab + q->pool;
+	for (; NEXT_RING(rdt, m) != q->rdh; rdt = NEXT_RING(rdt, m)) {
+		rd = &q->rdba[rdt];
+		if (q->rb[rdt] != NULL) {
 			printk("%s: tx overrun\n", cname(ctlr));
 			break;
 		}
 redux:
 		bp = i82563rballoc(p);
 		if (bp == NULL) {
-			if (rdt - ctlr->rdh >= 16)
+			if (rdt - q->rdh >= 16)
 				break;
-			printd("%s: pool %d: no rx buffers\n", cname(ctlr), ctlr->pool);
+			printd("%s: pool %d: no rx buffers\n", cname(ctlr), q->pool);
 			if (maysleep == 0) {
 				retval = -1;
 				goto out;
@@ -1108,27 +1307,53 @@ redux:
 			rendez_sleep(&p->r, icansleep, p);
 			goto redux;
 		}
-		ctlr->rb[rdt] = bp;
+		q->rb[rdt] = bp;
 		rd->addr[0] = paddr_low32(bp->rp);
 		rd->addr[1] = paddr_high32(bp->rp);
 		rd->status = 0;
-		ctlr->rdfree++;
+		q->rdfree++;
 	}
 out:
-	if (ctlr->rdt != rdt) {
-		ctlr->rdt = rdt;
+	if (q->rdt != rdt) {
+		q->rdt = rdt;
 		wmb_f();
-		csr32w(ctlr, Rdt, rdt);
+		csr32w(ctlr, qreg(q, Rdt), rdt);
 	}
 	return retval;
 }
 
-static void i82563rxinit(struct ctlr *ctlr)
+/* Spreads the flows over our queues: redirection table entry i, which gets
+ * the packets whose hash ends in i, goes to queue i % nq. */
+static void i82563rssinit(struct ctlr *ctlr)
+{
+	int i, j;
+	uint32_t r;
+
+	for (i = 0; i < sizeof(rsskey); i += 4)
+		csr32w(ctlr, Rssrk + i, rsskey[i] | rsskey[i + 1] << 8 |
+		       rsskey[i + 2] << 16 | rsskey[i + 3] << 24);
+	/* four one-byte entries per register; the queue is the top bit */
+	for (i = 0; i < Nreta; i += 4) {
+		r = 0;
+		for (j = 0; j < 4; j++)
+			r |= ((i + j) % ctlr->nq) << (j * 8 + 7);
+		csr32w(ctlr, Reta + i, r);
+	}
+	csr32w(ctlr, Mrqc, Rss2q | Rsstcpip4 | Rssip4);
+}
+
+/*
+ * Sets the receive buffer size, which is all of the queues'.  It's
+ * rbsz, unless a queue has a netmap, whose buffers only fit ordinary
+ * frames (without their crc).  Leaves the receiver off.
+ */
+static void i82563rctl(struct ctlr *ctlr)
 {
 	int i;
-	struct block *bp;
 
-	if (ctlr->rbsz <= 2048)
+	if (ctlr->nmqs)
+		csr32w(ctlr, Rctl, Dpf | Bsize2048 | Bam | RdtmsHALF | Secrc);
+	else if (ctlr->rbsz <= 2048)
 		csr32w(ctlr, Rctl, Dpf | Bsize2048 | Bam | RdtmsHALF);
 	else {
 		i = ctlr->rbsz / 1024;
@@ -1145,6 +1370,15 @@ static void i82563rxinit(struct ctlr *ctlr)
 			csr32w(ctlr, Rctl,
 				   Lpe | Dpf | BsizeFlex * i | Bam | RdtmsHALF | Secrc);
 	}
+}
+
+static void i82563rxinit(struct ctlr *ctlr)
+{
+	int i;
+	struct block *bp;
+	Qpair *q;
+
+	i82563rctl(ctlr);
 
 	if (cttab[ctlr->type].flag & Fert)
 		csr32w(ctlr, Ert, 1024 / 8);
@@ -1152,39 +1386,44 @@ static void i82563rxinit(struct ctlr *ctlr)
 	if (ctlr->type == i82566)
 		csr32w(ctlr, Pbs, 16);
 
-	csr32w(ctlr, Rdbal, paddr_low32(ctlr->rdba));
-	csr32w(ctlr, Rdbah, paddr_high32(ctlr->rdba));
-	csr32w(ctlr, Rdlen, ctlr->nrd * sizeof(Rd));
-	ctlr->rdh = 0;
-	csr32w(ctlr, Rdh, 0);
-	ctlr->rdt = 0;
-	csr32w(ctlr, Rdt, 0);
+	for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+		csr32w(ctlr, qreg(q, Rdbal), paddr_low32(q->rdba));
+		csr32w(ctlr, qreg(q, Rdbah), paddr_high32(q->rdba));
+		csr32w(ctlr, qreg(q, Rdlen), ctlr->nrd * sizeof(Rd));
+		q->rdh = 0;
+		csr32w(ctlr, qreg(q, Rdh), 0);
+		q->rdt = 0;
+		csr32w(ctlr, qreg(q, Rdt), 0);
+		for (i = 0; i < ctlr->nrd; i++)
+			if ((bp = q->rb[i]) != NULL) {
+				q->rb[i] = NULL;
+				freeb(bp);
+			}
+		if (cttab[ctlr->type].flag & F75)
+			csr32w(ctlr, qreg(q, Rxdctl),
+				   1 << WthreshSHIFT | 8 << PthreshSHIFT | 1 << HthreshSHIFT |
+				   Enable);
+		else
+			csr32w(ctlr, qreg(q, Rxdctl), 2 << WthreshSHIFT | 2 << PthreshSHIFT);
+	}
 	ctlr->rdtr = 0;	//25;
 	ctlr->radv = 0;	//500;
 	csr32w(ctlr, Rdtr, ctlr->rdtr);
 	csr32w(ctlr, Radv, ctlr->radv);
 
-	for (i = 0; i < ctlr->nrd; i++)
-		if ((bp = ctlr->rb[i]) != NULL) {
-			ctlr->rb[i] = NULL;
-			freeb(bp);
-		}
-	if (cttab[ctlr->type].flag & F75)
-		csr32w(ctlr, Rxdctl,
-			   1 << WthreshSHIFT | 8 << PthreshSHIFT | 1 << HthreshSHIFT |
-			   Enable);
-	else
-		csr32w(ctlr, Rxdctl, 2 << WthreshSHIFT | 2 << PthreshSHIFT);
-
 	/*
 	 * Enable checksum offload.
 	 */
 	csr32w(ctlr, Rxcsum, Tuofl | Ipofl | ETHERHDRSIZE);
+
+	if (ctlr->nq > 1)
+		i82563rssinit(ctlr);
+	csr32w(ctlr, Rctl, csr32r(ctlr, Rctl) | Ren);
 }
 
 static int i82563rim(void *v)
 {
-	return ((struct ctlr *)v)->rim != 0;
+	return ((Qpair *)v)->rim != 0;
 }
 
 static void i82563rproc(void *arg)
@@ -1193,31 +1432,43 @@ static void i82563rproc(void *arg)
 	struct block *bp;
 	struct ctlr *ctlr;
 	struct ether *edev;
+	Qpair *q;
 	Rd *rd;
 
-	edev = arg;
-	ctlr = edev->ctlr;
+	q = arg;
+	ctlr = q->ctlr;
+	edev = q->edev;
 
-	i82563rxinit(ctlr);
-	csr32w(ctlr, Rctl, csr32r(ctlr, Rctl) | Ren);
-	if (cttab[ctlr->type].flag & F75) {
-		csr32w(ctlr, Rxdctl, csr32r(ctlr, Rxdctl) | Enable);
-		im = Rxt0 | Rxo | Rxdmt0 | Rxseq | Ack;
-	} else
+	if (q->vec < 0)
 		im = Rxt0 | Rxo | Rxdmt0 | Rxseq | Ack;
+	else
+		im = Rxq0 << q->idx;
 	m = ctlr->nrd;
 
 	for (;;) {
-		i82563im(ctlr, im);
-		ctlr->rsleep++;
-		i82563replenish(ctlr, 1);
-		rendez_sleep(&ctlr->rrendez, i82563rim, ctlr);
-
-		rdh = ctlr->rdh;
+		i82563qim(q, im);
+		q->rsleep++;
+		qlock(&q->rlock);
+		if (q->nm == NULL)
+			i82563replenish(q, 1);
+		qunlock(&q->rlock);
+		rendez_sleep(&q->rrendez, i82563rim, q);
+
+		qlock(&q->rlock);
+		if (q->nm != NULL) {
+			/* the process has our ring; it just needs to hear about it.  our
+			 * own vector is for tx too. */
+			q->rim = 0;
+			netmap_notify(q->nm, q->vec < 0 ? NETMAP_SYNC_RX :
+			              NETMAP_SYNC_RX | NETMAP_SYNC_TX);
+			qunlock(&q->rlock);
+			continue;
+		}
+		rdh = q->rdh;
 		for (;;) {
-			rd = &ctlr->rdba[rdh];
-			rim = ctlr->rim;
-			ctlr->rim = 0;
+			rd = &q->rdba[rdh];
+			rim = q->rim;
+			q->rim = 0;
 			if (!(rd->status & Rdd))
 				break;
 
@@ -1228,7 +1479,7 @@ static void i82563rproc(void *arg)
 			 * an indication of whether the checksums were
 			 * calculated and valid.
 			 */
-			bp = ctlr->rb[rdh];
+			bp = q->rb[rdh];
 			if ((rd->status & Reop) && rd->errors == 0) {
 				bp->wp += rd->length;
 				bp->lim = bp->wp;	/* lie like a dog.  avoid packblock. */
@@ -1256,15 +1507,266 @@ static void i82563rproc(void *arg)
 				etheriq(edev, bp, 1);
 			} else
 				freeb(bp);
-			ctlr->rb[rdh] = NULL;
+			q->rb[rdh] = NULL;
 			rd->status = 0;
-			ctlr->rdfree--;
-			ctlr->rdh = rdh = NEXT_RING(rdh, m);
-			if (ctlr->nrd - ctlr->rdfree >= 32 || (rim & Rxdmt0))
-				if (i82563replenish(ctlr, 0) == -1)
+			q->rdfree--;
+			q->rdh = rdh = NEXT_RING(rdh, m);
+			if (ctlr->nrd - q->rdfree >= 32 || (rim & Rxdmt0))
+				if (i82563replenish(q, 0) == -1)
 					break;
 		}
+		qunlock(&q->rlock);
+	}
+}
+
+/*
+ * Netmap.  The process's ring slots are our descriptors: slot i's
+ * buffer goes in descriptor i, for good on rx and as it's sent on tx.
+ * Of the rx descriptors, the NIC gets everything from where the process
+ * last read up to the slot before its head.  The tx ring's free slots
+ * are the ones after the last we posted, up to two short of the last
+ * one that's done, which keeps tdt from catching up to tdh.
+ */
+
+/* Reaps the tx descriptors the NIC is done with, which on a netmap
+ * queue have no blocks. */
+static void i82563nmtxdone(Qpair *q)
+{
+	int n, m;
+
+	m = q->ctlr->ntd;
+	while (q->tdba[n = NEXT_RING(q->tdh, m)].status & Tdd) {
+		q->tdba[n].status = 0;
+		q->tdh = n;
+	}
+}
+
+/* Waits a while for the NIC to finish q's transmits.  Returns 0 if it
+ * did. */
+static int i82563txdrain(struct ether *edev, Qpair *q)
+{
+	int timeo;
+
+	for (timeo = 0; timeo < 1000; timeo++) {
+		if (q->nm != NULL)
+			i82563nmtxdone(q);
+		else
+			i82563cleanup(edev, q);
+		if (q->tdh == PREV_RING(q->tdt, q->ctlr->ntd))
+			return 0;
+		udelay(1000);
+	}
+	return -1;
+}
+
+/*
+ * Stops q's transmitter, drops whatever it still had posted, and starts
+ * it again on an empty ring.  For a netmap queue whose sends won't
+ * finish: its descriptors point into pages we're about to unpin.  On
+ * parts without a per-queue enable, this briefly stops every queue.
+ */
+static void i82563txreset(struct ctlr *ctlr, Qpair *q)
+{
+	int timeo;
+	uint32_t tctl, txdctl;
+
+	tctl = csr32r(ctlr, Tctl);
+	csr32w(ctlr, Tctl, tctl & ~Ten);
+	txdctl = csr32r(ctlr, qreg(q, Txdctl));
+	if (cttab[ctlr->type].flag & F75) {
+		csr32w(ctlr, qreg(q, Txdctl), txdctl & ~Enable);
+		for (timeo = 0; timeo < 10; timeo++) {
+			if (!(csr32r(ctlr, qreg(q, Txdctl)) & Enable))
+				break;
+			udelay(1000);
+		}
 	}
+	/* let any descriptor or buffer fetch that already started land */
+	udelay(100);
+	memset(q->tdba, 0, ctlr->ntd * sizeof(Td));
+	q->tdh = PREV_RING(0, ctlr->ntd);
+	csr32w(ctlr, qreg(q, Tdh), 0);
+	q->tdt = 0;
+	csr32w(ctlr, qreg(q, Tdt), 0);
+	csr32w(ctlr, qreg(q, Txdctl), txdctl);
+	csr32w(ctlr, Tctl, tctl);
+}
+
+/*
+ * Gives q's rings to nm's process, or takes them back.  Turning it off
+ * can't fail: if the NIC won't finish the process's sends, we reset the
+ * queue, so that nothing points at the process's pages once we return.
+ */
+static void i82563netmap(struct ether *edev, struct netmap *nm, int on)
+{
+	int i;
+	uint32_t rctl;
+	physaddr_t pa;
+	struct block *bp;
+	struct ctlr *ctlr;
+	Qpair *q;
+	Rd *rd;
+
+	ctlr = edev->ctlr;
+	if (on) {
+		if (ctlr->alloc == NULL)
+			error(Enodev);
+		if (nm->qidx >= ctlr->nq || ctlr->nrd != NETMAP_NR_SLOTS ||
+		    ctlr->ntd != NETMAP_NR_SLOTS)
+			error(Ebadarg);
+	}
+	q = &ctlr->qp[nm->qidx];
+	qlock(&q->rlock);
+	qlock(&q->tlock);
+	if (i82563txdrain(edev, q)) {
+		if (on) {
+			qunlock(&q->tlock);
+			qunlock(&q->rlock);
+			error(Enetbusy);
+		}
+		printk("%s: queue %d stuck sending, resetting it\n", cname(ctlr),
+		       q->idx);
+		i82563txreset(ctlr, q);
+	}
+	memset(q->tdba, 0, ctlr->ntd * sizeof(Td));
+
+	/* the receiver has to be off to move rdh */
+	rctl = csr32r(ctlr, Rctl);
+	csr32w(ctlr, Rctl, rctl & ~Ren);
+	for (i = 0; i < ctlr->nrd; i++) {
+		if ((bp = q->rb[i]) != NULL) {
+			q->rb[i] = NULL;
+			freeb(bp);
+		}
+		rd = &q->rdba[i];
+		pa = on ? netmap_buf_paddr(nm, NETMAP_RX_BUF(i)) : 0;
+		rd->addr[0] = (uint32_t)pa;
+		rd->addr[1] = (uint32_t)((uint64_t)pa >> 32);
+		rd->status = 0;
+	}
+	q->rdfree = 0;
+	q->rdh = 0;
+	csr32w(ctlr, qreg(q, Rdh), 0);
+	q->rdt = on ? PREV_RING(0, ctlr->nrd) : 0;
+	csr32w(ctlr, qreg(q, Rdt), q->rdt);
+	q->nm = on ? nm : NULL;
+	ctlr->nmqs += on ? 1 : -1;
+	i82563rctl(ctlr);
+	csr32w(ctlr, Rctl, csr32r(ctlr, Rctl) | (rctl & (Upe | Mpe | Ren)));
+
+	if (on) {
+		nm->rxhead = 0;
+		nm->rx->head = nm->rx->tail = 0;
+		nm->txhead = q->tdt;
+		nm->tx->head = q->tdt;
+		nm->tx->tail = PREV_RING(q->tdh, ctlr->ntd);
+	}
+	qunlock(&q->tlock);
+	qunlock(&q->rlock);
+	if (!on) {
+		/* the rproc refills the ring when it runs */
+		q->rim = Rxt0;
+		rendez_wakeup(&q->rrendez);
+	}
+}
+
+/* Is head somewhere from old to tail? */
+static int nmheadok(unsigned int head, unsigned int old, unsigned int tail,
+                    unsigned int m)
+{
+	return head < m && (head - old) % m <= (tail - old) % m;
+}
+
+static int i82563nmrxsync(Qpair *q, struct netmap *nm)
+{
+	unsigned int head, rdh, m;
+	struct ctlr *ctlr;
+	Rd *rd;
+
+	ctlr = q->ctlr;
+	m = ctlr->nrd;
+	head = ACCESS_ONCE(nm->rx->head);
+	if (!nmheadok(head, nm->rxhead, q->rdh, m))
+		return -1;
+	if (head != nm->rxhead) {
+		for (rdh = nm->rxhead; rdh != head; rdh = NEXT_RING(rdh, m))
+			q->rdba[rdh].status = 0;
+		nm->rxhead = head;
+		q->rdt = PREV_RING(head, m);
+		wmb_f();
+		csr32w(ctlr, qreg(q, Rdt), q->rdt);
+	}
+	for (rdh = q->rdh; rdh != q->rdt; rdh = NEXT_RING(rdh, m)) {
+		rd = &q->rdba[rdh];
+		if (!(rd->status & Rdd))
+			break;
+		rmb();
+		nm->rx->slot[rdh].len = rd->length;
+		if ((rd->status & Reop) && rd->errors == 0)
+			nm->rx->slot[rdh].flags = 0;
+		else
+			nm->rx->slot[rdh].flags = NETMAP_SLOT_ERR;
+	}
+	q->rdh = rdh;
+	wmb();
+	nm->rx->tail = rdh;
+	return 0;
+}
+
+static int i82563nmtxsync(Qpair *q, struct netmap *nm)
+{
+	unsigned int head, tdt, len, m;
+	physaddr_t pa;
+	struct ctlr *ctlr;
+	Td *td;
+
+	ctlr = q->ctlr;
+	m = ctlr->ntd;
+	head = ACCESS_ONCE(nm->tx->head);
+	if (!nmheadok(head, nm->txhead, PREV_RING(q->tdh, m), m))
+		return -1;
+	for (tdt = nm->txhead; tdt != head; tdt = NEXT_RING(tdt, m)) {
+		td = &q->tdba[tdt];
+		pa = netmap_buf_paddr(nm, NETMAP_TX_BUF(tdt));
+		len = MIN(MAX(nm->tx->slot[tdt].len, ETHERMINTU), NETMAP_BUF_SZ);
+		td->addr[0] = (uint32_t)pa;
+		td->addr[1] = (uint32_t)((uint64_t)pa >> 32);
+		td->control = Rs | Ifcs | Teop | len;
+		td->status = 0;
+	}
+	if (head != nm->txhead) {
+		nm->txhead = head;
+		q->tdt = head;
+		wmb_f();
+		csr32w(ctlr, qreg(q, Tdt), head);
+	}
+	i82563nmtxdone(q);
+	wmb();
+	nm->tx->tail = PREV_RING(q->tdh, m);
+	return 0;
+}
+
+static void i82563nmsync(struct ether *edev, struct netmap *nm, int flags)
+{
+	struct ctlr *ctlr;
+	Qpair *q;
+	int r;
+
+	ctlr = edev->ctlr;
+	q = &ctlr->qp[nm->qidx];
+	r = 0;
+	if (flags & NETMAP_SYNC_RX) {
+		qlock(&q->rlock);
+		r |= i82563nmrxsync(q, nm);
+		qunlock(&q->rlock);
+	}
+	if (flags & NETMAP_SYNC_TX) {
+		qlock(&q->tlock);
+		r |= i82563nmtxsync(q, nm);
+		qunlock(&q->tlock);
+	}
+	if (r)
+		error(Ebadarg);
 }
 
 static int i82563lim(void *v)
@@ -1525,6 +2027,8 @@ static void i82563attach(struct ether *edev)
 	int i;
 	struct block *bp;
 	struct ctlr *ctlr;
+	Qpair *q;
+	Td *tdba;
 
 	ctlr = edev->ctlr;
 	qlock(&ctlr->alock);
@@ -1535,42 +2039,48 @@ static void i82563attach(struct ether *edev)
 
 	ctlr->nrd = Nrd;
 	ctlr->ntd = Ntd;
-	ctlr->alloc =
-		kzmalloc(ctlr->nrd * sizeof(Rd) + ctlr->ntd * sizeof(Td) + 255, 0);
+	ctlr->alloc = kzmalloc(ctlr->nq * (ctlr->nrd * sizeof(Rd) +
+	                                   ctlr->ntd * sizeof(Td)) + 255, 0);
 	if (ctlr->alloc == NULL) {
 		qunlock(&ctlr->alock);
 		error(Enomem);
 	}
-	ctlr->rdba = (Rd *) ROUNDUP((uintptr_t) ctlr->alloc, 256);
-	ctlr->tdba = (Td *) (ctlr->rdba + ctlr->nrd);
-
-	ctlr->rb = kzmalloc(ctlr->nrd * sizeof(struct block *), 0);
-	ctlr->tb = kzmalloc(ctlr->ntd * sizeof(struct block *), 0);
+	tdba = (Td *) ROUNDUP((uintptr_t) ctlr->alloc, 256);
+	for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+		q->rdba = (Rd *) tdba;
+		q->tdba = (Td *) (q->rdba + ctlr->nrd);
+		tdba = q->tdba + ctlr->ntd;
+		q->rb = kzmalloc(ctlr->nrd * sizeof(struct block *), 0);
+		q->tb = kzmalloc(ctlr->ntd * sizeof(struct block *), 0);
+	}
 
 	if (waserror()) {
-		while ((bp = i82563rballoc(rbtab + ctlr->pool))) {
-			bp->free = NULL;
-			freeb(bp);
+		for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+			while ((bp = i82563rballoc(rbtab + q->pool))) {
+				bp->free = NULL;
+				freeb(bp);
+			}
+			kfree(q->tb);
+			q->tb = NULL;
+			kfree(q->rb);
+			q->rb = NULL;
 		}
-		kfree(ctlr->tb);
-		ctlr->tb = NULL;
-		kfree(ctlr->rb);
-		ctlr->rb = NULL;
 		kfree(ctlr->alloc);
 		ctlr->alloc = NULL;
 		qunlock(&ctlr->alock);
 		nexterror();
 	}
 
-	for (i = 0; i < Nrb; i++) {
-		bp = allocb(ctlr->rbsz + Rbalign);
-		bp->free = freetab[ctlr->pool];
-		freeb(bp);
+	for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+		for (i = 0; i < Nrb / ctlr->nq; i++) {
+			bp = allocb(ctlr->rbsz + Rbalign);
+			bp->free = freetab[q->pool];
+			freeb(bp);
+		}
 	}
 
 	/* the ktasks should free these names, if they ever exit */
 	lname = kmalloc(KNAMELEN, KMALLOC_WAIT);
-	rname = kmalloc(KNAMELEN, KMALLOC_WAIT);
 	tname = kmalloc(KNAMELEN, KMALLOC_WAIT);
 
 	snprintf(lname, KNAMELEN, "#l%dlproc", edev->ctlrno);
@@ -1584,8 +2094,29 @@ static void i82563attach(struct ether *edev)
 	else
 		ktask(lname, phylproc, edev);
 
-	snprintf(rname, KNAMELEN, "#l%drproc", edev->ctlrno);
-	ktask(rname, i82563rproc, edev);
+	i82563rxinit(ctlr);
+	if (ctlr->nq > 1) {
+		/* each cause's vector; both of each queue's clear when sent */
+		csr32w(ctlr, Ivar, ctlr->ivar);
+		csr32w(ctlr, Eiac, (Rxq0 | Txq0) * ((1 << ctlr->nq) - 1));
+		csr32w(ctlr, Ctrlext, csr32r(ctlr, Ctrlext) | Pbasup);
+		i82563im(ctlr, Other);
+	}
+	for (q = ctlr->qp; q < ctlr->qp + ctlr->nq; q++) {
+		/* an rproc starts here, but after it first sleeps, it runs wherever
+		 * its queue's irq woke it.  Queues spread over the LL cores, sharing
+		 * them if there are more queues; qcore can move them. */
+		if (q->vec >= 0) {
+			q->coreid = sched_irq_core(q->idx);
+			route_irqs(q->vec, q->coreid);
+		}
+		rname = kmalloc(KNAMELEN, KMALLOC_WAIT);
+		if (ctlr->nq > 1)
+			snprintf(rname, KNAMELEN, "#l%drproc%d", edev->ctlrno, q->idx);
+		else
+			snprintf(rname, KNAMELEN, "#l%drproc", edev->ctlrno);
+		ktask(rname, i82563rproc, q);
+	}
 
 	snprintf(tname, KNAMELEN, "#l%dtproc", edev->ctlrno);
 	ktask(tname, i82563tproc, edev);
@@ -1604,7 +2135,7 @@ static void i82563interrupt(struct hw_trapframe *hw_tf, void *arg)
 	ctlr = edev->ctlr;
 
 	spin_lock_irqsave(&ctlr->imlock);
-	csr32w(ctlr, Imc, ~0);
+	csr32w(ctlr, Imc, ctlr->im);
 	im = ctlr->im;
 
 	while ((icr = csr32r(ctlr, Icr)) & ctlr->im) {
@@ -1615,15 +2146,16 @@ static void i82563interrupt(struct hw_trapframe *hw_tf, void *arg)
 			ctlr->lintr++;
 		}
 		if (icr & (Rxt0 | Rxo | Rxdmt0 | Rxseq | Ack)) {
-			ctlr->rim = icr & (Rxt0 | Rxo | Rxdmt0 | Rxseq | Ack);
+			ctlr->qp[0].rim = icr & (Rxt0 | Rxo | Rxdmt0 | Rxseq | Ack);
 			im &= ~(Rxt0 | Rxo | Rxdmt0 | Rxseq | Ack);
-			rendez_wakeup(&ctlr->rrendez);
-			ctlr->rintr++;
+			rendez_wakeup(&ctlr->qp[0].rrendez);
+			ctlr->qp[0].rintr++;
 		}
 		if (icr & Txdw) {
 			im &= ~Txdw;
 			ctlr->tintr++;
-			rendez_wakeup(&ctlr->trendez);
+			ctlr->qp[0].tim = 1;
+			rendez_wakeup(&ctlr->qp[0].trendez);
 		}
 	}
 
@@ -1632,6 +2164,24 @@ static void i82563interrupt(struct hw_trapframe *hw_tf, void *arg)
 	spin_unlock_irqsave(&ctlr->imlock);
 }
 
+/*
+ * A queue pair's own vector.  Eiac already cleared our causes, and we
+ * can't tell rx from tx, so we mask both and poke both procs.  Each
+ * unmasks its cause before it sleeps again.
+ */
+static void i82563qinterrupt(struct hw_trapframe *hw_tf, void *arg)
+{
+	Qpair *q;
+
+	q = arg;
+	csr32w(q->ctlr, Imc, (Rxq0 | Txq0) << q->idx);
+	q->rintr++;
+	q->rim = Rxt0;
+	rendez_wakeup(&q->rrendez);
+	q->tim = 1;
+	rendez_wakeup(&q->trendez);
+}
+
 static int i82563detach(struct ctlr *ctlr)
 {
 	int r, timeo;
@@ -1861,6 +2411,7 @@ enum {
 	CMradv,
 	CMpause,
 	CMan,
+	CMqcore,
 };
 
 static struct cmdtab i82563ctlmsg[] = {
@@ -1868,6 +2419,7 @@ static struct cmdtab i82563ctlmsg[] = {
 	{CMradv, "radv", 2},
 	{CMpause, "pause", 1},
 	{CMan, "an", 1},
+	{CMqcore, "qcore", 3},
 };
 
 static long i82563ctl(struct ether *edev, void *buf, long n)
@@ -1878,6 +2430,7 @@ static long i82563ctl(struct ether *edev, void *buf, long n)
 	struct ctlr *ctlr;
 	struct cmdbuf *cb;
 	struct cmdtab *ct;
+	Qpair *q;
 
 	if ((ctlr = edev->ctlr) == NULL)
 		error(Enonexist);
@@ -1910,6 +2463,17 @@ static long i82563ctl(struct ether *edev, void *buf, long n)
 		case CMan:
 			csr32w(ctlr, Ctrl, csr32r(ctlr, Ctrl) | Lrst | Phyrst);
 			break;
+		case CMqcore:
+			/* move a queue (its irq, and so its procs) to another core */
+			v = strtoul(cb->f[1], &p, 0);
+			if (*p || v >= ctlr->nq)
+				error(Ebadarg);
+			q = &ctlr->qp[v];
+			v = strtoul(cb->f[2], &p, 0);
+			if (*p || q->vec < 0 || route_irqs(q->vec, v))
+				error(Ebadarg);
+			q->coreid = v;
+			break;
 	}
 	kfree(cb);
 	poperror();
@@ -2042,9 +2606,10 @@ static void i82563pci(void)
 		spinlock_init_irqsave(&c->imlock);
 		rendez_init(&c->lrendez);
 		qlock_init(&c->slock);
-		rendez_init(&c->rrendez);
-		rendez_init(&c->trendez);
-		qlock_init(&c->tlock);
+		for (int i = 0; i < Nq; i++) {
+			rendez_init(&c->qp[i].rrendez);
+			rendez_init(&c->qp[i].trendez);
+		}
 
 		c->type = type;
 		c->pcidev = p;
@@ -2061,8 +2626,19 @@ static void i82563pci(void)
 static int setup(struct ctlr *ctlr)
 {
 	struct pci_device *p;
-
-	if ((ctlr->pool = newpool()) == -1) {
+	Qpair *q;
+
+	for (q = ctlr->qp; q < ctlr->qp + Nq; q++) {
+		q->ctlr = ctlr;
+		q->idx = q - ctlr->qp;
+		q->pool = -1;
+		q->vec = -1;
+		q->coreid = -1;
+		qlock_init(&q->rlock);
+		qlock_init(&q->tlock);
+	}
+	ctlr->nq = 1;
+	if ((ctlr->qp[0].pool = newpool()) == -1) {
 		printd("%s: no pool\n", cname(ctlr));
 		return -1;
 	}
@@ -2089,6 +2665,60 @@ static void i82563_init(void)
 	i82563pci();
 }
 
+/*
+ * Parts with RSS get a queue pair per MSI-X vector, up to Nq, and one
+ * more vector for the other causes.  We need all of them; otherwise
+ * it's one queue, on whatever interrupt we got.
+ */
+static void i82563irqs(struct ether *edev)
+{
+	struct ctlr *ctlr;
+	struct pci_device *p;
+	int i, nq, ent, other, vec[Nq];
+	uint32_t ivar;
+
+	ctlr = edev->ctlr;
+	p = ctlr->pcidev;
+	other = register_irq(edev->irq, i82563interrupt, edev, edev->tbdf);
+	if (!(cttab[ctlr->type].flag & Fmq) || other < 0)
+		return;
+	nq = MIN(Nq, pci_msix_nr_vecs(p) - 1);
+	if (nq < 2 || (ent = pci_msix_vec_entry(p, other)) < 0)
+		return;
+	ivar = (Ivalid | ent) << IvarOther;
+	for (i = 0; i < nq; i++)
+		vec[i] = -1;
+	for (i = 0; i < nq; i++) {
+		if (i > 0 && (ctlr->qp[i].pool = newpool()) == -1)
+			break;
+		vec[i] = register_irq(edev->irq, i82563qinterrupt, &ctlr->qp[i],
+		                      edev->tbdf);
+		if (vec[i] < 0 || (ent = pci_msix_vec_entry(p, vec[i])) < 0)
+			break;
+		ivar |= (Ivalid | ent) << (IvarRxq + 4 * i);
+		ivar |= (Ivalid | ent) << (IvarTxq + 4 * i);
+	}
+	if (i < nq) {
+		printk("%s: only got %d of %d queue vectors, using 1 queue\n",
+		       cname(ctlr), i, nq);
+		/* Give back what we got.  Nothing raises these vectors yet, since
+		 * Ivar isn't set. */
+		for (i = 0; i < nq; i++) {
+			if (vec[i] >= 0)
+				deregister_irq(vec[i], i82563qinterrupt, &ctlr->qp[i]);
+			if (i > 0 && ctlr->qp[i].pool >= 0) {
+				freepool(ctlr->qp[i].pool);
+				ctlr->qp[i].pool = -1;
+			}
+		}
+		return;
+	}
+	for (i = 0; i < nq; i++)
+		ctlr->qp[i].vec = vec[i];
+	ctlr->ivar = ivar;
+	ctlr->nq = nq;
+}
+
 static int pnp(struct ether *edev, int type)
 {
 	struct ctlr *ctlr;
@@ -2129,13 +2759,17 @@ static int pnp(struct ether *edev, int type)
 	edev->attach = i82563attach;
 	edev->ifstat = i82563ifstat;
 	edev->ctl = i82563ctl;
+	edev->netmap = i82563netmap;
+	edev->nmsync = i82563nmsync;
 
 	edev->netif.arg = edev;
 	edev->netif.promiscuous = i82563promiscuous;
 	edev->shutdown = i82563shutdown;
 	edev->netif.multicast = i82563multicast;
 
-	register_irq(edev->irq, i82563interrupt, edev, edev->tbdf);
+	for (int i = 0; i < Nq; i++)
+		ctlr->qp[i].edev = edev;
+	i82563irqs(edev);
 	return 0;
 }
 
@@ -80,6 +80,7 @@ enum {
 	Fcah		= 0x0000002C,	/* Flow Control Address High */
 	Fct		= 0x00000030,	/* Flow Control Type */
 	Icr		= 0x000000C0,	/* Interrupt Cause Read */
+	Itr		= 0x000000C4,	/* Interrupt Throttling Rate (8254[01567]) */
 	Ics		= 0x000000C8,	/* Interrupt Cause Set */
 	Ims		= 0x000000D0,	/* Interrupt Mask Set/Read */
 	Imc		= 0x000000D8,	/* Interrupt mask Clear */
@@ -469,6 +470,13 @@ enum {
 	Ntd		= 64,		/* multiple of 8 */
 	Nrb		= 1024,		/* private receive buffers per Ctlr */
 	Rbsz		= 2048,
+	Rxbudget	= 64,		/* packets per rx poll */
+};
+
+enum {					/* Itr, in 256ns units */
+	Itrlatency	= 1000000000/70000/256,	/* 70000 intrs/sec */
+	Itrmixed	= 1000000000/20000/256,
+	Itrbulk		= 1000000000/8000/256,
 };
 
 struct ctlr {
@@ -504,6 +512,8 @@ struct ctlr {
 	unsigned int	lintr;
 	unsigned int	rsleep;
 	unsigned int	rintr;
+	unsigned int	rpoll;
+	unsigned int	rpkts;
 	unsigned int	txdw;
 	unsigned int	tintr;
 	unsigned int	ixsm;
@@ -521,6 +531,9 @@ struct ctlr {
 	int	rdh;			/* receive descriptor head */
 	int	rdt;			/* receive descriptor tail */
 	int	rdtr;			/* receive delay timer ring value */
+	int	itr;			/* interrupt throttling, -1 if no Itr */
+	int	itrfixed;		/* set by ctl; don't adapt itr */
+	int	ravg;			/* 8 * average packets per rx intr */
 
 	spinlock_t	tlock;
 	int	tbusy;
@@ -685,11 +698,17 @@ igbeifstat(struct ether* edev, void* a, long n, uint32_t offset)
 		ctlr->lintr, ctlr->lsleep);
 	l += snprintf(p+l, READSTR-l, "rintr: %ud %ud\n",
 		ctlr->rintr, ctlr->rsleep);
+	l += snprintf(p+l, READSTR-l, "rpoll: %ud %ud %ud\n",
+		ctlr->rpoll, ctlr->rpkts,
+		ctlr->rpoll ? ctlr->rpkts/ctlr->rpoll : 0);
 	l += snprintf(p+l, READSTR-l, "tintr: %ud %ud\n",
 		ctlr->tintr, ctlr->txdw);
 	l += snprintf(p+l, READSTR-l, "ixcs: %ud %ud %ud\n",
 		ctlr->ixsm, ctlr->ipcs, ctlr->tcpcs);
 	l += snprintf(p+l, READSTR-l, "rdtr: %ud\n", ctlr->rdtr);
+	if(ctlr->itr >= 0)
+		l += snprintf(p+l, READSTR-l, "itr: %d %s\n", ctlr->itr,
+			ctlr->itrfixed ? "fixed" : "adaptive");
 	l += snprintf(p+l, READSTR-l, "Ctrlext: %08x\n", csr32r(ctlr, Ctrlext));
 
 	l += snprintf(p+l, READSTR-l, "eeprom:");
@@ -719,10 +738,12 @@ igbeifstat(struct ether* edev, void* a, long n, uint32_t offset)
 
 enum {
 	CMrdtr,
+	CMitr,
 };
 
 static struct cmdtab igbectlmsg[] = {
 	{CMrdtr,	"rdtr",	2},
+	{CMitr,		"itr",	2},
 };
 
 static long
@@ -753,6 +774,23 @@ igbectl(struct ether* edev, void* buf, long n)
 		ctlr->rdtr = v;
 		csr32w(ctlr, Rdtr, Fpd|v);
 		break;
+	case CMitr:
+		/* at most v rx intrs/sec; 0 goes back to adapting to the load */
+		v = strtol(cb->f[1], &p, 0);
+		if(ctlr->itr < 0 || v < 0 || p == cb->f[1])
+			error(Ebadarg);
+		if(v == 0){
+			ctlr->itrfixed = 0;
+			break;
+		}
+		/* past ~3.9M/sec this is 0, which would turn throttling off */
+		v = 1000000000/v/256;
+		if(v == 0 || v > 0xFFFF)
+			error(Ebadarg);
+		ctlr->itrfixed = 1;
+		ctlr->itr = v;
+		csr32w(ctlr, Itr, v);
+		break;
 	}
 	kfree(cb);
 	poperror();
@@ -1149,6 +1187,19 @@ igberxinit(struct ctlr* ctlr)
 		csr32w(ctlr, Radv, 64);
 		break;
 	}
+	switch(ctlr->id){
+	case i82543gc:
+	case i82544ei:
+	case i82544eif:
+	case i82544gc:
+		ctlr->itr = -1;
+		break;
+	default:
+		if(!ctlr->itrfixed)
+			ctlr->itr = Itrlatency;
+		csr32w(ctlr, Itr, ctlr->itr);
+		break;
+	}
 	csr32w(ctlr, Rxdctl, (8<<WthreshSHIFT)|(8<<HthreshSHIFT)|4);
 
 	/*
@@ -1163,13 +1214,111 @@ igberim(void* ctlr)
 	return ((struct ctlr*)ctlr)->rim != 0;
 }
 
-static void
-igberproc(void* arg)
+/*
+ * Takes up to budget packets off the rx ring and returns how many it
+ * took.  If that's all of budget, there are probably more.
+ */
+static int
+igberpoll(struct ether* edev, int budget)
 {
 	Rd *rd;
 	struct block *bp;
 	struct ctlr *ctlr;
-	int r, rdh;
+	int rdh, n;
+
+	ctlr = edev->ctlr;
+	rdh = ctlr->rdh;
+	for(n = 0; n < budget; n++){
+		rd = &ctlr->rdba[rdh];
+
+		if(!(rd->status & Rdd))
+			break;
+
+		/*
+		 * Accept eop packets with no errors.
+		 * With no errors and the Ixsm bit set,
+		 * the descriptor status Tpcs and Ipcs bits give
+		 * an indication of whether the checksums were
+		 * calculated and valid.
+		 */
+		if((rd->status & Reop) && rd->errors == 0){
+			bp = ctlr->rb[rdh];
+			ctlr->rb[rdh] = NULL;
+			bp->wp += rd->length;
+			bp->next = NULL;
+			if(!(rd->status & Ixsm)){
+				ctlr->ixsm++;
+				if(rd->status & Ipcs){
+					/*
+					 * IP checksum calculated
+					 * (and valid as errors == 0).
+					 */
+					ctlr->ipcs++;
+					bp->flag |= Bipck;
+				}
+				if(rd->status & Tcpcs){
+					/*
+					 * TCP/UDP checksum calculated
+					 * (and valid as errors == 0).
+					 */
+					ctlr->tcpcs++;
+					bp->flag |= Btcpck|Budpck;
+				}
+				bp->checksum = rd->checksum;
+				bp->flag |= Bpktck;
+			}
+			etheriq(edev, bp, 1);
+		}
+		else if(ctlr->rb[rdh] != NULL){
+			freeb(ctlr->rb[rdh]);
+			ctlr->rb[rdh] = NULL;
+		}
+
+		memset(rd, 0, sizeof(Rd));
+		wmb();	/* make sure the zeroing happens before free (i think) */
+		ctlr->rdfree--;
+		rdh = NEXT_RING(rdh, ctlr->nrd);
+	}
+	ctlr->rdh = rdh;
+
+	if(ctlr->rdfree < ctlr->nrd/2 || (ctlr->rim & Rxdmt0))
+		igbereplenish(ctlr);
+	ctlr->rpoll++;
+	ctlr->rpkts += n;
+	return n;
+}
+
+/*
+ * Picks the interrupt rate from how many packets each rx interrupt has
+ * been getting us.  A few at a time means someone is waiting on each
+ * one, so we interrupt often.  Full polls mean a stream, which we'd
+ * rather take in big batches.
+ */
+static void
+igbeadaptitr(struct ctlr* ctlr, int npkts)
+{
+	int itr;
+
+	if(ctlr->itr < 0 || ctlr->itrfixed)
+		return;
+	ctlr->ravg += npkts - (ctlr->ravg >> 3);
+	if(ctlr->ravg < 4*8)
+		itr = Itrlatency;
+	else if(ctlr->ravg < Rxbudget/2*8)
+		itr = Itrmixed;
+	else
+		itr = Itrbulk;
+	if(itr != ctlr->itr){
+		ctlr->itr = itr;
+		csr32w(ctlr, Itr, itr);
+	}
+}
+
+static void
+igberproc(void* arg)
+{
+	struct ctlr *ctlr;
+	int r, n, npkts;
 	struct ether *edev;
 
 	edev = arg;
@@ -1186,62 +1335,19 @@ igberproc(void* arg)
 		ctlr->rsleep++;
 		rendez_sleep(&ctlr->rrendez, igberim, ctlr);
 
-		rdh = ctlr->rdh;
-		for(;;){
-			rd = &ctlr->rdba[rdh];
-
-			if(!(rd->status & Rdd))
-				break;
-
-			/*
-			 * Accept eop packets with no errors.
-			 * With no errors and the Ixsm bit set,
-			 * the descriptor status Tpcs and Ipcs bits give
-			 * an indication of whether the checksums were
-			 * calculated and valid.
-			 */
-			if((rd->status & Reop) && rd->errors == 0){
-				bp = ctlr->rb[rdh];
-				ctlr->rb[rdh] = NULL;
-				bp->wp += rd->length;
-				bp->next = NULL;
-				if(!(rd->status & Ixsm)){
-					ctlr->ixsm++;
-					if(rd->status & Ipcs){
-						/*
-						 * IP checksum calculated
-						 * (and valid as errors == 0).
-						 */
-						ctlr->ipcs++;
-						bp->flag |= Bipck;
-					}
-					if(rd->status & Tcpcs){
-						/*
-						 * TCP/UDP checksum calculated
-						 * (and valid as errors == 0).
-						 */
-						ctlr->tcpcs++;
-						bp->flag |= Btcpck|Budpck;
-					}
-					bp->checksum = rd->checksum;
-					bp->flag |= Bpktck;
-				}
-				etheriq(edev, bp, 1);
-			}
-			else if(ctlr->rb[rdh] != NULL){
-				freeb(ctlr->rb[rdh]);
-				ctlr->rb[rdh] = NULL;
-			}
-
-			memset(rd, 0, sizeof(Rd));
-			wmb();	/* make sure the zeroing happens before free (i think) */
-			ctlr->rdfree--;
-			rdh = NEXT_RING(rdh, ctlr->nrd);
-		}
-		ctlr->rdh = rdh;
-
-		if(ctlr->rdfree < ctlr->nrd/2 || (ctlr->rim & Rxdmt0))
-			igbereplenish(ctlr);
+		/*
+		 * The interrupt masked itself.  Leave it masked while
+		 * polls keep coming back full, letting everyone else on
+		 * the core run between them.
+		 */
+		npkts = 0;
+		do {
+			n = igberpoll(edev, Rxbudget);
+			npkts += n;
+			if(n == Rxbudget)
+				kthread_yield();
+		} while(n == Rxbudget);
+		igbeadaptitr(ctlr, npkts);
 	}
 }
 
@@ -1,25 +1,42 @@
 /*
- * Copyright (c) 2009 The Regents of the University  of California.  
- * See the COPYRIGHT files at the top of this source tree for full 
+ * Copyright (c) 2009 The Regents of the University  of California.
+ * See the COPYRIGHT files at the top of this source tree for full
  * license information.
  */
-#ifndef _ROS_ARSC_SERVER_H
-#define __ROS_ARSC_SERVER_H
+#ifndef ROS_KERN_ARSC_SERVER_H
+#define ROS_KERN_ARSC_SERVER_H
 #include <ros/common.h>
 #include <ros/ring_syscall.h>
+#include <ros/event.h>
 #include <arch/types.h>
 #include <arch/arch.h>
 
 #include <process.h>
 #include <syscall.h>
 #include <error.h>
+#include <atomic.h>
+#include <kref.h>
 
-extern struct proc_list arsc_proc_list;
-extern spinlock_t arsc_proc_lock;
+#define ARSC_MAX_RINGS				64
+#define ARSC_MAX_RINGS_PER_PROC		8
 
-syscall_sring_t* sys_init_arsc(struct proc* p);
-intreg_t syscall_async(struct proc* p, syscall_req_t *syscall);
-void arsc_server(uint32_t srcid, long a0, long a1, long a2);
+/* One submission/completion ring.  The sring lives in a user page (mapped at
+ * uva); we keep the back ring and a KVA for it.  Each ring holds a ref on its
+ * proc, and the ring table and any pollers working on it hold refs on the
+ * ring. */
+struct arsc_ring {
+	struct proc					*proc;
+	syscall_back_ring_t			back;
+	void						*uva;
+	struct event_queue			*ev_q;		/* for completion batches, or 0 */
+	spinlock_t					lock;		/* protects back */
+	struct kref					kref;
+	bool						dying;
+};
 
-static intreg_t process_generic_syscalls(struct proc* p, size_t max);
-#endif //ARSC_SERVER
+syscall_sring_t* sys_init_arsc(struct proc* p, struct event_queue *ev_q);
+intreg_t syscall_async(struct proc* p, syscall_req_t *syscall);
+void arsc_add_poller(uint32_t pcoreid);
+void arsc_proc_destroy(struct proc *p);
+void __arsc_poll(uint32_t srcid, long a0, long a1, long a2);
+#endif /* ROS_KERN_ARSC_SERVER_H */
@@ -0,0 +1,112 @@
+/* Copyright (c) 2014 The Regents of the University of California
+ * See LICENSE for details.
+ *
+ * Concurrent hash table.  It maps void* keys to void* values, and the client
+ * deals with the memory for both.
+ *
+ * - Lookups don't take any locks.  Call them from within a chash_read_lock(),
+ *   and the entry (and its key) won't be freed until you chash_read_unlock().
+ *   The value is the client's business: typically you kref_get_not_zero() it
+ *   before unlocking, like pid2proc() does.
+ * - Writers lock just the bucket they are changing.
+ * - chash_remove() waits for any lookups that could have seen the item, so once
+ *   it returns, it's safe to free whatever the key and value point to.  To
+ *   remove a batch, use chash_remove_deferred() on each, then wait once with
+ *   chash_free_dead().
+ * - The table grows incrementally: when it gets too full, we make a table twice
+ *   the size, and each insert moves a few buckets over to it, instead of one
+ *   caller rehashing everything at once.
+ * - A bucket is a cache line of slots, holding the entries' hashes and pointers
+ *   to them, so a lookup usually touches the bucket and the entry it wants, and
+ *   nothing else.  Full buckets chain more slots.
+ *
+ * Readers must not block, and must not remove anything from a chash (that
+ * would wait on themselves).  Readers from all chashes share the per-core
+ * reader state, which anyone can use via chash_sync_readers() to make their own
+ * lockless structures (e.g. the dcache's path walk). */
+
+#ifndef ROS_KERN_CHASH_H
+#define ROS_KERN_CHASH_H
+
+#include <ros/common.h>
+#include <atomic.h>
+
+#define CHASH_SLOTS				4
+
+struct chash_entry {
+	size_t						hash;
+	void						*k;
+	void						*v;
+	struct chash_entry			*next;		/* on a list of dead entries */
+};
+
+/* Slot i is empty if slots[i] is 0.  hashes[i] is the low bits of the entry's
+ * hash, which readers check before looking at the entry. */
+struct chash_bucket {
+	spinlock_t					lock;
+	uint32_t					hashes[CHASH_SLOTS];
+	bool						moved;	/* to the new table, when growing */
+	struct chash_entry			*slots[CHASH_SLOTS];
+	struct chash_bucket			*more;	/* overflow slots */
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+struct chash_table {
+	unsigned int				sz;		/* nr buckets, a power of 2 */
+	struct chash_bucket			*buckets;
+};
+
+struct chash {
+	struct chash_table			*tbl;		/* where new items go */
+	struct chash_table			*old_tbl;	/* being moved to tbl, if growing */
+	atomic_t					nr_items;
+	spinlock_t					resize_lock;
+	unsigned int				migrate_idx;	/* next old bucket to move */
+	size_t						(*hashfn)(void *k);
+	ssize_t						(*eqfn)(void *k1, void *k2);
+};
+
+/* Per-core lockless reader state.  rd_seq is odd while in a read section.
+ * Read sections nest (e.g. an IRQ handler doing a lookup). */
+struct chash_reader {
+	seq_ctr_t					rd_seq;
+	unsigned int				nesting;
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+/* Call this once on bootup, after initializing the slab allocator.  */
+void chash_init(void);
+
+/* Hash/equals functions for keys that are just numbers or pointers */
+size_t __generic_hash(void *k);
+ssize_t __generic_eq(void *k1, void *k2);
+
+struct chash *chash_create(unsigned int min_sz, size_t (*hashfn)(void *k),
+                           ssize_t (*eqfn)(void *k1, void *k2));
+void chash_destroy(struct chash *h);
+
+/* Returns FALSE if we're out of memory.  Duplicate keys are the caller's
+ * problem. */
+bool chash_insert(struct chash *h, void *k, void *v);
+/* Returns the value for k, or 0.  Call within chash_read_lock(). */
+void *chash_lookup(struct chash *h, void *k);
+/* Lookup for when you don't have a key object: match(query, key) is checked on
+ * every key with the given hash.  Call within chash_read_lock(). */
+void *chash_lookup_fn(struct chash *h, size_t hash, void *query,
+                      bool (*match)(void *query, void *k));
+/* Removes k, returning its value (or 0).  Waits on lockless readers. */
+void *chash_remove(struct chash *h, void *k);
+/* Removes k without waiting, putting its entry on *dead.  Once you're done
+ * removing things (and outside any read section), chash_free_dead() waits on
+ * the readers once for the lot.  Don't free the keys or values until then. */
+void *chash_remove_deferred(struct chash *h, void *k,
+                            struct chash_entry **dead);
+void chash_free_dead(struct chash_entry *dead);
+size_t chash_count(struct chash *h);
+/* Runs func on every value, locklessly.  Func can't block.  Items added or
+ * removed concurrently may or may not be seen. */
+void chash_for_each(struct chash *h, void (*func)(void *v));
+
+struct chash_reader *chash_read_lock(void);
+void chash_read_unlock(struct chash_reader *rd);
+void chash_sync_readers(void);
+
+#endif /* ROS_KERN_CHASH_H */
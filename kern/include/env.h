@@ -17,6 +17,7 @@
 #include <arch/arch.h>
 #include <sys/queue.h>
 #include <atomic.h>
+#include <bitmask.h>
 #include <mm.h>
 #include <vfs.h>
 #include <schedule.h>
@@ -29,7 +30,6 @@ TAILQ_HEAD(vcore_tailq, vcore);
 #define PROC_PROGNAME_SZ 20
 // TODO: clean this up.
 struct proc {
-	TAILQ_ENTRY(proc) proc_arsc_link;
 	TAILQ_ENTRY(proc) sibling_link;
 	spinlock_t proc_lock;
 	struct user_context scp_ctx; 	/* context for an SCP.  TODO: move to vc0 */
@@ -72,15 +72,18 @@ struct proc {
 	spinlock_t pte_lock;		/* Protects page tables (mem mgmt) */
 	struct vmr_tailq vm_regions;
 	int vmr_history;
+	/* TLB shootdowns only go to tlb_cores, the cores with our cr3 loaded.
+	 * tlb_gen counts shootdowns, so cores with a tagged TLB can tell if their
+	 * old entries for us are stale.  Those are tagged by tlb_ctx_id, since pids
+	 * get reused. */
+	DECL_BITMASK(tlb_cores, MAX_NUM_CPUS);
+	atomic_t tlb_gen;
+	unsigned long tlb_ctx_id;
 
 	// Per process info and data pages
  	procinfo_t *SAFE procinfo;       // KVA of per-process shared info table (RO)
 	procdata_t *SAFE procdata;       // KVA of per-process shared data table (RW)
 	
-	// The backring pointers for processing asynchronous system calls from the user
-	// Note this is the actual backring, not a pointer to it somewhere else
-	syscall_back_ring_t syscallbackring;
-	
 	// The front ring pointers for pushing asynchronous system events out to the user
 	// Note this is the actual frontring, not a pointer to it somewhere else
 	sysevent_front_ring_t syseventfrontring;
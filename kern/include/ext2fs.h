@@ -118,6 +118,10 @@ the crap we keep around for glibc/posix is (probably still) in octal. */
 #define EXT3_JOURNAL_DATA_FL	0x00040000	/* journal file data */
 #define EXT2_RESERVED_FL		0x80000000	/* reserved for ext2 library */
 
+/* Superblock s_flags, tells us how to treat chars when hashing dir names */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
 /* Directory entry file types */
 #define EXT2_FT_UNKNOWN			0	/* unknown file type */
 #define EXT2_FT_REG_FILE		1	/* regular file */
@@ -182,7 +186,9 @@ struct ext2_sb {
 /* Next chunk, Other options */
 	uint32_t					s_default_mount_opts;
 	uint32_t					s_first_meta_bg;	/* BG id of first meta */
-	uint8_t						s_reserved[760];
+	uint8_t						s_reserved1[88];	/* ext3/4 stuff we skip */
+	uint32_t					s_flags;			/* misc flags, ext3+ */
+	uint8_t						s_reserved[668];
 };
 
 /* All block ids are absolute (not relative to the BG). */
@@ -243,9 +249,52 @@ struct ext2_dirent {
 	uint8_t						dir_name[256];		/* might be < 255 on disc */
 };
 
+/* Directory indexing (htree).  An indexed directory (EXT2_INDEX_FL) keeps a
+ * hash-ordered tree of dir blocks in its first block, hidden after the ".."
+ * entry, whose reclen covers the rest of the block.  Interior index blocks look
+ * like a single unused dirent (inode 0, reclen of the whole block).  Older
+ * code that doesn't know about the index just sees empty space.
+ *
+ * Each dx entry maps a hash to a (logical) dir block: the block holds names
+ * whose hash is >= the entry's hash and < the next entry's hash.  The first
+ * entry in a node has an implied hash of 0, and its hash field holds the
+ * count/limit of the node instead.  The low bit of an entry's hash means the
+ * hash collided with the previous block, so lookups may need to keep going. */
+#define EXT2_HASH_LEGACY			0
+#define EXT2_HASH_HALF_MD4			1
+#define EXT2_HASH_TEA				2
+#define EXT2_HASH_LEGACY_UNSIGNED	3
+#define EXT2_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2_HASH_TEA_UNSIGNED		5
+
+#define EXT2_HTREE_EOF				0x7fffffff
+#define EXT2_DX_MAX_LEVELS			2		/* root + 1 level of index nodes */
+
+struct ext2_dx_root_info {
+	uint32_t					reserved_zero;
+	uint8_t						hash_version;
+	uint8_t						info_length;		/* always 8 */
+	uint8_t						indirect_levels;	/* 0 -> root points to leaves */
+	uint8_t						unused_flags;
+};
+
+/* Overlays the hash field of the first dx entry in a node */
+struct ext2_dx_countlimit {
+	uint16_t					limit;				/* max entries in the node */
+	uint16_t					count;				/* entries in use, incl this */
+};
+
+struct ext2_dx_entry {
+	uint32_t					hash;
+	uint32_t					block;				/* logical dir block */
+};
+
 /* Every FS must extern it's type, and be included in vfs_init() */
 extern struct fs_type ext2_fs_type;
 
+/* Prints how the inode's blocks are laid out on disk (used by the monitor) */
+void ext2_print_frag(struct inode *inode);
+
 /* This hangs off the VFS's SB, and tracks in-memory copies of the disc SB and
  * the block group descriptor table.  For now, s_dirty (VFS) will track the
  * dirtiness of all things hanging off the sb.  Both of the objects contained
@@ -256,10 +305,23 @@ struct ext2_sb_info {
 	unsigned int				nr_bgs;
 };
 
+/* Preallocation window sizes, in FS blocks.  A regular file's window starts
+ * at the min (or the SB's s_prealloc_blocks, if set) and doubles each time the
+ * file uses all of it, up to the max. */
+#define EXT2_PREALLOC_MIN			8
+#define EXT2_PREALLOC_MAX			256
+
 /* Inode in-memory data.  This stuff is in cpu-native endianness.  If we start
  * using the data in the actual inode and in the buffer cache, change
- * ext2_my_bh() and its two callers.  Assume this data is dirty. */
+ * ext2_my_bh() and its two callers.  Assume this data is dirty.
+ *
+ * The prealloc blocks are marked used in the bitmap, but aren't linked into the
+ * inode yet.  They are given back when the inode is released. */
 struct ext2_i_info {
 	uint32_t					i_block[15];		/* list of blocks reserved*/
+	uint32_t					i_prealloc_block;	/* next prealloc'd block */
+	unsigned int				i_prealloc_count;	/* nr prealloc'd blocks */
+	unsigned int				i_prealloc_goal;	/* size of the next window */
+	uint32_t					i_last_block;		/* last block we alloc'd */
 };
 #endif /* ROS_KERN_EXT2FS_H */
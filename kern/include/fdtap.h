@@ -0,0 +1,40 @@
+/* Copyright (c) 2015 The Regents of the University of California
+ * See LICENSE for details.
+ *
+ * FD taps, kernel side.  See ros/fdtap.h for the interface.
+ *
+ * A tap belongs to its FD slot in the proc's open_files, and holds a ref on
+ * the chan it tapped.  Devices that support taps implement the tapfd dev op,
+ * keep their taps on a list, and call fire_tap() on them when something
+ * happens.  A device must not fire a tap after tapfd(FDTAP_CMD_REM) returns,
+ * so it should fire and remove under the same lock. */
+
+#ifndef ROS_KERN_FDTAP_H
+#define ROS_KERN_FDTAP_H
+
+#include <ros/fdtap.h>
+#include <sys/queue.h>
+
+struct proc;
+struct chan;
+
+struct fd_tap {
+	SLIST_ENTRY(fd_tap)			link;		/* for the device's use */
+	struct proc					*proc;
+	struct chan					*chan;
+	int							fd;
+	int							filter;
+	struct event_queue			*ev_q;
+	int							ev_id;
+	void						*data;
+};
+SLIST_HEAD(fdtap_slist, fd_tap);
+
+int add_fd_tap(struct proc *p, struct fd_tap_req *tap_req);
+int remove_fd_tap(struct proc *p, int fd);
+struct fd_tap *take_fd_tap(struct proc *p, int fd);
+void free_fd_tap(struct fd_tap *tap);
+void remove_all_fd_taps(struct proc *p);
+void fire_tap(struct fd_tap *tap, int filter);
+
+#endif /* ROS_KERN_FDTAP_H */
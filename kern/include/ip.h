@@ -3,6 +3,8 @@
 #ifndef ROS_KERN_IP_H
 #define ROS_KERN_IP_H
 #include <ns.h>
+#include <fdtap.h>
+#include <netmap.h>
 
 enum {
 	Addrlen = 64,
@@ -92,6 +94,10 @@ struct conv {
 
 	struct route *r;			/* last route used */
 	uint32_t rgen;				/* routetable generation for *r */
+
+	spinlock_t tap_lock;		/* protects the tap lists */
+	struct fdtap_slist data_taps;
+	struct fdtap_slist listen_taps;
 };
 
 struct Ipifc;
@@ -1039,6 +1045,9 @@ struct ether {
 	long (*ctl) (struct ether *, void *, long);	/* custom ctl messages */
 	void (*power) (struct ether *, int);	/* power on/off */
 	void (*shutdown) (struct ether *);	/* shutdown hardware before reboot */
+	/* netmap (see netmap.h): switch a queue to/from nm's rings, move them */
+	void (*netmap) (struct ether *, struct netmap *, int);
+	void (*nmsync) (struct ether *, struct netmap *, int);
 	void *ctlr;
 	int pcmslot;				/* PCMCIA */
 	int fullduplex;				/* non-zero if full duplex */
@@ -1050,6 +1059,9 @@ struct ether {
 	int nvlan;
 	struct ether *vlans[MaxFID];
 
+	qlock_t nmlock;
+	struct netmap *nm[NETMAP_MAX_QS];
+
 	/* another case where we wish we had anon struct members. */
 	struct netif netif;
 };
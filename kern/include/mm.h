@@ -15,6 +15,7 @@
 #include <slab.h>
 
 struct file;
+struct page;
 struct proc;								/* preprocessor games */
 
 /* Basic structure defining a region of a process's virtual memory.  Note we
@@ -47,7 +48,7 @@ int shrink_vmr(struct vm_region *vmr, uintptr_t va);
 void destroy_vmr(struct vm_region *vmr);
 struct vm_region *find_vmr(struct proc *p, uintptr_t va);
 struct vm_region *find_first_vmr(struct proc *p, uintptr_t va);
-void isolate_vmrs(struct proc *p, uintptr_t va, size_t len);
+int isolate_vmrs(struct proc *p, uintptr_t va, size_t len);
 void unmap_and_destroy_vmrs(struct proc *p);
 int duplicate_vmrs(struct proc *p, struct proc *new_p);
 void print_vmrs(struct proc *p);
@@ -64,6 +65,12 @@ int mprotect(struct proc *p, uintptr_t addr, size_t len, int prot);
 int munmap(struct proc *p, uintptr_t addr, size_t len);
 int handle_page_fault(struct proc *p, uintptr_t va, int prot);
 unsigned long populate_va(struct proc *p, uintptr_t va, unsigned long nr_pgs);
+int loan_user_pages(struct proc *p, uintptr_t va, int nr_pgs,
+                    struct page **pages);
+int pin_user_pages(struct proc *p, uintptr_t va, int nr_pgs,
+                   struct page **pages);
+int remap_user_page(struct proc *p, uintptr_t va, struct page *page);
+bool user_page_on_loan(struct proc *p, uintptr_t va);
 
 /* These assume the mm_lock is held already */
 int __do_mprotect(struct proc *p, uintptr_t addr, size_t len, int prot);
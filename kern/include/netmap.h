@@ -0,0 +1,57 @@
+/* Copyright (c) 2015 The Regents of the University of California
+ * See LICENSE for details.
+ *
+ * Netmap, kernel side.  See ros/netmap.h for the interface.
+ *
+ * A netmap belongs to one queue of one #ether device, in ether->nm[], and
+ * holds the pinned pages of the region the process registered.  The driver's
+ * netmap op switches the queue over to the region's buffers (and back), its
+ * nmsync op moves the rings, and it calls netmap_notify() when the queue
+ * interrupts.  Both ops run with ether->nmlock held, and the driver must not
+ * notify after netmap(off) returns. */
+
+#ifndef ROS_KERN_NETMAP_H
+#define ROS_KERN_NETMAP_H
+
+#include <ros/netmap.h>
+#include <sys/queue.h>
+#include <pmap.h>
+
+#define NETMAP_MAX_QS			8
+#define NETMAP_NR_PAGES			(NETMAP_REGION_SZ >> PGSHIFT)
+
+struct proc;
+struct chan;
+struct ether;
+
+struct netmap {
+	TAILQ_ENTRY(netmap)			link;		/* on the global list */
+	struct ether				*ether;
+	struct chan					*chan;		/* who we were registered on */
+	struct proc					*proc;
+	int							fd;
+	int							qidx;
+	struct event_queue			*ev_q;
+	int							ev_id;
+	struct netmap_ring			*rx;
+	struct netmap_ring			*tx;
+	uint32_t					rxhead;		/* the heads as of the last sync */
+	uint32_t					txhead;
+	struct page					*pages[NETMAP_NR_PAGES];
+};
+TAILQ_HEAD(netmap_tailq, netmap);
+
+/* Physical address of the buffer at off (a NETMAP_*_BUF()) */
+static inline physaddr_t netmap_buf_paddr(struct netmap *nm, size_t off)
+{
+	return page2pa(nm->pages[off >> PGSHIFT]) + PGOFF(off);
+}
+
+int netmap_reg(struct proc *p, int fd, struct netmap_req *req);
+int netmap_unreg(struct proc *p, int fd, int qidx);
+int netmap_sync(struct proc *p, int fd, int qidx, int flags);
+void netmap_notify(struct netmap *nm, int which);
+void netmap_chan_closed(struct ether *ether, struct chan *chan);
+void remove_all_netmaps(struct proc *p);
+
+#endif /* ROS_KERN_NETMAP_H */
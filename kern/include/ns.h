@@ -8,6 +8,10 @@
 #include <rwlock.h>
 #include <linker_func.h>
 
+struct page;
+struct fd_tap;
+struct iovec;
+
 /*
  * functions (possibly) linked in, complete, from libc.
  */
@@ -336,8 +340,13 @@ struct extra_bdata {
 	/* using u32s for packing reasons.  this means no extras > 4GB */
 	uint32_t off;
 	uint32_t len;
+	/* how we hold base: a kmalloc ref (kfree to release), or, if EXTD_PAGE, a
+	 * ref on the page whose kva is base (e.g. a page cache page). */
+	uint32_t flags;
 };
 
+#define EXTD_PAGE			(1 << 0)
+
 struct block {
 	struct block *next;
 	struct block *list;
@@ -427,6 +436,8 @@ struct dev {
 	void (*power) (int);		/* power mgt: power(1) → on, power (0) → off */
 //  int (*config)( int unused_int, char *unused_char_p_t, DevConf*);
 	char *(*chaninfo) (struct chan *, char *, size_t);
+	/* optional: adds or removes (FDTAP_CMD_*) an FD tap, see fdtap.h */
+	int (*tapfd) (struct chan *, struct fd_tap *, int);
 	/* we need to be aligned, i think to 32 bytes, for the linker tables. */
 } __attribute__ ((aligned(32)));
 
@@ -625,6 +636,10 @@ void addrootfile(char *unused_char_p_t, uint8_t * unused_uint8_p_t, uint32_t);
 struct block *adjustblock(struct block *, int);
 struct block *allocb(int);
 void block_add_extd(struct block *b, unsigned int nr_bufs, int mem_flags);
+void extd_incref(struct extra_bdata *ebd);
+void extd_decref(struct extra_bdata *ebd);
+void block_append_page(struct block *b, struct page *page, uint32_t off,
+                       uint32_t len);
 int anyhigher(void);
 int anyready(void);
 void _assert(char *unused_char_p_t);
@@ -798,6 +813,7 @@ long qbwrite(struct queue *, struct block *);
 long qibwrite(struct queue *q, struct block *b);
 struct queue *qbypass(void (*)(void *, struct block *), void *);
 int qcanread(struct queue *);
+int qcanwrite(struct queue *);
 void qclose(struct queue *);
 int qconsume(struct queue *, void *, int);
 struct block *qcopy(struct queue *, int unused_int, uint32_t);
@@ -816,6 +832,8 @@ int qiwrite(struct queue *, void *, int);
 int qlen(struct queue *);
 void qnoblock(struct queue *, int);
 struct queue *qopen(int unused_int, int, void (*)(void *), void *);
+typedef void (*qio_wake_cb_t)(struct queue *q, void *data, int filter);
+void qio_set_wake_cb(struct queue *q, qio_wake_cb_t func, void *data);
 int qpass(struct queue *, struct block *);
 int qpassnolim(struct queue *, struct block *);
 int qproduce(struct queue *, void *, int);
@@ -1004,13 +1022,18 @@ int sysopen(char *path, int mode);
 long unionread(struct chan *c, void *va, long n);
 long sysread(int fd, void *va, long n);
 long syspread(int fd, void *va, long n, int64_t off);
+long sysreadv(int fd, struct iovec *iov, int iovcnt);
+long syspreadv(int fd, struct iovec *iov, int iovcnt, int64_t off);
 int sysremove(char *path);
 int64_t sysseek(int fd, int64_t off, int whence);
 void validstat(uint8_t * s, int n, int slashok);
 int sysstat(char *path, uint8_t*, int n);
 int sysstatakaros(char *path, struct kstat *);
 long syswrite(int fd, void *va, long n);
+long sysbwrite(int fd, struct block *bp);
 long syspwrite(int fd, void *va, long n, int64_t off);
+long syswritev(int fd, struct iovec *iov, int iovcnt);
+long syspwritev(int fd, struct iovec *iov, int iovcnt, int64_t off);
 int syswstat(char *path, uint8_t * buf, int n);
 struct dir *chandirstat(struct chan *c);
 struct dir *sysdirstat(char *name);
@@ -1044,6 +1067,7 @@ static inline int abs(int a)
 
 extern char *eve;
 extern unsigned int qiomaxatomic;
+extern unsigned int qiozerocopymin;
 
 /* special sections */
 #define __devtab  __attribute__((__section__(".devtab")))
@@ -64,6 +64,7 @@ void page_alloc_init(struct multiboot_info *mbi);
 void colored_page_alloc_init(void);
 
 error_t upage_alloc(struct proc* p, page_t *SAFE *page, int zero);
+error_t upage_alloc_jumbo(page_t **page, size_t order, int zero);
 error_t kpage_alloc(page_t *SAFE *page);
 void *kpage_alloc_addr(void);
 void *kpage_zalloc_addr(void);
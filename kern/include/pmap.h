@@ -91,12 +91,24 @@ void	page_decref(page_t *COUNT(1) pp);
 
 void	tlb_invalidate(pde_t *COUNT(NPDENTRIES) pgdir, void *SNT va);
 void tlb_flush_global(void);
+void tlb_flush_range(uintptr_t start, uintptr_t end);
+/* Arch specific: loads p's page tables (the kernel's if p is 0) */
+void tlb_load_proc(struct proc *p);
 bool regions_collide_unsafe(uintptr_t start1, uintptr_t end1, 
                             uintptr_t start2, uintptr_t end2);
 
 /* Arch specific implementations for these */
 pte_t *pgdir_walk(pde_t *COUNT(NPDENTRIES) pgdir, const void *SNT va, int create);
 int get_va_perms(pde_t *COUNT(NPDENTRIES) pgdir, const void *SNT va);
+/* Jumbo pages for user memory.  Shifts are log2 of the page size.  Arches
+ * without them say PGSHIFT for both the min and the max. */
+int pgdir_min_jumbo_shift(void);
+int pgdir_max_jumbo_shift(void);
+int pgdir_page_shift(pde_t *pgdir, const void *va);
+bool pgdir_jumbo_slot_empty(pde_t *pgdir, const void *va, int pml_shift);
+int pgdir_map_jumbo(pde_t *pgdir, const void *va, physaddr_t pa, int perm,
+                    int pml_shift);
+int env_split_jumbo(struct proc *p, const void *va);
 
 static inline page_t *SAFE ppn2page(size_t ppn)
 {
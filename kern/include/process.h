@@ -52,9 +52,8 @@
 
 #include <env.h>
 
-/* Can use a htable iterator to iterate through all active procs */
-extern struct hashtable *pid_hash;
-extern spinlock_t pid_hash_lock;
+/* Can use chash_for_each() to iterate through all active procs */
+extern struct chash *pid_hash;
 
 /* Initialization */
 void proc_init(void);
@@ -133,6 +132,8 @@ void switch_back(struct proc *new_p, struct proc *old_proc);
 void abandon_core(void);
 void clear_owning_proc(uint32_t coreid);
 void proc_tlbshootdown(struct proc *p, uintptr_t start, uintptr_t end);
+void proc_tlbshootdown_sync(struct proc *p, uintptr_t start, uintptr_t end);
+void proc_load_cr3(struct proc *old_p, struct proc *new_p);
 
 /* Kernel message handlers for process management */
 void __startcore(uint32_t srcid, long a0, long a1, long a2);
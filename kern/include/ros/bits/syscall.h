@@ -73,6 +73,14 @@
 #define SYS_rename				123
 #define SYS_fchdir				124
 #define SYS_dup_fds_to			125
+#define SYS_sendfile			126
+#define SYS_tap_fds				127
+#define SYS_readv				128
+#define SYS_writev				129
+#define SYS_preadv				130
+#define SYS_pwritev				131
+#define SYS_netmap_reg			132
+#define SYS_netmap_sync			133
 
 /* Misc syscalls */
 #define SYS_gettimeofday		140
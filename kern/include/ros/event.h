@@ -25,6 +25,8 @@
 /* Not seriously used flags */
 #define EVENT_ROUNDROBIN		0x100	/* pick a vcore, RR style */
 #define EVENT_VCORE_APPRO		0x200	/* send to where the kernel wants */
+/* Coalesce bursts: like NOMSG, plus only alert once til the mbox is drained */
+#define EVENT_COALESCE			0x1000
 
 /* Flags from the program to the 2LS */
 #define EVENT_JUSTHANDLEIT		0x400	/* 2LS should handle the ev_q */
@@ -47,6 +49,7 @@
 #define EV_SYSCALL				10
 #define EV_CHECK_MSGS			11
 #define EV_POSIX_SIGNAL			12
+#define EV_ARSC					13
 #define NR_EVENT_TYPES			25 /* keep me last (and 1 > the last one) */
 
 /* Will probably have dynamic notifications later */
@@ -70,11 +73,14 @@ struct event_msg {
 
 /* Structure for storing / receiving event messages.  An overflow causes the
  * bit of the event to get set in the bitmap.  You can also have just the bit
- * sent (and no message). */
+ * sent (and no message).  EVENT_COALESCE senders count themselves in
+ * ev_nr_coalesced, and only the first one since the receiver last cleared it
+ * alerts anyone. */
 struct event_mbox {
 	struct ucq 					ev_msgs;
 	bool						ev_check_bits;
 	uint8_t						ev_bitmap[(MAX_NR_EVENT - 1) / 8 + 1];
+	atomic_t					ev_nr_coalesced;
 };
 
 /* The kernel sends messages to this structure, which describes how and where
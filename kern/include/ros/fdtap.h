@@ -0,0 +1,42 @@
+/* Copyright (c) 2015 The Regents of the University of California
+ * See LICENSE for details.
+ *
+ * FD taps: readiness notifications for FDs, sent as events.
+ *
+ * A process taps an FD with a filter (what it cares about), an event queue, an
+ * event id, and a data word.  When the FD's underlying device sees one of the
+ * filtered conditions, the kernel sends an event with ev_type = ev_id, ev_arg2
+ * = the conditions that fired, ev_arg3 = data, and ev_arg4 = the FD.
+ *
+ * Every tap fires once when it is added, for the conditions that already hold.
+ * After that, edge-triggered taps (FDTAP_FILT_EDGE) only fire when a condition
+ * becomes true: the FD goes from not readable to readable, from not writable
+ * to writable, or hangs up.  Level-triggered taps also fire on every new
+ * arrival of data or space.  Use an ev_q with EVENT_COALESCE if you only need
+ * to know *that* an FD has something, and not how many times. */
+
+#ifndef ROS_INC_FDTAP_H
+#define ROS_INC_FDTAP_H
+
+#include <ros/event.h>
+
+#define FDTAP_FILT_READABLE		0x00000001
+#define FDTAP_FILT_WRITABLE		0x00000002
+#define FDTAP_FILT_HANGUP		0x00000004
+#define FDTAP_FILT_ALL			(FDTAP_FILT_READABLE | FDTAP_FILT_WRITABLE | \
+                                 FDTAP_FILT_HANGUP)
+#define FDTAP_FILT_EDGE			0x80000000	/* mode, not a condition */
+
+#define FDTAP_CMD_ADD			1
+#define FDTAP_CMD_REM			2
+
+struct fd_tap_req {
+	int							fd;
+	int							cmd;
+	int							filter;
+	int							ev_id;
+	struct event_queue			*ev_q;
+	void						*data;
+};
+
+#endif /* ROS_INC_FDTAP_H */
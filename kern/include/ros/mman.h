@@ -36,6 +36,7 @@
 #define MAP_POPULATE	0x08000
 #define MAP_NONBLOCK	0x10000
 #define MAP_STACK		0x20000
+#define MAP_HUGE		0x40000	/* prefer jumbo pages, even the biggest */
 
 #define MAP_FAILED		((void*)-1)
 
@@ -0,0 +1,86 @@
+/* Copyright (c) 2015 The Regents of the University of California
+ * See LICENSE for details.
+ *
+ * Netmap: a NIC queue's rx and tx rings, in memory the process shares with the
+ * kernel, so it can run its own packet loop without a copy or a syscall per
+ * packet.
+ *
+ * The process allocates a page-aligned, NETMAP_REGION_SZ region of anonymous
+ * memory and registers it, with an #ether FD and a queue index.  The kernel
+ * pins the region's pages and points the queue's descriptors at the buffers in
+ * it, and from then on the queue's packets only go to and from the region; the
+ * kernel's own traffic uses the NIC's other queues, if it has any.  The
+ * registration lasts until it is removed, the FD is closed, or the process
+ * execs or exits.  Leave the region mapped as it is until then: unmapping it,
+ * mprotecting it, write()ing from it, or read()ing into it can leave the
+ * process looking at different pages than the NIC is.  Big writes lend the
+ * pages out and the next write to them copies them, and reads can flip whole
+ * pages in place of the region's.  Only the process that registered can sync
+ * or remove it, even if others share the FD.
+ *
+ * Each ring is slot-for-slot with its buffers and the NIC's descriptors: slot
+ * i of the rx ring is NETMAP_RX_BUF(i), and slot i of the tx ring is
+ * NETMAP_TX_BUF(i).  On both rings, the process owns the slots from head up to
+ * (not including) tail and the kernel owns the rest.  On the rx ring those are
+ * received packets, on the tx ring they are free slots to fill.  The process
+ * advances head past the slots it is done with (packets it consumed, or ones
+ * it filled in to send) and calls sys_netmap_sync(), which hands them to the
+ * NIC and moves tail up to what the NIC has finished (packets received, or
+ * slots whose packets went out).  The kernel always holds a slot or two back,
+ * so head == tail means the process has no slots.
+ *
+ * If the registration has an ev_q, each interrupt for the queue sends an event
+ * with ev_type = ev_id, ev_arg2 = NETMAP_SYNC_* for the rings that might have
+ * news, ev_arg3 = the queue index, and ev_arg4 = the FD.  Use a coalescing
+ * ev_q, or none at all and just poll with syncs.  Don't count on hearing about
+ * tx completions; sync the tx ring when you need space. */
+
+#ifndef ROS_INC_NETMAP_H
+#define ROS_INC_NETMAP_H
+
+#include <ros/common.h>
+#include <ros/arch/mmu.h>
+#include <ros/event.h>
+
+#define NETMAP_NR_SLOTS			256
+#define NETMAP_BUF_SZ			2048
+
+/* Offsets into the region */
+#define NETMAP_RX_RING			0
+#define NETMAP_TX_RING			PGSIZE
+#define NETMAP_BUFS				(2 * PGSIZE)
+#define NETMAP_RX_BUF(i)		(NETMAP_BUFS + (i) * NETMAP_BUF_SZ)
+#define NETMAP_TX_BUF(i)		NETMAP_RX_BUF(NETMAP_NR_SLOTS + (i))
+#define NETMAP_REGION_SZ		NETMAP_TX_BUF(NETMAP_NR_SLOTS)
+
+#define NETMAP_SLOT_ERR			0x0001	/* rx: bad packet, drop it */
+
+struct netmap_slot {
+	uint16_t					len;
+	uint16_t					flags;
+};
+
+struct netmap_ring {
+	uint32_t					head;		/* written by the process */
+	uint32_t					tail;		/* written by the kernel */
+	uint32_t					nr_slots;
+	uint32_t					pad;
+	struct netmap_slot			slot[NETMAP_NR_SLOTS];
+};
+
+#define NETMAP_CMD_REG			1
+#define NETMAP_CMD_UNREG		2
+
+struct netmap_req {
+	int							cmd;
+	int							qidx;
+	void						*region;	/* REG only, as are the rest */
+	struct event_queue			*ev_q;		/* 0 for no events */
+	int							ev_id;
+};
+
+/* sys_netmap_sync() flags, and the rings an event is about */
+#define NETMAP_SYNC_RX			0x1
+#define NETMAP_SYNC_TX			0x2
+
+#endif /* ROS_INC_NETMAP_H */
@@ -17,6 +17,16 @@
 #define RES_APPLE_PIES		 2
 #define MAX_NUM_RESOURCES    3
 
+/* Not a resource you request, but you can sys_provision() it to pick how the
+ * ksched places a process's cores on the machine. */
+#define RES_CORE_PLACEMENT	0x100
+
+/* Core placement policies */
+#define CORE_PLACE_ANY			0	/* whatever is idle, in order */
+#define CORE_PLACE_COMPACT		1	/* same LLC, then socket; no SMT sibs */
+#define CORE_PLACE_COMPACT_SMT	2	/* same, but pack onto hyperthreads */
+#define NR_CORE_PLACEMENTS		3
+
 /* Flags */
 #define REQ_ASYNC			0x01 // Sync by default (?)
 #define REQ_SOFT			0x02 // just making something up
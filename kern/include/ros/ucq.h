@@ -33,6 +33,7 @@ struct ucq {
 	atomic_t					nr_extra_pgs;	/* nr pages mmaped */
 	atomic_t					cons_idx;		/* cons pg and slot nr */
 	bool						ucq_ready;		/* ucq is ready to be used */
+	bool						u_single_cons;	/* user: one consumer, no atomics */
 	/* Userspace lock for modifying the UCQ */
 	uint64_t					u_lock[2 * ARCH_CL_SIZE / 8];
 };
@@ -20,9 +20,9 @@ TAILQ_HEAD(proc_list, proc);		/* Declares 'struct proc_list' */
  * be used as a ref source while the ksched has a valid kref. */
 struct sched_pcore {
 	TAILQ_ENTRY(sched_pcore)	prov_next;			/* on a proc's prov list */
-	TAILQ_ENTRY(sched_pcore)	alloc_next;			/* on an alloc list (idle)*/
 	struct proc					*prov_proc;			/* who this is prov to */
 	struct proc					*alloc_proc;		/* who this is alloc to */
+	uint32_t					idle;				/* claim with a CAS */
 };
 TAILQ_HEAD(sched_pcore_tailq, sched_pcore);
 
@@ -32,10 +32,19 @@ struct sched_proc_data {
 	struct proc_list 			*cur_list;			/* which tailq we're on */
 	struct sched_pcore_tailq	prov_alloc_me;		/* prov cores alloced us */
 	struct sched_pcore_tailq	prov_not_alloc_me;	/* maybe alloc to others */
-	/* count of lists? */
-	/* other accounting info */
+	int							placement;			/* CORE_PLACE_ policy */
+	/* SCP fair share, protected by the proclist_lock */
+	int							nice;				/* -20 (greedy) to 19 */
+	uint64_t					vruntime;			/* weighted ticks of CPU */
+	uint64_t					ticks_charged;		/* vc0 ticks in vruntime */
+	uint64_t					runnable_tsc;		/* when it last woke */
+	int							runq;				/* last LL core, or -1 */
+	int							runq_idx;			/* heap slot, -1 if not in */
 };
 
+#define SCHED_NICE_MIN			-20
+#define SCHED_NICE_MAX			19
+
 void schedule_init(void);
 
 /************** Process Management Callbacks **************/
@@ -78,6 +87,11 @@ void cpu_bored(void);
  * inappropriate, since we need to know which specific core is now free. */
 void avail_res_changed(int res_type, long change);
 
+/* A core for the idx'th of a set of kernel jobs that each want their own core,
+ * like a NIC's queues.  These are always low-latency cores (the ones that run
+ * IRQs, ktasks, and SCPs), shared once there are more jobs than LL cores. */
+int sched_irq_core(int idx);
+
 /************** Proc's view of the world **************/
 /* How many vcores p will think it can have */
 uint32_t max_vcores(struct proc *p);
@@ -87,6 +101,22 @@ uint32_t max_vcores(struct proc *p);
  * this from generic kernel code, since it might not be present in all kernel
  * schedulers. */
 int provision_core(struct proc *p, uint32_t pcoreid);
+/* Sets how p's cores are placed (CORE_PLACE_*, ros/resource.h) */
+int sched_set_placement(struct proc *p, int policy);
+/* Sets p's share of the LL cores while it is an SCP, from SCHED_NICE_MIN to
+ * SCHED_NICE_MAX.  Lower is a bigger share. */
+int sched_set_nice(struct proc *p, int nice);
+/* The weight an SCP with a given nice value gets, relative to 1024 for nice 0 */
+int sched_nice_weight(int nice);
+/* Runs procs through an SCP runq heap, by their ksched_data.vruntime: puts them
+ * all on it, takes the first nr_drop of them back off (from wherever they are
+ * in the heap), then pops the rest back into procs, in the order the ksched
+ * would run them.  Returns how many it popped.  For testing the ksched. */
+int __sched_runq_sort(struct proc **procs, int nr, int nr_drop);
+/* Claims an idle pcore and tracks it as allocated to p, the way the MCP ksched
+ * does, but doesn't give it to p.  Returns the pcoreid, or -1 if none are idle.
+ * Give it back with __sched_put_idle_core().  For testing the ksched. */
+int __sched_claim_idle_core(struct proc *p);
 
 /************** Debugging **************/
 void sched_diag(void);
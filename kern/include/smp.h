@@ -72,6 +72,9 @@ struct per_cpu_info {
 	int cpu_state;
 	uint64_t last_tick_cnt;
 	uint64_t state_ticks[NR_CPU_STATES];
+	/* How we wait in smp_idle.  Set with set_cpu_idle_mode(). */
+	int idle_mode;
+	uint64_t idle_poll_ticks;
 #ifdef __SHARC__
 	// held spin-locks. this will have to go elsewhere if multiple kernel
 	// threads can share a CPU.
@@ -83,11 +86,11 @@ struct per_cpu_info {
 	taskstate_t *tss;
 	segdesc_t *gdt;
 #endif
-	/* KMSGs */
-	spinlock_t immed_amsg_lock;
-	struct kernel_msg_list NTPTV(a0t) NTPTV(a1t) NTPTV(a2t) immed_amsgs;
-	spinlock_t routine_amsg_lock;
-	struct kernel_msg_list NTPTV(a0t) NTPTV(a1t) NTPTV(a2t) routine_amsgs;
+	/* KMSGs.  Only this core touches the RKM fifo and the free msg cache. */
+	struct kernel_msg_queue kmsgs;
+	struct kernel_message *routine_fifo;
+	struct kernel_message *kmsg_cache;
+	unsigned int nr_kmsg_cache;
 	/* profiling -- opaque to all but the profiling code. */
 	void *profiling;
 }__attribute__((aligned(ARCH_CL_SIZE)));
@@ -106,14 +109,36 @@ typedef struct per_cpu_info NTPTV(t) NTPTV(a0t) NTPTV(a1t) NTPTV(a2t) per_cpu_in
 extern per_cpu_info_t (RO per_cpu_info)[MAX_NUM_CPUS];
 extern volatile uint32_t RO num_cpus;
 
+/* Idle modes.  A halted core needs an IPI to wake up.  A core that is polling or
+ * MWAITing is watching its kmsg queue, so the push of an RKM wakes it without
+ * an IPI.  POLL spins for a while before falling back to MWAIT (or halt, if
+ * the machine can't MWAIT). */
+#define IDLE_HALT				0
+#define IDLE_MWAIT				1
+#define IDLE_POLL				2
+#define NR_IDLE_MODES			3
+
+/* Where each core sits in the machine, filled in by topology_init().  The IDs
+ * are dense, starting from 0, and less than num_cpus: cores with the same
+ * phys_core are hyperthreads of one another, cores with the same llc share a
+ * last-level cache, and cores with the same socket share a package. */
+struct core_topo {
+	int							socket;
+	int							llc;
+	int							phys_core;
+};
+extern struct core_topo core_topo[MAX_NUM_CPUS];
+
 /* SMP bootup functions */
 void smp_boot(void);
 void smp_idle(void) __attribute__((noreturn));
 void smp_percpu_init(void); // this must be called by each core individually
 void __arch_pcpu_init(uint32_t coreid);	/* each arch has one of these */
+void topology_init(void);	/* arch-specific, call after the cores are up */
 
 void __set_cpu_state(struct per_cpu_info *pcpui, int state);
 void reset_cpu_state_ticks(int coreid);
+int set_cpu_idle_mode(uint32_t coreid, int mode, uint64_t poll_usec);
 
 /* SMP utility functions */
 int smp_call_function_self(isr_t handler, void *data,
@@ -6,6 +6,7 @@
 #include <ros/trapframe.h>
 #include <arch/arch.h>
 #include <arch/mmu.h>
+#include <ros/atomic.h>
 #include <sys/queue.h>
 #include <arch/trap.h>
 
@@ -14,6 +15,7 @@ typedef void (*isr_t)(struct hw_trapframe *hw_tf, void *data);
 
 void idt_init(void);
 int register_irq(int irq, isr_t handler, void *irq_arg, uint32_t tbdf);
+int deregister_irq(int vector, isr_t handler, void *irq_arg);
 int route_irqs(int cpu_vec, int coreid);
 void print_trapframe(struct hw_trapframe *hw_tf);
 void print_user_ctx(struct user_context *ctx);
@@ -56,7 +58,13 @@ void __arch_reflect_trap_hwtf(struct hw_trapframe *hw_tf, unsigned int trap_nr,
  * Also, a big difference is that smp_calls can use the same message (registered
  * in the interrupt_handlers[] for x86) for every recipient, but the kernel
  * messages require a unique message.  Also for now, but it might be like that
- * for a while on x86 (til we have a broadcast). */
+ * for a while on x86 (til we have a broadcast).
+ *
+ * Each core's queues are lock-free: senders push onto them with a CAS, and only
+ * the destination core takes messages off (all at once, then in send order).
+ * Senders only IPI a core if it doesn't already have a KMSG IPI on the way,
+ * like the LAPIC does with a vector that is already pending.  Freed messages go
+ * to a small per-core cache, so most sends don't touch the slab allocator. */
 
 #define KMSG_IMMEDIATE 			1
 #define KMSG_ROUTINE 			2
@@ -65,7 +73,7 @@ typedef void (*amr_t)(uint32_t srcid, long a0, long a1, long a2);
 
 struct kernel_message
 {
-	STAILQ_ENTRY(kernel_message) link;
+	struct kernel_message *next;
 	uint32_t srcid;
 	uint32_t dstid;
 	amr_t pc;
@@ -74,12 +82,27 @@ struct kernel_message
 	long arg2;
 }__attribute__((aligned(8)));
 
-STAILQ_HEAD(kernel_msg_list, kernel_message);
 typedef struct kernel_message kernel_message_t;
 
+/* A core's incoming KMSGs.  Other cores write this, so it gets its own cache
+ * line in the pcpui.  The lists are in reverse send order (newest first).
+ * polling is set while the idle core is spinning or MWAITing on this line.
+ * returns has the messages this core sent, once their targets ran them. */
+struct kernel_msg_queue {
+	struct kernel_message		*immed_amsgs;
+	struct kernel_message		*routine_amsgs;
+	struct kernel_message		*returns;
+	atomic_t					ipi_pending;
+	bool						polling;
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
 void kernel_msg_init(void);
 uint32_t send_kernel_message(uint32_t dst, amr_t pc, long arg0, long arg1,
                              long arg2, int type);
+/* Sends the same message to each of the num cores in pc_arr, IPIing them after
+ * all of the messages are queued. */
+void send_kernel_message_multi(uint32_t *pc_arr, uint32_t num, amr_t pc,
+                               long arg0, long arg1, long arg2, int type);
 void handle_kmsg_ipi(struct hw_trapframe *hw_tf, void *data);
 void process_routine_kmsg(void);
 void print_kmsgs(uint32_t coreid);
@@ -20,7 +20,7 @@
 #include <kref.h>
 #include <time.h>
 #include <radix.h>
-#include <hashtable.h>
+#include <chash.h>
 #include <pagemap.h>
 #include <blockdev.h>
 
@@ -50,6 +50,7 @@ struct file_operations;
 struct fs_type;
 struct vfsmount;
 struct pipe_inode_info;
+struct fd_tap;
 
 /* List def's we need */
 TAILQ_HEAD(sb_tailq, super_block);
@@ -126,10 +127,10 @@ struct super_block {
 	struct file_tailq			s_files;		/* assigned files */
 	struct dentry_tailq			s_lru_d;		/* unused dentries (in dcache)*/
 	spinlock_t					s_lru_lock;
-	struct hashtable			*s_dcache;		/* dentry cache */
+	struct chash				*s_dcache;		/* dentry cache */
+	seq_ctr_t					s_dcache_seq;	/* for lockless lookups */
 	spinlock_t					s_dcache_lock;
-	struct hashtable			*s_icache;		/* inode cache */
-	spinlock_t					s_icache_lock;
+	struct chash				*s_icache;		/* inode cache */
 	struct block_device			*s_bdev;
 	TAILQ_ENTRY(super_block)	s_instances;	/* list of sbs of this fs type*/
 	char						s_name[32];
@@ -276,6 +277,7 @@ struct file {
 	unsigned int				f_uid;
 	unsigned int				f_gid;
 	int							f_error;
+	bool						f_last_writer;	/* set for ->release */
 	struct event_poll_tailq		f_ep_links;
 	spinlock_t					f_ep_lock;
 	void						*f_privdata;	/* tty/socket driver hook */
@@ -375,6 +377,7 @@ struct small_fd_set {
 struct file_desc {
 	struct file					*fd_file;
 	unsigned int				fd_flags;
+	struct fd_tap				*fd_tap;		/* 9ns only, see fdtap.h */
 };
 
 /* All open files for a process */
@@ -444,6 +447,7 @@ struct dentry *dcache_get(struct super_block *sb, struct dentry *what_i_want);
 void dcache_put(struct super_block *sb, struct dentry *key_val);
 struct dentry *dcache_remove(struct super_block *sb, struct dentry *key);
 void dcache_prune(struct super_block *sb, bool negative_only);
+void dcache_for_each(struct super_block *sb, void (*func)(struct dentry *));
 int generic_dentry_hash(struct dentry *dentry, struct qstr *qstr);
 
 /* Inode Functions */
@@ -465,6 +469,10 @@ ssize_t generic_file_read(struct file *file, char *buf, size_t count,
                           off64_t *offset);
 ssize_t generic_file_write(struct file *file, const char *buf, size_t count,
                            off64_t *offset);
+ssize_t generic_file_readv(struct file *file, const struct iovec *vector,
+                           unsigned long count, off64_t *offset);
+ssize_t generic_file_writev(struct file *file, const struct iovec *vector,
+                            unsigned long count, off64_t *offset);
 ssize_t generic_dir_read(struct file *file, char *u_buf, size_t count,
                          off64_t *offset);
 struct file *alloc_file(void);
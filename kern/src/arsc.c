@@ -4,6 +4,25 @@
 #pragma nosharc
 #endif
 
+/* Asynchronous remote syscalls.
+ *
+ * A process sets up any number of syscall rings (up to a limit) with
+ * sys_init_arsc(), each a page of shared memory.  It pushes requests (pointers
+ * to struct syscalls) onto the ring, and never traps.  The ksched gives us a
+ * few dedicated cores at boot, and each of those runs a poller: a routine kmsg
+ * that picks a ring with work, runs a batch of its syscalls, and re-sends
+ * itself to its own core (which needs no IPI) to do it again.
+ *
+ * Each syscall is run like a local syscall, in the proc's address space, so it
+ * can block.  The poller queues its next pass before running anything, so if a
+ * syscall blocks, the core moves on to the next pass and keeps draining the
+ * rings.  When the blocked syscall's kthread restarts, (on whatever core woke
+ * it), it finishes just that syscall and idles.
+ *
+ * Syscalls complete out of order, so userspace watches the struct syscall's
+ * flags for SC_DONE, like with any other async syscall.  We also advance the
+ * ring's rsp_prod as syscalls finish, and if the ring has an ev_q, post one
+ * EV_ARSC per batch (ev_arg2 is how many finished, ev_arg3 is the ring). */
 
 #include <ros/common.h>
 #include <ros/ring_syscall.h>
@@ -16,15 +35,26 @@
 #include <kmalloc.h>
 #include <pmap.h>
 #include <stdio.h>
-#include <hashtable.h>
 #include <smp.h>
+#include <event.h>
+#include <trap.h>
+#include <kthread.h>
 #include <arsc_server.h>
 #include <kref.h>
 
+struct arsc_poller {
+	uint32_t					pcoreid;
+	unsigned int				cursor;		/* where to start looking */
+	bool						asleep;		/* no rings, not polling */
+};
 
-
-struct proc_list arsc_proc_list = TAILQ_HEAD_INITIALIZER(arsc_proc_list);
-spinlock_t arsc_proc_lock = SPINLOCK_INITIALIZER_IRQSAVE;
+/* The ring table holds a ref on each ring.  Protected by arsc_lock, as are the
+ * pollers' asleep flags. */
+static struct arsc_ring *arsc_rings[ARSC_MAX_RINGS];
+static unsigned int nr_arsc_rings;
+static struct arsc_poller arsc_pollers[CONFIG_ARSC_POLLERS];
+static unsigned int nr_arsc_pollers;
+static spinlock_t arsc_lock = SPINLOCK_INITIALIZER;
 
 intreg_t inline syscall_async(struct proc *p, syscall_req_t *call)
 {
@@ -33,97 +63,251 @@ intreg_t inline syscall_async(struct proc *p, syscall_req_t *call)
 	               sc->arg2, sc->arg3, sc->arg4, sc->arg5);
 }
 
-syscall_sring_t* sys_init_arsc(struct proc *p)
+static void arsc_ring_release(struct kref *kref)
+{
+	struct arsc_ring *ring = container_of(kref, struct arsc_ring, kref);
+
+	page_decref(kva2page(ring->back.sring));
+	proc_decref(ring->proc);
+	kfree(ring);
+}
+
+/* Called by the ksched for each core it gives us.  The poller starts out
+ * asleep, and the first ring will wake it. */
+void arsc_add_poller(uint32_t pcoreid)
+{
+	struct arsc_poller *poller;
+
+	spin_lock(&arsc_lock);
+	assert(nr_arsc_pollers < ARRAY_SIZE(arsc_pollers));
+	poller = &arsc_pollers[nr_arsc_pollers++];
+	poller->pcoreid = pcoreid;
+	poller->cursor = 0;
+	poller->asleep = TRUE;
+	spin_unlock(&arsc_lock);
+}
+
+syscall_sring_t* sys_init_arsc(struct proc *p, struct event_queue *ev_q)
 {
-	kref_get(&p->p_kref, 1);		/* we're storing an external ref here */
-	syscall_sring_t* sring;
-	void * va;
-	// TODO: need to pin this page in the future when swapping happens
-	va = do_mmap(p,MMAP_LOWEST_VA, SYSCALLRINGSIZE, PROT_READ | PROT_WRITE,
-	             MAP_ANONYMOUS | MAP_POPULATE, NULL, 0);
-	pte_t *pte = pgdir_walk(p->env_pgdir, (void*)va, 0);
+	struct arsc_ring *ring;
+	syscall_sring_t *sring;
+	void *va;
+	pte_t *pte;
+	unsigned int nr_mine = 0;
+	uint32_t wake_pcs[CONFIG_ARSC_POLLERS];
+	unsigned int nr_wake = 0;
+
+	if (!nr_arsc_pollers) {
+		set_errno(ENOSYS);
+		return 0;
+	}
+	ring = kzmalloc(sizeof(struct arsc_ring), 0);
+	if (!ring) {
+		set_errno(ENOMEM);
+		return 0;
+	}
+	va = do_mmap(p, MMAP_LOWEST_VA, SYSCALLRINGSIZE, PROT_READ | PROT_WRITE,
+	             MAP_ANONYMOUS | MAP_POPULATE | MAP_LOCKED, NULL, 0);
+	if (va == MAP_FAILED) {
+		kfree(ring);
+		return 0;
+	}
+	pte = pgdir_walk(p->env_pgdir, va, 0);
 	assert(pte);
-	sring = (syscall_sring_t*) (ppn2kva(PTE2PPN(*pte)));
-	/*make sure we are able to allocate the shared ring */
-	assert(sring != NULL);
- 	p->procdata->syscallring = sring;
-	/* Initialize the generic syscall ring buffer */
+	sring = (syscall_sring_t*)ppn2kva(PTE2PPN(*pte));
+	/* We use the page through the KVA, so hold a ref in case the user unmaps
+	 * it out from under us. */
+	page_incref(kva2page(sring));
 	SHARED_RING_INIT(sring);
+	BACK_RING_INIT(&ring->back, sring, SYSCALLRINGSIZE);
+	ring->proc = p;
+	proc_incref(p, 1);
+	ring->uva = va;
+	ring->ev_q = ev_q;
+	spinlock_init(&ring->lock);
+	kref_init(&ring->kref, arsc_ring_release, 1);
 
-	BACK_RING_INIT(&p->syscallbackring,
-	               sring,
-	               SYSCALLRINGSIZE);
-
-	spin_lock_irqsave(&arsc_proc_lock);
-	TAILQ_INSERT_TAIL(&arsc_proc_list, p, proc_arsc_link);
-	spin_unlock_irqsave(&arsc_proc_lock);
+	spin_lock(&arsc_lock);
+	for (int i = 0; i < nr_arsc_rings; i++)
+		if (arsc_rings[i]->proc == p)
+			nr_mine++;
+	/* Checking DYING under the lock syncs with arsc_proc_destroy() */
+	if ((p->state == PROC_DYING) || (nr_mine >= ARSC_MAX_RINGS_PER_PROC) ||
+	    (nr_arsc_rings >= ARSC_MAX_RINGS)) {
+		spin_unlock(&arsc_lock);
+		kref_put(&ring->kref);
+		munmap(p, (uintptr_t)va, SYSCALLRINGSIZE);
+		set_errno(EBUSY);
+		return 0;
+	}
+	arsc_rings[nr_arsc_rings++] = ring;
+	for (int i = 0; i < nr_arsc_pollers; i++) {
+		if (arsc_pollers[i].asleep) {
+			arsc_pollers[i].asleep = FALSE;
+			wake_pcs[nr_wake++] = i;
+		}
+	}
+	spin_unlock(&arsc_lock);
+	for (int i = 0; i < nr_wake; i++)
+		send_kernel_message(arsc_pollers[wake_pcs[i]].pcoreid, __arsc_poll,
+		                    wake_pcs[i], 0, 0, KMSG_ROUTINE);
+	/* The first ring is the one procdata advertises */
+	if (!p->procdata->syscallring)
+		p->procdata->syscallring = va;
 	return (syscall_sring_t*)va;
 }
 
-void arsc_server(uint32_t srcid, long a0, long a1, long a2)
+/* Takes all of p's rings out of the table.  Pollers that are working on one
+ * have their own refs, and won't pick up any new requests from it. */
+void arsc_proc_destroy(struct proc *p)
 {
-	struct proc *p = NULL;
-	TAILQ_INIT(&arsc_proc_list);
-	while (1) {
-		while (TAILQ_EMPTY(&arsc_proc_list))
-			cpu_relax();
-		
-		TAILQ_FOREACH(p, &arsc_proc_list, proc_arsc_link) {
-			/* Probably want to try to process a dying process's syscalls.  If
-			 * not, just move it to an else case */
-			process_generic_syscalls (p, MAX_ASRC_BATCH); 
-			if (p->state == PROC_DYING) {
-				TAILQ_REMOVE(&arsc_proc_list, p, proc_arsc_link);
-				proc_decref(p);
-				/* Need to break out, so the TAILQ_FOREACH doesn't flip out.
-				 * It's not fair, but we're not dealing with that yet anyway */
-				break;
-			}
+	struct arsc_ring *dead[ARSC_MAX_RINGS_PER_PROC];
+	unsigned int nr_dead = 0;
+
+	spin_lock(&arsc_lock);
+	for (int i = 0; i < nr_arsc_rings; ) {
+		if (arsc_rings[i]->proc != p) {
+			i++;
+			continue;
 		}
+		arsc_rings[i]->dying = TRUE;
+		dead[nr_dead++] = arsc_rings[i];
+		arsc_rings[i] = arsc_rings[--nr_arsc_rings];
 	}
+	spin_unlock(&arsc_lock);
+	for (int i = 0; i < nr_dead; i++)
+		kref_put(&dead[i]->kref);
 }
 
-static intreg_t process_generic_syscalls(struct proc *p, size_t max)
+/* Pollers don't own a proc.  They keep a counted ref on whichever proc's
+ * address space they loaded last, like a kthread would, and only switch when
+ * they need a different one. */
+static void arsc_load_proc(struct proc *p)
 {
-	size_t count = 0;
-	syscall_back_ring_t* sysbr = &p->syscallbackring;
-	struct per_cpu_info* pcpui = &per_cpu_info[core_id()];
-	struct proc *old_proc;
-	// looking at a process not initialized to perform arsc. 
-	if (sysbr == NULL) 
-		return count;
-	/* Bail out if there is nothing to do */
-	if (!RING_HAS_UNCONSUMED_REQUESTS(sysbr))
-		return 0;
-	/* Switch to the address space of the process, so we can handle their
-	 * pointers, etc. */
-	old_proc = switch_to(p);
-	// max is the most we'll process.  max = 0 means do as many as possible
-	// TODO: check for initialization of the ring. 
-	while (RING_HAS_UNCONSUMED_REQUESTS(sysbr) && ((!max)||(count < max)) ) {
-		// ASSUME: one queue per process
-		count++;
-		//printk("DEBUG PRE: sring->req_prod: %d, sring->rsp_prod: %d\n",
-		//	   sysbr->sring->req_prod, sysbr->sring->rsp_prod);
-		// might want to think about 0-ing this out, if we aren't
-		// going to explicitly fill in all fields
-		syscall_rsp_t rsp;
-		// this assumes we get our answer immediately for the syscall.
-		syscall_req_t* req = RING_GET_REQUEST(sysbr, ++sysbr->req_cons);
-		
-		pcpui->cur_kthread->sysc = req->sc;
-		run_local_syscall(req->sc); // TODO: blocking call will block arcs as well.
-		
-		// need to keep the slot in the ring buffer if it is blocked
-		(sysbr->rsp_prod_pvt)++;
-		req->status = RES_ready;
-		RING_PUSH_RESPONSES(sysbr);
-
-		//printk("DEBUG POST: sring->req_prod: %d, sring->rsp_prod: %d\n",
-		//	   sysbr->sring->req_prod, sysbr->sring->rsp_prod);
+	struct per_cpu_info *pcpui = &per_cpu_info[core_id()];
+	struct proc *old_proc = pcpui->cur_proc;
+
+	if (old_proc == p)
+		return;
+	proc_incref(p, 1);
+	pcpui->cur_proc = p;
+	proc_load_cr3(old_proc, p);
+	if (old_proc)
+		proc_decref(old_proc);
+}
+
+static void arsc_unload_proc(void)
+{
+	struct per_cpu_info *pcpui = &per_cpu_info[core_id()];
+
+	if (pcpui->cur_proc)
+		__abandon_core();
+}
+
+/* Round-robins over the rings, starting after the last one poller took work
+ * from.  Returns a ref'd ring with requests, or 0.  Hold arsc_lock. */
+static struct arsc_ring *__arsc_pick_ring(struct arsc_poller *poller)
+{
+	struct arsc_ring *ring;
+	unsigned int idx;
+
+	for (int i = 0; i < nr_arsc_rings; i++) {
+		idx = (poller->cursor + i) % nr_arsc_rings;
+		ring = arsc_rings[idx];
+		/* Racy peek; we'll check again when we claim a request */
+		if (!RING_HAS_UNCONSUMED_REQUESTS(&ring->back))
+			continue;
+		poller->cursor = idx + 1;
+		kref_get(&ring->kref, 1);
+		return ring;
+	}
+	return 0;
+}
+
+/* Consumes the next request from ring, returning its syscall or 0. */
+static struct syscall *arsc_claim_sysc(struct arsc_ring *ring)
+{
+	struct syscall *sysc = 0;
+	syscall_req_t *req;
+
+	spin_lock(&ring->lock);
+	if (!ring->dying && RING_HAS_UNCONSUMED_REQUESTS(&ring->back)) {
+		req = RING_GET_REQUEST(&ring->back, ++ring->back.req_cons);
+		/* The slot is the user's again once the syscall is done, so don't
+		 * touch it after this. */
+		sysc = ACCESS_ONCE(req->sc);
 	}
-	/* switch back to whatever context we were in before */
-	switch_back(p, old_proc);
-	return (intreg_t)count;
+	spin_unlock(&ring->lock);
+	return sysc;
+}
+
+/* Reports nr_done more finished syscalls on ring. */
+static void arsc_complete(struct arsc_ring *ring, unsigned int nr_done)
+{
+	struct event_msg msg = {0};
+
+	spin_lock(&ring->lock);
+	ring->back.rsp_prod_pvt += nr_done;
+	RING_PUSH_RESPONSES(&ring->back);
+	spin_unlock(&ring->lock);
+	if (!ring->ev_q)
+		return;
+	msg.ev_type = EV_ARSC;
+	msg.ev_arg2 = nr_done;
+	msg.ev_arg3 = ring->uva;
+	send_event(ring->proc, ring->ev_q, &msg, 0);
 }
 
+/* One pass of a poller, a0 is the poller's index. */
+void __arsc_poll(uint32_t srcid, long a0, long a1, long a2)
+{
+	struct arsc_poller *poller = &arsc_pollers[a0];
+	struct per_cpu_info *pcpui = &per_cpu_info[core_id()];
+	struct arsc_ring *ring;
+	struct syscall *sysc;
+	unsigned int nr_done = 0;
+
+	spin_lock(&arsc_lock);
+	if (!nr_arsc_rings) {
+		poller->asleep = TRUE;
+		spin_unlock(&arsc_lock);
+		arsc_unload_proc();
+		return;
+	}
+	ring = __arsc_pick_ring(poller);
+	spin_unlock(&arsc_lock);
+	/* PRKM runs us with IRQs off, but syscalls need them on, and since we
+	 * resend ourselves forever, this is also the only window this core has
+	 * for immediate kmsgs, shootdowns, and alarms.  PRKM turns them back off
+	 * when we return. */
+	enable_irq();
+	/* Queue our next pass before doing any work.  If a syscall blocks, the
+	 * core will run that pass while the syscall waits. */
+	send_kernel_message(core_id(), __arsc_poll, a0, 0, 0, KMSG_ROUTINE);
+	if (!ring) {
+		if (pcpui->cur_proc && (pcpui->cur_proc->state == PROC_DYING))
+			arsc_unload_proc();
+		cpu_relax();
+		return;
+	}
+	/* Blocking syscalls need their kthread to keep a ref on the proc, so we
+	 * aren't a ktask.  PRKM resets this for the next kmsg. */
+	pcpui->cur_kthread->is_ktask = FALSE;
+	while ((nr_done < MAX_ASRC_BATCH) && (sysc = arsc_claim_sysc(ring))) {
+		arsc_load_proc(ring->proc);
+		run_local_syscall(sysc);
+		pcpui = &per_cpu_info[core_id()];
+		if (!in_early_rkmsg_ctx(pcpui)) {
+			/* We blocked, and were restarted in default context, maybe on
+			 * another core.  Our poller already moved on, so just finish this
+			 * one syscall.  PRKM will idle once we return. */
+			arsc_complete(ring, nr_done + 1);
+			kref_put(&ring->kref);
+			return;
+		}
+		nr_done++;
+	}
+	if (nr_done)
+		arsc_complete(ring, nr_done);
+	kref_put(&ring->kref);
+}
@@ -10,7 +10,7 @@
 #include <error.h>
 #include <string.h>
 #include <assert.h>
-#include <hashtable.h>
+#include <chash.h>
 #include <smp.h>
 #include <kmalloc.h>
 #include <kdebug.h>
@@ -145,7 +145,7 @@ void hashlock_init_irqsave(struct hashlock *hl, unsigned int nr_entries)
 /* Helper, gets the specific spinlock for a hl/key combo. */
 static spinlock_t *get_spinlock(struct hashlock *hl, long key)
 {
-	/* using the hashtable's generic hash function */
+	/* using the chash's generic hash function */
 	return &hl->locks[__generic_hash((void*)key) % hl->nr_entries];
 }
 
@@ -0,0 +1,520 @@
+/* Copyright (c) 2014 The Regents of the University of California
+ * See LICENSE for details.
+ *
+ * Concurrent, incrementally growing hash table.  See chash.h for the rules.
+ *
+ * Entries never change once they are in the table, so readers can check a
+ * slot's hash, grab the entry pointer, and then check the entry itself, without
+ * caring whether a writer is changing the slot under them.  Emptied slots get
+ * reused right away: the old entry is still good for anyone who already had it,
+ * until the remover syncs with the readers and frees it.
+ *
+ * Growing: when the table gets too full, we install a table twice the size as
+ * h->tbl and the old one as h->old_tbl.  Each insert then moves the next few
+ * old buckets over, under the old bucket's lock.  The new table gets pointers
+ * to the same entries, and the old bucket's slots stay as they are, so lockless
+ * readers on it still see everything.  A moved bucket is marked, and everyone
+ * uses the new table for it.  Once every bucket is moved, we drop the old
+ * table, wait on the readers, and free its buckets (but not the entries, which
+ * the new table has).
+ *
+ * Writers find their bucket within a read section too, so the tables they
+ * point to can't be freed out from under them. */
+
+#include <chash.h>
+#include <slab.h>
+#include <kmalloc.h>
+#include <smp.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#define CHASH_MAX_LOAD			2		/* avg items per bucket before growing */
+#define CHASH_MIGRATE_BATCH		8		/* nr buckets moved per insert */
+
+struct kmem_cache *chash_entry_cache;
+struct kmem_cache *chash_bucket_cache;
+static struct chash_reader chash_readers[MAX_NUM_CPUS];
+
+void chash_init(void)
+{
+	chash_entry_cache = kmem_cache_create("chash_entry",
+	                                      sizeof(struct chash_entry),
+	                                      __alignof__(struct chash_entry), 0, 0,
+	                                      0);
+	chash_bucket_cache = kmem_cache_create("chash_bucket",
+	                                       sizeof(struct chash_bucket),
+	                                       __alignof__(struct chash_bucket), 0,
+	                                       0, 0);
+}
+
+size_t __generic_hash(void *k)
+{
+	/* 0x9e370001UL used by Linux (32 bit)
+	 * (prime approx to the golden ratio to the max integer, IAW Knuth)
+	 */
+	return (size_t)k * 0x9e370001UL;
+}
+
+ssize_t __generic_eq(void *k1, void *k2)
+{
+	return k1 == k2;
+}
+
+/* Lockless readers announce themselves in their core's chash_reader.  They can
+ * take spinlocks, but can't block or wait on other readers. */
+struct chash_reader *chash_read_lock(void)
+{
+	struct chash_reader *rd = &chash_readers[core_id()];
+
+	if (rd->nesting++)
+		return rd;
+	rd->rd_seq++;
+	mb();	/* announce ourselves before looking at anything */
+	return rd;
+}
+
+void chash_read_unlock(struct chash_reader *rd)
+{
+	if (--rd->nesting)
+		return;
+	mb();	/* finish our reads before announcing we're done */
+	rd->rd_seq++;
+}
+
+/* Waits until every reader that could have seen something we unhooked before
+ * calling this is done. */
+void chash_sync_readers(void)
+{
+	seq_ctr_t seq;
+
+	/* We'd wait on ourselves */
+	assert(!chash_readers[core_id()].nesting);
+	mb();	/* the unhooking happens before we peek at the readers */
+	for (int i = 0; i < num_cpus; i++) {
+		seq = ACCESS_ONCE(chash_readers[i].rd_seq);
+		if (!seq_is_locked(seq))
+			continue;
+		while (ACCESS_ONCE(chash_readers[i].rd_seq) == seq)
+			cpu_relax();
+	}
+}
+
+static struct chash_table *chash_alloc_table(unsigned int sz)
+{
+	struct chash_table *tbl;
+
+	tbl = kmalloc(sizeof(struct chash_table), 0);
+	if (!tbl)
+		return 0;
+	tbl->buckets = kzmalloc_align(sz * sizeof(struct chash_bucket), 0,
+	                              __alignof__(struct chash_bucket));
+	if (!tbl->buckets) {
+		kfree(tbl);
+		return 0;
+	}
+	tbl->sz = sz;
+	for (int i = 0; i < sz; i++)
+		spinlock_init(&tbl->buckets[i].lock);
+	return tbl;
+}
+
+/* Frees the table's buckets.  The entries are someone else's problem: they're
+ * either gone or in another table. */
+static void chash_free_table(struct chash_table *tbl)
+{
+	struct chash_bucket *b, *next;
+
+	for (int i = 0; i < tbl->sz; i++) {
+		for (b = tbl->buckets[i].more; b; b = next) {
+			next = b->more;
+			kmem_cache_free(chash_bucket_cache, b);
+		}
+	}
+	kfree(tbl->buckets);
+	kfree(tbl);
+}
+
+struct chash *chash_create(unsigned int min_sz, size_t (*hashfn)(void *k),
+                           ssize_t (*eqfn)(void *k1, void *k2))
+{
+	struct chash *h = kmalloc(sizeof(struct chash), 0);
+	unsigned int sz = 16;
+
+	if (!h)
+		return 0;
+	/* min_sz is in items, and we fill buckets up to CHASH_MAX_LOAD */
+	while (sz * CHASH_MAX_LOAD < min_sz)
+		sz <<= 1;
+	h->tbl = chash_alloc_table(sz);
+	if (!h->tbl) {
+		kfree(h);
+		return 0;
+	}
+	h->old_tbl = 0;
+	atomic_init(&h->nr_items, 0);
+	spinlock_init(&h->resize_lock);
+	h->migrate_idx = 0;
+	h->hashfn = hashfn;
+	h->eqfn = eqfn;
+	return h;
+}
+
+/* The chash must be empty and unused */
+void chash_destroy(struct chash *h)
+{
+	assert(!chash_count(h));
+	if (h->old_tbl)
+		chash_free_table(h->old_tbl);
+	chash_free_table(h->tbl);
+	kfree(h);
+}
+
+size_t chash_count(struct chash *h)
+{
+	return atomic_read(&h->nr_items);
+}
+
+/* Returns the bucket readers should look in for hash.  Call within a read
+ * section.  The bucket could be a moved one, if a grow started after we read
+ * h->tbl, but its slots are still intact and have everything from before the
+ * grow. */
+static struct chash_bucket *chash_read_bucket(struct chash *h, size_t hash)
+{
+	struct chash_table *tbl, *old;
+	struct chash_bucket *b;
+
+	tbl = ACCESS_ONCE(h->tbl);
+	rmb();	/* growers set old_tbl before tbl */
+	old = ACCESS_ONCE(h->old_tbl);
+	if (old) {
+		b = &old->buckets[hash & (old->sz - 1)];
+		if (!ACCESS_ONCE(b->moved))
+			return b;
+		rmb();	/* the new table had b's entries before b was marked */
+	}
+	return &tbl->buckets[hash & (tbl->sz - 1)];
+}
+
+/* Locks and returns the bucket that currently holds hash.  Call within a read
+ * section. */
+static struct chash_bucket *chash_lock_bucket(struct chash *h, size_t hash)
+{
+	struct chash_bucket *b;
+
+	while (1) {
+		b = chash_read_bucket(h, hash);
+		spin_lock(&b->lock);
+		/* If it moved while we locked, the new table has it */
+		if (!b->moved)
+			return b;
+		spin_unlock(&b->lock);
+	}
+}
+
+/* Returns the next entry in *b's chain, starting at slot *idx, whose hash is
+ * hash, or 0 if there are no more.  Advances *b and *idx past it. */
+static struct chash_entry *chash_next_match(struct chash_bucket **b, int *idx,
+                                            size_t hash)
+{
+	struct chash_entry *e;
+
+	while (*b) {
+		for (; *idx < CHASH_SLOTS; (*idx)++) {
+			if (ACCESS_ONCE((*b)->hashes[*idx]) != (uint32_t)hash)
+				continue;
+			e = ACCESS_ONCE((*b)->slots[*idx]);
+			if (e && (e->hash == hash)) {
+				(*idx)++;
+				return e;
+			}
+		}
+		*b = ACCESS_ONCE((*b)->more);
+		*idx = 0;
+	}
+	return 0;
+}
+
+void *chash_lookup_fn(struct chash *h, size_t hash, void *query,
+                      bool (*match)(void *query, void *k))
+{
+	struct chash_bucket *b = chash_read_bucket(h, hash);
+	struct chash_entry *e;
+	int idx = 0;
+
+	while ((e = chash_next_match(&b, &idx, hash))) {
+		if (match(query, e->k))
+			return e->v;
+	}
+	return 0;
+}
+
+void *chash_lookup(struct chash *h, void *k)
+{
+	size_t hash = h->hashfn(k);
+	struct chash_bucket *b = chash_read_bucket(h, hash);
+	struct chash_entry *e;
+	int idx = 0;
+
+	while ((e = chash_next_match(&b, &idx, hash))) {
+		if (h->eqfn(k, e->k))
+			return e->v;
+	}
+	return 0;
+}
+
+/* Puts e in the first free slot of locked bucket b's chain, adding more slots
+ * if we need to.  Returns FALSE if we're out of memory. */
+static bool chash_bucket_add(struct chash_bucket *b, struct chash_entry *e)
+{
+	struct chash_bucket *more;
+
+	while (1) {
+		for (int i = 0; i < CHASH_SLOTS; i++) {
+			if (b->slots[i])
+				continue;
+			b->hashes[i] = (uint32_t)e->hash;
+			wmb();	/* lockless readers can see e as soon as it's in a slot */
+			b->slots[i] = e;
+			return TRUE;
+		}
+		if (!b->more)
+			break;
+		b = b->more;
+	}
+	more = kmem_cache_alloc(chash_bucket_cache, 0);
+	if (!more)
+		return FALSE;
+	memset(more, 0, sizeof(struct chash_bucket));
+	more->hashes[0] = (uint32_t)e->hash;
+	more->slots[0] = e;
+	wmb();	/* as above */
+	b->more = more;
+	return TRUE;
+}
+
+/* Empties whichever slot of locked bucket b's chain has e. */
+static void chash_bucket_del(struct chash_bucket *b, struct chash_entry *e)
+{
+	for (; b; b = b->more) {
+		for (int i = 0; i < CHASH_SLOTS; i++) {
+			if (b->slots[i] == e) {
+				b->slots[i] = 0;
+				return;
+			}
+		}
+	}
+}
+
+/* Puts pointers to old bucket idx's entries in the new table, and marks it
+ * moved.  Returns FALSE if we ran out of memory.  Caller holds the
+ * resize_lock. */
+static bool chash_migrate_bucket(struct chash_table *old,
+                                 struct chash_table *new, unsigned int idx)
+{
+	struct chash_bucket *ob = &old->buckets[idx], *b_i, *nb;
+	struct chash_entry *e;
+	bool ok = TRUE;
+
+	spin_lock(&ob->lock);
+	for (b_i = ob; b_i && ok; b_i = b_i->more) {
+		for (int i = 0; (i < CHASH_SLOTS) && ok; i++) {
+			if (!(e = b_i->slots[i]))
+				continue;
+			nb = &new->buckets[e->hash & (new->sz - 1)];
+			spin_lock(&nb->lock);
+			ok = chash_bucket_add(nb, e);
+			spin_unlock(&nb->lock);
+		}
+	}
+	if (!ok) {
+		/* Take back the ones we put in (deleting the others is a no-op), so we
+		 * don't move them twice.  Readers only get to those new buckets for
+		 * other old buckets' hashes, so they won't miss them. */
+		for (b_i = ob; b_i; b_i = b_i->more) {
+			for (int i = 0; i < CHASH_SLOTS; i++) {
+				if (!(e = b_i->slots[i]))
+					continue;
+				nb = &new->buckets[e->hash & (new->sz - 1)];
+				spin_lock(&nb->lock);
+				chash_bucket_del(nb, e);
+				spin_unlock(&nb->lock);
+			}
+		}
+		spin_unlock(&ob->lock);
+		return FALSE;
+	}
+	wmb();	/* the entries are in the new table before anyone is sent there */
+	ob->moved = TRUE;
+	spin_unlock(&ob->lock);
+	return TRUE;
+}
+
+/* Moves a few more buckets if we're growing, or starts growing if we're too
+ * full.  Returns the old table if we finished moving it, which the caller frees
+ * after leaving its read section and syncing with the readers.  We don't wait
+ * on the resize_lock: whoever has it is making progress. */
+static struct chash_table *chash_grow_some(struct chash *h)
+{
+	struct chash_table *old, *new;
+
+	if (!h->old_tbl &&
+	    (atomic_read(&h->nr_items) <= h->tbl->sz * CHASH_MAX_LOAD))
+		return 0;
+	if (!spin_trylock(&h->resize_lock))
+		return 0;
+	if (!h->old_tbl) {
+		if (atomic_read(&h->nr_items) <= h->tbl->sz * CHASH_MAX_LOAD) {
+			spin_unlock(&h->resize_lock);
+			return 0;
+		}
+		/* Not a big deal if this fails, the chains are just longer */
+		new = chash_alloc_table(h->tbl->sz * 2);
+		if (!new) {
+			spin_unlock(&h->resize_lock);
+			return 0;
+		}
+		h->migrate_idx = 0;
+		h->old_tbl = h->tbl;
+		wmb();	/* readers look at tbl first, so old_tbl must be set */
+		h->tbl = new;
+		spin_unlock(&h->resize_lock);
+		return 0;
+	}
+	old = h->old_tbl;
+	for (int i = 0; i < CHASH_MIGRATE_BATCH; i++) {
+		if (h->migrate_idx == old->sz)
+			break;
+		if (!chash_migrate_bucket(old, h->tbl, h->migrate_idx))
+			break;
+		h->migrate_idx++;
+	}
+	if (h->migrate_idx != old->sz) {
+		spin_unlock(&h->resize_lock);
+		return 0;
+	}
+	h->old_tbl = 0;
+	spin_unlock(&h->resize_lock);
+	return old;
+}
+
+bool chash_insert(struct chash *h, void *k, void *v)
+{
+	struct chash_reader *rd;
+	struct chash_bucket *b;
+	struct chash_entry *e;
+	struct chash_table *done_tbl;
+	bool ok;
+
+	e = kmem_cache_alloc(chash_entry_cache, 0);
+	if (!e)
+		return FALSE;
+	e->hash = h->hashfn(k);
+	e->k = k;
+	e->v = v;
+	rd = chash_read_lock();
+	b = chash_lock_bucket(h, e->hash);
+	ok = chash_bucket_add(b, e);
+	spin_unlock(&b->lock);
+	if (!ok) {
+		chash_read_unlock(rd);
+		kmem_cache_free(chash_entry_cache, e);
+		return FALSE;
+	}
+	atomic_inc(&h->nr_items);
+	done_tbl = chash_grow_some(h);
+	chash_read_unlock(rd);
+	if (done_tbl) {
+		chash_sync_readers();
+		chash_free_table(done_tbl);
+	}
+	return TRUE;
+}
+
+void *chash_remove_deferred(struct chash *h, void *k,
+                            struct chash_entry **dead)
+{
+	struct chash_reader *rd;
+	struct chash_bucket *b, *b_i;
+	struct chash_entry *e;
+	size_t hash = h->hashfn(k);
+	int idx = 0;
+
+	rd = chash_read_lock();
+	b = chash_lock_bucket(h, hash);
+	/* We hold the lock, but matching is the same as for the readers */
+	b_i = b;
+	while ((e = chash_next_match(&b_i, &idx, hash))) {
+		if (h->eqfn(k, e->k))
+			break;
+	}
+	if (e)
+		chash_bucket_del(b, e);
+	spin_unlock(&b->lock);
+	chash_read_unlock(rd);
+	if (!e)
+		return 0;
+	atomic_dec(&h->nr_items);
+	e->next = *dead;
+	*dead = e;
+	return e->v;
+}
+
+void chash_free_dead(struct chash_entry *dead)
+{
+	struct chash_entry *next;
+
+	if (!dead)
+		return;
+	chash_sync_readers();
+	for (; dead; dead = next) {
+		next = dead->next;
+		kmem_cache_free(chash_entry_cache, dead);
+	}
+}
+
+void *chash_remove(struct chash *h, void *k)
+{
+	struct chash_entry *dead = 0;
+	void *v;
+
+	v = chash_remove_deferred(h, k, &dead);
+	chash_free_dead(dead);
+	return v;
+}
+
+/* Runs func on each entry in b's chain */
+static void chash_bucket_for_each(struct chash_bucket *b, void (*func)(void *v))
+{
+	struct chash_entry *e;
+
+	for (; b; b = ACCESS_ONCE(b->more)) {
+		for (int i = 0; i < CHASH_SLOTS; i++) {
+			e = ACCESS_ONCE(b->slots[i]);
+			if (e)
+				func(e->v);
+		}
+	}
+}
+
+void chash_for_each(struct chash *h, void (*func)(void *v))
+{
+	struct chash_reader *rd;
+	struct chash_table *old;
+
+	rd = chash_read_lock();
+	/* Holding the resize lock keeps buckets from moving, so we don't see any
+	 * item twice. */
+	spin_lock(&h->resize_lock);
+	old = h->old_tbl;
+	if (old) {
+		for (int i = 0; i < old->sz; i++) {
+			if (!old->buckets[i].moved)
+				chash_bucket_for_each(&old->buckets[i], func);
+		}
+	}
+	for (int i = 0; i < h->tbl->sz; i++)
+		chash_bucket_for_each(&h->tbl->buckets[i], func);
+	spin_unlock(&h->resize_lock);
+	chash_read_unlock(rd);
+}
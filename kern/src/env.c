@@ -149,6 +149,8 @@ void env_user_mem_free(env_t* e, void* start, size_t len)
 	}
 
 	env_user_mem_walk(e,start,len,&user_page_free,NULL);
-	tlbflush();
+	/* Not just our TLB: other cores could have old entries for e (tagged ones,
+	 * even if they aren't running e right now). */
+	proc_tlbshootdown(e, (uintptr_t)start, (uintptr_t)start + len);
 }
 
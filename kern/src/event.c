@@ -67,21 +67,30 @@ static void set_vcore_msgable(uint32_t vcoreid)
  * flags if you don't want to give them the option of EVENT_NOMSG (which is what
  * we do when sending an indirection event).  Make sure that if mbox is a user
  * pointer, that you've checked it *and* have that processes address space
- * loaded.  This can get called with a KVA for mbox. */
-static void post_ev_msg(struct proc *p, struct event_mbox *mbox,
+ * loaded.  This can get called with a KVA for mbox.
+ *
+ * Returns FALSE if the event was coalesced with earlier ones that the receiver
+ * hasn't drained yet, meaning it has already been (or is being) alerted. */
+static bool post_ev_msg(struct proc *p, struct event_mbox *mbox,
                         struct event_msg *msg, int ev_flags)
 {
 	printd("[kernel] Sending event type %d to mbox %p\n", msg->ev_type, mbox);
 	/* Sanity check */
 	assert(p);
 	/* If they just want a bit (NOMSG), just set the bit */
-	if (ev_flags & EVENT_NOMSG) {
+	if (ev_flags & (EVENT_NOMSG | EVENT_COALESCE)) {
 		SET_BITMASK_BIT_ATOMIC(mbox->ev_bitmap, msg->ev_type);
 		wmb();
 		mbox->ev_check_bits = TRUE;
+		/* The bit must be out before we count ourselves.  The receiver clears
+		 * the count before scanning the bits, so either it sees our bit, or we
+		 * see the cleared count and alert it again. */
+		if (ev_flags & EVENT_COALESCE)
+			return atomic_fetch_and_add(&mbox->ev_nr_coalesced, 1) == 0;
 	} else {
 		send_ucq_msg(&mbox->ev_msgs, p, msg);
 	}
+	return TRUE;
 }
 
 /* Helper: use this when sending a message to a VCPD mbox.  It just posts to the
@@ -428,7 +437,10 @@ void send_event(struct proc *p, struct event_queue *ev_q, struct event_msg *msg,
 	 * ev_q is a NOMSG, we won't actually memcpy or anything, it'll just be a
 	 * vehicle for sending the ev_type. */
 	assert(msg);
-	post_ev_msg(p, ev_mbox, msg, ev_q->ev_flags);
+	/* If we coalesced with an undrained event, the receiver was already
+	 * alerted, so we skip the INDIR and the IPI. */
+	if (!post_ev_msg(p, ev_mbox, msg, ev_q->ev_flags))
+		goto out;
 	wmb();	/* ensure ev_msg write is before alerting the vcore */
 	/* Prod/alert a vcore with an IPI or INDIR, if desired.  INDIR will also
 	 * call try_notify (IPI) later */
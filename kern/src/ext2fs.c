@@ -157,45 +157,74 @@ void ext2_dirty_metablock(struct super_block *sb, void *buffer)
 		bdev_dirty_buffer(bh);
 }
 
-/* Helper for alloc_block.  It will try to alloc a block from the BG, starting
- * with blk_idx (relative number within the BG).   If successful, it will return
- * the FS block number via *block_num.  TODO: concurrency protection */
+/* Helper for alloc_blocks.  It will try to alloc up to *count contiguous blocks
+ * from the BG, starting with blk_idx (relative number within the BG).  If that
+ * block is taken, we look for the first run of *count free blocks, settling for
+ * the first free block if there is no such run.  Runs never wrap around the end
+ * of the BG.  If successful, it will return the first FS block number via
+ * *block_num and the length of the run in *count.  TODO: concurrency
+ * protection */
 static bool ext2_tryalloc(struct super_block *sb, struct ext2_block_group *bg,
-                          unsigned int blk_idx, uint32_t *block_num)
+                          unsigned int blk_idx, uint32_t *block_num,
+                          unsigned int *count)
 {
 	uint8_t *blk_bitmap;
 	struct ext2_sb_info *e2sbi = (struct ext2_sb_info*)sb->s_fs_info;
 	unsigned int blks_per_bg = le32_to_cpu(e2sbi->e2sb->s_blocks_per_group);
-	bool found = FALSE;
+	unsigned int idx, run_start = 0, run_len = 0, nr_got = 0;
+	int first_free = -1;
 
 	/* Check to see if there are any free blocks */
-	if (!le32_to_cpu(bg->bg_free_blocks_cnt))
+	if (!le16_to_cpu(bg->bg_free_blocks_cnt))
 		return FALSE;
-	/* Check the bitmap for your desired block.  We'll loop through the whole
-	 * BG, starting with the one we want first. */
 	blk_bitmap = ext2_get_metablock(sb, bg->bg_block_bitmap);
-	for (int i = 0; i < blks_per_bg; i++) {
-		if (!(GET_BITMASK_BIT(blk_bitmap, blk_idx))) {
-			SET_BITMASK_BIT(blk_bitmap, blk_idx);
-			bg->bg_free_blocks_cnt--;
-			ext2_dirty_metablock(sb, blk_bitmap);
-			found = TRUE;
-			break;
+	/* Check the bitmap for your desired block.  If it's taken, we'll loop
+	 * through the whole BG, starting with the one we want first. */
+	if (GET_BITMASK_BIT(blk_bitmap, blk_idx)) {
+		for (int i = 0; i < blks_per_bg; i++) {
+			idx = (blk_idx + i) % blks_per_bg;
+			/* a used block, or the wrap-around, ends the current run */
+			if (GET_BITMASK_BIT(blk_bitmap, idx) || !idx) {
+				run_len = 0;
+				if (GET_BITMASK_BIT(blk_bitmap, idx))
+					continue;
+			}
+			if (first_free < 0)
+				first_free = idx;
+			if (!run_len)
+				run_start = idx;
+			if (++run_len == *count)
+				break;
 		}
-		/* Note: the wrap-around hasn't been tested yet */
-		blk_idx = (blk_idx + 1) % blks_per_bg;
+		if (run_len == *count)
+			blk_idx = run_start;
+		else if (first_free >= 0)
+			blk_idx = first_free;
+		else
+			goto out;	/* the free count was wrong */
+	}
+	for (idx = blk_idx; nr_got < *count && idx < blks_per_bg; idx++, nr_got++) {
+		if (GET_BITMASK_BIT(blk_bitmap, idx))
+			break;
+		SET_BITMASK_BIT(blk_bitmap, idx);
 	}
+	bg->bg_free_blocks_cnt =
+	        cpu_to_le16(le16_to_cpu(bg->bg_free_blocks_cnt) - nr_got);
+	ext2_dirty_metablock(sb, blk_bitmap);
+	*block_num = ext2_bgidx2block(sb, bg, blk_idx);
+	*count = nr_got;
+out:
 	ext2_put_metablock(sb, blk_bitmap);
-	if (found)
-		*block_num = ext2_bgidx2block(sb, bg, blk_idx);
-	return found;
+	return nr_got != 0;
 }
 
-/* This allocates a fresh block for the inode, preferably 'fetish' (name
- * courtesy of L.F.), returning the FS block number that's been allocated.
- * Note, Linux does some block preallocation here.  Consider doing the same (off
- * the in-memory inode).  Note the lack of concurrency protections here. */
-uint32_t ext2_alloc_block(struct inode *inode, uint32_t fetish)
+/* Allocates a run of up to *count contiguous blocks, preferably starting at
+ * 'fetish' (name courtesy of L.F.).  Returns the first FS block number, and the
+ * length of the run in *count.  This only deals with the bitmaps; use
+ * ext2_alloc_blocks() for an inode's data.  Note the lack of concurrency
+ * protections here. */
+static uint32_t __ext2_alloc_blocks(struct inode *inode, uint32_t fetish,
+                                    unsigned int *count)
 {
 	struct ext2_sb_info *e2sbi = (struct ext2_sb_info*)inode->i_sb->s_fs_info;
 	struct ext2_block_group *fetish_bg, *bg_i = e2sbi->e2bg;
@@ -203,11 +232,15 @@ uint32_t ext2_alloc_block(struct inode *inode, uint32_t fetish)
 	bool found = FALSE;
 	uint32_t retval = 0;
 
+	/* Hints past the end of the FS (e.g. last block + 1) just use our BG */
+	if ((fetish < le32_to_cpu(e2sbi->e2sb->s_first_data_block)) ||
+	    (fetish >= le32_to_cpu(e2sbi->e2sb->s_blocks_cnt)))
+		fetish = ext2_bgidx2block(inode->i_sb, ext2_inode2bg(inode), 0);
 	/* Get our ideal starting point */
 	fetish_bg = ext2_block2bg(inode->i_sb, fetish);
 	blk_idx = ext2_block2bgidx(inode->i_sb, fetish);
-	/* Try to find a free block in the BG of the one we desire */
-	found = ext2_tryalloc(inode->i_sb, fetish_bg, blk_idx, &retval);
+	/* Try to find free blocks in the BG of the one we desire */
+	found = ext2_tryalloc(inode->i_sb, fetish_bg, blk_idx, &retval, count);
 	if (found)
 		return retval;
 
@@ -217,7 +250,7 @@ uint32_t ext2_alloc_block(struct inode *inode, uint32_t fetish)
 	for (int i = 0; i < e2sbi->nr_bgs; i++, bg_i++) {
 		if (bg_i == fetish_bg)
 			continue;
-		found = ext2_tryalloc(inode->i_sb, bg_i, 0, &retval);
+		found = ext2_tryalloc(inode->i_sb, bg_i, 0, &retval, count);
 		if (found)
 			break;
 	}
@@ -226,6 +259,150 @@ uint32_t ext2_alloc_block(struct inode *inode, uint32_t fetish)
 	return retval;
 }
 
+/* Marks count blocks, starting at block_num, as free.  The run must be within
+ * one BG (which is always true for runs from ext2_tryalloc()). */
+static void ext2_free_blocks(struct super_block *sb, uint32_t block_num,
+                             unsigned int count)
+{
+	struct ext2_block_group *bg = ext2_block2bg(sb, block_num);
+	unsigned int blk_idx = ext2_block2bgidx(sb, block_num);
+	uint8_t *blk_bitmap;
+
+	if (!count)
+		return;
+	blk_bitmap = ext2_get_metablock(sb, bg->bg_block_bitmap);
+	for (int i = 0; i < count; i++) {
+		assert(GET_BITMASK_BIT(blk_bitmap, blk_idx + i));
+		CLR_BITMASK_BIT(blk_bitmap, blk_idx + i);
+	}
+	bg->bg_free_blocks_cnt =
+	        cpu_to_le16(le16_to_cpu(bg->bg_free_blocks_cnt) + count);
+	ext2_dirty_metablock(sb, blk_bitmap);
+	ext2_put_metablock(sb, blk_bitmap);
+}
+
+/* Gives the inode's preallocated blocks back to the FS */
+static void ext2_discard_prealloc(struct inode *inode)
+{
+	struct ext2_i_info *e2ii = (struct ext2_i_info*)inode->i_fs_info;
+
+	ext2_free_blocks(inode->i_sb, e2ii->i_prealloc_block,
+	                 e2ii->i_prealloc_count);
+	e2ii->i_prealloc_count = 0;
+}
+
+/* Gives back the unused tail of a run from ext2_alloc_blocks().  If it is right
+ * in front of the prealloc window (or there is no window), it becomes part of
+ * the window, so the next allocation will get it. */
+static void ext2_return_blocks(struct inode *inode, uint32_t block_num,
+                               unsigned int count)
+{
+	struct ext2_i_info *e2ii = (struct ext2_i_info*)inode->i_fs_info;
+
+	if (!count)
+		return;
+	e2ii->i_last_block = block_num - 1;
+	if (!e2ii->i_prealloc_count) {
+		e2ii->i_prealloc_block = block_num;
+		e2ii->i_prealloc_count = count;
+	} else if (block_num + count == e2ii->i_prealloc_block) {
+		e2ii->i_prealloc_block = block_num;
+		e2ii->i_prealloc_count += count;
+	} else {
+		ext2_free_blocks(inode->i_sb, block_num, count);
+	}
+}
+
+/* Size of a fresh prealloc window, in blocks.  The SB can ask for a specific
+ * size, like in Linux. */
+static unsigned int ext2_prealloc_min(struct super_block *sb)
+{
+	struct ext2_sb *e2sb = ((struct ext2_sb_info*)sb->s_fs_info)->e2sb;
+
+	if ((le32_to_cpu(e2sb->s_feature_compat) &
+	     EXT2_FEATURE_COMPAT_DIR_PREALLOC) && e2sb->s_prealloc_blocks)
+		return e2sb->s_prealloc_blocks;
+	return EXT2_PREALLOC_MIN;
+}
+
+/* Sets up the allocation state of a freshly read or created inode's e2ii */
+static void ext2_init_prealloc(struct inode *inode)
+{
+	struct ext2_i_info *e2ii = (struct ext2_i_info*)inode->i_fs_info;
+
+	e2ii->i_prealloc_block = 0;
+	e2ii->i_prealloc_count = 0;
+	e2ii->i_prealloc_goal = ext2_prealloc_min(inode->i_sb);
+	e2ii->i_last_block = 0;
+}
+
+/* Returns the best place for the inode's next block: its prealloc window, then
+ * right after the last block we gave it, then anywhere in its BG. */
+static uint32_t ext2_alloc_goal(struct inode *inode)
+{
+	struct ext2_i_info *e2ii = (struct ext2_i_info*)inode->i_fs_info;
+
+	if (e2ii->i_prealloc_count)
+		return e2ii->i_prealloc_block;
+	if (e2ii->i_last_block)
+		return e2ii->i_last_block + 1;
+	return ext2_bgidx2block(inode->i_sb, ext2_inode2bg(inode), 0);
+}
+
+/* This allocates a run of up to *count contiguous fresh blocks for the inode,
+ * preferably starting at 'fetish', returning the first FS block number and the
+ * length of the run in *count (which is at least 1).
+ *
+ * Regular files get a window of blocks preallocated right after the run, which
+ * later calls will use if they want the next block.  That keeps sequentially
+ * written files contiguous, and saves a trip through the bitmap for most
+ * allocations.  The window grows while the file keeps using it.  Note the lack
+ * of concurrency protections here. */
+uint32_t ext2_alloc_blocks(struct inode *inode, uint32_t fetish,
+                           unsigned int *count)
+{
+	struct ext2_i_info *e2ii = (struct ext2_i_info*)inode->i_fs_info;
+	unsigned int want = *count, got;
+	uint32_t retval;
+
+	assert(want);
+	if (e2ii->i_prealloc_count && (fetish == e2ii->i_prealloc_block)) {
+		*count = MIN(want, e2ii->i_prealloc_count);
+		retval = e2ii->i_prealloc_block;
+		e2ii->i_prealloc_block += *count;
+		e2ii->i_prealloc_count -= *count;
+		/* Used the whole window, so try a bigger one next time */
+		if (!e2ii->i_prealloc_count)
+			e2ii->i_prealloc_goal = MIN(e2ii->i_prealloc_goal * 2,
+			                            EXT2_PREALLOC_MAX);
+		e2ii->i_last_block = retval + *count - 1;
+		return retval;
+	}
+	/* The window (if any) isn't where we want to be, so give it back */
+	if (e2ii->i_prealloc_count) {
+		ext2_discard_prealloc(inode);
+		e2ii->i_prealloc_goal = ext2_prealloc_min(inode->i_sb);
+	}
+	got = want;
+	if (S_ISREG(inode->i_mode))
+		got += e2ii->i_prealloc_goal;
+	retval = __ext2_alloc_blocks(inode, fetish, &got);
+	*count = MIN(want, got);
+	e2ii->i_last_block = retval + *count - 1;
+	if (got > *count) {
+		e2ii->i_prealloc_block = retval + *count;
+		e2ii->i_prealloc_count = got - *count;
+	}
+	return retval;
+}
+
+/* Allocates a single block for the inode, preferably 'fetish'. */
+uint32_t ext2_alloc_block(struct inode *inode, uint32_t fetish)
+{
+	unsigned int count = 1;
+	return ext2_alloc_blocks(inode, fetish, &count);
+}
+
 /* Inode Management */
 
 /* Helper for alloc_diskinode.  It will try to alloc a disk inode from the BG.
@@ -279,7 +456,8 @@ unsigned long ext2_alloc_diskinode(struct inode *inode,
 		/* TODO: intelligently pick a different bg to use than the current one.
 		 * Right now, we just jump to the next one, though you should do things
 		 * like take into account the ratio of directories to files. */
-		bg += 1;
+		if (bg + 1 < e2sbi->e2bg + e2sbi->nr_bgs)
+			bg += 1;
 	}
 	/* Try to find a free inode in the chosen BG */
 	found = ext2_tryalloc_diskinode(inode->i_sb, bg, &retval);
@@ -320,14 +498,13 @@ static uint32_t *ext2_find_inotable_slot(struct inode *inode, uint32_t blkid,
  * differently than for a file page/buffer). */
 static void ext2_fill_inotable_slot(struct inode *inode, uint32_t *blk_slot)
 {
-	uint32_t new_blkid, hint_blk;
+	uint32_t new_blkid;
 	void *new_blk;
 
 	if (le32_to_cpu(*blk_slot))
 		return;
-	/* Use any block in our inode's BG as a hint for the indirect block */
-	hint_blk = ext2_bgidx2block(inode->i_sb, ext2_inode2bg(inode), 0);
-	new_blkid = ext2_alloc_block(inode, hint_blk);
+	/* Put the indirect block in line with the inode's data */
+	new_blkid = ext2_alloc_block(inode, ext2_alloc_goal(inode));
 	/* Actually read in the block we alloc'd */
 	new_blk = ext2_get_metablock(inode->i_sb, new_blkid);
 	memset(new_blk, 0, inode->i_sb->s_blocksize);
@@ -444,9 +621,7 @@ void *ext2_get_ino_metablock(struct inode *inode, unsigned long ino_block)
 	}
 	/* If there isn't a block there, alloc and insert one.  This block will be
 	 * the next big chunk of "file" data for this inode. */
-	blkid = ext2_alloc_block(inode, ext2_bgidx2block(inode->i_sb,
-	                                                 ext2_inode2bg(inode),
-	                                                 0));
+	blkid = ext2_alloc_block(inode, ext2_alloc_goal(inode));
 	*blk_slot = cpu_to_le32(blkid);
 	ext2_dirty_metablock(inode->i_sb, blk_slot);
 	ext2_put_metablock(inode->i_sb, blk_slot);
@@ -468,6 +643,79 @@ void ext2_print_ino_blocks(struct inode *inode)
 		printk("# %03d, Block %03d\n", i, ext2_find_inoblock(inode, i));
 }
 
+/* Like ext2_find_inoblock(), but it won't alloc any tables.  Returns 0 for a
+ * hole. */
+static uint32_t ext2_peek_inoblock(struct inode *inode, uint32_t ino_block)
+{
+	struct ext2_i_info *e2ii = (struct ext2_i_info*)inode->i_fs_info;
+	unsigned int ptrs_per_blk = inode->i_sb->s_blocksize / sizeof(uint32_t);
+	unsigned int reach = ptrs_per_blk;
+	uint32_t blkid, *table;
+	int depth;
+
+	if (ino_block < 12)
+		return e2ii->i_block[ino_block];
+	ino_block -= 12;
+	/* Find the level of indirection, and how much its top table can index */
+	for (depth = 1; (ino_block >= reach) && (depth < 3); depth++) {
+		ino_block -= reach;
+		reach *= ptrs_per_blk;
+	}
+	blkid = e2ii->i_block[11 + depth];
+	while (blkid && depth--) {
+		reach /= ptrs_per_blk;
+		table = ext2_get_metablock(inode->i_sb, blkid);
+		blkid = le32_to_cpu(table[ino_block / reach]);
+		ino_block %= reach;
+		ext2_put_metablock(inode->i_sb, table);
+	}
+	return blkid;
+}
+
+/* Prints how fragmented the inode is: the contiguous runs (extents) of blocks
+ * it has on disk.  A file written sequentially should be one extent, other than
+ * the breaks for its indirect blocks. */
+void ext2_print_frag(struct inode *inode)
+{
+	unsigned int nr_blks = ROUNDUP(inode->i_size, inode->i_sb->s_blocksize) /
+	                       inode->i_sb->s_blocksize;
+	unsigned int nr_mapped = 0, nr_extents = 0, nr_holes = 0, longest = 0;
+	unsigned int ext_len = 0;
+	uint32_t blkid, ext_start = 0, prev = 0;
+
+	printk("Inode %d, Size: %d, FS blocks: %d\n", inode->i_ino, inode->i_size,
+	       nr_blks);
+	for (int i = 0; i <= nr_blks; i++) {
+		blkid = i < nr_blks ? ext2_peek_inoblock(inode, i) : 0;
+		if (blkid && ext_len && (blkid == prev + 1)) {
+			nr_mapped++;
+			ext_len++;
+			prev = blkid;
+			continue;
+		}
+		/* Either a hole or a new extent, so the old extent is done */
+		if (ext_len) {
+			printk("\tExtent: blocks %8d - %8d (%d)\n", ext_start,
+			       ext_start + ext_len - 1, ext_len);
+			longest = MAX(longest, ext_len);
+			ext_len = 0;
+		}
+		if (i == nr_blks)
+			break;
+		if (!blkid) {
+			nr_holes++;
+			continue;
+		}
+		nr_mapped++;
+		nr_extents++;
+		ext_start = prev = blkid;
+		ext_len = 1;
+	}
+	printk("%d blocks in %d extents, %d holes, longest extent %d, avg %d\n",
+	       nr_mapped, nr_extents, nr_holes, longest,
+	       nr_extents ? nr_mapped / nr_extents : 0);
+}
+
 /* Misc Functions */
 
 /* This checks an ext2 disc SB for consistency, optionally printing out its
@@ -630,13 +878,14 @@ struct fs_type ext2_fs_type = {"EXT2", 0, ext2_get_sb, ext2_kill_sb, {0, 0},
 
 /* Page Map Operations */
 
-/* Sets up the bidirectional mapping between the page and its buffer heads.  As
- * a future optimization, we could try and detect if all of the blocks are
- * contiguous (either before or after making them) and compact them to one BH.
- * Note there is an assumption that the file has at least one block in it. */
+/* Sets up the bidirectional mapping between the page and its buffer heads.
+ * Blocks that are contiguous on disk share a BH, so a page laid out contiguously
+ * is a single BH (and a single IO).  Any missing blocks are allocated in one
+ * run for the rest of the page.  Note there is an assumption that the file has
+ * at least one block in it. */
 int ext2_mappage(struct page_map *pm, struct page *page)
 {
-	struct buffer_head *bh;
+	struct buffer_head *bh, *prev = 0;
 	struct inode *inode = (struct inode*)pm->pm_host;
 	assert(!page->pg_private);		/* double check that we aren't bh-mapped */
 	assert(inode->i_mapping == pm);	/* double check we are the inode for pm */
@@ -644,53 +893,67 @@ int ext2_mappage(struct page_map *pm, struct page *page)
 	unsigned int blk_per_pg = PGSIZE / inode->i_sb->s_blocksize;
 	unsigned int sct_per_blk = inode->i_sb->s_blocksize / bdev->b_sector_sz;
 	uint32_t ino_blk_num, fs_blk_num = 0, *fs_blk_slot;
+	uint32_t run_blk = 0;			/* next unused block of our alloc'd run */
+	unsigned int run_left = 0, bh_flags;
+	int retval = 0;
 
-	bh = kmem_cache_alloc(bh_kcache, 0);
-	page->pg_private = bh;
 	for (int i = 0; i < blk_per_pg; i++) {
-		/* free_bh() can handle having a halfway aborted mappage() */
-		if (!bh)
-			return -ENOMEM;
-		bh->bh_page = page;							/* weak ref */
-		bh->bh_buffer = page2kva(page) + i * inode->i_sb->s_blocksize;
-		bh->bh_flags = 0;							/* whatever... */
-		bh->bh_bdev = bdev;							/* uncounted ref */
 		/* compute the first sector of the FS block for the ith buf in the pg */
 		ino_blk_num = page->pg_index * blk_per_pg + i;
 		fs_blk_slot = ext2_lookup_inotable_slot(inode, ino_blk_num);
-		/* If there isn't a block there, lets get one.  The previous fs_blk_num
-		 * is our hint (or we have to compute one). */
+		/* If there isn't a block there, lets get one.  We grab enough for the
+		 * rest of the page, right after the previous block if we can. */
 		if (!*fs_blk_slot) {
-			if (!fs_blk_num) {
-				fs_blk_num = ext2_bgidx2block(inode->i_sb,
-				                              ext2_inode2bg(inode), 0);
+			if (!run_left) {
+				run_left = blk_per_pg - i;
+				run_blk = ext2_alloc_blocks(inode, fs_blk_num ? fs_blk_num + 1
+				                                   : ext2_alloc_goal(inode),
+				                            &run_left);
 			}
-			fs_blk_num = ext2_alloc_block(inode, fs_blk_num + 1);
+			fs_blk_num = run_blk++;
+			run_left--;
 			/* Link it, and dirty the inode indirect block */
 			*fs_blk_slot = cpu_to_le32(fs_blk_num);
 			ext2_dirty_metablock(inode->i_sb, fs_blk_slot);
 			/* the block is still on disk, and we don't want its contents */
-			bh->bh_flags = BH_NEEDS_ZEROED;			/* talking to readpage */
+			bh_flags = BH_NEEDS_ZEROED;				/* talking to readpage */
 			/* update our num blocks, with 512B each "block" (ext2-style) */
 			inode->i_blocks += inode->i_sb->s_blocksize >> 9;
 		} else {	/* there is a block there already */
-			fs_blk_num = *fs_blk_slot;
+			fs_blk_num = le32_to_cpu(*fs_blk_slot);
+			bh_flags = 0;
 		}
 		ext2_put_metablock(inode->i_sb, fs_blk_slot);
-		bh->bh_sector = fs_blk_num * sct_per_blk;
-		bh->bh_nr_sector = sct_per_blk;
-		/* Stop if we're the last block in the page.  We could be going beyond
-		 * the end of the file, in which case the next BHs will be zeroed. */
-		if (i == blk_per_pg - 1) {
-			bh->bh_next = 0;
+		/* Extend the previous BH if we're right after it on disk.  We could be
+		 * going beyond the end of the file, in which case the next BHs will be
+		 * zeroed. */
+		if (prev && (prev->bh_flags == bh_flags) &&
+		    (prev->bh_sector + prev->bh_nr_sector == fs_blk_num * sct_per_blk)) {
+			prev->bh_nr_sector += sct_per_blk;
+			continue;
+		}
+		bh = kmem_cache_alloc(bh_kcache, 0);
+		/* free_bh() can handle having a halfway aborted mappage() */
+		if (!bh) {
+			retval = -ENOMEM;
 			break;
-		} else {
-			/* get and link to the next BH. */
-			bh->bh_next = kmem_cache_alloc(bh_kcache, 0);
-			bh = bh->bh_next;
 		}
+		bh->bh_page = page;							/* weak ref */
+		bh->bh_buffer = page2kva(page) + i * inode->i_sb->s_blocksize;
+		bh->bh_flags = bh_flags;
+		bh->bh_bdev = bdev;							/* uncounted ref */
+		bh->bh_sector = fs_blk_num * sct_per_blk;
+		bh->bh_nr_sector = sct_per_blk;
+		bh->bh_next = 0;
+		if (prev)
+			prev->bh_next = bh;
+		else
+			page->pg_private = bh;
+		prev = bh;
 	}
-	return 0;
+	/* Anything left over goes back in the prealloc window */
+	ext2_return_blocks(inode, run_blk, run_left);
+	return retval;
 }
 
 /* Fills page with its contents from its backing store file.  Note that we do
@@ -729,7 +992,7 @@ int ext2_readpage(struct page_map *pm, struct page *page)
 			breq->nr_bhs++;
 			i++;
 		} else {
-			memset(bh->bh_buffer, 0, pm->pm_host->i_sb->s_blocksize);
+			memset(bh->bh_buffer, 0, bh->bh_nr_sector << SECTOR_SZ_LOG);
 			bh->bh_flags |= BH_DIRTY;
 			atomic_or(&bh->bh_page->pg_flags, PG_DIRTY);
 		}
@@ -754,9 +1017,36 @@ int ext2_readpage(struct page_map *pm, struct page *page)
 	return 0;
 }
 
+/* Writes the page back to its blocks.  The blocks were allocated and mapped
+ * when the page was read in (mappage), and contiguous blocks share a BH, so
+ * this is one IO per on-disk extent of the page. */
 int ext2_writepage(struct page_map *pm, struct page *page)
 {
-	return -1;
+	int retval;
+	struct block_device *bdev = pm->pm_host->i_sb->s_bdev;
+	struct buffer_head *bh;
+	struct block_request *breq;
+
+	assert(atomic_read(&page->pg_flags) & PG_BUFFER);
+	breq = kmem_cache_alloc(breq_kcache, 0);
+	if (!breq)
+		return -ENOMEM;
+	breq->flags = BREQ_WRITE;
+	breq->callback = generic_breq_done;
+	breq->data = 0;
+	sem_init_irqsave(&breq->sem, 0);
+	breq->bhs = breq->local_bhs;
+	breq->nr_bhs = 0;
+	for (bh = (struct buffer_head*)page->pg_private; bh; bh = bh->bh_next) {
+		assert(breq->nr_bhs < NR_INLINE_BH);
+		breq->bhs[breq->nr_bhs++] = bh;
+		bh->bh_flags &= ~BH_DIRTY;
+	}
+	retval = bdev_submit_request(bdev, breq);
+	assert(!retval);
+	sleep_on_breq(breq);
+	kmem_cache_free(breq_kcache, breq);
+	return 0;
 }
 
 /* Super Operations */
@@ -782,6 +1072,7 @@ struct inode *ext2_alloc_inode(struct super_block *sb)
  * inode is still on disc is irrelevant. */
 void ext2_dealloc_inode(struct inode *inode)
 {
+	ext2_discard_prealloc(inode);
 	kmem_cache_free(ext2_i_kcache, inode->i_fs_info);
 }
 
@@ -852,6 +1143,7 @@ void ext2_read_inode(struct inode *inode)
 	struct ext2_i_info *e2ii = (struct ext2_i_info*)inode->i_fs_info;
 	for (int i = 0; i < 15; i++)
 		e2ii->i_block[i] = le32_to_cpu(my_ino->i_block[i]);
+	ext2_init_prealloc(inode);
 	/* TODO: (HASH) unused: inode->i_hash add to hash (saves on disc reading) */
 	/* TODO: we could consider saving a pointer to the disk inode and pinning
 	 * its buffer in memory, but for now we'll just free it. */
@@ -864,11 +1156,35 @@ void ext2_dirty_inode(struct inode *inode)
 	// presumably we'll ext2_dirty_metablock(void *buffer) here
 }
 
+/* Copies the in-memory inode back to its disk inode, dirtying the metablock.
+ * The inode's i_block[] is the cached copy in the e2ii. */
+static void ext2_sync_diskinode(struct inode *inode)
+{
+	struct ext2_i_info *e2ii = (struct ext2_i_info*)inode->i_fs_info;
+	struct ext2_inode *disk_inode = ext2_get_diskinode(inode);
+
+	disk_inode->i_mode = cpu_to_le16(inode->i_mode);
+	disk_inode->i_uid = cpu_to_le16(inode->i_uid);
+	disk_inode->i_gid = cpu_to_le16(inode->i_gid);
+	disk_inode->i_links_cnt = cpu_to_le16(inode->i_nlink);
+	disk_inode->i_size = cpu_to_le32(inode->i_size);
+	disk_inode->i_atime = cpu_to_le32(inode->i_atime.tv_sec);
+	disk_inode->i_ctime = cpu_to_le32(inode->i_ctime.tv_sec);
+	disk_inode->i_mtime = cpu_to_le32(inode->i_mtime.tv_sec);
+	disk_inode->i_blocks = cpu_to_le32(inode->i_blocks);
+	disk_inode->i_flags = cpu_to_le32(inode->i_flags);
+	for (int i = 0; i < 15; i++)
+		disk_inode->i_block[i] = cpu_to_le32(e2ii->i_block[i]);
+	ext2_dirty_metablock(inode->i_sb, disk_inode);
+	ext2_put_metablock(inode->i_sb, disk_inode);
+}
+
 /* write the inode to disk (specifically, to inode inode->i_ino), synchronously
- * if we're asked to wait */
+ * if we're asked to wait.  For now, this just dirties the buffer; syncing the
+ * block device happens elsewhere (or not at all). */
 void ext2_write_inode(struct inode *inode, bool wait)
 {
-I_AM_HERE;
+	ext2_sync_diskinode(inode);
 }
 
 /* called when an inode is decref'd, to do any FS specific work */
@@ -1059,10 +1375,10 @@ static bool create_each_func(struct ext2_dirent *dir_i, long a1, long a2,
 	unsigned int real_len = ext2_dirent_len(dir_i);
 	/* How much room is available after this dir_i before the next one */
 	unsigned int record_slack = le16_to_cpu(dir_i->dir_reclen) - real_len;
-	/* TODO: Note that this technique will clobber any directory indexing.  They
-	 * exist after the .. entry with an inode of 0.  Check the docs for
-	 * specifics and think up a nice way to tell the diff between a reserved
-	 * entry and an unused one, when inode == 0. */
+	/* Note that this technique will clobber any directory indexing, which
+	 * lives in the slack after "..", or in blocks that look like one unused
+	 * entry.  Callers must only use this on leaves of an indexed dir, or drop
+	 * the index first (ext2_dx_clear_index()). */
 	if (record_slack < our_rec_len)
 		return FALSE;
 	/* At this point, there is enough room for us.  Stick our new one in right
@@ -1077,21 +1393,735 @@ static bool create_each_func(struct ext2_dirent *dir_i, long a1, long a2,
 	return TRUE;
 }
 
-/* Called when creating a new disk inode in dir associated with dentry.  We need
- * to fill out the i_ino, set the type, and do whatever else we need */
-int ext2_create(struct inode *dir, struct dentry *dentry, int mode,
-               struct nameidata *nd)
+/* Directory Indexing (htree) */
+
+/* Returns TRUE if the FS can have hash indexed directories */
+static bool ext2_has_dir_index(struct super_block *sb)
+{
+	struct ext2_sb *e2sb = ((struct ext2_sb_info*)sb->s_fs_info)->e2sb;
+	return le32_to_cpu(e2sb->s_feature_compat) & EXT2_FEATURE_COMPAT_DIR_INDEX;
+}
+
+static inline uint32_t ext2_rol32(uint32_t word, unsigned int shift)
+{
+	return (word << shift) | (word >> (32 - shift));
+}
+
+/* The hash functions need to match Linux's bit for bit, so these are straight
+ * ports of fs/ext4/hash.c.  The only twist is whether names are hashed as
+ * signed or unsigned chars, which depends on the arch that made the FS. */
+static inline int ext2_hash_char(const char *name, int i, bool unsigned_chars)
+{
+	return unsigned_chars ? (int)((unsigned char*)name)[i] :
+	                        (int)((signed char*)name)[i];
+}
+
+/* The old hash from the very first htree implementation */
+static uint32_t ext2_dx_hack_hash(const char *name, int len,
+                                  bool unsigned_chars)
+{
+	uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+	for (int i = 0; i < len; i++) {
+		hash = hash1 + (hash0 ^ (ext2_hash_char(name, i, unsigned_chars) *
+		                         7152373));
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+/* Packs up to num words of the name into buf, padded with the length */
+static void ext2_dx_str2hashbuf(const char *msg, int len, uint32_t *buf,
+                                int num, bool unsigned_chars)
+{
+	uint32_t pad, val;
+
+	pad = (uint32_t)len | ((uint32_t)len << 8);
+	pad |= pad << 16;
+	val = pad;
+	if (len > num * 4)
+		len = num * 4;
+	for (int i = 0; i < len; i++) {
+		val = ext2_hash_char(msg, i, unsigned_chars) + (val << 8);
+		if ((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+	if (--num >= 0)
+		*buf++ = val;
+	while (--num >= 0)
+		*buf++ = pad;
+}
+
+#define DX_F(x, y, z)		((z) ^ ((x) & ((y) ^ (z))))
+#define DX_G(x, y, z)		(((x) & (y)) + (((x) ^ (y)) & (z)))
+#define DX_H(x, y, z)		((x) ^ (y) ^ (z))
+#define DX_ROUND(f, a, b, c, d, x, s)                                          \
+	(a += f(b, c, d) + x, a = ext2_rol32(a, s))
+#define DX_K1				0
+#define DX_K2				013240474631UL
+#define DX_K3				015666365641UL
+
+/* Basic cut-down MD4 transform */
+static void ext2_dx_half_md4(uint32_t buf[4], const uint32_t in[8])
+{
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	DX_ROUND(DX_F, a, b, c, d, in[0] + DX_K1,  3);
+	DX_ROUND(DX_F, d, a, b, c, in[1] + DX_K1,  7);
+	DX_ROUND(DX_F, c, d, a, b, in[2] + DX_K1, 11);
+	DX_ROUND(DX_F, b, c, d, a, in[3] + DX_K1, 19);
+	DX_ROUND(DX_F, a, b, c, d, in[4] + DX_K1,  3);
+	DX_ROUND(DX_F, d, a, b, c, in[5] + DX_K1,  7);
+	DX_ROUND(DX_F, c, d, a, b, in[6] + DX_K1, 11);
+	DX_ROUND(DX_F, b, c, d, a, in[7] + DX_K1, 19);
+
+	DX_ROUND(DX_G, a, b, c, d, in[1] + DX_K2,  3);
+	DX_ROUND(DX_G, d, a, b, c, in[3] + DX_K2,  5);
+	DX_ROUND(DX_G, c, d, a, b, in[5] + DX_K2,  9);
+	DX_ROUND(DX_G, b, c, d, a, in[7] + DX_K2, 13);
+	DX_ROUND(DX_G, a, b, c, d, in[0] + DX_K2,  3);
+	DX_ROUND(DX_G, d, a, b, c, in[2] + DX_K2,  5);
+	DX_ROUND(DX_G, c, d, a, b, in[4] + DX_K2,  9);
+	DX_ROUND(DX_G, b, c, d, a, in[6] + DX_K2, 13);
+
+	DX_ROUND(DX_H, a, b, c, d, in[3] + DX_K3,  3);
+	DX_ROUND(DX_H, d, a, b, c, in[7] + DX_K3,  9);
+	DX_ROUND(DX_H, c, d, a, b, in[2] + DX_K3, 11);
+	DX_ROUND(DX_H, b, c, d, a, in[6] + DX_K3, 15);
+	DX_ROUND(DX_H, a, b, c, d, in[1] + DX_K3,  3);
+	DX_ROUND(DX_H, d, a, b, c, in[5] + DX_K3,  9);
+	DX_ROUND(DX_H, c, d, a, b, in[0] + DX_K3, 11);
+	DX_ROUND(DX_H, b, c, d, a, in[4] + DX_K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+/* The Tiny Encryption Algorithm, 16 rounds */
+static void ext2_dx_tea(uint32_t buf[4], const uint32_t in[4])
+{
+	uint32_t sum = 0;
+	uint32_t b0 = buf[0], b1 = buf[1];
+	uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+
+	for (int n = 0; n < 16; n++) {
+		sum += 0x9e3779b9;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	}
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+/* Hashes name with the given hash_version (which already accounts for
+ * signedness), using the SB's seed.  The low bit is always clear; it is used
+ * in the index to mark collisions. */
+static uint32_t ext2_dx_hash(struct super_block *sb, const char *name, int len,
+                             uint8_t hash_version)
+{
+	struct ext2_sb *e2sb = ((struct ext2_sb_info*)sb->s_fs_info)->e2sb;
+	uint32_t buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+	uint32_t in[8], hash;
+	bool unsigned_chars = hash_version >= EXT2_HASH_LEGACY_UNSIGNED;
+
+	/* A seed of all 0s means use the default */
+	for (int i = 0; i < 4; i++) {
+		if (e2sb->s_hash_seed[i]) {
+			for (int j = 0; j < 4; j++)
+				buf[j] = le32_to_cpu(e2sb->s_hash_seed[j]);
+			break;
+		}
+	}
+	switch (hash_version) {
+		case (EXT2_HASH_LEGACY):
+		case (EXT2_HASH_LEGACY_UNSIGNED):
+			hash = ext2_dx_hack_hash(name, len, unsigned_chars);
+			break;
+		case (EXT2_HASH_HALF_MD4):
+		case (EXT2_HASH_HALF_MD4_UNSIGNED):
+			for (const char *p = name; len > 0; len -= 32, p += 32) {
+				ext2_dx_str2hashbuf(p, len, in, 8, unsigned_chars);
+				ext2_dx_half_md4(buf, in);
+			}
+			hash = buf[1];
+			break;
+		case (EXT2_HASH_TEA):
+		case (EXT2_HASH_TEA_UNSIGNED):
+			for (const char *p = name; len > 0; len -= 16, p += 16) {
+				ext2_dx_str2hashbuf(p, len, in, 4, unsigned_chars);
+				ext2_dx_tea(buf, in);
+			}
+			hash = buf[0];
+			break;
+		default:
+			warn("Unknown ext2 dir hash version %d", hash_version);
+			return 0;
+	}
+	hash &= ~1;
+	if (hash == (EXT2_HTREE_EOF << 1))
+		hash = (EXT2_HTREE_EOF - 1) << 1;
+	return hash;
+}
+
+/* Converts the version stored in a dx root (or the SB default) to the one we
+ * actually hash with, based on the SB's signedness flag. */
+static uint8_t ext2_dx_hash_version(struct super_block *sb, uint8_t version)
+{
+	struct ext2_sb *e2sb = ((struct ext2_sb_info*)sb->s_fs_info)->e2sb;
+	if ((version <= EXT2_HASH_TEA) &&
+	    (le32_to_cpu(e2sb->s_flags) & EXT2_FLAGS_UNSIGNED_HASH))
+		version += EXT2_HASH_LEGACY_UNSIGNED;
+	return version;
+}
+
+/* Accessors for index nodes.  entries[0] doubles as the count/limit. */
+static unsigned int ext2_dx_get_count(struct ext2_dx_entry *entries)
+{
+	return le16_to_cpu(((struct ext2_dx_countlimit*)entries)->count);
+}
+
+static unsigned int ext2_dx_get_limit(struct ext2_dx_entry *entries)
+{
+	return le16_to_cpu(((struct ext2_dx_countlimit*)entries)->limit);
+}
+
+static void ext2_dx_set_count(struct ext2_dx_entry *entries, unsigned int cnt)
+{
+	((struct ext2_dx_countlimit*)entries)->count = cpu_to_le16(cnt);
+}
+
+static void ext2_dx_set_limit(struct ext2_dx_entry *entries, unsigned int lim)
+{
+	((struct ext2_dx_countlimit*)entries)->limit = cpu_to_le16(lim);
+}
+
+static uint32_t ext2_dx_get_hash(struct ext2_dx_entry *entry)
+{
+	return le32_to_cpu(entry->hash);
+}
+
+/* The top byte is reserved (for the 'large_dir' ext4 feature) */
+static uint32_t ext2_dx_get_block(struct ext2_dx_entry *entry)
+{
+	return le32_to_cpu(entry->block) & 0x00ffffff;
+}
+
+/* The root info lives after "." (12 bytes) and the 12 bytes of "..", whose
+ * reclen covers the rest of the block. */
+static struct ext2_dx_root_info *ext2_dx_root_info(void *root_blk)
+{
+	return root_blk + 24;
+}
+
+static struct ext2_dx_entry *ext2_dx_root_entries(void *root_blk)
+{
+	struct ext2_dx_root_info *info = ext2_dx_root_info(root_blk);
+	return (void*)info + info->info_length;
+}
+
+static unsigned int ext2_dx_root_limit(struct super_block *sb)
+{
+	return (sb->s_blocksize - 32) / sizeof(struct ext2_dx_entry);
+}
+
+/* Interior nodes start with an empty dirent covering the whole block */
+static struct ext2_dx_entry *ext2_dx_node_entries(void *node_blk)
+{
+	return node_blk + 8;
+}
+
+static unsigned int ext2_dx_node_limit(struct super_block *sb)
+{
+	return (sb->s_blocksize - 8) / sizeof(struct ext2_dx_entry);
+}
+
+/* Sets up a fresh interior node in node_blk, returning its entries */
+static struct ext2_dx_entry *ext2_dx_init_node(struct super_block *sb,
+                                               void *node_blk)
+{
+	struct ext2_dirent *fake = node_blk;
+	struct ext2_dx_entry *entries = ext2_dx_node_entries(node_blk);
+	memset(node_blk, 0, sb->s_blocksize);
+	fake->dir_reclen = cpu_to_le16(sb->s_blocksize);
+	ext2_dx_set_limit(entries, ext2_dx_node_limit(sb));
+	return entries;
+}
+
+/* One level of a walk down the index: the node's metablock, its entries, and
+ * the entry we followed to get to the next level. */
+struct ext2_dx_frame {
+	void						*buf;
+	struct ext2_dx_entry		*entries;
+	struct ext2_dx_entry		*at;
+};
+
+static void ext2_dx_put_frames(struct super_block *sb,
+                               struct ext2_dx_frame *frames, int nr_frames)
+{
+	for (int i = 0; i < nr_frames; i++)
+		ext2_put_metablock(sb, frames[i].buf);
+}
+
+/* Walks the index of dir down to the leaf that should hold name, filling in
+ * one frame per level (frames needs room for EXT2_DX_MAX_LEVELS), and passing
+ * back the name's hash and the hash version.  The leaf block is
+ * frames[retval - 1].at.  Returns the number of levels, or 0 if the index is
+ * busted or of a flavor we don't support, in which case the caller ought to
+ * treat dir as unindexed.  Put the frames when you are done. */
+static int ext2_dx_probe(struct inode *dir, struct qstr *name, uint32_t *hash,
+                         uint8_t *hash_version, struct ext2_dx_frame *frames)
+{
+	struct super_block *sb = dir->i_sb;
+	unsigned int nr_dir_blks = dir->i_size / sb->s_blocksize;
+	unsigned int count, limit, levels;
+	struct ext2_dx_root_info *info;
+	struct ext2_dx_entry *entries, *lo, *hi, *mid;
+	void *blk;
+	int depth = 0;
+
+	blk = ext2_get_ino_metablock(dir, 0);
+	info = ext2_dx_root_info(blk);
+	if (info->reserved_zero || (info->info_length != 8) ||
+	    (info->indirect_levels >= EXT2_DX_MAX_LEVELS) ||
+	    (info->hash_version > EXT2_HASH_TEA_UNSIGNED)) {
+		warn_once("Unsupported ext2 dir index on inode %d", dir->i_ino);
+		ext2_put_metablock(sb, blk);
+		return 0;
+	}
+	*hash_version = ext2_dx_hash_version(sb, info->hash_version);
+	*hash = ext2_dx_hash(sb, name->name, name->len, *hash_version);
+	levels = info->indirect_levels + 1;
+	entries = ext2_dx_root_entries(blk);
+	limit = ext2_dx_root_limit(sb);
+	while (1) {
+		frames[depth].buf = blk;
+		frames[depth].entries = entries;
+		depth++;
+		count = ext2_dx_get_count(entries);
+		if ((ext2_dx_get_limit(entries) != limit) || !count || (count > limit))
+			goto out_busted;
+		/* Find the last entry whose hash is <= ours.  entries[0] has an
+		 * implied hash of 0, so it's always a candidate. */
+		lo = entries + 1;
+		hi = entries + count - 1;
+		while (lo <= hi) {
+			mid = lo + (hi - lo) / 2;
+			if (ext2_dx_get_hash(mid) > *hash)
+				hi = mid - 1;
+			else
+				lo = mid + 1;
+		}
+		frames[depth - 1].at = lo - 1;
+		if (ext2_dx_get_block(lo - 1) >= nr_dir_blks)
+			goto out_busted;
+		if (depth == levels)
+			return levels;
+		blk = ext2_get_ino_metablock(dir, ext2_dx_get_block(lo - 1));
+		entries = ext2_dx_node_entries(blk);
+		limit = ext2_dx_node_limit(sb);
+	}
+out_busted:
+	warn_once("Corrupt ext2 dir index on inode %d", dir->i_ino);
+	ext2_dx_put_frames(sb, frames, depth);
+	return 0;
+}
+
+/* If the names hashing to hash might continue into the next leaf (the next
+ * index entry has the same hash, with the collision bit set), this advances
+ * the frames to that leaf and returns TRUE. */
+static bool ext2_dx_next_leaf(struct inode *dir, uint32_t hash,
+                              struct ext2_dx_frame *frames, int levels)
+{
+	struct ext2_dx_frame *frame;
+	int i = levels - 1;
+
+	/* Find the deepest level that has an entry after the one we took */
+	while (frames[i].at + 1 >= frames[i].entries +
+	                           ext2_dx_get_count(frames[i].entries)) {
+		if (!i)
+			return FALSE;
+		i--;
+	}
+	if ((ext2_dx_get_hash(frames[i].at + 1) & ~1) != hash)
+		return FALSE;
+	frames[i].at++;
+	/* Reload the levels below, starting from their first entries */
+	for (i++; i < levels; i++) {
+		frame = &frames[i];
+		ext2_put_metablock(dir->i_sb, frame->buf);
+		frame->buf = ext2_get_ino_metablock(dir,
+		                                ext2_dx_get_block(frames[i - 1].at));
+		frame->entries = ext2_dx_node_entries(frame->buf);
+		frame->at = frame->entries;
+	}
+	return TRUE;
+}
+
+/* Looks for name in a single dir block, returning its dirent or 0 */
+static struct ext2_dirent *ext2_find_in_dirblock(struct super_block *sb,
+                                                 void *blk, struct qstr *name)
+{
+	struct ext2_dirent *dir_i = blk;
+	while ((void*)dir_i < blk + sb->s_blocksize) {
+		if (le32_to_cpu(dir_i->dir_inode) &&
+		    (dir_i->dir_namelen == name->len) &&
+		    !strncmp((char*)dir_i->dir_name, name->name, name->len))
+			return dir_i;
+		/* a 0 reclen would have us spin forever on a corrupt block */
+		if (!le16_to_cpu(dir_i->dir_reclen))
+			break;
+		dir_i = (void*)dir_i + le16_to_cpu(dir_i->dir_reclen);
+	}
+	return 0;
+}
+
+/* Tries to squeeze dentry's dirent into a single dir block */
+static bool ext2_add_to_dirblock(struct super_block *sb, void *blk,
+                                 struct dentry *dentry, unsigned int rec_len)
+{
+	struct ext2_dirent *dir_i = blk;
+	while ((void*)dir_i < blk + sb->s_blocksize) {
+		if (create_each_func(dir_i, (long)dentry, (long)rec_len, 0))
+			return TRUE;
+		if (!le16_to_cpu(dir_i->dir_reclen))
+			break;
+		dir_i = (void*)dir_i + le16_to_cpu(dir_i->dir_reclen);
+	}
+	return FALSE;
+}
+
+/* Looks up dentry's name in an indexed dir.  Returns 0 if it found the name
+ * (and loaded the inode), -ENOENT if the name isn't there, or -EINVAL if the
+ * index is unusable and the caller should do a linear scan. */
+static int ext2_dx_lookup(struct inode *dir, struct dentry *dentry)
+{
+	struct ext2_dx_frame frames[EXT2_DX_MAX_LEVELS];
+	struct ext2_dirent *dir_i;
+	uint8_t hash_version;
+	uint32_t hash;
+	void *leaf;
+	int levels, retval = -ENOENT;
+
+	levels = ext2_dx_probe(dir, &dentry->d_name, &hash, &hash_version,
+	                       frames);
+	if (!levels)
+		return -EINVAL;
+	do {
+		leaf = ext2_get_ino_metablock(dir,
+		                          ext2_dx_get_block(frames[levels - 1].at));
+		dir_i = ext2_find_in_dirblock(dir->i_sb, leaf, &dentry->d_name);
+		if (dir_i) {
+			load_inode(dentry, (long)le32_to_cpu(dir_i->dir_inode));
+			retval = 0;
+		}
+		ext2_put_metablock(dir->i_sb, leaf);
+	} while (retval && ext2_dx_next_leaf(dir, hash, frames, levels));
+	ext2_dx_put_frames(dir->i_sb, frames, levels);
+	return retval;
+}
+
+/* Inserts an index entry in frame's node, right after frame->at.  The caller
+ * makes sure there is room. */
+static void ext2_dx_insert_entry(struct ext2_dx_frame *frame, uint32_t hash,
+                                 uint32_t block)
+{
+	struct ext2_dx_entry *new = frame->at + 1;
+	unsigned int count = ext2_dx_get_count(frame->entries);
+	memmove(new + 1, new, (void*)(frame->entries + count) - (void*)new);
+	new->hash = cpu_to_le32(hash);
+	new->block = cpu_to_le32(block);
+	ext2_dx_set_count(frame->entries, count + 1);
+}
+
+/* Makes sure the index node right above the leaf has room for another entry.
+ * If the root is the full node, we push its entries down a level.  If an
+ * interior node is full, we split it, which needs room in the root.  *levels
+ * gets updated if the tree grew.  Returns 0 on success, -ENOSPC if the index is
+ * maxed out. */
+static int ext2_dx_make_room(struct inode *dir, struct ext2_dx_frame *frames,
+                             int *levels)
+{
+	struct super_block *sb = dir->i_sb;
+	struct ext2_dx_frame *root = &frames[0], *frame = &frames[*levels - 1];
+	struct ext2_dx_entry *new_entries;
+	unsigned int count = ext2_dx_get_count(frame->entries);
+	unsigned int split;
+	uint32_t new_blkno, split_hash;
+	void *new_node;
+
+	if (count < ext2_dx_get_limit(frame->entries))
+		return 0;
+	if ((*levels == 1) || (ext2_dx_get_count(root->entries) <
+	                       ext2_dx_get_limit(root->entries))) {
+		/* The dir grows by one block, at the end */
+		new_blkno = dir->i_size / sb->s_blocksize;
+		new_node = ext2_get_ino_metablock(dir, new_blkno);
+		new_entries = ext2_dx_init_node(sb, new_node);
+	} else {
+		return -ENOSPC;
+	}
+	if (*levels == 1) {
+		/* Move all of the root's entries into the new node, and make that
+		 * the root's only child. */
+		memcpy(new_entries + 1, root->entries + 1,
+		       (count - 1) * sizeof(struct ext2_dx_entry));
+		new_entries[0].block = root->entries[0].block;
+		ext2_dx_set_count(new_entries, count);
+		frames[1].buf = new_node;
+		frames[1].entries = new_entries;
+		frames[1].at = new_entries + (root->at - root->entries);
+		ext2_dx_set_count(root->entries, 1);
+		root->entries[0].block = cpu_to_le32(new_blkno);
+		root->at = root->entries;
+		ext2_dx_root_info(root->buf)->indirect_levels = 1;
+		ext2_dirty_metablock(sb, root->buf);
+		ext2_dirty_metablock(sb, new_node);
+		*levels = 2;
+		return 0;
+	}
+	/* Split the interior node, moving the upper half to the new node */
+	split = count / 2;
+	split_hash = ext2_dx_get_hash(frame->entries + split);
+	memcpy(new_entries + 1, frame->entries + split + 1,
+	       (count - split - 1) * sizeof(struct ext2_dx_entry));
+	new_entries[0].block = frame->entries[split].block;
+	ext2_dx_set_count(new_entries, count - split);
+	ext2_dx_set_count(frame->entries, split);
+	ext2_dx_insert_entry(root, split_hash, new_blkno);
+	ext2_dirty_metablock(sb, root->buf);
+	ext2_dirty_metablock(sb, frame->buf);
+	ext2_dirty_metablock(sb, new_node);
+	if (frame->at >= frame->entries + split) {
+		/* Our leaf moved to the new node */
+		frame->at = new_entries + (frame->at - (frame->entries + split));
+		ext2_put_metablock(sb, frame->buf);
+		frame->buf = new_node;
+		frame->entries = new_entries;
+		root->at++;
+	} else {
+		ext2_put_metablock(sb, new_node);
+	}
+	return 0;
+}
+
+/* Helper for splitting leaves, one per live dirent */
+struct ext2_dx_map {
+	uint32_t					hash;
+	uint16_t					offs;
+	uint16_t					size;
+};
+
+/* Packs the dirents in map (which point into src) into leaf */
+static void ext2_dx_pack_leaf(struct super_block *sb, void *leaf, void *src,
+                              struct ext2_dx_map *map, unsigned int nr)
+{
+	struct ext2_dirent *dir_i = leaf, *last = leaf;
+	memset(leaf, 0, sb->s_blocksize);
+	for (int i = 0; i < nr; i++) {
+		memcpy(dir_i, src + map[i].offs, map[i].size);
+		dir_i->dir_reclen = cpu_to_le16(map[i].size);
+		last = dir_i;
+		dir_i = (void*)dir_i + map[i].size;
+	}
+	/* The last one gets the slack (or the whole block, if there are none) */
+	last->dir_reclen = cpu_to_le16(leaf + sb->s_blocksize - (void*)last);
+}
+
+/* Splits the full leaf under frame->at, moving the upper half (by hash) of its
+ * dirents into a new dir block and indexing it in frame's node, which must
+ * have room.  Returns the metablock of whichever leaf should now hold hash. */
+static void *ext2_dx_split_leaf(struct inode *dir, struct ext2_dx_frame *frame,
+                                uint32_t hash, uint8_t hash_version)
+{
+	struct super_block *sb = dir->i_sb;
+	unsigned int blksz = sb->s_blocksize;
+	struct ext2_dx_map *map, tmp;
+	struct ext2_dirent *dir_i;
+	unsigned int count = 0, split, moved_sz = 0;
+	uint32_t new_blkno, split_hash;
+	void *leaf, *new_leaf, *copy;
+
+	/* The smallest dirent is 12 bytes ("." rounds up to this) */
+	map = kmalloc(sizeof(struct ext2_dx_map) * (blksz / 12), KMALLOC_WAIT);
+	copy = kmalloc(blksz, KMALLOC_WAIT);
+	leaf = ext2_get_ino_metablock(dir, ext2_dx_get_block(frame->at));
+	memcpy(copy, leaf, blksz);
+	/* Build a map of the live dirents, sorted by hash.  There aren't many, so
+	 * an insertion sort is fine. */
+	for (dir_i = copy; (void*)dir_i < copy + blksz;
+	     dir_i = (void*)dir_i + le16_to_cpu(dir_i->dir_reclen)) {
+		if (!le16_to_cpu(dir_i->dir_reclen))
+			break;
+		if (!le32_to_cpu(dir_i->dir_inode))
+			continue;
+		map[count].hash = ext2_dx_hash(sb, (char*)dir_i->dir_name,
+		                               dir_i->dir_namelen, hash_version);
+		map[count].offs = (void*)dir_i - copy;
+		map[count].size = ext2_dirent_len(dir_i);
+		for (int i = count; i && (map[i - 1].hash > map[i].hash); i--) {
+			tmp = map[i];
+			map[i] = map[i - 1];
+			map[i - 1] = tmp;
+		}
+		count++;
+	}
+	/* A full leaf holds at least three max-length names */
+	assert(count >= 2);
+	/* Split in the middle, size-wise, so both halves have room for another
+	 * dirent of any size. */
+	for (split = count; split > 1; split--) {
+		if (moved_sz + map[split - 1].size / 2 > blksz / 2)
+			break;
+		moved_sz += map[split - 1].size;
+	}
+	split_hash = map[split].hash;
+	/* If the hash straddles the split, mark it as continuing */
+	if (split_hash == map[split - 1].hash)
+		split_hash |= 1;
+	new_blkno = dir->i_size / blksz;
+	new_leaf = ext2_get_ino_metablock(dir, new_blkno);
+	ext2_dx_pack_leaf(sb, leaf, copy, map, split);
+	ext2_dx_pack_leaf(sb, new_leaf, copy, map + split, count - split);
+	ext2_dx_insert_entry(frame, split_hash, new_blkno);
+	ext2_dirty_metablock(sb, frame->buf);
+	ext2_dirty_metablock(sb, leaf);
+	ext2_dirty_metablock(sb, new_leaf);
+	kfree(copy);
+	kfree(map);
+	if (hash >= (split_hash & ~1)) {
+		ext2_put_metablock(sb, leaf);
+		return new_leaf;
+	}
+	ext2_put_metablock(sb, new_leaf);
+	return leaf;
+}
+
+/* Adds dentry's dirent to an indexed dir, splitting leaves and growing the
+ * index as needed.  Returns 0 on success, -EINVAL if the index is unusable
+ * (caller should drop it), or -ENOSPC if the index is full. */
+static int ext2_dx_add_entry(struct inode *dir, struct dentry *dentry,
+                             unsigned int rec_len)
+{
+	struct super_block *sb = dir->i_sb;
+	struct ext2_dx_frame frames[EXT2_DX_MAX_LEVELS];
+	uint8_t hash_version;
+	uint32_t hash;
+	void *leaf;
+	int levels, retval;
+
+	levels = ext2_dx_probe(dir, &dentry->d_name, &hash, &hash_version, frames);
+	if (!levels)
+		return -EINVAL;
+	leaf = ext2_get_ino_metablock(dir, ext2_dx_get_block(frames[levels - 1].at));
+	if (ext2_add_to_dirblock(sb, leaf, dentry, rec_len)) {
+		ext2_put_metablock(sb, leaf);
+		ext2_dx_put_frames(sb, frames, levels);
+		return 0;
+	}
+	ext2_put_metablock(sb, leaf);
+	retval = ext2_dx_make_room(dir, frames, &levels);
+	if (retval) {
+		warn("Ext2 dir index for inode %d is full", dir->i_ino);
+		ext2_dx_put_frames(sb, frames, levels);
+		return retval;
+	}
+	leaf = ext2_dx_split_leaf(dir, &frames[levels - 1], hash, hash_version);
+	/* Both halves of a split have at least a half block free */
+	if (!ext2_add_to_dirblock(sb, leaf, dentry, rec_len))
+		panic("No room in a freshly split ext2 dir block!");
+	ext2_put_metablock(sb, leaf);
+	ext2_dx_put_frames(sb, frames, levels);
+	ext2_sync_diskinode(dir);
+	return 0;
+}
+
+/* Turns a full, single-block dir into an indexed one.  Everything after ".."
+ * moves to a new leaf (block 1), and block 0 becomes the index root.  The
+ * caller then adds its dirent via the index, which will split the leaf.
+ * Returns 0 on success, -EINVAL if block 0 doesn't look like we expect. */
+static int ext2_dx_make_indexed(struct inode *dir)
+{
+	struct super_block *sb = dir->i_sb;
+	struct ext2_sb *e2sb = ((struct ext2_sb_info*)sb->s_fs_info)->e2sb;
+	unsigned int blksz = sb->s_blocksize;
+	struct ext2_dirent *dot, *dotdot, *dir_i, *last;
+	struct ext2_dx_root_info *info;
+	struct ext2_dx_entry *entries;
+	void *root, *leaf, *rest;
+	unsigned int rest_len;
+
+	assert(dir->i_size == blksz);
+	root = ext2_get_ino_metablock(dir, 0);
+	dot = root;
+	dotdot = root + 12;
+	/* The root info has a fixed location, so "." must be exactly 12 long */
+	if ((le16_to_cpu(dot->dir_reclen) != 12) || (dot->dir_namelen != 1) ||
+	    (dotdot->dir_namelen != 2) || strncmp((char*)dotdot->dir_name, "..", 2)) {
+		ext2_put_metablock(sb, root);
+		return -EINVAL;
+	}
+	rest = (void*)dotdot + le16_to_cpu(dotdot->dir_reclen);
+	rest_len = root + blksz - rest;
+	leaf = ext2_get_ino_metablock(dir, 1);
+	memset(leaf, 0, blksz);
+	if (rest_len) {
+		memcpy(leaf, rest, rest_len);
+		/* Stretch the last dirent to cover the new end of the block */
+		for (dir_i = last = leaf; (void*)dir_i < leaf + rest_len;
+		     dir_i = (void*)dir_i + le16_to_cpu(dir_i->dir_reclen)) {
+			if (!le16_to_cpu(dir_i->dir_reclen))
+				break;
+			last = dir_i;
+		}
+		last->dir_reclen = cpu_to_le16(leaf + blksz - (void*)last);
+	} else {
+		((struct ext2_dirent*)leaf)->dir_reclen = cpu_to_le16(blksz);
+	}
+	/* Now ".." covers the rest of block 0, and the root hides inside */
+	dotdot->dir_reclen = cpu_to_le16(blksz - 12);
+	info = ext2_dx_root_info(root);
+	memset(info, 0, blksz - 24);
+	info->hash_version = e2sb->s_def_hash_version;
+	if (info->hash_version > EXT2_HASH_TEA)
+		info->hash_version = EXT2_HASH_HALF_MD4;
+	info->info_length = 8;
+	entries = ext2_dx_root_entries(root);
+	ext2_dx_set_limit(entries, ext2_dx_root_limit(sb));
+	ext2_dx_set_count(entries, 1);
+	entries[0].block = cpu_to_le32(1);
+	ext2_dirty_metablock(sb, root);
+	ext2_dirty_metablock(sb, leaf);
+	ext2_put_metablock(sb, leaf);
+	ext2_put_metablock(sb, root);
+	dir->i_flags |= EXT2_INDEX_FL;
+	ext2_sync_diskinode(dir);
+	return 0;
+}
+
+/* Drops a busted (or unsupported) index.  Whatever was in the root becomes
+ * slack after "..", and the interior nodes look like empty dirents, so the dir
+ * is still a valid unindexed dir. */
+static void ext2_dx_clear_index(struct inode *dir)
+{
+	dir->i_flags &= ~EXT2_INDEX_FL;
+	ext2_sync_diskinode(dir);
+}
+
+/* Gets a disk inode for a new inode in dir, whose type is already set, and sets
+ * up its e2ii. */
+static void ext2_new_diskinode(struct inode *dir, struct inode *inode)
 {
-	struct inode *inode = dentry->d_inode;
 	struct ext2_block_group *dir_bg = ext2_inode2bg(dir);
 	struct ext2_inode *disk_inode;
 	struct ext2_i_info *e2ii;
-	uint32_t dir_block;
-	unsigned int our_rec_len;
-	struct ext2_dirent *new_dirent;
-	/* Set basic inode stuff for files, get a disk inode, etc */
-	SET_FTYPE(inode->i_mode, __S_IFREG);
-	inode->i_fop = &ext2_f_op_file;
+
 	inode->i_ino = ext2_alloc_diskinode(inode, dir_bg);
 	/* Initialize disk inode (this will be different for short symlinks) */
 	disk_inode = ext2_get_diskinode(inode);
@@ -1101,36 +2131,76 @@ int ext2_create(struct inode *dir, struct dentry *dentry, int mode,
 	e2ii = (struct ext2_i_info*)inode->i_fs_info;
 	for (int i = 0; i < 15; i++)
 		e2ii->i_block[i] = le32_to_cpu(disk_inode->i_block[i]);
+	ext2_init_prealloc(inode);
 	/* Dirty and put the disk inode */
-	ext2_dirty_metablock(dentry->d_sb, disk_inode);
-	ext2_put_metablock(dentry->d_sb, disk_inode);
-	/* Insert it in the directory (make a dirent, might expand the dir too) */
+	ext2_dirty_metablock(inode->i_sb, disk_inode);
+	ext2_put_metablock(inode->i_sb, disk_inode);
+}
+
+/* Inserts dentry's dirent in dir (might expand the dir too) */
+static int ext2_add_dirent(struct inode *dir, struct dentry *dentry, int mode)
+{
+	uint32_t dir_block;
+	unsigned int our_rec_len;
+	struct ext2_dirent *new_dirent;
+	int retval;
+
 	/* Note the disk dir_name is not null terminated */
 	our_rec_len = ROUNDUP(8 + dentry->d_name.len, 4);
 	assert(our_rec_len <= 8 + 256);
-	/* Consider caching the start point for future dirent ops.  Or even using
-	 * the indexed directory.... */
+	/* Indexed dirs go straight to the right block.  If we can't use the index,
+	 * we need to drop it, since the linear insert below would clobber it. */
+	if (dir->i_flags & EXT2_INDEX_FL) {
+		if (ext2_has_dir_index(dir->i_sb)) {
+			retval = ext2_dx_add_entry(dir, dentry, our_rec_len);
+			if (retval != -EINVAL)
+				return retval;
+		}
+		ext2_dx_clear_index(dir);
+	}
 	dir_block = ext2_foreach_dirent(dir, create_each_func, (long)dentry,
 	                                (long)our_rec_len, (long)mode);
 	/* If this returned a block number, we didn't find room in any of the
-	 * existing directory blocks, so we need to make a new one, stick it in the
-	 * dir inode, and stick our dirent at the beginning.  The reclen is the
-	 * whole blocksize (since it's the last entry in this block) */
+	 * existing directory blocks.  If we just filled up the first block, we
+	 * switch to an indexed dir (like Linux does).  Otherwise, we need to make a
+	 * new one, stick it in the dir inode, and stick our dirent at the
+	 * beginning.  The reclen is the whole blocksize (since it's the last entry
+	 * in this block) */
 	if (dir_block) {
+		if ((dir_block == 1) && ext2_has_dir_index(dir->i_sb) &&
+		    !ext2_dx_make_indexed(dir))
+			return ext2_dx_add_entry(dir, dentry, our_rec_len);
 		new_dirent = ext2_get_ino_metablock(dir, dir_block);
 		ext2_write_dirent(new_dirent, dentry, dentry->d_sb->s_blocksize);
 		ext2_dirty_metablock(dentry->d_sb, new_dirent);
 		ext2_put_metablock(dentry->d_sb, new_dirent);
+		ext2_sync_diskinode(dir);
 	}
 	return 0;
 }
 
+/* Called when creating a new disk inode in dir associated with dentry.  We need
+ * to fill out the i_ino, set the type, and do whatever else we need */
+int ext2_create(struct inode *dir, struct dentry *dentry, int mode,
+               struct nameidata *nd)
+{
+	struct inode *inode = dentry->d_inode;
+	/* Set basic inode stuff for files, get a disk inode, etc */
+	SET_FTYPE(inode->i_mode, __S_IFREG);
+	inode->i_fop = &ext2_f_op_file;
+	ext2_new_diskinode(dir, inode);
+	return ext2_add_dirent(dir, dentry, mode);
+}
+
 /* If we match, this loads the inode for the dentry and returns true (so we
  * break out) */
 static bool lookup_each_func(struct ext2_dirent *dir_i, long a1, long a2,
                              long a3)
 {
 	struct dentry *dentry = (struct dentry*)a1;
+	/* Unused entries (and dx index nodes) have no inode */
+	if (!le32_to_cpu(dir_i->dir_inode))
+		return FALSE;
 	/* Test if we're the one (TODO: use d_compare).  Note, dir_name is not
 	 * null terminated, hence the && test. */
 	if (!strncmp((char*)dir_i->dir_name, dentry->d_name.name,
@@ -1154,9 +2224,19 @@ struct dentry *ext2_lookup(struct inode *dir, struct dentry *dentry,
                            struct nameidata *nd)
 {
 	assert(S_ISDIR(dir->i_mode));
-	struct ext2_dirent *dir_buf, *dir_i;
+	int retval;
+	/* Use the hash index if there is one, falling back to the linear scan if
+	 * the index is busted.  The linear scan works on indexed dirs too. */
+	if ((dir->i_flags & EXT2_INDEX_FL) && ext2_has_dir_index(dir->i_sb)) {
+		retval = ext2_dx_lookup(dir, dentry);
+		if (!retval)
+			return dentry;
+		if (retval == -ENOENT)
+			goto not_found;
+	}
 	if (!ext2_foreach_dirent(dir, lookup_each_func, (long)dentry, 0, 0))
 		return dentry;
+not_found:
 	printd("EXT2: Not Found, %s\n", dentry->d_name.name);	
 	return 0;
 }
@@ -1194,18 +2274,51 @@ I_AM_HERE;
 }
 
 /* Called when creating a new inode for a directory associated with dentry in
- * dir with the given mode.  Note, we might (later) need to track subdirs within
- * the parent inode, like we do with regular files.  I'd rather not, so we'll
- * see if we need it. */
+ * dir with the given mode.  The new dir gets one block, with "." and "..", and
+ * a link from each of those and from its dirent in dir. */
 int ext2_mkdir(struct inode *dir, struct dentry *dentry, int mode)
 {
-I_AM_HERE;
-	#if 0
 	struct inode *inode = dentry->d_inode;
-	inode->i_ino = ext2_get_free_ino();
+	struct super_block *sb = inode->i_sb;
+	struct ext2_block_group *bg;
+	struct ext2_inode *dir_disk_inode;
+	struct ext2_dirent *dot, *dotdot;
+	int retval;
+
 	SET_FTYPE(inode->i_mode, __S_IFDIR);
 	inode->i_fop = &ext2_f_op_dir;
-	#endif
+	ext2_new_diskinode(dir, inode);
+	bg = ext2_inode2bg(inode);
+	bg->bg_used_dirs_cnt = cpu_to_le16(le16_to_cpu(bg->bg_used_dirs_cnt) + 1);
+	/* This grows i_size to one block */
+	dot = ext2_get_ino_metablock(inode, 0);
+	dot->dir_inode = cpu_to_le32(inode->i_ino);
+	dot->dir_reclen = cpu_to_le16(12);
+	dot->dir_namelen = 1;
+	dot->dir_filetype = EXT2_FT_DIR;
+	dot->dir_name[0] = '.';
+	dotdot = (void*)dot + 12;
+	dotdot->dir_inode = cpu_to_le32(dir->i_ino);
+	dotdot->dir_reclen = cpu_to_le16(sb->s_blocksize - 12);
+	dotdot->dir_namelen = 2;
+	dotdot->dir_filetype = EXT2_FT_DIR;
+	dotdot->dir_name[0] = '.';
+	dotdot->dir_name[1] = '.';
+	ext2_dirty_metablock(sb, dot);
+	ext2_put_metablock(sb, dot);
+	inode->i_nlink = 2;
+	ext2_sync_diskinode(inode);
+	/* Adding the dirent can sync dir's disk inode from its i_nlink, so we do
+	 * that first. */
+	if ((retval = ext2_add_dirent(dir, dentry, mode)))
+		return retval;
+	/* Our ".." links to dir.  The VFS bumps dir's i_nlink after we return, so
+	 * we only do the disk's count. */
+	dir_disk_inode = ext2_get_diskinode(dir);
+	dir_disk_inode->i_links_cnt =
+	        cpu_to_le16(le16_to_cpu(dir_disk_inode->i_links_cnt) + 1);
+	ext2_dirty_metablock(sb, dir_disk_inode);
+	ext2_put_metablock(sb, dir_disk_inode);
 	return 0;
 }
 
@@ -1391,6 +2504,10 @@ I_AM_HERE;
 /* Called when the file is about to be closed (file obj freed) */
 int ext2_release(struct inode *inode, struct file *file)
 {
+	/* Once the last writer is gone, don't hold on to blocks we might never
+	 * write.  Other closes leave the window for the writers still going. */
+	if ((file->f_mode & S_IWUSR) && file->f_last_writer)
+		ext2_discard_prealloc(inode);
 	return 0;
 }
 
@@ -1412,7 +2529,7 @@ unsigned int ext2_poll(struct file *file, struct poll_table_struct *poll_table)
 ssize_t ext2_readv(struct file *file, const struct iovec *vector,
                   unsigned long count, off64_t *offset)
 {
-	return -1;
+	return generic_file_readv(file, vector, count, offset);
 }
 
 /* Writes count bytes to a file, starting from (and modifiying) offset, and
@@ -1420,7 +2537,7 @@ ssize_t ext2_readv(struct file *file, const struct iovec *vector,
 ssize_t ext2_writev(struct file *file, const struct iovec *vector,
                   unsigned long count, off64_t *offset)
 {
-	return -1;
+	return generic_file_writev(file, vector, count, offset);
 }
 
 /* Write the contents of file to the page.  Will sort the params later */
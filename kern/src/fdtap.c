@@ -0,0 +1,178 @@
+/* Copyright (c) 2015 The Regents of the University of California
+ * See LICENSE for details.
+ *
+ * FD taps: readiness events for 9ns FDs.
+ *
+ * Each FD has at most one tap, stored in its slot in the proc's open_files.
+ * Adding a tap hands it to the chan's device (the tapfd dev op), which hooks
+ * it up to whatever it uses to track readiness (usually its qio queues) and
+ * calls fire_tap() when that changes.  Closing the FD, exec, and proc
+ * destruction all remove the FD's tap. */
+
+#include <fdtap.h>
+#include <event.h>
+#include <kmalloc.h>
+#include <process.h>
+#include <smp.h>
+#include <syscall.h>
+#include <vfs.h>
+#include <ns.h>
+#include <error.h>
+#include <umem.h>
+
+/* Installs tap in its FD's slot, if the FD still refers to tap's chan and has
+ * no tap yet.  Hold the fgrp lock to keep the FD from changing. */
+static int __install_fd_tap(struct proc *p, struct fd_tap *tap)
+{
+	struct files_struct *open_files = &p->open_files;
+	int ret = -1;
+
+	spin_lock(&open_files->lock);
+	if ((tap->fd < open_files->max_fdset) &&
+	    GET_BITMASK_BIT(open_files->open_fds->fds_bits, tap->fd) &&
+	    !open_files->fd[tap->fd].fd_file &&
+	    !open_files->fd[tap->fd].fd_tap) {
+		open_files->fd[tap->fd].fd_tap = tap;
+		ret = 0;
+	}
+	spin_unlock(&open_files->lock);
+	return ret;
+}
+
+/* Returns 0 on success, -1 with errno set on failure. */
+int add_fd_tap(struct proc *p, struct fd_tap_req *tap_req)
+{
+	ERRSTACK(1);
+	struct fgrp *f = p->fgrp;
+	struct fd_tap *tap;
+	struct chan *chan;
+	struct dev *dev;
+	int ret;
+
+	if (!(tap_req->filter & FDTAP_FILT_ALL) ||
+	    !is_user_rwaddr(tap_req->ev_q, sizeof(struct event_queue))) {
+		set_errno(EINVAL);
+		return -1;
+	}
+	tap = kzmalloc(sizeof(struct fd_tap), KMALLOC_WAIT);
+	tap->proc = p;
+	tap->fd = tap_req->fd;
+	tap->filter = tap_req->filter;
+	tap->ev_q = tap_req->ev_q;
+	tap->ev_id = tap_req->ev_id;
+	tap->data = tap_req->data;
+	if (waserror()) {
+		kfree(tap);
+		poperror();
+		return -1;
+	}
+	chan = fdtochan(f, tap->fd, -1, FALSE, TRUE);
+	poperror();
+	tap->chan = chan;
+	dev = &devtab[chan->type];
+	if (!dev->tapfd) {
+		cclose(chan);
+		kfree(tap);
+		set_errno(ENOSYS);
+		return -1;
+	}
+	if (waserror()) {
+		cclose(chan);
+		kfree(tap);
+		poperror();
+		return -1;
+	}
+	dev->tapfd(chan, tap, FDTAP_CMD_ADD);
+	poperror();
+	/* The FD could have been closed, or even reopened, while we were in the
+	 * device.  Checking under the fgrp lock syncs with fdclose(). */
+	spin_lock(&f->lock);
+	if (!f->closed && (tap->fd <= f->maxfd) && (f->fd[tap->fd] == chan))
+		ret = __install_fd_tap(p, tap);
+	else
+		ret = -1;
+	spin_unlock(&f->lock);
+	if (ret) {
+		free_fd_tap(tap);
+		set_errno(EBUSY);
+		return -1;
+	}
+	return 0;
+}
+
+/* Takes the tap out of fd's slot, if there is one.  The caller frees it. */
+struct fd_tap *take_fd_tap(struct proc *p, int fd)
+{
+	struct files_struct *open_files = &p->open_files;
+	struct fd_tap *tap = 0;
+
+	if (fd < 0)
+		return 0;
+	spin_lock(&open_files->lock);
+	if (fd < open_files->max_fdset) {
+		tap = open_files->fd[fd].fd_tap;
+		open_files->fd[fd].fd_tap = 0;
+	}
+	spin_unlock(&open_files->lock);
+	return tap;
+}
+
+/* Unhooks the tap from its device and frees it.  The device won't fire it
+ * once tapfd returns. */
+void free_fd_tap(struct fd_tap *tap)
+{
+	ERRSTACK(1);
+
+	if (!waserror())
+		devtab[tap->chan->type].tapfd(tap->chan, tap, FDTAP_CMD_REM);
+	poperror();
+	cclose(tap->chan);
+	kfree(tap);
+}
+
+/* Returns 0 on success, -1 with errno set on failure. */
+int remove_fd_tap(struct proc *p, int fd)
+{
+	struct fd_tap *tap = take_fd_tap(p, fd);
+
+	if (!tap) {
+		set_errno(EBADF);
+		return -1;
+	}
+	free_fd_tap(tap);
+	return 0;
+}
+
+/* Called when p's FDs are going away, or when its address space is (exec),
+ * since the taps point at its ev_qs. */
+void remove_all_fd_taps(struct proc *p)
+{
+	struct fd_tap *tap;
+
+	for (int i = 0; i < p->open_files.max_fdset; i++) {
+		tap = take_fd_tap(p, i);
+		if (tap)
+			free_fd_tap(tap);
+	}
+}
+
+/* Devices call this with the conditions that happened, plus FDTAP_FILT_EDGE if
+ * a condition just became true (e.g. an empty queue got data).  Level taps fire
+ * for any of their conditions, edge taps only for transitions.  Hangups are
+ * always edges.  Don't call this from IRQ context. */
+void fire_tap(struct fd_tap *tap, int filter)
+{
+	struct event_msg ev_msg = {0};
+	int fired = filter & tap->filter & FDTAP_FILT_ALL;
+
+	if (!fired)
+		return;
+	if ((tap->filter & FDTAP_FILT_EDGE) && !(filter & FDTAP_FILT_EDGE) &&
+	    !(fired & FDTAP_FILT_HANGUP))
+		return;
+	ev_msg.ev_type = tap->ev_id;
+	ev_msg.ev_arg2 = fired;
+	ev_msg.ev_arg3 = tap->data;
+	ev_msg.ev_arg4 = tap->fd;
+	send_event(tap->proc, tap->ev_q, &ev_msg, 0);
+}
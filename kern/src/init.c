@@ -28,7 +28,7 @@
 #include <manager.h>
 #include <testing.h>
 #include <kmalloc.h>
-#include <hashtable.h>
+#include <chash.h>
 #include <radix.h>
 #include <mm.h>
 #include <frontend.h>
@@ -72,7 +72,7 @@ void kernel_init(multiboot_info_t *mboot_info)
 	pmem_init(multiboot_kaddr);
 	kmem_cache_init();              // Sets up slab allocator
 	kmalloc_init();
-	hashtable_init();
+	chash_init();
 	radix_init();
 	cache_color_alloc_init();       // Inits data structs
 	colored_page_alloc_init();      // Allocates colors for agnostic processes
@@ -30,7 +30,7 @@
 #include <pmap.h>
 #include <slab.h>
 #include <kmalloc.h>
-#include <hashtable.h>
+#include <chash.h>
 #include <radix.h>
 #include <monitor.h>
 #include <kthread.h>
@@ -696,6 +696,141 @@ bool test_kernel_messages(void)
 	return true;
 }
 #endif // CONFIG_X86
+
+/* Funcs and global vars for test_kmsg_latency() */
+#define KMSG_NR_ORDERED		1000
+#define KMSG_NR_PINGPONGS	10000
+#define KMSG_NR_BCASTS		1000
+
+static long kmsg_next_seq;
+static bool kmsg_out_of_order;
+static atomic_t kmsg_counter;
+static long kmsg_pingpongs_left;
+static volatile bool kmsg_pingpong_done;
+
+static void __test_kmsg_order(uint32_t srcid, long a0, long a1, long a2)
+{
+	if (a0 != kmsg_next_seq)
+		kmsg_out_of_order = TRUE;
+	kmsg_next_seq = a0 + 1;
+	atomic_dec(&kmsg_counter);
+}
+
+/* Bounces between two cores, in IRQ context, til we're out of bounces */
+static void __test_kmsg_pingpong(uint32_t srcid, long a0, long a1, long a2)
+{
+	if (!--kmsg_pingpongs_left) {
+		kmsg_pingpong_done = TRUE;
+		return;
+	}
+	send_kernel_message(srcid, __test_kmsg_pingpong, 0, 0, 0, KMSG_IMMEDIATE);
+}
+
+/* Starts the bouncing between us and a0, so that the caller stays out of it */
+static void __test_kmsg_pingpong_start(uint32_t srcid, long a0, long a1,
+                                       long a2)
+{
+	send_kernel_message(a0, __test_kmsg_pingpong, 0, 0, 0, KMSG_IMMEDIATE);
+}
+
+static void __test_kmsg_bcast(uint32_t srcid, long a0, long a1, long a2)
+{
+	atomic_dec(&kmsg_counter);
+}
+
+/* Checks that KMSGs arrive in order and go back to their sender, then prints
+ * how long a one-way send takes, how long a round trip takes between two cores,
+ * and how long it takes to get an IMMED to every other core, one send at a time
+ * and with send_kernel_message_multi(). */
+bool test_kmsg_latency(void)
+{
+	uint32_t pc_arr[MAX_NUM_CPUS];
+	uint32_t nr_others = 0;
+	uint64_t start, unicast_ticks = 0, multi_ticks = 0;
+
+	for (int i = 0; i < num_cpus; i++) {
+		if (i != core_id())
+			pc_arr[nr_others++] = i;
+	}
+	if (nr_others < 2) {
+		printk("Need at least 3 cores to test kmsg latency, skipping\n");
+		return true;
+	}
+
+	/* Each class of KMSG runs in the order it was sent */
+	kmsg_next_seq = 0;
+	kmsg_out_of_order = FALSE;
+	atomic_init(&kmsg_counter, KMSG_NR_ORDERED);
+	for (long i = 0; i < KMSG_NR_ORDERED; i++) {
+		send_kernel_message(pc_arr[0], __test_kmsg_order, i, 0, 0,
+		                    KMSG_ROUTINE);
+	}
+	while (atomic_read(&kmsg_counter))
+		cpu_relax();
+	KT_ASSERT_M("Routine KMSGs should run in the order they were sent",
+	            !kmsg_out_of_order);
+	kmsg_next_seq = 0;
+	atomic_init(&kmsg_counter, KMSG_NR_ORDERED);
+	for (long i = 0; i < KMSG_NR_ORDERED; i++) {
+		send_kernel_message(pc_arr[0], __test_kmsg_order, i, 0, 0,
+		                    KMSG_IMMEDIATE);
+	}
+	while (atomic_read(&kmsg_counter))
+		cpu_relax();
+	KT_ASSERT_M("Immediate KMSGs should run in the order they were sent",
+	            !kmsg_out_of_order);
+
+	/* One way: we stream IMMEDs at another core, which gives them back to us */
+	atomic_init(&kmsg_counter, KMSG_NR_ORDERED);
+	start = read_tsc();
+	for (int i = 0; i < KMSG_NR_ORDERED; i++)
+		send_kernel_message(pc_arr[0], __test_kmsg_bcast, 0, 0, 0,
+		                    KMSG_IMMEDIATE);
+	start = read_tsc() - start;
+	while (atomic_read(&kmsg_counter))
+		cpu_relax();
+	printk("KMSG one-way stream: %llu ticks per send\n",
+	       start / KMSG_NR_ORDERED);
+	KT_ASSERT_M("KMSGs should go back to their sender once they've run",
+	            ACCESS_ONCE(per_cpu_info[core_id()].kmsgs.returns) ||
+	            per_cpu_info[core_id()].nr_kmsg_cache);
+
+	/* Two other cores bounce an IMMED back and forth */
+	kmsg_pingpongs_left = KMSG_NR_PINGPONGS * 2;
+	kmsg_pingpong_done = FALSE;
+	wmb();
+	start = read_tsc();
+	send_kernel_message(pc_arr[1], __test_kmsg_pingpong_start, pc_arr[0], 0, 0,
+	                    KMSG_IMMEDIATE);
+	while (!kmsg_pingpong_done)
+		cpu_relax();
+	start = read_tsc() - start;
+	printk("KMSG ping-pong: %llu ticks (%llu nsec) per round trip\n",
+	       start / KMSG_NR_PINGPONGS, tsc2nsec(start) / KMSG_NR_PINGPONGS);
+
+	for (int i = 0; i < KMSG_NR_BCASTS; i++) {
+		atomic_init(&kmsg_counter, nr_others);
+		start = read_tsc();
+		for (int j = 0; j < nr_others; j++)
+			send_kernel_message(pc_arr[j], __test_kmsg_bcast, 0, 0, 0,
+			                    KMSG_IMMEDIATE);
+		while (atomic_read(&kmsg_counter))
+			cpu_relax();
+		unicast_ticks += read_tsc() - start;
+		atomic_init(&kmsg_counter, nr_others);
+		start = read_tsc();
+		send_kernel_message_multi(pc_arr, nr_others, __test_kmsg_bcast, 0, 0,
+		                          0, KMSG_IMMEDIATE);
+		while (atomic_read(&kmsg_counter))
+			cpu_relax();
+		multi_ticks += read_tsc() - start;
+	}
+	printk("KMSG broadcast to %d cores: %llu ticks one at a time, %llu ticks "
+	       "multicast\n", nr_others, unicast_ticks / KMSG_NR_BCASTS,
+	       multi_ticks / KMSG_NR_BCASTS);
+
+	return true;
+}
 static void test_single_cache(int iters, size_t size, int align, int flags,
                               void (*ctor)(void *, size_t),
                               void (*dtor)(void *, size_t))
@@ -759,117 +894,172 @@ bool test_kmalloc(void)
 	return true;
 }
 
-static size_t test_hash_fn_col(void *k)
+#define CHASH_NR_SHARED		4096
+#define CHASH_NR_PER_CORE	1024
+#define CHASH_NR_LOOKUPS	100000
+
+static struct chash *test_ch;
+static atomic_t chash_counter;
+static uint64_t chash_lookup_ticks[MAX_NUM_CPUS];
+static uint64_t chash_insert_ticks[MAX_NUM_CPUS];
+static bool chash_lookup_failed;
+
+static void *test_chash_val(uintptr_t k)
 {
-	return (size_t)k % 2; // collisions in slots 0 and 1
+	return (void*)(k ^ 0xf00d0000);
 }
 
-bool test_hashtable(void)
+static size_t test_hash_fn_col(void *k)
 {
-	struct test {int x; int y;};
-	struct test tstruct[10];
-
-	struct hashtable *h;
-	uintptr_t k = 5;
-	struct test *v = &tstruct[0];
-
-	h = create_hashtable(32, __generic_hash, __generic_eq);
-	
-	// test inserting one item, then finding it again
-	KT_ASSERT_M("It should be possible to insert items to a hashtable", 
-	            hashtable_insert(h, (void*)k, v));
-	v = NULL;
-	KT_ASSERT_M("It should be possible to find inserted stuff in a hashtable", 
-	            (v = hashtable_search(h, (void*)k)));
-
-	KT_ASSERT_M("The extracted element should be the same we inserted", 
-	            (v == &tstruct[0]));
-
-	v = NULL;
-
-	KT_ASSERT_M("It should be possible to remove an existing element", 
-	            (v = hashtable_remove(h, (void*)k)));
+	return (size_t)k % 2; // collisions in buckets 0 and 1
+}
 
-	KT_ASSERT_M("An element should not remain in a hashtable after deletion", 
-	            !(v = hashtable_search(h, (void*)k)));
+/* Each core adds and removes its own keys, while looking up the shared ones,
+ * which all cores hit in the same buckets.  The table grows while we do it. */
+static void __test_chash_worker(uint32_t srcid, long a0, long a1, long a2)
+{
+	struct chash_reader *rd;
+	uintptr_t base = CHASH_NR_SHARED + core_id() * CHASH_NR_PER_CORE;
+	uintptr_t k;
+	uint64_t start;
 
-	/* Testing a bunch of items, insert, search, and removal */
-	for (int i = 0; i < 10; i++) {
-		k = i; // vary the key, we don't do KEY collisions
-		KT_ASSERT_M("It should be possible to insert elements to a hashtable", 
-		            (hashtable_insert(h, (void*)k, &tstruct[i])));
-	}
-	// read out the 10 items
-	for (int i = 0; i < 10; i++) {
-		k = i;
-		KT_ASSERT_M("It should be possible to find inserted stuff in a hashtable", 
-		            (v = hashtable_search(h, (void*)k)));
-		KT_ASSERT_M("The extracted element should be the same we inserted", 
-		            (v == &tstruct[i]));
+	start = read_tsc();
+	for (int i = 0; i < CHASH_NR_PER_CORE; i++) {
+		if (!chash_insert(test_ch, (void*)(base + i),
+		                  test_chash_val(base + i)))
+			chash_lookup_failed = TRUE;
 	}
-
-	KT_ASSERT_M("The total count of number of elements should be 10", 
-	            (10 == hashtable_count(h)));
-
-	// remove the 10 items
-	for (int i = 0; i < 10; i++) {
-		k = i;
-		KT_ASSERT_M("It should be possible to remove an existing element", 
-		            (v = hashtable_remove(h, (void*)k)));
-
+	chash_insert_ticks[core_id()] = read_tsc() - start;
+	start = read_tsc();
+	for (int i = 0; i < CHASH_NR_LOOKUPS; i++) {
+		k = (i * 7919) % CHASH_NR_SHARED;
+		rd = chash_read_lock();
+		if (chash_lookup(test_ch, (void*)k) != test_chash_val(k))
+			chash_lookup_failed = TRUE;
+		chash_read_unlock(rd);
 	}
-	// make sure they are all gone
-	for (int i = 0; i < 10; i++) {
-		k = i;
-		KT_ASSERT_M("An element should not remain in a hashtable after deletion", 
-		            !(v = hashtable_search(h, (void*)k)));
+	chash_lookup_ticks[core_id()] = read_tsc() - start;
+	for (int i = 0; i < CHASH_NR_PER_CORE; i++) {
+		rd = chash_read_lock();
+		if (chash_lookup(test_ch, (void*)(base + i)) !=
+		    test_chash_val(base + i))
+			chash_lookup_failed = TRUE;
+		chash_read_unlock(rd);
+		if (chash_remove(test_ch, (void*)(base + i)) !=
+		    test_chash_val(base + i))
+			chash_lookup_failed = TRUE;
 	}
+	atomic_dec(&chash_counter);
+}
 
-	KT_ASSERT_M("The hashtable should be empty", 
-	            (0 == hashtable_count(h)));
-
-	hashtable_destroy(h);
-
-	// same test of a bunch of items, but with collisions.
-	/* Testing a bunch of items with collisions, etc. */
-	h = create_hashtable(32, test_hash_fn_col, __generic_eq);
-	// insert 10 items
-	for (int i = 0; i < 10; i++) {
-		k = i; // vary the key, we don't do KEY collisions
+bool test_chash(void)
+{
+	struct chash_reader *rd;
+	uintptr_t k;
+	bool ok;
+	uint64_t lookup_ticks = 0, insert_ticks = 0;
+	size_t count = 0;
 
-		KT_ASSERT_M("It should be possible to insert elements to a hashtable", 
-		            (hashtable_insert(h, (void*)k, &tstruct[i])));
-	}
-	// read out the 10 items
-	for (int i = 0; i < 10; i++) {
-		k = i;
-		KT_ASSERT_M("It should be possible to find inserted stuff in a hashtable", 
-		            (v = hashtable_search(h, (void*)k)));
-		KT_ASSERT_M("The extracted element should be the same we inserted", 
-		            (v == &tstruct[i]));
+	void count_item(void *v)
+	{
+		count++;
 	}
 
-	KT_ASSERT_M("The total count of number of elements should be 10", 
-	            (10 == hashtable_count(h)));
-
-	// remove the 10 items
-	for (int i = 0; i < 10; i++) {
-		k = i;
-		KT_ASSERT_M("It should be possible to remove an existing element", 
-		            (v = hashtable_remove(h, (void*)k)));
+	test_ch = chash_create(16, __generic_hash, __generic_eq);
+	KT_ASSERT_M("It should be possible to create a chash", test_ch);
+
+	/* One item */
+	KT_ASSERT_M("It should be possible to insert items to a chash",
+	            chash_insert(test_ch, (void*)5, test_chash_val(5)));
+	rd = chash_read_lock();
+	ok = chash_lookup(test_ch, (void*)5) == test_chash_val(5);
+	chash_read_unlock(rd);
+	KT_ASSERT_M("The extracted element should be the same we inserted", ok);
+	KT_ASSERT_M("It should be possible to remove an existing element",
+	            chash_remove(test_ch, (void*)5) == test_chash_val(5));
+	rd = chash_read_lock();
+	ok = !chash_lookup(test_ch, (void*)5);
+	chash_read_unlock(rd);
+	KT_ASSERT_M("An element should not remain in a chash after deletion", ok);
+	chash_destroy(test_ch);
+
+	/* Lots of collisions: these need more slots than a bucket has */
+	test_ch = chash_create(16, test_hash_fn_col, __generic_eq);
+	KT_ASSERT_M("It should be possible to create a chash", test_ch);
+	for (k = 0; k < 10 * CHASH_SLOTS; k++)
+		KT_ASSERT_M("It should be possible to insert colliding items",
+		            chash_insert(test_ch, (void*)k, test_chash_val(k)));
+	ok = TRUE;
+	rd = chash_read_lock();
+	for (k = 0; k < 10 * CHASH_SLOTS; k++)
+		ok &= chash_lookup(test_ch, (void*)k) == test_chash_val(k);
+	chash_read_unlock(rd);
+	KT_ASSERT_M("Colliding items should be findable", ok);
+	/* Emptied slots in the middle of a chain get reused */
+	for (k = 0; k < 10 * CHASH_SLOTS; k += 3)
+		KT_ASSERT_M("It should be possible to remove a colliding item",
+		            chash_remove(test_ch, (void*)k) == test_chash_val(k));
+	for (k = 0; k < 10 * CHASH_SLOTS; k += 3)
+		KT_ASSERT_M("It should be possible to reinsert a colliding item",
+		            chash_insert(test_ch, (void*)k, test_chash_val(k)));
+	ok = TRUE;
+	rd = chash_read_lock();
+	for (k = 0; k < 10 * CHASH_SLOTS; k++)
+		ok &= chash_lookup(test_ch, (void*)k) == test_chash_val(k);
+	chash_read_unlock(rd);
+	KT_ASSERT_M("Colliding items should be findable after reuse", ok);
+	for (k = 0; k < 10 * CHASH_SLOTS; k++)
+		KT_ASSERT_M("It should be possible to remove a colliding item",
+		            chash_remove(test_ch, (void*)k) == test_chash_val(k));
+	KT_ASSERT_M("The chash should be empty", !chash_count(test_ch));
+	chash_destroy(test_ch);
+
+	/* A bunch of items, enough to grow the table a few times */
+	test_ch = chash_create(16, __generic_hash, __generic_eq);
+	KT_ASSERT_M("It should be possible to create a chash", test_ch);
+	for (k = 0; k < CHASH_NR_SHARED; k++) {
+		KT_ASSERT_M("It should be possible to insert items to a chash",
+		            chash_insert(test_ch, (void*)k, test_chash_val(k)));
+		/* Everything should be findable at every point of the growing */
+		ok = TRUE;
+		rd = chash_read_lock();
+		for (uintptr_t j = 0; j <= k; j += 61)
+			ok &= chash_lookup(test_ch, (void*)j) == test_chash_val(j);
+		chash_read_unlock(rd);
+		KT_ASSERT_M("Items should be findable while the chash grows", ok);
 	}
-	// make sure they are all gone
-	for (int i = 0; i < 10; i++) {
-		k = i;
-
-		KT_ASSERT_M("An element should not remain in a hashtable after deletion", 
-		            !(v = hashtable_search(h, (void*)k)));
+	KT_ASSERT_M("The chash should count every item",
+	            chash_count(test_ch) == CHASH_NR_SHARED);
+	chash_for_each(test_ch, count_item);
+	KT_ASSERT_M("chash_for_each should see every item exactly once",
+	            count == CHASH_NR_SHARED);
+
+	/* Concurrent inserts, lookups, and removes on every other core.  We can't
+	 * send one to ourselves, since we spin until they are done. */
+	chash_lookup_failed = FALSE;
+	atomic_init(&chash_counter, num_cpus - 1);
+	for (int i = 1; i < num_cpus; i++)
+		send_kernel_message(i, __test_chash_worker, 0, 0, 0, KMSG_ROUTINE);
+	while (atomic_read(&chash_counter))
+		cpu_relax();
+	KT_ASSERT_M("Concurrent chash lookups should find the right items",
+	            !chash_lookup_failed);
+	KT_ASSERT_M("Only the shared items should remain in the chash",
+	            chash_count(test_ch) == CHASH_NR_SHARED);
+	for (int i = 1; i < num_cpus; i++) {
+		lookup_ticks += chash_lookup_ticks[i];
+		insert_ticks += chash_insert_ticks[i];
 	}
+	if (num_cpus > 1)
+		printk("chash on %d cores: %llu ticks/lookup, %llu ticks/insert\n",
+		       num_cpus - 1, lookup_ticks / ((num_cpus - 1) * CHASH_NR_LOOKUPS),
+		       insert_ticks / ((num_cpus - 1) * CHASH_NR_PER_CORE));
 
-	KT_ASSERT_M("The hashtable should be empty", 
-	            (0 == hashtable_count(h)));
-
-	hashtable_destroy(h);
+	for (k = 0; k < CHASH_NR_SHARED; k++)
+		KT_ASSERT_M("It should be possible to remove an existing element",
+		            chash_remove(test_ch, (void*)k) == test_chash_val(k));
+	KT_ASSERT_M("The chash should be empty", !chash_count(test_ch));
+	chash_destroy(test_ch);
 
 	return true;
 }
@@ -1992,6 +2182,247 @@ bool test_kmalloc_incref(void)
 	return TRUE;
 }
 
+#define KSCHED_NR_LOOPS 20000
+
+struct ksched_stress_worker {
+	struct proc					*p;
+	uint64_t					nr_grants;
+	uint64_t					nr_misses;
+	uint64_t					grant_ticks;
+	uint64_t					max_ticks;
+	bool						double_grant;
+};
+static struct ksched_stress_worker ksched_workers[MAX_NUM_CPUS];
+static struct proc *ksched_core_owner[MAX_NUM_CPUS];
+static atomic_t ksched_workers_left;
+
+/* Each worker acts like an MCP that keeps asking for a core and yielding it,
+ * and every so often provisions the core it has, so the prov lists see some
+ * traffic too. */
+static void __test_ksched_stress(uint32_t srcid, long a0, long a1, long a2)
+{
+	struct ksched_stress_worker *w = &ksched_workers[a0];
+	uint64_t start, ticks;
+	int pcoreid;
+
+	for (int i = 0; i < KSCHED_NR_LOOPS; i++) {
+		start = read_tsc();
+		pcoreid = __sched_claim_idle_core(w->p);
+		ticks = read_tsc() - start;
+		if (pcoreid < 0) {
+			w->nr_misses++;
+			cpu_relax();
+			continue;
+		}
+		w->nr_grants++;
+		w->grant_ticks += ticks;
+		w->max_ticks = MAX(w->max_ticks, ticks);
+		if (!atomic_cas_ptr((void**)&ksched_core_owner[pcoreid], 0, w->p))
+			w->double_grant = TRUE;
+		if (!(i % 8))
+			provision_core(w->p, pcoreid);
+		for (int j = 0; j < i % 64; j++)
+			cpu_relax();
+		ksched_core_owner[pcoreid] = 0;
+		__sched_put_idle_core(w->p, pcoreid);
+		if (!(i % 8))
+			provision_core(0, pcoreid);
+	}
+	atomic_dec(&ksched_workers_left);
+}
+
+/* Claims every idle core, then gives them all back.  Returns how many. */
+static int ksched_count_idle(struct proc *p)
+{
+	uint32_t pc_arr[MAX_NUM_CPUS];
+	int nr = 0, pcoreid;
+
+	while ((pcoreid = __sched_claim_idle_core(p)) >= 0)
+		pc_arr[nr++] = pcoreid;
+	for (int i = 0; i < nr; i++)
+		__sched_put_idle_core(p, pc_arr[i]);
+	return nr;
+}
+
+static struct proc *ksched_fake_proc(void)
+{
+	struct proc *p = kzmalloc(sizeof(struct proc), KMALLOC_WAIT);
+
+	TAILQ_INIT(&p->ksched_data.prov_alloc_me);
+	TAILQ_INIT(&p->ksched_data.prov_not_alloc_me);
+	p->ksched_data.placement = CORE_PLACE_ANY;
+	p->ksched_data.runq = -1;
+	p->ksched_data.runq_idx = -1;
+	return p;
+}
+
+bool test_ksched_stress(void)
+{
+	uint32_t nr_workers = 0;
+	uint64_t nr_grants = 0, nr_misses = 0, grant_ticks = 0, max_ticks = 0;
+	int nr_idle;
+	struct proc *counter = ksched_fake_proc();
+
+	nr_idle = ksched_count_idle(counter);
+	/* Workers run on every core but this one (which is spinning) */
+	for (int i = 0; i < num_cpus; i++) {
+		if (i == core_id())
+			continue;
+		memset(&ksched_workers[nr_workers], 0,
+		       sizeof(struct ksched_stress_worker));
+		ksched_workers[nr_workers].p = ksched_fake_proc();
+		nr_workers++;
+	}
+	if (nr_workers < 2 || !nr_idle) {
+		printk("Need at least 2 idle cores to stress the ksched, skipping\n");
+		for (int i = 0; i < nr_workers; i++)
+			kfree(ksched_workers[i].p);
+		kfree(counter);
+		return true;
+	}
+	memset(ksched_core_owner, 0, sizeof(ksched_core_owner));
+	atomic_init(&ksched_workers_left, nr_workers);
+	for (int i = 0, w = 0; i < num_cpus; i++) {
+		if (i == core_id())
+			continue;
+		send_kernel_message(i, __test_ksched_stress, w++, 0, 0, KMSG_ROUTINE);
+	}
+	while (atomic_read(&ksched_workers_left))
+		cpu_relax();
+
+	for (int i = 0; i < nr_workers; i++) {
+		KT_ASSERT_M("No core should be granted to two procs at once",
+		            !ksched_workers[i].double_grant);
+		KT_ASSERT_M("Workers should have unprovisioned everything",
+		            TAILQ_EMPTY(&ksched_workers[i].p->ksched_data.prov_alloc_me)
+		            && TAILQ_EMPTY(&ksched_workers[i].p->ksched_data.
+		                           prov_not_alloc_me));
+		nr_grants += ksched_workers[i].nr_grants;
+		nr_misses += ksched_workers[i].nr_misses;
+		grant_ticks += ksched_workers[i].grant_ticks;
+		max_ticks = MAX(max_ticks, ksched_workers[i].max_ticks);
+		kfree(ksched_workers[i].p);
+	}
+	KT_ASSERT_M("Every core should be idle again",
+	            ksched_count_idle(counter) == nr_idle);
+	kfree(counter);
+	KT_ASSERT_M("Workers should have gotten some cores", nr_grants);
+	printk("ksched: %d workers, %d idle cores: %llu grants, %llu misses, "
+	       "%llu nsec avg grant, %llu nsec max\n", nr_workers, nr_idle,
+	       nr_grants, nr_misses, tsc2nsec(grant_ticks / nr_grants),
+	       tsc2nsec(max_ticks));
+	return true;
+}
+
+#define IDLE_NR_WAKEUPS		1000
+#define IDLE_GAP_USEC		20		/* long enough for the core to go idle */
+#define IDLE_POLL_USEC		1000	/* longer than the gap, so POLL polls */
+
+static volatile bool idle_woke;
+static bool idle_saw_polling;
+
+static void __test_idle_wakeup(uint32_t srcid, long a0, long a1, long a2)
+{
+	if (per_cpu_info[core_id()].kmsgs.polling)
+		idle_saw_polling = TRUE;
+	idle_woke = TRUE;
+}
+
+/* Times how long it takes from sending an RKM to an idle core til it runs, for
+ * each idle mode.  A halted core needs the IPI; polling and MWAITing cores just
+ * see the push. */
+bool test_idle_wakeup(void)
+{
+	static char *mode_names[NR_IDLE_MODES] = {"halt", "mwait", "poll"};
+	uint32_t target = (core_id() + 1) % num_cpus;
+	struct per_cpu_info *pcpui = &per_cpu_info[target];
+	int old_mode = pcpui->idle_mode;
+	uint64_t old_poll_ticks = pcpui->idle_poll_ticks;
+	uint64_t start, ticks, total, max;
+
+	if (num_cpus < 2) {
+		printk("Need at least 2 cores to test idle wakeups, skipping\n");
+		return true;
+	}
+	idle_saw_polling = FALSE;
+	for (int mode = 0; mode < NR_IDLE_MODES; mode++) {
+		KT_ASSERT_M("Should be able to set the idle mode",
+		            !set_cpu_idle_mode(target, mode, IDLE_POLL_USEC));
+		/* The core picks up its new mode the next time it idles */
+		idle_woke = FALSE;
+		send_kernel_message(target, __test_idle_wakeup, 0, 0, 0, KMSG_ROUTINE);
+		while (!idle_woke)
+			cpu_relax();
+		total = 0;
+		max = 0;
+		for (int i = 0; i < IDLE_NR_WAKEUPS; i++) {
+			udelay(IDLE_GAP_USEC);
+			idle_woke = FALSE;
+			start = read_tsc();
+			send_kernel_message(target, __test_idle_wakeup, 0, 0, 0,
+			                    KMSG_ROUTINE);
+			while (!idle_woke)
+				cpu_relax();
+			ticks = read_tsc() - start;
+			total += ticks;
+			max = MAX(max, ticks);
+		}
+		printk("idle %s (really %s): %llu nsec avg wakeup, %llu nsec max\n",
+		       mode_names[mode], mode_names[pcpui->idle_mode],
+		       tsc2nsec(total / IDLE_NR_WAKEUPS), tsc2nsec(max));
+	}
+	KT_ASSERT_M("Cores should stop polling before running RKMs",
+	            !idle_saw_polling);
+	set_cpu_idle_mode(target, old_mode, tsc2usec(old_poll_ticks));
+	return true;
+}
+
+#define RUNQ_NR_PROCS		64
+#define RUNQ_NR_DROPS		20
+
+/* Checks that the SCP runq heaps give procs back by vruntime, even after
+ * removals from the middle, and that nice values map to sane weights. */
+bool test_scp_runq(void)
+{
+	struct proc *procs[RUNQ_NR_PROCS], *popped[RUNQ_NR_PROCS];
+	int nr;
+
+	KT_ASSERT_M("Nice 0 should have the base weight",
+	            sched_nice_weight(0) == 1024);
+	for (int n = SCHED_NICE_MIN; n < SCHED_NICE_MAX; n++) {
+		KT_ASSERT_M("Lower nice values should get more weight",
+		            sched_nice_weight(n) > sched_nice_weight(n + 1));
+		KT_ASSERT_M("Each nice step should be about 1.25x",
+		            (sched_nice_weight(n) * 100 >=
+		             sched_nice_weight(n + 1) * 115) &&
+		            (sched_nice_weight(n) * 100 <=
+		             sched_nice_weight(n + 1) * 135));
+	}
+	for (int i = 0; i < RUNQ_NR_PROCS; i++) {
+		procs[i] = ksched_fake_proc();
+		/* scrambled, with some duplicates */
+		procs[i]->ksched_data.vruntime = (i * 37) % (RUNQ_NR_PROCS / 2);
+		popped[i] = procs[i];
+	}
+	nr = __sched_runq_sort(popped, RUNQ_NR_PROCS, RUNQ_NR_DROPS);
+	KT_ASSERT_M("Everything not dropped should come off the runq",
+	            nr == RUNQ_NR_PROCS - RUNQ_NR_DROPS);
+	for (int i = 0; i < nr; i++) {
+		if (i)
+			KT_ASSERT_M("Procs should come off the runq by vruntime",
+			            popped[i - 1]->ksched_data.vruntime <=
+			            popped[i]->ksched_data.vruntime);
+		for (int j = 0; j < RUNQ_NR_DROPS; j++)
+			KT_ASSERT_M("Dropped procs should stay off the runq",
+			            popped[i] != procs[j]);
+		KT_ASSERT_M("Popped procs should not think they're on a runq",
+		            popped[i]->ksched_data.runq_idx == -1);
+	}
+	for (int i = 0; i < RUNQ_NR_PROCS; i++)
+		kfree(procs[i]);
+	return true;
+}
+
 static struct ktest ktests[] = {
 #ifdef CONFIG_X86
 	KTEST_REG(ipi_sending,        CONFIG_TEST_ipi_sending),
@@ -2000,6 +2431,7 @@ static struct ktest ktests[] = {
 	KTEST_REG(pit,                CONFIG_TEST_pit),
 	KTEST_REG(circ_buffer,        CONFIG_TEST_circ_buffer),
 	KTEST_REG(kernel_messages,    CONFIG_TEST_kernel_messages),
+	KTEST_REG(kmsg_latency,       CONFIG_TEST_kmsg_latency),
 #endif // CONFIG_X86
 #ifdef CONFIG_PAGE_COLORING
 	KTEST_REG(page_coloring,      CONFIG_TEST_page_coloring),
@@ -2012,7 +2444,7 @@ static struct ktest ktests[] = {
 	KTEST_REG(smp_call_functions, CONFIG_TEST_smp_call_functions),
 	KTEST_REG(slab,               CONFIG_TEST_slab),
 	KTEST_REG(kmalloc,            CONFIG_TEST_kmalloc),
-	KTEST_REG(hashtable,          CONFIG_TEST_hashtable),
+	KTEST_REG(chash,              CONFIG_TEST_chash),
 	KTEST_REG(bcq,                CONFIG_TEST_bcq),
 	KTEST_REG(ucq,                CONFIG_TEST_ucq),
 	KTEST_REG(vm_regions,         CONFIG_TEST_vm_regions),
@@ -2030,6 +2462,9 @@ static struct ktest ktests[] = {
 	KTEST_REG(rv,                 CONFIG_TEST_rv),
 	KTEST_REG(alarm,              CONFIG_TEST_alarm),
 	KTEST_REG(kmalloc_incref,     CONFIG_TEST_kmalloc_incref),
+	KTEST_REG(ksched_stress,      CONFIG_TEST_ksched_stress),
+	KTEST_REG(idle_wakeup,        CONFIG_TEST_idle_wakeup),
+	KTEST_REG(scp_runq,           CONFIG_TEST_scp_runq),
 };
 static int num_ktests = sizeof(ktests) / sizeof(struct ktest);
 linker_func_1(register_pb_ktests)
@@ -98,7 +98,7 @@ void restart_kthread(struct kthread *kthread)
 	/* Only change current if we need to (the kthread was in process context) */
 	if (kthread->proc) {
 		/* Load our page tables before potentially decreffing cur_proc */
-		lcr3(kthread->proc->env_cr3);
+		proc_load_cr3(pcpui->cur_proc, kthread->proc);
 		/* Might have to clear out an existing current.  If they need to be set
 		 * later (like in restartcore), it'll be done on demand. */
 		if (pcpui->cur_proc)
@@ -233,15 +233,25 @@ struct vm_region *find_first_vmr(struct proc *p, uintptr_t va)
 }
 
 /* Makes sure that no VMRs cross either the start or end of the given region
- * [va, va + len), splitting any VMRs that are on the endpoints. */
-void isolate_vmrs(struct proc *p, uintptr_t va, size_t len)
+ * [va, va + len), splitting any VMRs that are on the endpoints.  Jumbo pages
+ * can't cross VMRs either, so we break up any on the endpoints too.  Returns 0
+ * on success, -ENOMEM if we couldn't break up a jumbo. */
+int isolate_vmrs(struct proc *p, uintptr_t va, size_t len)
 {
 	struct vm_region *vmr;
+	int ret;
+
 	if ((vmr = find_vmr(p, va)))
 		split_vmr(vmr, va);
 	/* TODO: don't want to do another find (linear search) */
 	if ((vmr = find_vmr(p, va + len)))
 		split_vmr(vmr, va + len);
+	spin_lock(&p->pte_lock);
+	ret = env_split_jumbo(p, (void*)va);
+	if (!ret)
+		ret = env_split_jumbo(p, (void*)(va + len));
+	spin_unlock(&p->pte_lock);
+	return ret;
 }
 
 void unmap_and_destroy_vmrs(struct proc *p)
@@ -265,6 +275,28 @@ void unmap_and_destroy_vmrs(struct proc *p)
 	spin_unlock(&p->vmr_lock);
 }
 
+/* Helper: gives new_p a copy of p's jumbo page at va, of size 1 << shift.  0 on
+ * success, -ERROR on failure. */
+static int copy_jumbo(struct proc *p, struct proc *new_p, uintptr_t va,
+                      int shift)
+{
+	struct page *pp;
+	size_t order = shift - PGSHIFT;
+	pte_t *pte = pgdir_walk(p->env_pgdir, (void*)va, 0);
+
+	assert(!(va & ((1UL << shift) - 1)));
+	if (upage_alloc_jumbo(&pp, order, FALSE))
+		return -ENOMEM;
+	memcpy(page2kva(pp), page2kva(page_lookup(p->env_pgdir, (void*)va, 0)),
+	       1UL << shift);
+	if (pgdir_map_jumbo(new_p->env_pgdir, (void*)va, page2pa(pp),
+	                    *pte & PTE_PERM, shift)) {
+		free_cont_pages(page2kva(pp), order);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
 /* Helper: copies the contents of pages from p to new p.  For pages that aren't
  * present, once we support swapping or CoW, we can do something more
  * intelligent.  0 on success, -ERROR on failure. */
@@ -308,8 +340,29 @@ static int copy_pages(struct proc *p, struct proc *new_p, uintptr_t va_start,
 		}
 		return 0;
 	}
-	return env_user_mem_walk(p, (void*)va_start, va_end - va_start, &copy_page,
-	                         new_p);
+	size_t jumbo_sz = 1UL << pgdir_min_jumbo_shift();
+	uintptr_t va = va_start, next_va;
+	int shift, ret;
+
+	if (jumbo_sz == PGSIZE)
+		return env_user_mem_walk(p, (void*)va_start, va_end - va_start,
+		                         &copy_page, new_p);
+	/* Copy jumbos as jumbos, so the parent doesn't have to demote them for the
+	 * memwalk.  They don't cross VMRs, so each one starts at or after va_start,
+	 * and we'll see its start as we step through one small jumbo at a time. */
+	while (va < va_end) {
+		next_va = MIN(ROUNDUP(va + 1, jumbo_sz), va_end);
+		shift = pgdir_page_shift(p->env_pgdir, (void*)va);
+		if ((shift > PGSHIFT) && !copy_jumbo(p, new_p, va, shift)) {
+			va += 1UL << shift;
+			continue;
+		}
+		ret = env_user_mem_walk(p, (void*)va, next_va - va, &copy_page, new_p);
+		if (ret)
+			return ret;
+		va = next_va;
+	}
+	return 0;
 }
 
 /* This will make new_p have the same VMRs as p, and it will make sure all
@@ -510,22 +563,105 @@ static int __copy_and_swap_pmpg(struct proc *p, struct page **pp)
 	return 0;
 }
 
+/* Transparent jumbo pages for anonymous memory.  A VMR gets them if it asks with
+ * MAP_HUGE, or automatically if it spans at least JUMBO_AUTO_NR of the smallest
+ * jumbos, at which point rounding its usage up to jumbos won't waste much.  Only
+ * MAP_HUGE gets the biggest jumbos (1GB on x86), since zeroing one takes a
+ * while.
+ *
+ * Jumbos never cross a VMR boundary: we only map one when its whole aligned
+ * region is in the VMR, and isolate_vmrs() breaks up any that would straddle a
+ * split.  When we can't get a jumbo (no contiguous memory, or a page table is
+ * already in the way), we just use little pages.  We check for the page table
+ * before allocating, so once part of a range has little pages, faults on the
+ * rest of it go straight to little pages too. */
+#define JUMBO_AUTO_NR			8
+
+/* Helper: tries to map an anonymous jumbo of 1 << shift bytes at va. */
+static bool __map_anon_jumbo(struct proc *p, uintptr_t va, int shift,
+                             int pte_prot)
+{
+	struct page *page;
+	size_t order = shift - PGSHIFT;
+	bool empty;
+	int ret;
+
+	/* Our caller holds the vmr_lock, so no one else is faulting in the range,
+	 * but the pgdir_map_jumbo() still checks again. */
+	spin_lock(&p->pte_lock);
+	empty = pgdir_jumbo_slot_empty(p->env_pgdir, (void*)va, shift);
+	spin_unlock(&p->pte_lock);
+	if (!empty)
+		return FALSE;
+	if (upage_alloc_jumbo(&page, order, TRUE))
+		return FALSE;
+	spin_lock(&p->pte_lock);
+	ret = pgdir_map_jumbo(p->env_pgdir, (void*)va, page2pa(page), pte_prot,
+	                      shift);
+	spin_unlock(&p->pte_lock);
+	if (ret) {
+		free_cont_pages(page2kva(page), order);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Helper: if vmr wants jumbos, tries to map one that covers va and fits in
+ * [start, end).  Returns the size of the jumbo mapped, or 0 if va should get a
+ * little page. */
+static size_t map_anon_jumbo(struct proc *p, struct vm_region *vmr,
+                             uintptr_t va, uintptr_t start, uintptr_t end,
+                             int pte_prot)
+{
+	int shift = pgdir_min_jumbo_shift();
+	int max_shift = pgdir_max_jumbo_shift();
+	uintptr_t base;
+
+	if (vmr->vm_file || (shift == PGSHIFT))
+		return 0;
+	if (!(vmr->vm_flags & MAP_HUGE) &&
+	    (vmr->vm_end - vmr->vm_base < (uintptr_t)JUMBO_AUTO_NR << shift))
+		return 0;
+	if ((vmr->vm_flags & MAP_HUGE) && (max_shift > shift)) {
+		base = ROUNDDOWN(va, 1UL << max_shift);
+		if ((base >= start) && (base + (1UL << max_shift) <= end) &&
+		    __map_anon_jumbo(p, base, max_shift, pte_prot))
+			return 1UL << max_shift;
+	}
+	base = ROUNDDOWN(va, 1UL << shift);
+	if ((base >= start) && (base + (1UL << shift) <= end) &&
+	    __map_anon_jumbo(p, base, shift, pte_prot))
+		return 1UL << shift;
+	return 0;
+}
+
 /* Hold the VMR lock when you call this - it'll assume the entire VA range is
  * mappable, which isn't true if there are concurrent changes to the VMRs. */
-static int populate_anon_va(struct proc *p, uintptr_t va, unsigned long nr_pgs,
-                            int pte_prot)
+static int populate_anon_va(struct proc *p, struct vm_region *vmr, uintptr_t va,
+                            unsigned long nr_pgs, int pte_prot)
 {
 	struct page *page;
+	uintptr_t end = va + (nr_pgs << PGSHIFT);
+	size_t amt;
 	int ret;
-	for (long i = 0; i < nr_pgs; i++) {
+
+	while (va < end) {
+		/* jumbos must start at or after va, so we don't clobber pages before
+		 * the range */
+		amt = map_anon_jumbo(p, vmr, va, va, end, pte_prot);
+		if (amt) {
+			va += amt;
+			continue;
+		}
 		if (upage_alloc(p, &page, TRUE))
 			return -ENOMEM;
 		/* could imagine doing a memwalk instead of a for loop */
-		ret = map_page_at_addr(p, page, va + i * PGSIZE, pte_prot);
+		ret = map_page_at_addr(p, page, va, pte_prot);
 		if (ret) {
 			page_decref(page);
 			return ret;
 		}
+		va += PGSIZE;
 	}
 	return 0;
 }
@@ -662,7 +798,7 @@ void *do_mmap(struct proc *p, uintptr_t addr, size_t len, int prot, int flags,
 		unsigned long nr_pgs = len >> PGSHIFT;
 		int ret = 0;
 		if (!file) {
-			ret = populate_anon_va(p, addr, nr_pgs, pte_prot);
+			ret = populate_anon_va(p, vmr, addr, nr_pgs, pte_prot);
 		} else {
 			/* Note: this will unlock if it blocks.  our refcnt on the file
 			 * keeps the pm alive when we unlock */
@@ -715,7 +851,10 @@ int __do_mprotect(struct proc *p, uintptr_t addr, size_t len, int prot)
 	/* TODO: this is aggressively splitting, when we might not need to if the
 	 * prots are the same as the previous.  Plus, there are three excessive
 	 * scans.  Finally, we might be able to merge when we are done. */
-	isolate_vmrs(p, addr, len);
+	if (isolate_vmrs(p, addr, len)) {
+		set_errno(ENOMEM);
+		return -1;
+	}
 	vmr = find_first_vmr(p, addr);
 	while (vmr && vmr->vm_base < addr + len) {
 		if (vmr->vm_prot == prot)
@@ -730,7 +869,12 @@ int __do_mprotect(struct proc *p, uintptr_t addr, size_t len, int prot)
 		for (uintptr_t va = vmr->vm_base; va < vmr->vm_end; va += PGSIZE) { 
 			pte = pgdir_walk(p->env_pgdir, (void*)va, 0);
 			if (pte && PAGE_PRESENT(*pte)) {
-				*pte = (*pte & ~PTE_PERM) | pte_prot;
+				/* Pages on loan stay read-only until the next write fault */
+				if (!vmr->vm_file && (pte_prot == PTE_USER_RW) &&
+				    (kref_refcnt(&ppn2page(PTE2PPN(*pte))->pg_kref) > 1))
+					*pte = (*pte & ~PTE_PERM) | PTE_USER_RO;
+				else
+					*pte = (*pte & ~PTE_PERM) | pte_prot;
 				shootdown_needed = TRUE;
 			}
 		}
@@ -813,8 +957,12 @@ int __do_munmap(struct proc *p, uintptr_t addr, size_t len)
 	bool shootdown_needed = FALSE;
 
 	/* TODO: this will be a bit slow, since we end up doing three linear
-	 * searches (two in isolate, one in find_first). */
-	isolate_vmrs(p, addr, len);
+	 * searches (two in isolate, one in find_first).  The memwalks below demote
+	 * any jumbos left in the range, which can't cross its ends. */
+	if (isolate_vmrs(p, addr, len)) {
+		set_errno(ENOMEM);
+		return -1;
+	}
 	first_vmr = find_first_vmr(p, addr);
 	vmr = first_vmr;
 	spin_lock(&p->pte_lock);	/* changing PTEs */
@@ -914,6 +1062,59 @@ static int __hpf_load_page(struct proc *p, struct page_map *pm,
  * shootdown is on its way.  Userspace should have waited for the mprotect to
  * return before trying to write (or whatever), so we don't care and will fault
  * them. */
+/* Helper: breaks a loan of the anon page at va.  The kernel loans out anon
+ * pages by making their PTEs read-only and taking a ref (loan_user_pages()), so
+ * a write to a read-only page in a writable VMR is a write to a loaned page.
+ * If we're the only one left with a ref, we can just make it writable again.
+ * Otherwise, we copy it.  Returns TRUE if va had a loaned page, in which case
+ * *ret is the fault's return value.  Hold the vmr_lock. */
+static bool __break_page_loan(struct proc *p, uintptr_t va, int *ret)
+{
+	struct page *old_page, *new_page;
+	pte_t *pte;
+	pte_t old_pte;
+
+	spin_lock(&p->pte_lock);
+	if (pgdir_page_shift(p->env_pgdir, (void*)va) != PGSHIFT) {
+		spin_unlock(&p->pte_lock);
+		return FALSE;
+	}
+	pte = pgdir_walk(p->env_pgdir, (void*)va, FALSE);
+	if (!pte || !PAGE_PRESENT(*pte) || (*pte & PTE_W)) {
+		spin_unlock(&p->pte_lock);
+		return FALSE;
+	}
+	old_pte = *pte;
+	old_page = ppn2page(PTE2PPN(old_pte));
+	*ret = 0;
+	if (kref_refcnt(&old_page->pg_kref) == 1) {
+		/* Stale read-only TLB entries just cause a spurious fault. */
+		*pte = old_pte | PTE_W;
+		spin_unlock(&p->pte_lock);
+		return TRUE;
+	}
+	spin_unlock(&p->pte_lock);
+	if (upage_alloc(p, &new_page, FALSE)) {
+		*ret = -ENOMEM;
+		return TRUE;
+	}
+	memcpy(page2kva(new_page), page2kva(old_page), PGSIZE);
+	spin_lock(&p->pte_lock);
+	if (*pte != old_pte) {
+		/* Someone else broke the loan (or unmapped the page) while we copied.
+		 * If they left it read-only, the user will fault again. */
+		spin_unlock(&p->pte_lock);
+		page_decref(new_page);
+		return TRUE;
+	}
+	/* The PTE's ref on old_page moves to whoever has it on loan */
+	*pte = PTE(page2ppn(new_page), PTE_P | PTE_USER_RW);
+	spin_unlock(&p->pte_lock);
+	proc_tlbshootdown(p, va, va + PGSIZE);
+	page_decref(old_page);
+	return TRUE;
+}
+
 int handle_page_fault(struct proc *p, uintptr_t va, int prot)
 {
 	struct vm_region *vmr;
@@ -921,6 +1122,7 @@ int handle_page_fault(struct proc *p, uintptr_t va, int prot)
 	unsigned int f_idx;	/* index of the missing page in the file */
 	pte_t *pte;
 	int ret = 0;
+	int pte_prot;
 	bool first = TRUE;
 	va = ROUNDDOWN(va,PGSIZE);
 
@@ -939,8 +1141,16 @@ refault:
 		ret = -EPERM;
 		goto out;
 	}
+	/* TODO: careful with MAP_PRIVATE etc.  might do this separately (file, no
+	 * file) */
+	pte_prot = (vmr->vm_prot & PROT_WRITE) ? PTE_USER_RW :
+	           (vmr->vm_prot & (PROT_READ|PROT_EXEC)) ? PTE_USER_RO : 0;
 	if (!vmr->vm_file) {
-		/* No file - just want anonymous memory */
+		if ((prot == PROT_WRITE) && __break_page_loan(p, va, &ret))
+			goto out;
+		/* No file - just want anonymous memory, maybe a whole jumbo of it */
+		if (map_anon_jumbo(p, vmr, va, vmr->vm_base, vmr->vm_end, pte_prot))
+			goto out;
 		if (upage_alloc(p, &a_page, TRUE)) {
 			ret = -ENOMEM;
 			goto out;
@@ -997,10 +1207,7 @@ refault:
 		if (vmr->vm_prot & PROT_EXEC)
 			icache_flush_page((void*)va, page2kva(a_page));
 	}
-	/* update the page table TODO: careful with MAP_PRIVATE etc.  might do this
-	 * separately (file, no file) */
-	int pte_prot = (vmr->vm_prot & PROT_WRITE) ? PTE_USER_RW :
-	               (vmr->vm_prot & (PROT_READ|PROT_EXEC)) ? PTE_USER_RO : 0;
+	/* update the page table */
 	ret = map_page_at_addr(p, a_page, va, pte_prot);
 	/* fall through, even for errors */
 out_put_pg:
@@ -1038,7 +1245,7 @@ unsigned long populate_va(struct proc *p, uintptr_t va, unsigned long nr_pgs)
 		           (vmr->vm_prot & (PROT_READ|PROT_EXEC)) ? PTE_USER_RO : 0;
 		nr_pgs_this_vmr = MIN(nr_pgs, (vmr->vm_end - va) >> PGSHIFT);
 		if (!vmr->vm_file) {
-			if (populate_anon_va(p, va, nr_pgs_this_vmr, pte_prot)) {
+			if (populate_anon_va(p, vmr, va, nr_pgs_this_vmr, pte_prot)) {
 				/* on any error, we can just bail.  we might be underestimating
 				 * nr_filled. */
 				break;
@@ -1064,6 +1271,139 @@ unsigned long populate_va(struct proc *p, uintptr_t va, unsigned long nr_pgs)
 	return nr_filled;
 }
 
+/* Takes a ref on each anon page backing [va, va + nr_pgs * PGSIZE), stopping at
+ * the first one we can't have.  Loans make the PTEs read-only, pins need them
+ * to already be writable.  The caller is about to hand loaned pages to a device
+ * or another reader, so we wait until no core's TLB still lets the user write
+ * them. */
+static int __grab_user_pages(struct proc *p, uintptr_t va, int nr_pgs,
+                             struct page **pages, bool loan)
+{
+	struct vm_region *vmr = 0;
+	pte_t *pte;
+	bool shootdown_needed = FALSE;
+	int i;
+
+	spin_lock(&p->vmr_lock);
+	spin_lock(&p->pte_lock);
+	for (i = 0; i < nr_pgs; i++) {
+		if (!vmr || (va + i * PGSIZE >= vmr->vm_end))
+			vmr = find_vmr(p, va + i * PGSIZE);
+		if (!vmr || vmr->vm_file || !(vmr->vm_prot & PROT_READ))
+			break;
+		if (!loan && !(vmr->vm_prot & PROT_WRITE))
+			break;
+		if (pgdir_page_shift(p->env_pgdir, (void*)va + i * PGSIZE) != PGSHIFT)
+			break;
+		pte = pgdir_walk(p->env_pgdir, (void*)va + i * PGSIZE, FALSE);
+		if (!pte || !PAGE_PRESENT(*pte))
+			break;
+		if (loan && (*pte & PTE_W)) {
+			*pte &= ~PTE_W;
+			shootdown_needed = TRUE;
+		} else if (!loan && !(*pte & PTE_W)) {
+			break;
+		}
+		pages[i] = ppn2page(PTE2PPN(*pte));
+		page_incref(pages[i]);
+	}
+	spin_unlock(&p->pte_lock);
+	spin_unlock(&p->vmr_lock);
+	if (shootdown_needed)
+		proc_tlbshootdown_sync(p, va, va + i * PGSIZE);
+	return i;
+}
+
+/* Loans the anon pages backing [va, va + nr_pgs * PGSIZE) to the kernel, for
+ * zero-copy I/O.  Each page in pages[] comes with a ref, and its PTE is now
+ * read-only, so the next write from userspace (or a fork's child) gets its own
+ * copy, unless the kernel has let go of the page by then.  See
+ * __break_page_loan().  Returns the number of pages loaned, starting at va,
+ * which is less than nr_pgs if we hit a page we can't loan: file-backed,
+ * jumbo, or not faulted in. */
+int loan_user_pages(struct proc *p, uintptr_t va, int nr_pgs,
+                    struct page **pages)
+{
+	return __grab_user_pages(p, va, nr_pgs, pages, TRUE);
+}
+
+/* Returns TRUE if the page at va looks like it is out on loan: read-only, in a
+ * writable anon VMR.  A write fault there breaks the loan.  This is just a
+ * peek; handle_page_fault() checks again. */
+bool user_page_on_loan(struct proc *p, uintptr_t va)
+{
+	struct vm_region *vmr;
+	pte_t *pte;
+	bool ret = FALSE;
+
+	spin_lock(&p->vmr_lock);
+	vmr = find_vmr(p, va);
+	if (vmr && !vmr->vm_file && (vmr->vm_prot & PROT_WRITE)) {
+		spin_lock(&p->pte_lock);
+		if (pgdir_page_shift(p->env_pgdir, (void*)va) == PGSHIFT) {
+			pte = pgdir_walk(p->env_pgdir, (void*)va, FALSE);
+			ret = pte && PAGE_PRESENT(*pte) && !(*pte & PTE_W);
+		}
+		spin_unlock(&p->pte_lock);
+	}
+	spin_unlock(&p->vmr_lock);
+	return ret;
+}
+
+/* Pins the writable anon pages backing [va, va + nr_pgs * PGSIZE), for memory
+ * the kernel and the process share, such as DMA buffers and rings.  Each page
+ * in pages[] comes with a ref, and its PTE stays writable, so both sides see
+ * each other's writes.  The process keeps the mapping as long as it leaves it
+ * alone: an munmap, an mprotect, or loaning the pages out (e.g. a zero-copy
+ * write()) can leave it with different pages than the kernel has.  Returns the
+ * number of pages pinned, like loan_user_pages(); pages that are read-only
+ * (including ones out on loan) stop it too. */
+int pin_user_pages(struct proc *p, uintptr_t va, int nr_pgs,
+                   struct page **pages)
+{
+	return __grab_user_pages(p, va, nr_pgs, pages, FALSE);
+}
+
+int remap_user_page(struct proc *p, uintptr_t va, struct page *page)
+{
+	struct vm_region *vmr;
+	struct page *old_page = 0;
+	pte_t *pte;
+	int shift;
+
+	spin_lock(&p->vmr_lock);
+	vmr = find_vmr(p, va);
+	if (!vmr || vmr->vm_file || !(vmr->vm_prot & PROT_WRITE) ||
+	    (va + PGSIZE > vmr->vm_end)) {
+		spin_unlock(&p->vmr_lock);
+		return -1;
+	}
+	spin_lock(&p->pte_lock);
+	shift = pgdir_page_shift(p->env_pgdir, (void*)va);
+	if (shift && (shift != PGSHIFT)) {
+		spin_unlock(&p->pte_lock);
+		spin_unlock(&p->vmr_lock);
+		return -1;
+	}
+	pte = pgdir_walk(p->env_pgdir, (void*)va, TRUE);
+	if (!pte) {
+		spin_unlock(&p->pte_lock);
+		spin_unlock(&p->vmr_lock);
+		return -1;
+	}
+	if (PAGE_PRESENT(*pte))
+		old_page = ppn2page(PTE2PPN(*pte));
+	page_incref(page);
+	*pte = PTE(page2ppn(page), PTE_P | PTE_USER_RO);
+	spin_unlock(&p->pte_lock);
+	spin_unlock(&p->vmr_lock);
+	if (old_page) {
+		proc_tlbshootdown(p, va, va + PGSIZE);
+		page_decref(old_page);
+	}
+	return 0;
+}
+
 /* Kernel Dynamic Memory Mappings */
 uintptr_t dyn_vmap_llim = KERN_DYN_TOP;
 spinlock_t dyn_vmap_lock = SPINLOCK_INITIALIZER;
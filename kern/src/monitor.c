@@ -28,6 +28,7 @@
 #include <event.h>
 #include <trap.h>
 #include <time.h>
+#include <ext2fs.h>
 
 #include <ros/memlayout.h>
 #include <ros/event.h>
@@ -992,6 +993,7 @@ int mon_fs(int argc, char **argv, struct hw_trapframe *hw_tf)
 		printk("\tls DIR: print the dir tree starting with DIR\n");
 		printk("\tpid: proc PID's fs crap placeholder\n");
 		printk("\tpmflusher: start a ktask to keep flushing all PMs\n");
+		printk("\tfrag FILE: show the on-disk layout of an ext2 FILE\n");
 		return 1;
 	}
 	if (!strcmp(argv[1], "open")) {
@@ -1026,13 +1028,12 @@ int mon_fs(int argc, char **argv, struct hw_trapframe *hw_tf)
 			printk("DENTRY     FLAGS      REFCNT NAME\n");
 			printk("--------------------------------\n");
 			/* Hash helper */
-			void print_dcache_entry(void *item)
+			void print_dcache_entry(struct dentry *d_i)
 			{
-				struct dentry *d_i = (struct dentry*)item;
 				printk("%p %p %02d     %s\n", d_i, d_i->d_flags,
 				       kref_refcnt(&d_i->d_kref), d_i->d_name.name);
 			}
-			hash_for_each(sb->s_dcache, print_dcache_entry);
+			dcache_for_each(sb, print_dcache_entry);
 		}
 		if (argc < 3)
 			return 0;
@@ -1068,6 +1069,21 @@ int mon_fs(int argc, char **argv, struct hw_trapframe *hw_tf)
 		/* whatever.  placeholder. */
 	} else if (!strcmp(argv[1], "pmflusher")) {
 		ktask("pm_flusher", pm_flusher, 0);
+	} else if (!strcmp(argv[1], "frag")) {
+		if (argc != 3) {
+			printk("Give me a file.\n");
+			return 1;
+		}
+		dentry = lookup_dentry(argv[2], 0);
+		if (!dentry) {
+			printk("No such file %s\n", argv[2]);
+			return 1;
+		}
+		if (dentry->d_sb->s_type != &ext2_fs_type)
+			printk("%s is not on an ext2 FS\n", argv[2]);
+		else
+			ext2_print_frag(dentry->d_inode);
+		kref_put(&dentry->d_kref);
 	} else {
 		printk("Bad option\n");
 		return 1;
@@ -66,6 +66,8 @@ extern void pktmediumlink(void);
 extern char *eve;
 static long ndbwrite(struct Fs *, char *unused_char_p_t, uint32_t, int);
 static void closeconv(struct conv *);
+static void ip_fire_taps(struct conv *conv, struct fdtap_slist *list,
+                         int filter);
 
 static int ip3gen(struct chan *c, int i, struct dir *dp)
 {
@@ -560,6 +562,114 @@ static int ipwstat(struct chan *c, uint8_t * dp, int n)
 }
 
 /* Should be able to handle any file type chan. Feel free to extend it. */
+static void __ip_fire_taps(struct conv *conv, struct fdtap_slist *list,
+                           int filter)
+{
+	struct fd_tap *tap;
+
+	spin_lock(&conv->tap_lock);
+	SLIST_FOREACH(tap, list, link)
+		fire_tap(tap, filter);
+	spin_unlock(&conv->tap_lock);
+}
+
+static void __ip_fire_taps_kmsg(uint32_t srcid, long a0, long a1, long a2)
+{
+	__ip_fire_taps((struct conv*)a0, (struct fdtap_slist*)a1, (int)a2);
+}
+
+/* Convs are never freed, so we can safely put off firing their taps until we
+ * are out of IRQ context. */
+static void ip_fire_taps(struct conv *conv, struct fdtap_slist *list,
+                         int filter)
+{
+	if (SLIST_EMPTY(list))
+		return;
+	if (in_irq_ctx(&per_cpu_info[core_id()])) {
+		send_kernel_message(core_id(), __ip_fire_taps_kmsg, (long)conv,
+		                    (long)list, filter, KMSG_ROUTINE);
+		return;
+	}
+	__ip_fire_taps(conv, list, filter);
+}
+
+/* The data file is readable when rq is and writable when wq is, so each queue
+ * only reports its own half. */
+static void ip_rq_wake_cb(struct queue *q, void *data, int filter)
+{
+	struct conv *conv = data;
+
+	filter &= FDTAP_FILT_READABLE | FDTAP_FILT_HANGUP | FDTAP_FILT_EDGE;
+	ip_fire_taps(conv, &conv->data_taps, filter);
+}
+
+static void ip_wq_wake_cb(struct queue *q, void *data, int filter)
+{
+	struct conv *conv = data;
+
+	filter &= FDTAP_FILT_WRITABLE | FDTAP_FILT_HANGUP | FDTAP_FILT_EDGE;
+	ip_fire_taps(conv, &conv->data_taps, filter);
+}
+
+/* Taps on a data file watch its conv's queues.  Opening a listen file is what
+ * accepts a call, so it's too late to tap that; instead, taps on an announced
+ * conv's ctl file are readable when a call is waiting to be listened for. */
+static int iptapfd(struct chan *chan, struct fd_tap *tap, int cmd)
+{
+	struct conv *conv;
+	struct fdtap_slist *list;
+	int ready = 0;
+
+	conv = ipfs[chan->dev]->p[PROTO(chan->qid)]->conv[CONV(chan->qid)];
+	switch (TYPE(chan->qid)) {
+		case Qdata:
+			list = &conv->data_taps;
+			if (qcanread(conv->rq))
+				ready |= FDTAP_FILT_READABLE;
+			if (qcanwrite(conv->wq))
+				ready |= FDTAP_FILT_WRITABLE;
+			if (qisclosed(conv->rq))
+				ready |= FDTAP_FILT_READABLE | FDTAP_FILT_HANGUP;
+			break;
+		case Qctl:
+			if (tap->filter & FDTAP_FILT_WRITABLE) {
+				set_errno(EINVAL);
+				error("Can't tap a ctl file for writing");
+			}
+			list = &conv->listen_taps;
+			if (conv->incall)
+				ready |= FDTAP_FILT_READABLE;
+			break;
+		default:
+			set_errno(ENOSYS);
+			error("Can't tap #I file type %d", TYPE(chan->qid));
+	}
+	switch (cmd) {
+		case FDTAP_CMD_ADD:
+			/* These stay set for the life of the conv, which is forever */
+			if (list == &conv->data_taps) {
+				qio_set_wake_cb(conv->rq, ip_rq_wake_cb, conv);
+				qio_set_wake_cb(conv->wq, ip_wq_wake_cb, conv);
+			}
+			spin_lock(&conv->tap_lock);
+			SLIST_INSERT_HEAD(list, tap, link);
+			/* Tell the new tap what's already true, like it just happened */
+			if (ready)
+				fire_tap(tap, ready | FDTAP_FILT_EDGE);
+			spin_unlock(&conv->tap_lock);
+			break;
+		case FDTAP_CMD_REM:
+			spin_lock(&conv->tap_lock);
+			SLIST_REMOVE(list, tap, fd_tap, link);
+			spin_unlock(&conv->tap_lock);
+			break;
+		default:
+			set_errno(ENOSYS);
+			error("Unsupported FD tap command %p", cmd);
+	}
+	return 0;
+}
+
 static char *ipchaninfo(struct chan *ch, char *ret, size_t ret_l)
 {
 	struct conv *conv;
@@ -1249,6 +1359,7 @@ struct dev ipdevtab __devtab = {
 	ipwstat,
 	devpower,
 	ipchaninfo,
+	iptapfd,
 };
 
 int Fsproto(struct Fs *f, struct Proto *p)
@@ -1308,6 +1419,9 @@ retry:
 			qlock_init(&c->listenq);
 			rendez_init(&c->cr);
 			rendez_init(&c->listenr);
+			spinlock_init(&c->tap_lock);
+			SLIST_INIT(&c->data_taps);
+			SLIST_INIT(&c->listen_taps);
 			qlock(&c->qlock);
 			c->p = p;
 			c->x = pp - p->conv;
@@ -1432,6 +1546,8 @@ struct conv *Fsnewcall(struct conv *c, uint8_t * raddr, uint16_t rport,
 	qunlock(&c->qlock);
 
 	rendez_wakeup(&c->listenr);
+	ip_fire_taps(c, &c->listen_taps,
+	             FDTAP_FILT_READABLE | (i == 0 ? FDTAP_FILT_EDGE : 0));
 
 	return nc;
 }
@@ -0,0 +1,258 @@
+/* Copyright (c) 2015 The Regents of the University of California
+ * See LICENSE for details.
+ *
+ * Netmap: user-mapped packet rings for #ether queues.
+ *
+ * We pin the region the process gives us (it can't mmap a chan, so it brings
+ * its own memory), hand it to the driver, and look the netmap up by FD and
+ * queue on each sync.  Registrations are also on a global list, so exec and
+ * exit can find the ones whose FDs are staying open; those point into an
+ * address space that is going away. */
+
+#include <netmap.h>
+#include <event.h>
+#include <kmalloc.h>
+#include <process.h>
+#include <smp.h>
+#include <syscall.h>
+#include <mm.h>
+#include <ns.h>
+#include <ip.h>
+#include <error.h>
+#include <umem.h>
+
+static struct netmap_tailq netmaps = TAILQ_HEAD_INITIALIZER(netmaps);
+static spinlock_t netmaps_lock = SPINLOCK_INITIALIZER;
+
+static void netmap_free(struct netmap *nm)
+{
+	for (int i = 0; i < NETMAP_NR_PAGES; i++) {
+		if (nm->pages[i])
+			page_decref(nm->pages[i]);
+	}
+	kfree(nm);
+}
+
+/* Gets the ether behind c, or throws. */
+static struct ether *chan_ether(struct chan *c)
+{
+	struct ether *ether;
+
+	if (devtab[c->type].dc != 'l')
+		error(Ebadusefd);
+	ether = c->aux;
+	if (!ether->netmap)
+		error(Ebadusefd);
+	return ether;
+}
+
+/* Takes nm off its queue and frees it.  Hold the nmlock. */
+static void __netmap_unreg(struct ether *ether, struct netmap *nm)
+{
+	ether->netmap(ether, nm, FALSE);
+	ether->nm[nm->qidx] = 0;
+	spin_lock(&netmaps_lock);
+	TAILQ_REMOVE(&netmaps, nm, link);
+	spin_unlock(&netmaps_lock);
+	netmap_free(nm);
+}
+
+/* Returns 0 on success, -1 with errno set on failure. */
+int netmap_reg(struct proc *p, int fd, struct netmap_req *req)
+{
+	ERRSTACK(3);
+	uintptr_t va = (uintptr_t)req->region;
+	struct netmap *nm;
+	struct ether *ether;
+	struct chan *c;
+
+	if ((req->qidx < 0) || (req->qidx >= NETMAP_MAX_QS) || PGOFF(va) ||
+	    !is_user_rwaddr(req->region, NETMAP_REGION_SZ) ||
+	    (req->ev_q && !is_user_rwaddr(req->ev_q,
+	                                  sizeof(struct event_queue)))) {
+		set_errno(EINVAL);
+		return -1;
+	}
+	nm = kzmalloc(sizeof(struct netmap), KMALLOC_WAIT);
+	nm->proc = p;
+	nm->fd = fd;
+	nm->qidx = req->qidx;
+	nm->ev_q = req->ev_q;
+	nm->ev_id = req->ev_id;
+	if ((populate_va(p, va, NETMAP_NR_PAGES) != NETMAP_NR_PAGES) ||
+	    (pin_user_pages(p, va, NETMAP_NR_PAGES, nm->pages) !=
+	     NETMAP_NR_PAGES)) {
+		netmap_free(nm);
+		set_errno(EFAULT);
+		return -1;
+	}
+	nm->rx = page2kva(nm->pages[NETMAP_RX_RING >> PGSHIFT]);
+	nm->tx = page2kva(nm->pages[NETMAP_TX_RING >> PGSHIFT]);
+	memset(nm->rx, 0, sizeof(struct netmap_ring));
+	memset(nm->tx, 0, sizeof(struct netmap_ring));
+	nm->rx->nr_slots = NETMAP_NR_SLOTS;
+	nm->tx->nr_slots = NETMAP_NR_SLOTS;
+	if (waserror()) {
+		netmap_free(nm);
+		poperror();
+		return -1;
+	}
+	c = fdtochan(p->fgrp, fd, -1, FALSE, TRUE);
+	if (waserror()) {
+		cclose(c);
+		nexterror();
+	}
+	ether = chan_ether(c);
+	nm->ether = ether;
+	nm->chan = c;
+	qlock(&ether->nmlock);
+	if (waserror()) {
+		qunlock(&ether->nmlock);
+		nexterror();
+	}
+	if (ether->nm[nm->qidx])
+		error(Einuse);
+	ether->netmap(ether, nm, TRUE);
+	ether->nm[nm->qidx] = nm;
+	spin_lock(&netmaps_lock);
+	TAILQ_INSERT_TAIL(&netmaps, nm, link);
+	spin_unlock(&netmaps_lock);
+	poperror();
+	qunlock(&ether->nmlock);
+	poperror();
+	cclose(c);
+	poperror();
+	return 0;
+}
+
+/* Returns 0 on success, -1 with errno set on failure. */
+int netmap_unreg(struct proc *p, int fd, int qidx)
+{
+	ERRSTACK(3);
+	struct ether *ether;
+	struct netmap *nm;
+	struct chan *c;
+
+	if (waserror()) {
+		poperror();
+		return -1;
+	}
+	c = fdtochan(p->fgrp, fd, -1, FALSE, TRUE);
+	if (waserror()) {
+		cclose(c);
+		nexterror();
+	}
+	ether = chan_ether(c);
+	if ((qidx < 0) || (qidx >= NETMAP_MAX_QS))
+		error(Ebadarg);
+	qlock(&ether->nmlock);
+	if (waserror()) {
+		qunlock(&ether->nmlock);
+		nexterror();
+	}
+	nm = ether->nm[qidx];
+	if (!nm || (nm->chan != c) || (nm->proc != p))
+		error(Ebadarg);
+	__netmap_unreg(ether, nm);
+	poperror();
+	qunlock(&ether->nmlock);
+	poperror();
+	cclose(c);
+	poperror();
+	return 0;
+}
+
+/* Returns 0 on success, -1 with errno set on failure. */
+int netmap_sync(struct proc *p, int fd, int qidx, int flags)
+{
+	ERRSTACK(3);
+	struct ether *ether;
+	struct netmap *nm;
+	struct chan *c;
+
+	if (waserror()) {
+		poperror();
+		return -1;
+	}
+	c = fdtochan(p->fgrp, fd, -1, FALSE, TRUE);
+	if (waserror()) {
+		cclose(c);
+		nexterror();
+	}
+	ether = chan_ether(c);
+	if ((qidx < 0) || (qidx >= NETMAP_MAX_QS))
+		error(Ebadarg);
+	qlock(&ether->nmlock);
+	if (waserror()) {
+		qunlock(&ether->nmlock);
+		nexterror();
+	}
+	nm = ether->nm[qidx];
+	if (!nm || (nm->chan != c) || (nm->proc != p))
+		error(Ebadarg);
+	ether->nmsync(ether, nm, flags & (NETMAP_SYNC_RX | NETMAP_SYNC_TX));
+	poperror();
+	qunlock(&ether->nmlock);
+	poperror();
+	cclose(c);
+	poperror();
+	return 0;
+}
+
+/* Drivers call this when nm's queue interrupts, with the NETMAP_SYNC_* rings
+ * that might have something.  Don't call this from IRQ context. */
+void netmap_notify(struct netmap *nm, int which)
+{
+	struct event_msg ev_msg = {0};
+
+	if (!nm->ev_q)
+		return;
+	ev_msg.ev_type = nm->ev_id;
+	ev_msg.ev_arg2 = which;
+	ev_msg.ev_arg3 = (void*)(long)nm->qidx;
+	ev_msg.ev_arg4 = nm->fd;
+	send_event(nm->proc, nm->ev_q, &ev_msg, 0);
+}
+
+/* Called when one of ether's chans closes, which ends any registrations made
+ * through it. */
+void netmap_chan_closed(struct ether *ether, struct chan *chan)
+{
+	qlock(&ether->nmlock);
+	for (int i = 0; i < NETMAP_MAX_QS; i++) {
+		if (ether->nm[i] && (ether->nm[i]->chan == chan))
+			__netmap_unreg(ether, ether->nm[i]);
+	}
+	qunlock(&ether->nmlock);
+}
+
+/* Called when p's address space or FDs are going away, like
+ * remove_all_fd_taps(). */
+void remove_all_netmaps(struct proc *p)
+{
+	struct netmap *nm;
+	struct ether *ether;
+	int qidx;
+
+	while (1) {
+		spin_lock(&netmaps_lock);
+		TAILQ_FOREACH(nm, &netmaps, link) {
+			if (nm->proc == p)
+				break;
+		}
+		if (!nm) {
+			spin_unlock(&netmaps_lock);
+			return;
+		}
+		ether = nm->ether;
+		qidx = nm->qidx;
+		spin_unlock(&netmaps_lock);
+		/* nm could go away once we unlock, but ethers never do.  Whoever
+		 * beat us to it took it off the list too. */
+		qlock(&ether->nmlock);
+		nm = ether->nm[qidx];
+		if (nm && (nm->proc == p))
+			__netmap_unreg(ether, nm);
+		qunlock(&ether->nmlock);
+	}
+}
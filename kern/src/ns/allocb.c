@@ -103,6 +103,59 @@ void block_add_extd(struct block *b, unsigned int nr_bufs, int mem_flags)
 	b->nr_extra_bufs = nr_bufs;
 }
 
+/* Takes another reference on ebd's buffer, e.g. when pointing a second ebd at
+ * it.  The ref is released with extd_decref(). */
+void extd_incref(struct extra_bdata *ebd)
+{
+	if (ebd->flags & EXTD_PAGE)
+		page_incref(kva2page((void*)ebd->base));
+	else
+		kmalloc_incref((void*)ebd->base);
+}
+
+/* Releases ebd's reference on its buffer, and clears out the ebd. */
+void extd_decref(struct extra_bdata *ebd)
+{
+	if (!ebd->base)
+		return;
+	if (ebd->flags & EXTD_PAGE)
+		page_decref(kva2page((void*)ebd->base));
+	else
+		kfree((void*)ebd->base);
+	ebd->base = 0;
+	ebd->off = 0;
+	ebd->len = 0;
+	ebd->flags = 0;
+}
+
+/* Appends [off, off + len) of page to b's extra data, without copying.  The
+ * block holds a ref on the page until the extd is released, so the page won't
+ * be freed out from under the block (e.g. a page cache page that is evicted
+ * while a NIC is sending it), though its contents could change.
+ *
+ * Caller is responsible for concurrent access to the block's metadata. */
+void block_append_page(struct block *b, struct page *page, uint32_t off,
+                       uint32_t len)
+{
+	struct extra_bdata *ebd;
+	unsigned int idx;
+
+	assert(off + len <= PGSIZE);
+	/* Find the slot after the last one in use, growing the array if needed */
+	for (idx = b->nr_extra_bufs; idx > 0; idx--) {
+		if (b->extra_data[idx - 1].base)
+			break;
+	}
+	block_add_extd(b, idx + 1, KMALLOC_WAIT);
+	ebd = &b->extra_data[idx];
+	page_incref(page);
+	ebd->base = (uintptr_t)page2kva(page);
+	ebd->off = off;
+	ebd->len = len;
+	ebd->flags = EXTD_PAGE;
+	b->extra_len += len;
+}
+
 /*
  *  interrupt time allocation
  */
@@ -134,18 +187,12 @@ struct block *iallocb(int size)
 void freeb(struct block *b)
 {
 	void *dead = (void *)Bdead;
-	struct extra_bdata *ebd;
 
 	if (b == NULL)
 		return;
 
-	/* assuming our release method is kfree, which will change when we support
-	 * user buffers */
-	for (int i = 0; i < b->nr_extra_bufs; i++) {
-		ebd = &b->extra_data[i];
-		if (ebd->base)
-			kfree((void*)ebd->base);
-	}
+	for (int i = 0; i < b->nr_extra_bufs; i++)
+		extd_decref(&b->extra_data[i]);
 	kfree(b->extra_data);	/* harmless if it is 0 */
 	b->extra_data = 0;		/* in case the block is reused by a free override */
 	/*
@@ -201,9 +248,13 @@ void checkb(struct block *b, char *msg)
 
 	for (int i = 0; i < b->nr_extra_bufs; i++) {
 		ebd = &b->extra_data[i];
-		if (ebd->base) {
-			if (!kmalloc_refcnt((void*)ebd->base))
-				panic("checkb buf %d, base %p has no refcnt!\n", i, ebd->base);
+		if (!ebd->base)
+			continue;
+		if (ebd->flags & EXTD_PAGE) {
+			if (!kref_refcnt(&kva2page((void*)ebd->base)->pg_kref))
+				panic("checkb buf %d, page %p has no refcnt!\n", i, ebd->base);
+		} else if (!kmalloc_refcnt((void*)ebd->base)) {
+			panic("checkb buf %d, base %p has no refcnt!\n", i, ebd->base);
 		}
 	}
 
@@ -402,6 +402,8 @@ long devbwrite(struct chan *c, struct block *bp, uint32_t offset)
 	ERRSTACK(1);
 	long n;
 
+	/* write() wants the data in one place, not spread across extra_data */
+	bp = linearizeblock(bp);
 	if (waserror()) {
 		freeb(bp);
 		nexterror();
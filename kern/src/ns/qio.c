@@ -12,6 +12,9 @@
 #include <pmap.h>
 #include <smp.h>
 #include <ip.h>
+#include <mm.h>
+#include <umem.h>
+#include <ros/fdtap.h>
 
 #define PANIC_EXTRA(b)                                                          \
 {                                                                              \
@@ -57,6 +60,8 @@ struct queue {
 	struct rendez rr;			/* process waiting to read */
 	qlock_t wlock;				/* mutex for writing processes */
 	struct rendez wr;			/* process waiting to write */
+	qio_wake_cb_t wake_cb;		/* tells FD taps about readiness */
+	void *wake_data;
 
 	char err[ERRMAX];
 };
@@ -66,6 +71,9 @@ enum {
 };
 
 unsigned int qiomaxatomic = Maxatomic;
+/* qwrite()s and qread()s of at least this much user memory try to move whole
+ * pages instead of copying them. */
+unsigned int qiozerocopymin = 16 * PGSIZE;
 
 void ixsummary(void)
 {
@@ -77,6 +85,28 @@ void ixsummary(void)
 		   consumecnt, producecnt, qcopycnt);
 }
 
+/* Tells the wake callback, if any, about the FDTAP_FILT_ conditions in filter.
+ * Call this without the q lock. */
+static void qwake_cb(struct queue *q, int filter)
+{
+	if (filter && q->wake_cb)
+		q->wake_cb(q, q->wake_data, filter);
+}
+
+/* Readiness to report after a producer added data to q.  Hold the lock. */
+static int __qreadable_filt(struct queue *q, bool was_empty)
+{
+	return FDTAP_FILT_READABLE | (was_empty ? FDTAP_FILT_EDGE : 0);
+}
+
+/* Readiness to report after a consumer took data from q.  Hold the lock. */
+static int __qwritable_filt(struct queue *q, bool was_full)
+{
+	if (q->len >= q->limit)
+		return 0;
+	return FDTAP_FILT_WRITABLE | (was_full ? FDTAP_FILT_EDGE : 0);
+}
+
 /*
  *  free a list of blocks
  */
@@ -282,11 +312,8 @@ struct block *pullupblock(struct block *bp, int n)
 			ebd->len -= seglen;
 			ebd->off += seglen;
 			bp->extra_len -= seglen;
-			if (ebd->len == 0) {
-				kfree((void *)ebd->base);
-				ebd->off = 0;
-				ebd->base = 0;
-			}
+			if (ebd->len == 0)
+				extd_decref(ebd);
 		}
 		/* maybe just call pullupblock recursively here */
 		if (len)
@@ -370,11 +397,8 @@ static int pullext(struct block *bp, int count)
 		bytes += rem;
 		ed->off += rem;
 		ed->len -= rem;
-		if (ed->len == 0) {
-			kfree((void *)ed->base);
-			ed->base = 0;
-			ed->off = 0;
-		}
+		if (ed->len == 0)
+			extd_decref(ed);
 	}
 	return bytes;
 }
@@ -396,11 +420,8 @@ static int dropext(struct block *bp, int count)
 		count -= rem;
 		bytes += rem;
 		ed->len -= rem;
-		if (ed->len == 0) {
-			kfree((void *)ed->base);
-			ed->base = 0;
-			ed->off = 0;
-		}
+		if (ed->len == 0)
+			extd_decref(ed);
 	}
 	return bytes;
 }
@@ -551,7 +572,8 @@ struct block *adjustblock(struct block *bp, int len)
  */
 struct block *qget(struct queue *q)
 {
-	int dowakeup;
+	int dowakeup, wake_filt;
+	bool was_full;
 	struct block *b;
 
 	/* sync with qwrite */
@@ -563,6 +585,7 @@ struct block *qget(struct queue *q)
 		spin_unlock_irqsave(&q->lock);
 		return NULL;
 	}
+	was_full = q->len >= q->limit;
 	q->bfirst = b->next;
 	b->next = 0;
 	q->len -= BALLOC(b);
@@ -575,11 +598,13 @@ struct block *qget(struct queue *q)
 		dowakeup = 1;
 	} else
 		dowakeup = 0;
+	wake_filt = __qwritable_filt(q, was_full);
 
 	spin_unlock_irqsave(&q->lock);
 
 	if (dowakeup)
 		rendez_wakeup(&q->wr);
+	qwake_cb(q, wake_filt);
 
 	return b;
 }
@@ -591,10 +616,12 @@ struct block *qget(struct queue *q)
 int qdiscard(struct queue *q, int len)
 {
 	struct block *b;
-	int dowakeup, n, sofar, body_amt, extra_amt;
+	int dowakeup, n, sofar, body_amt, extra_amt, wake_filt;
+	bool was_full;
 	struct extra_bdata *ebd;
 
 	spin_lock_irqsave(&q->lock);
+	was_full = q->len >= q->limit;
 	for (sofar = 0; sofar < len; sofar += n) {
 		b = q->bfirst;
 		if (b == NULL)
@@ -623,11 +650,10 @@ int qdiscard(struct queue *q, int len)
 				if (!ebd->base || !ebd->len)
 					continue;
 				if (extra_amt >= ebd->len) {
-					/* remove the entire entry, note the kfree release */
+					/* remove the entire entry, releasing the buffer */
 					b->extra_len -= ebd->len;
 					extra_amt -= ebd->len;
-					kfree((void*)ebd->base);
-					ebd->base = ebd->off = ebd->len = 0;
+					extd_decref(ebd);
 					continue;
 				}
 				ebd->off += extra_amt;
@@ -653,11 +679,13 @@ int qdiscard(struct queue *q, int len)
 		dowakeup = 1;
 	} else
 		dowakeup = 0;
+	wake_filt = sofar ? __qwritable_filt(q, was_full) : 0;
 
 	spin_unlock_irqsave(&q->lock);
 
 	if (dowakeup)
 		rendez_wakeup(&q->wr);
+	qwake_cb(q, wake_filt);
 
 	return sofar;
 }
@@ -668,12 +696,14 @@ int qdiscard(struct queue *q, int len)
 int qconsume(struct queue *q, void *vp, int len)
 {
 	struct block *b;
-	int n, dowakeup;
+	int n, dowakeup, wake_filt;
+	bool was_full;
 	uint8_t *p = vp;
 	struct block *tofree = NULL;
 
 	/* sync with qwrite */
 	spin_lock_irqsave(&q->lock);
+	was_full = q->len >= q->limit;
 
 	for (;;) {
 		b = q->bfirst;
@@ -721,11 +751,13 @@ int qconsume(struct queue *q, void *vp, int len)
 		dowakeup = 1;
 	} else
 		dowakeup = 0;
+	wake_filt = __qwritable_filt(q, was_full);
 
 	spin_unlock_irqsave(&q->lock);
 
 	if (dowakeup)
 		rendez_wakeup(&q->wr);
+	qwake_cb(q, wake_filt);
 
 	if (tofree != NULL)
 		freeblist(tofree);
@@ -735,7 +767,8 @@ int qconsume(struct queue *q, void *vp, int len)
 
 int qpass(struct queue *q, struct block *b)
 {
-	int dlen, len, dowakeup;
+	int dlen, len, dowakeup, wake_filt;
+	bool was_empty;
 
 	/* sync with qread */
 	dowakeup = 0;
@@ -753,6 +786,7 @@ int qpass(struct queue *q, struct block *b)
 	}
 
 	/* add buffer to queue */
+	was_empty = !q->bfirst;
 	if (q->bfirst)
 		q->blast->next = b;
 	else
@@ -777,17 +811,20 @@ int qpass(struct queue *q, struct block *b)
 		q->state &= ~Qstarve;
 		dowakeup = 1;
 	}
+	wake_filt = __qreadable_filt(q, was_empty);
 	spin_unlock_irqsave(&q->lock);
 
 	if (dowakeup)
 		rendez_wakeup(&q->rr);
+	qwake_cb(q, wake_filt);
 
 	return len;
 }
 
 int qpassnolim(struct queue *q, struct block *b)
 {
-	int dlen, len, dowakeup;
+	int dlen, len, dowakeup, wake_filt;
+	bool was_empty;
 
 	/* sync with qread */
 	dowakeup = 0;
@@ -800,6 +837,7 @@ int qpassnolim(struct queue *q, struct block *b)
 	}
 
 	/* add buffer to queue */
+	was_empty = !q->bfirst;
 	if (q->bfirst)
 		q->blast->next = b;
 	else
@@ -824,10 +862,12 @@ int qpassnolim(struct queue *q, struct block *b)
 		q->state &= ~Qstarve;
 		dowakeup = 1;
 	}
+	wake_filt = __qreadable_filt(q, was_empty);
 	spin_unlock_irqsave(&q->lock);
 
 	if (dowakeup)
 		rendez_wakeup(&q->rr);
+	qwake_cb(q, wake_filt);
 
 	return len;
 }
@@ -861,7 +901,8 @@ struct block *packblock(struct block *bp)
 int qproduce(struct queue *q, void *vp, int len)
 {
 	struct block *b;
-	int dowakeup;
+	int dowakeup, wake_filt;
+	bool was_empty;
 	uint8_t *p = vp;
 
 	/* sync with qread */
@@ -876,6 +917,7 @@ int qproduce(struct queue *q, void *vp, int len)
 	}
 
 	/* save in buffer */
+	was_empty = !q->bfirst;
 	/* use Qcoalesce here to save storage */
 	// TODO: Consider removing the Qcoalesce flag and force a coalescing
 	// strategy by default.
@@ -910,10 +952,12 @@ int qproduce(struct queue *q, void *vp, int len)
 
 	if (q->len >= q->limit)
 		q->state |= Qflow;
+	wake_filt = __qreadable_filt(q, was_empty);
 	spin_unlock_irqsave(&q->lock);
 
 	if (dowakeup)
 		rendez_wakeup(&q->rr);
+	qwake_cb(q, wake_filt);
 
 	return len;
 }
@@ -921,8 +965,7 @@ int qproduce(struct queue *q, void *vp, int len)
 /* Add an extra_data entry to newb at newb_idx pointing to b's body, starting at
  * body_rp, for up to len.  Returns the len consumed. 
  *
- * The base is 'b', so that we can kfree it later.  This currently ties us to
- * using kfree for the release method for all extra_data.
+ * The base is 'b', so that we can kfree it later.
  *
  * It is possible to have a body size that is 0, if there is no offset, and
  * b->wp == b->rp.  This will have an extra data entry of 0 length. */
@@ -936,6 +979,7 @@ static size_t point_to_body(struct block *b, uint8_t *body_rp,
 
 	kmalloc_incref(b);
 	ebd->base = (uintptr_t)b;
+	ebd->flags = 0;
 	ebd->off = (uint32_t)(body_rp - (uint8_t*)b);
 	ebd->len = MIN(b->wp - body_rp, len);	/* think of body_rp as b->rp */
 	assert((int)ebd->len >= 0);
@@ -958,8 +1002,9 @@ static size_t point_to_buf(struct block *b, unsigned int b_idx, uint32_t b_off,
 	assert(b_idx < b->nr_extra_bufs);
 	assert(newb_idx < newb->nr_extra_bufs);
 
-	kmalloc_incref((void*)b_ebd->base);
+	extd_incref(b_ebd);
 	n_ebd->base = b_ebd->base;
+	n_ebd->flags = b_ebd->flags;
 	n_ebd->off = b_ebd->off + b_off;
 	n_ebd->len = MIN(b_ebd->len - b_off, len);
 	newb->extra_len += n_ebd->len;
@@ -1184,6 +1229,17 @@ struct queue *qbypass(void (*bypass) (void *, struct block *), void *arg)
 	return q;
 }
 
+/* Sets the callback qio uses to report readiness changes, as FDTAP_FILT_
+ * conditions (plus FDTAP_FILT_EDGE when they just became true).  It is called
+ * without the q lock, possibly from IRQ context.  Once set, it stays set for
+ * the life of the queue, so func must handle having no one to tell. */
+void qio_set_wake_cb(struct queue *q, qio_wake_cb_t func, void *data)
+{
+	q->wake_data = data;
+	wmb();	/* if we see func, we'll also see the data for it */
+	q->wake_cb = func;
+}
+
 static int notempty(void *a)
 {
 	struct queue *q = a;
@@ -1255,11 +1311,27 @@ struct block *qremove(struct queue *q)
 	return b;
 }
 
-static size_t read_from_block(struct block *b, uint8_t *to, size_t amt)
+/* Helper: gives the user ebd's page at to, instead of copying it.  We can only
+ * do this for a whole page, going to a page-aligned user address.  Returns TRUE
+ * if we did. */
+static bool flip_page_to_user(struct extra_bdata *ebd, uint8_t *to,
+                              size_t copy_amt)
+{
+	if (!(ebd->flags & EXTD_PAGE) || ebd->off || (copy_amt != PGSIZE) ||
+	    PGOFF(to))
+		return FALSE;
+	return !remap_user_page(current, (uintptr_t)to,
+	                        kva2page((void*)ebd->base));
+}
+
+/* If flip is set, to is user memory, and we'll try to remap whole pages there
+ * rather than copy them. */
+static size_t read_from_block(struct block *b, uint8_t *to, size_t amt,
+                              bool flip)
 {
 	size_t copy_amt, retval = 0;
 	struct extra_bdata *ebd;
-	
+
 	copy_amt = MIN(BHLEN(b), amt);
 	memcpy(to, b->rp, copy_amt);
 	/* advance the rp, since this block not be completely consumed and future
@@ -1275,7 +1347,8 @@ static size_t read_from_block(struct block *b, uint8_t *to, size_t amt)
 		if (!ebd->base || !ebd->len)
 			continue;
 		copy_amt = MIN(ebd->len, amt);
-		memcpy(to, (void*)(ebd->base + ebd->off), copy_amt);
+		if (!flip || !flip_page_to_user(ebd, to, copy_amt))
+			memcpy(to, (void*)(ebd->base + ebd->off), copy_amt);
 		/* we're actually consuming the entries, just like how we advance rp up
 		 * above, and might only consume part of one. */
 		ebd->len -= copy_amt;
@@ -1284,8 +1357,7 @@ static size_t read_from_block(struct block *b, uint8_t *to, size_t amt)
 		if (!ebd->len) {
 			/* we don't actually have to decref here.  it's also done in
 			 * freeb().  this is the earliest we can free. */
-			kfree((void*)ebd->base);
-			ebd->base = ebd->off = 0;
+			extd_decref(ebd);
 		}
 		to += copy_amt;
 		amt -= copy_amt;
@@ -1303,17 +1375,18 @@ struct block *bl2mem(uint8_t * p, struct block *b, int n)
 {
 	int i;
 	struct block *next;
+	bool flip = (n >= qiozerocopymin) && current && is_user_rwaddr(p, n);
 
 	/* could be slicker here, since read_from_block is smart */
 	for (; b != NULL; b = next) {
 		i = BLEN(b);
 		if (i > n) {
 			/* partial block, consume some */
-			read_from_block(b, p, n);
+			read_from_block(b, p, n, flip);
 			return b;
 		}
 		/* full block, consume all and move on */
-		i = read_from_block(b, p, i);
+		i = read_from_block(b, p, i, flip);
 		n -= i;
 		p += i;
 		next = b->next;
@@ -1374,15 +1447,17 @@ void qputback(struct queue *q, struct block *b)
  *  flow control, get producer going again
  *  called with q ilocked
  */
-static void qwakeup_iunlock(struct queue *q)
+static void qwakeup_iunlock(struct queue *q, bool was_full)
 {
 	int dowakeup = 0;
+	int wake_filt;
 
 	/* if writer flow controlled, restart */
 	if ((q->state & Qflow) && q->len < q->limit / 2) {
 		q->state &= ~Qflow;
 		dowakeup = 1;
 	}
+	wake_filt = __qwritable_filt(q, was_full);
 
 	spin_unlock_irqsave(&q->lock);
 
@@ -1392,6 +1467,7 @@ static void qwakeup_iunlock(struct queue *q)
 			q->kick(q->arg);
 		rendez_wakeup(&q->wr);
 	}
+	qwake_cb(q, wake_filt);
 }
 
 /*
@@ -1402,6 +1478,7 @@ struct block *qbread(struct queue *q, int len)
 	ERRSTACK(1);
 	struct block *b, *nb;
 	int n;
+	bool was_full;
 
 	qlock(&q->rlock);
 	if (waserror()) {
@@ -1424,6 +1501,7 @@ struct block *qbread(struct queue *q, int len)
 	}
 
 	/* if we get here, there's at least one block in the queue */
+	was_full = q->len >= q->limit;
 	b = qremove(q);
 	n = BLEN(b);
 
@@ -1442,7 +1520,7 @@ struct block *qbread(struct queue *q, int len)
 	}
 
 	/* restart producer */
-	qwakeup_iunlock(q);
+	qwakeup_iunlock(q, was_full);
 
 	poperror();
 	qunlock(&q->rlock);
@@ -1458,6 +1536,7 @@ long qread(struct queue *q, void *vp, int len)
 	ERRSTACK(1);
 	struct block *b, *first, **l;
 	int m, n;
+	bool was_full;
 
 	qlock(&q->rlock);
 	if (waserror()) {
@@ -1481,6 +1560,7 @@ again:
 	}
 
 	/* if we get here, there's at least one block in the queue */
+	was_full = q->len >= q->limit;
 	// TODO: Consider removing the Qcoalesce flag and force a coalescing
 	// strategy by default.
 	if (q->state & Qcoalesce) {
@@ -1530,7 +1610,7 @@ again:
 	}
 
 	/* restart producer */
-	qwakeup_iunlock(q);
+	qwakeup_iunlock(q, was_full);
 
 	poperror();
 	qunlock(&q->rlock);
@@ -1552,7 +1632,8 @@ uint32_t noblockcnt;
 long qbwrite(struct queue *q, struct block *b)
 {
 	ERRSTACK(1);
-	int n, dowakeup;
+	int n, dowakeup, wake_filt;
+	bool was_empty;
 	volatile bool should_free_b = TRUE;
 
 	n = BLEN(b);
@@ -1593,6 +1674,7 @@ long qbwrite(struct queue *q, struct block *b)
 
 	/* queue the block */
 	should_free_b = FALSE;
+	was_empty = !q->bfirst;
 	if (q->bfirst)
 		q->blast->next = b;
 	else
@@ -1609,6 +1691,7 @@ long qbwrite(struct queue *q, struct block *b)
 		q->state &= ~Qstarve;
 		dowakeup = 1;
 	}
+	wake_filt = __qreadable_filt(q, was_empty);
 	spin_unlock_irqsave(&q->lock);
 
 	/*  get output going again */
@@ -1618,6 +1701,7 @@ long qbwrite(struct queue *q, struct block *b)
 	/* wakeup anyone consuming at the other end */
 	if (dowakeup)
 		rendez_wakeup(&q->rr);
+	qwake_cb(q, wake_filt);
 
 	/*
 	 *  flow control, wait for queue to get below the limit
@@ -1648,7 +1732,8 @@ long qbwrite(struct queue *q, struct block *b)
 
 long qibwrite(struct queue *q, struct block *b)
 {
-	int n, dowakeup;
+	int n, dowakeup, wake_filt;
+	bool was_empty;
 
 	dowakeup = 0;
 
@@ -1657,6 +1742,7 @@ long qibwrite(struct queue *q, struct block *b)
 	spin_lock_irqsave(&q->lock);
 
 	QDEBUG checkb(b, "qibwrite");
+	was_empty = !q->bfirst;
 	if (q->bfirst)
 		q->blast->next = b;
 	else
@@ -1669,6 +1755,7 @@ long qibwrite(struct queue *q, struct block *b)
 		q->state &= ~Qstarve;
 		dowakeup = 1;
 	}
+	wake_filt = __qreadable_filt(q, was_empty);
 
 	spin_unlock_irqsave(&q->lock);
 
@@ -1677,10 +1764,63 @@ long qibwrite(struct queue *q, struct block *b)
 			q->kick(q->arg);
 		rendez_wakeup(&q->rr);
 	}
+	qwake_cb(q, wake_filt);
 
 	return n;
 }
 
+#ifdef CONFIG_BLOCK_EXTRAS
+/* Helper: points ebd at a kmalloc'd copy of len bytes at p. */
+static void qio_copy_extd(struct block *b, struct extra_bdata *ebd, uint8_t *p,
+                          int len)
+{
+	void *ext_buf = kmalloc(len, 0);
+
+	memcpy(ext_buf, p, len);
+	ebd->base = (uintptr_t)ext_buf;
+	ebd->off = 0;
+	ebd->len = len;
+	b->extra_len += len;
+}
+
+/* Helper: builds a block for the n bytes of user memory at p, borrowing its
+ * whole pages (see loan_user_pages()) and copying the rest.  Returns 0 if we
+ * couldn't borrow any pages. */
+static struct block *qio_loan_block(uint8_t *p, int n)
+{
+	struct page *pages[Maxatomic / PGSIZE];
+	int head = MIN(ROUNDUP((uintptr_t)p, PGSIZE) - (uintptr_t)p, n);
+	int nr_pgs = MIN((n - head) >> PGSHIFT, ARRAY_SIZE(pages));
+	int nr_loaned, idx = 0;
+	struct extra_bdata *ebd;
+	struct block *b;
+
+	if (!nr_pgs)
+		return 0;
+	nr_loaned = loan_user_pages(current, (uintptr_t)p + head, nr_pgs, pages);
+	if (!nr_loaned)
+		return 0;
+	b = allocb(64);
+	block_add_extd(b, nr_loaned + 2, KMALLOC_WAIT);
+	if (head)
+		qio_copy_extd(b, &b->extra_data[idx++], p, head);
+	for (int i = 0; i < nr_loaned; i++) {
+		/* the ebd takes our ref on the page */
+		ebd = &b->extra_data[idx++];
+		ebd->base = (uintptr_t)page2kva(pages[i]);
+		ebd->off = 0;
+		ebd->len = PGSIZE;
+		ebd->flags = EXTD_PAGE;
+		b->extra_len += PGSIZE;
+	}
+	p += head + nr_loaned * PGSIZE;
+	n -= head + nr_loaned * PGSIZE;
+	if (n)
+		qio_copy_extd(b, &b->extra_data[idx++], p, n);
+	return b;
+}
+#endif
+
 /*
  *  write to a queue.  only Maxatomic bytes at a time is atomic.
  */
@@ -1689,11 +1829,17 @@ int qwrite(struct queue *q, void *vp, int len)
 	int n, sofar;
 	struct block *b;
 	uint8_t *p = vp;
-	void *ext_buf;
+#ifdef CONFIG_BLOCK_EXTRAS
+	bool zcopy;
+#endif
 
 	QDEBUG if (!islo())
 		 printd("qwrite hi %p\n", getcallerpc(&q));
 
+#ifdef CONFIG_BLOCK_EXTRAS
+	/* Big writes from user memory borrow its pages instead of copying */
+	zcopy = (len >= qiozerocopymin) && current && is_user_rwaddr(vp, len);
+#endif
 	sofar = 0;
 	do {
 		n = len - sofar;
@@ -1709,14 +1855,12 @@ int qwrite(struct queue *q, void *vp, int len)
 		 * only available via padblock (to the left).  we also need some space
 		 * for pullupblock for some basic headers (like icmp) that get written
 		 * in directly */
-		b = allocb(64);
-		ext_buf = kmalloc(n, 0);
-		memcpy(ext_buf, p + sofar, n);
-		block_add_extd(b, 1, KMALLOC_WAIT); /* returns 0 on success */
-		b->extra_data[0].base = (uintptr_t)ext_buf;
-		b->extra_data[0].off = 0;
-		b->extra_data[0].len = n;
-		b->extra_len += n;
+		b = zcopy ? qio_loan_block(p + sofar, n) : 0;
+		if (!b) {
+			b = allocb(64);
+			block_add_extd(b, 1, KMALLOC_WAIT);
+			qio_copy_extd(b, &b->extra_data[0], p + sofar, n);
+		}
 #else
 		b = allocb(n);
 		memmove(b->wp, p + sofar, n);
@@ -1782,12 +1926,14 @@ void qfree(struct queue *q)
 void qclose(struct queue *q)
 {
 	struct block *bfirst;
+	bool was_closed;
 
 	if (q == NULL)
 		return;
 
 	/* mark it */
 	spin_lock_irqsave(&q->lock);
+	was_closed = q->state & Qclosed;
 	q->state |= Qclosed;
 	q->state &= ~(Qflow | Qstarve);
 	strncpy(q->err, Ehungup, sizeof(q->err));
@@ -1804,6 +1950,9 @@ void qclose(struct queue *q)
 	/* wake up readers/writers */
 	rendez_wakeup(&q->rr);
 	rendez_wakeup(&q->wr);
+	/* readers and writers will both see the hangup without blocking */
+	if (!was_closed)
+		qwake_cb(q, FDTAP_FILT_ALL | FDTAP_FILT_EDGE);
 }
 
 /*
@@ -1812,8 +1961,11 @@ void qclose(struct queue *q)
  */
 void qhangup(struct queue *q, char *msg)
 {
+	bool was_closed;
+
 	/* mark it */
 	spin_lock_irqsave(&q->lock);
+	was_closed = q->state & Qclosed;
 	q->state |= Qclosed;
 	if (msg == 0 || *msg == 0)
 		strncpy(q->err, Ehungup, sizeof(q->err));
@@ -1824,6 +1976,8 @@ void qhangup(struct queue *q, char *msg)
 	/* wake up readers/writers */
 	rendez_wakeup(&q->rr);
 	rendez_wakeup(&q->wr);
+	if (!was_closed)
+		qwake_cb(q, FDTAP_FILT_ALL | FDTAP_FILT_EDGE);
 }
 
 /*
@@ -1876,6 +2030,14 @@ int qcanread(struct queue *q)
 	return q->bfirst != 0;
 }
 
+/*
+ *  return true if we can write without blocking
+ */
+int qcanwrite(struct queue *q)
+{
+	return q->bypass || (q->len < q->limit) || (q->state & Qclosed);
+}
+
 /*
  *  change queue limit
  */
@@ -1898,13 +2060,17 @@ void qnoblock(struct queue *q, int onoff)
 void qflush(struct queue *q)
 {
 	struct block *bfirst;
+	int wake_filt;
+	bool was_full;
 
 	/* mark it */
 	spin_lock_irqsave(&q->lock);
+	was_full = q->len >= q->limit;
 	bfirst = q->bfirst;
 	q->bfirst = 0;
 	q->len = 0;
 	q->dlen = 0;
+	wake_filt = __qwritable_filt(q, was_full);
 	spin_unlock_irqsave(&q->lock);
 
 	/* free queued blocks */
@@ -1912,6 +2078,7 @@ void qflush(struct queue *q)
 
 	/* wake up readers/writers */
 	rendez_wakeup(&q->wr);
+	qwake_cb(q, wake_filt);
 }
 
 int qfull(struct queue *q)
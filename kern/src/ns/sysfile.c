@@ -12,6 +12,10 @@
 #include <pmap.h>
 #include <smp.h>
 #include <ip.h>
+#include <fdtap.h>
+#include <netmap.h>
+#include <umem.h>
+#include <sys/uio.h>
 
 enum {
 	DIRSIZE = STATFIXLEN + 32 * 4,
@@ -194,6 +198,7 @@ void fdclose(struct fgrp *f, int fd)
 	
 	int i;
 	struct chan *c;
+	struct fd_tap *tap;
 
 	spin_lock(&f->lock);
 	if (f->closed) {
@@ -212,9 +217,12 @@ void fdclose(struct fgrp *f, int fd)
 			f->maxfd = i;
 	if (fd < f->minfd)
 		f->minfd = fd;
+	tap = take_fd_tap(current, fd);
 	/* VFS hack: give the FD back to VFS */
 	put_fd(&current->open_files, fd);
 	spin_unlock(&f->lock);
+	if (tap)
+		free_fd_tap(tap);
 	cclose(c);
 }
 
@@ -901,6 +909,36 @@ long syspread(int fd, void *va, long n, int64_t off)
 	return rread(fd, va, n, &off);
 }
 
+/* Reads into each iovec in turn, stopping at the first short read, so we don't
+ * block for more once we have something. */
+static long rreadv(int fd, struct iovec *iov, int iovcnt, int64_t *offp)
+{
+	long n, sofar = 0;
+	int64_t off;
+
+	for (int i = 0; i < iovcnt; i++) {
+		if (offp)
+			off = *offp + sofar;
+		n = rread(fd, iov[i].iov_base, iov[i].iov_len, offp ? &off : NULL);
+		if (n < 0)
+			return sofar ? sofar : -1;
+		sofar += n;
+		if (n < iov[i].iov_len)
+			break;
+	}
+	return sofar;
+}
+
+long sysreadv(int fd, struct iovec *iov, int iovcnt)
+{
+	return rreadv(fd, iov, iovcnt, NULL);
+}
+
+long syspreadv(int fd, struct iovec *iov, int iovcnt, int64_t off)
+{
+	return rreadv(fd, iov, iovcnt, &off);
+}
+
 int sysremove(char *path)
 {
 	ERRSTACK(2);
@@ -1186,6 +1224,156 @@ long syspwrite(int fd, void *va, long n, int64_t off)
 	return rwrite(fd, va, n, &off);
 }
 
+/* Writes a block to fd's chan at *offp, or at its current offset if offp is 0,
+ * without copying the block's data.  This always consumes bp, even on error. */
+static long rbwrite(int fd, struct block *bp, int64_t *offp)
+{
+	ERRSTACK(3);
+	struct chan *c;
+	struct block *b = bp;
+	int64_t off;
+	long n = BLEN(bp);
+
+	if (waserror()) {
+		freeb(b);	/* harmless if bwrite already has it */
+		poperror();
+		return -1;
+	}
+	c = fdtochan(current->fgrp, fd, OWRITE, 1, 1);
+	if (waserror()) {
+		cclose(c);
+		nexterror();
+	}
+	if (c->qid.type & QTDIR)
+		error(Eisdir);
+	if (offp == NULL) {
+		spin_lock(&c->lock);	/* legacy lock for int64 assignment */
+		off = c->offset;
+		c->offset += n;
+		spin_unlock(&c->lock);
+	} else
+		off = *offp;
+	if (waserror()) {
+		if (offp == NULL) {
+			spin_lock(&c->lock);
+			c->offset -= n;
+			spin_unlock(&c->lock);
+		}
+		nexterror();
+	}
+	if (off < 0)
+		error(Enegoff);
+	/* bwrite consumes the block, even if it throws */
+	b = 0;
+	n = devtab[c->type].bwrite(c, bp, off);
+	poperror();
+	poperror();
+	cclose(c);
+	poperror();
+	return n;
+}
+
+long sysbwrite(int fd, struct block *bp)
+{
+	return rbwrite(fd, bp, NULL);
+}
+
+/* Returns TRUE if fd's device takes blocks as they are (its own bwrite), like a
+ * network conversation or a pipe, instead of copying them into its write(). */
+static bool fd_takes_blocks(int fd)
+{
+	ERRSTACK(1);
+	struct chan *c;
+	bool ret;
+
+	if (waserror()) {
+		poperror();
+		return FALSE;
+	}
+	c = fdtochan(current->fgrp, fd, OWRITE, 1, 1);
+	poperror();
+	ret = devtab[c->type].bwrite && (devtab[c->type].bwrite != devbwrite);
+	cclose(c);
+	return ret;
+}
+
+/* Copies len bytes of the user's iovecs into one block, starting at iovec *idx,
+ * *iov_off bytes in, and advances them.  Returns 0 and sets errno on failure. */
+static struct block *iov_to_block(struct iovec *iov, int *idx, size_t *iov_off,
+                                  size_t len)
+{
+	struct block *b = allocb(len);
+	size_t amt;
+
+	while (len) {
+		amt = MIN(iov[*idx].iov_len - *iov_off, len);
+		if (memcpy_from_user_errno(current, b->wp,
+		                           iov[*idx].iov_base + *iov_off, amt)) {
+			freeb(b);
+			return 0;
+		}
+		b->wp += amt;
+		len -= amt;
+		*iov_off += amt;
+		if (*iov_off == iov[*idx].iov_len) {
+			(*idx)++;
+			*iov_off = 0;
+		}
+	}
+	return b;
+}
+
+/* Devices that take blocks get each qiomaxatomic of the iovecs as one block, so
+ * e.g. a protocol header and its payload go out in one packet.  Everyone else
+ * gets a write per iovec.  Like rreadv(), we stop early on a short write. */
+static long rwritev(int fd, struct iovec *iov, int iovcnt, int64_t *offp)
+{
+	struct block *b;
+	long n, sofar = 0;
+	size_t total = 0, iov_off = 0;
+	int64_t off;
+	int idx = 0;
+
+	if (!fd_takes_blocks(fd)) {
+		for (int i = 0; i < iovcnt; i++) {
+			if (offp)
+				off = *offp + sofar;
+			n = rwrite(fd, iov[i].iov_base, iov[i].iov_len,
+			           offp ? &off : NULL);
+			if (n < 0)
+				return sofar ? sofar : -1;
+			sofar += n;
+			if (n < iov[i].iov_len)
+				break;
+		}
+		return sofar;
+	}
+	for (int i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+	while (sofar < total) {
+		b = iov_to_block(iov, &idx, &iov_off, MIN(total - sofar, qiomaxatomic));
+		if (!b)
+			return sofar ? sofar : -1;
+		if (offp)
+			off = *offp + sofar;
+		n = rbwrite(fd, b, offp ? &off : NULL);
+		if (n < 0)
+			return sofar ? sofar : -1;
+		sofar += n;
+	}
+	return sofar;
+}
+
+long syswritev(int fd, struct iovec *iov, int iovcnt)
+{
+	return rwritev(fd, iov, iovcnt, NULL);
+}
+
+long syspwritev(int fd, struct iovec *iov, int iovcnt, int64_t off)
+{
+	return rwritev(fd, iov, iovcnt, &off);
+}
+
 int syswstat(char *path, uint8_t * buf, int n)
 {
 	ERRSTACK(2);
@@ -1440,6 +1628,10 @@ void close_9ns_files(struct proc *p, bool only_cloexec)
 	if (!only_cloexec)
 		f->closed = TRUE;
 	spin_unlock(&f->lock);
+	/* Taps and netmaps point into the address space, which exec is about to
+	 * replace */
+	remove_all_fd_taps(p);
+	remove_all_netmaps(p);
 
 	/* maxfd is a legit val, not a +1 */
 	for (int i = 0; i <= f->maxfd; i++) {
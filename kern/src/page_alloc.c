@@ -23,6 +23,7 @@
 
 static void __page_decref(page_t *CT(1) page);
 static error_t __page_alloc_specific(page_t** page, size_t ppn);
+static void __jumbo_track(size_t ppn, int delta);
 
 #ifdef CONFIG_PAGE_COLORING
 #define NUM_KERNEL_COLORS 8
@@ -35,13 +36,92 @@ static error_t __page_alloc_specific(page_t** page, size_t ppn);
 uint8_t* global_cache_colors_map;
 size_t global_next_color = 0;
 
+/* Free lists for user jumbo pages.  For each jumbo order, we count the free
+ * pages in every naturally aligned block of that order, and keep the blocks
+ * that are entirely free on a list, so upage_alloc_jumbo() can pop one instead
+ * of scanning memory.  Whenever a page goes on or comes off the colored free
+ * lists, __jumbo_track() updates its blocks.  Protected by the
+ * colored_page_free_list_lock. */
+struct jumbo_block {
+	LIST_ENTRY(jumbo_block)		link;
+	size_t						nr_free;
+};
+LIST_HEAD(jumbo_block_list, jumbo_block);
+
+struct jumbo_order {
+	size_t						order;
+	size_t						nr_blocks;
+	struct jumbo_block			*blocks;
+	struct jumbo_block_list		free_blocks;
+};
+
+#define NR_JUMBO_ORDERS			2
+
+static struct jumbo_order jumbo_orders[NR_JUMBO_ORDERS];
+static int nr_jumbo_orders;
+
+/* Helper: sets up tracking for blocks of 2^order pages, starting from whatever
+ * is free now.  Until this runs, __jumbo_track() ignores the order. */
+static void jumbo_order_init(size_t order)
+{
+	struct jumbo_order *jo = &jumbo_orders[nr_jumbo_orders];
+	struct jumbo_block *jb;
+
+	assert(nr_jumbo_orders < NR_JUMBO_ORDERS);
+	jo->order = order;
+	/* the last, partial block (if any) can never be a jumbo */
+	jo->nr_blocks = max_nr_pages >> order;
+	jo->blocks = kzmalloc(jo->nr_blocks * sizeof(struct jumbo_block),
+	                      KMALLOC_WAIT);
+	LIST_INIT(&jo->free_blocks);
+	spin_lock_irqsave(&colored_page_free_list_lock);
+	for (size_t i = 0; i < jo->nr_blocks << order; i++) {
+		if (page_is_free(i))
+			jo->blocks[i >> order].nr_free++;
+	}
+	for (size_t i = 0; i < jo->nr_blocks; i++) {
+		jb = &jo->blocks[i];
+		if (jb->nr_free == 1UL << order)
+			LIST_INSERT_HEAD(&jo->free_blocks, jb, link);
+	}
+	nr_jumbo_orders++;
+	spin_unlock_irqsave(&colored_page_free_list_lock);
+}
+
+/* Helper: page ppn went on (delta 1) or came off (delta -1) the free lists.
+ * Hold the colored_page_free_list_lock. */
+static void __jumbo_track(size_t ppn, int delta)
+{
+	struct jumbo_order *jo;
+	struct jumbo_block *jb;
+
+	for (int i = 0; i < nr_jumbo_orders; i++) {
+		jo = &jumbo_orders[i];
+		if ((ppn >> jo->order) >= jo->nr_blocks)
+			continue;
+		jb = &jo->blocks[ppn >> jo->order];
+		if (jb->nr_free == 1UL << jo->order)
+			LIST_REMOVE(jb, link);
+		jb->nr_free += delta;
+		if (jb->nr_free == 1UL << jo->order)
+			LIST_INSERT_HEAD(&jo->free_blocks, jb, link);
+	}
+}
+
 void colored_page_alloc_init()
 {
+	size_t min_order = pgdir_min_jumbo_shift() - PGSHIFT;
+	size_t max_order = pgdir_max_jumbo_shift() - PGSHIFT;
+
 	global_cache_colors_map = 
 	       kmalloc(BYTES_FOR_BITMASK(llc_cache->num_colors), 0);
 	CLR_BITMASK(global_cache_colors_map, llc_cache->num_colors);
 	for(int i = 0; i < llc_cache->num_colors/NUM_KERNEL_COLORS; i++)
 		cache_color_alloc(llc_cache, global_cache_colors_map);
+	if (min_order)
+		jumbo_order_init(min_order);
+	if (max_order != min_order)
+		jumbo_order_init(max_order);
 }
 
 /* Initializes a page.  We can optimize this a bit since 0 usually works to init
@@ -65,6 +145,7 @@ static void __page_init(struct page *page)
 	if(i < (base_color+range)) {                                            \
 		*page = LIST_FIRST(&colored_page_free_list[i]);                     \
 		LIST_REMOVE(*page, pg_link);                                        \
+		__jumbo_track(page2ppn(*page), -1);                                 \
 		__page_init(*page);                                                 \
 		return i;                                                           \
 	}                                                                       \
@@ -103,6 +184,7 @@ static error_t __page_alloc_specific(page_t** page, size_t ppn)
 		return -ENOMEM;
 	*page = sp_page;
 	LIST_REMOVE(*page, pg_link);
+	__jumbo_track(ppn, -1);
 	__page_init(*page);
 	return 0;
 }
@@ -135,6 +217,43 @@ error_t upage_alloc(struct proc* p, page_t** page, int zero)
 	return ret;
 }
 
+/* Allocates 2^order contiguous pages, naturally aligned (the first ppn is a
+ * multiple of 2^order), to back a user jumbo page.  Like upage_alloc(), each
+ * little page gets its own ref, and *page is set to the first one.  This
+ * ignores page coloring, since a jumbo covers every color anyway.
+ *
+ * order must be one of the jumbo orders (pgdir_{min,max}_jumbo_shift() -
+ * PGSHIFT), which have their own lists of free blocks. */
+error_t upage_alloc_jumbo(page_t **page, size_t order, int zero)
+{
+	size_t npages = 1UL << order;
+	struct jumbo_order *jo = 0;
+	struct jumbo_block *jb;
+	size_t first;
+
+	for (int i = 0; i < nr_jumbo_orders; i++) {
+		if (jumbo_orders[i].order == order)
+			jo = &jumbo_orders[i];
+	}
+	if (!jo)
+		return -ENOMEM;
+	spin_lock_irqsave(&colored_page_free_list_lock);
+	jb = LIST_FIRST(&jo->free_blocks);
+	if (!jb) {
+		spin_unlock_irqsave(&colored_page_free_list_lock);
+		return -ENOMEM;
+	}
+	first = (jb - jo->blocks) << order;
+	/* taking the first page takes jb off its list */
+	for (size_t j = 0; j < npages; j++)
+		__page_alloc_specific(page, first + j);
+	spin_unlock_irqsave(&colored_page_free_list_lock);
+	*page = ppn2page(first);
+	if (zero)
+		memset(page2kva(*page), 0, npages * PGSIZE);
+	return 0;
+}
+
 /* Allocates a refcounted page of memory for the kernel's use */
 error_t kpage_alloc(page_t** page) 
 {
@@ -318,6 +437,7 @@ static void page_release(struct kref *kref)
 	   page,
 	   pg_link
 	);
+	__jumbo_track(page2ppn(page), 1);
 }
 
 /* Helper when initializing a page - just to prevent the proliferation of
@@ -348,7 +348,7 @@ static int __pm_mark_unmap(struct proc *p, pte_t *pte, void *va, void *arg)
 static void shootdown_and_reset_ptrstore(void *proc_ptrs[], int *arr_idx)
 {
 	for (int i = 0; i < *arr_idx; i++)
-		proc_tlbshootdown((struct proc*)proc_ptrs[i], 0, 0);
+		proc_tlbshootdown((struct proc*)proc_ptrs[i], 0, UMAPTOP);
 	*arr_idx = 0;
 }
 
@@ -246,11 +246,15 @@ int page_insert(pde_t *pgdir, struct page *page, void *va, int perm)
 page_t *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 {
 	pte_t* pte = pgdir_walk(pgdir, va, 0);
+	size_t pgsize;
 	if (!pte || !PAGE_PRESENT(*pte))
 		return 0;
 	if (pte_store)
 		*pte_store = pte;
-	return pa2page(PTE_ADDR(*pte));
+	/* A jumbo maps a run of little pages; we want the one holding va */
+	pgsize = 1UL << pgdir_page_shift(pgdir, va);
+	return pa2page(ROUNDDOWN(PTE_ADDR(*pte), pgsize)) +
+	       (((uintptr_t)va & (pgsize - 1)) >> PGSHIFT);
 }
 
 /**
@@ -317,6 +321,21 @@ void tlb_invalidate(pde_t *pgdir, void *va)
 	invlpg(va);
 }
 
+/* Past this many pages, it's cheaper to flush the whole TLB than to invlpg each
+ * page. */
+#define TLB_FLUSH_MAX_PAGES		32
+
+/* Flushes [start, end) of the current address space from this core's TLB */
+void tlb_flush_range(uintptr_t start, uintptr_t end)
+{
+	if (end - start > TLB_FLUSH_MAX_PAGES * PGSIZE) {
+		tlbflush();
+		return;
+	}
+	for (uintptr_t va = start; va < end; va += PGSIZE)
+		invlpg((void*)va);
+}
+
 /* Helper, returns true if any part of (start1, end1) is within (start2, end2).
  * Equality of endpoints (like end1 == start2) is okay.
  * Assumes no wrap-around. */
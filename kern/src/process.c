@@ -20,7 +20,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <time.h>
-#include <hashtable.h>
+#include <chash.h>
 #include <slab.h>
 #include <sys/queue.h>
 #include <frontend.h>
@@ -46,8 +46,9 @@ static void restore_vc_fp_state(struct preempt_data *vcpd);
 #define PID_MAX 32767 // goes from 0 to 32767, with 0 reserved
 static DECL_BITMASK(pid_bmask, PID_MAX + 1);
 spinlock_t pid_bmask_lock = SPINLOCK_INITIALIZER;
-struct hashtable *pid_hash;
-spinlock_t pid_hash_lock; // initialized in proc_init
+struct chash *pid_hash;
+/* Unlike pids, these are never reused.  0 means no proc. */
+static atomic_t next_tlb_ctx_id;
 
 /* Finds the next free entry (zero) entry in the pid_bitmask.  Set means busy.
  * PID 0 is reserved (in proc_init).  A return value of 0 is a failure (and
@@ -177,63 +178,45 @@ int __proc_set_state(struct proc *p, uint32_t state)
 
 /* Returns a pointer to the proc with the given pid, or 0 if there is none.
  * This uses get_not_zero, since it is possible the refcnt is 0, which means the
- * process is dying and we should not have the ref (and thus return 0).  We need
- * to lock to protect us from getting p, (someone else removes and frees p),
- * then get_not_zero() on p.
- * Don't push the locking into the hashtable without dealing with this. */
+ * process is dying and we should not have the ref (and thus return 0).  The
+ * chash read lock protects us from getting p, (someone else removes and frees
+ * p), then get_not_zero() on p: __proc_free() waits for us in chash_remove(). */
 struct proc *pid2proc(pid_t pid)
 {
-	spin_lock(&pid_hash_lock);
-	struct proc *p = hashtable_search(pid_hash, (void*)(long)pid);
+	struct chash_reader *rd = chash_read_lock();
+	struct proc *p = chash_lookup(pid_hash, (void*)(long)pid);
 	if (p)
 		if (!kref_get_not_zero(&p->p_kref, 1))
 			p = 0;
-	spin_unlock(&pid_hash_lock);
+	chash_read_unlock(rd);
 	return p;
 }
 
 /* Used by devproc for successive reads of the proc table.
  * Returns a pointer to the nth proc, or 0 if there is none.
  * This uses get_not_zero, since it is possible the refcnt is 0, which means the
- * process is dying and we should not have the ref (and thus return 0).  We need
- * to lock to protect us from getting p, (someone else removes and frees p),
- * then get_not_zero() on p.
- * Don't push the locking into the hashtable without dealing with this. */
+ * process is dying and we should not have the ref (and thus return 0).  As with
+ * pid2proc, the chash keeps p from being freed while we look at it. */
 struct proc *pid_nth(unsigned int n)
 {
-	struct proc *p;
-	spin_lock(&pid_hash_lock);
-	if (!hashtable_count(pid_hash)) {
-		spin_unlock(&pid_hash_lock);
-		return NULL;
-	}
-	struct hashtable_itr *iter = hashtable_iterator(pid_hash);
-	p = hashtable_iterator_value(iter);
-
-	while (p) {
-		/* if this process is not valid, it doesn't count,
-		 * so continue
-		 */
-
-		if (kref_get_not_zero(&p->p_kref, 1)){
-			/* this one counts */
-			if (! n){
-				printd("pid_nth: at end, p %p\n", p);
-				break;
-			}
-			kref_put(&p->p_kref);
-			n--;
-		}
-		if (!hashtable_iterator_advance(iter)){
-			p = NULL;
-			break;
+	struct proc *ret = 0;
+
+	void find_nth(void *item)
+	{
+		struct proc *p = (struct proc*)item;
+		/* if this process is not valid, it doesn't count.  We can't kref_put()
+		 * in here (it might be the last ref), so we only get the nth. */
+		if (ret || !kref_refcnt(&p->p_kref))
+			return;
+		if (n--)
+			return;
+		if (kref_get_not_zero(&p->p_kref, 1)) {
+			printd("pid_nth: at end, p %p\n", p);
+			ret = p;
 		}
-		p = hashtable_iterator_value(iter);
 	}
-
-	spin_unlock(&pid_hash_lock);
-	kfree(iter);
-	return p;
+	chash_for_each(pid_hash, find_nth);
+	return ret;
 }
 
 /* Performs any initialization related to processes, such as create the proc
@@ -247,10 +230,8 @@ void proc_init(void)
 	             MAX(ARCH_CL_SIZE, __alignof__(struct proc)), 0, 0, 0);
 	/* Init PID mask and hash.  pid 0 is reserved. */
 	SET_BITMASK_BIT(pid_bmask, 0);
-	spinlock_init(&pid_hash_lock);
-	spin_lock(&pid_hash_lock);
-	pid_hash = create_hashtable(100, __generic_hash, __generic_eq);
-	spin_unlock(&pid_hash_lock);
+	pid_hash = chash_create(128, __generic_hash, __generic_eq);
+	assert(pid_hash);
 	schedule_init();
 
 	atomic_init(&num_envs, 0);
@@ -320,6 +301,7 @@ error_t proc_alloc(struct proc **pp, struct proc *parent, int flags)
 	// Setup the default map of where to get cache colors from
 	p->cache_colors_map = global_cache_colors_map;
 	p->next_cache_color = 0;
+	p->tlb_ctx_id = atomic_fetch_and_add(&next_tlb_ctx_id, 1) + 1;
 	/* Initialize the address space */
 	if ((r = env_setup_vm(p)) < 0) {
 		kmem_cache_free(proc_cache, p);
@@ -420,9 +402,8 @@ void __proc_ready(struct proc *p)
 	/* Tell the ksched about us.  TODO: do we need to worry about the ksched
 	 * doing stuff to us before we're added to the pid_hash? */
 	__sched_proc_register(p);
-	spin_lock(&pid_hash_lock);
-	hashtable_insert(pid_hash, (void*)(long)p->pid, p);
-	spin_unlock(&pid_hash_lock);
+	if (!chash_insert(pid_hash, (void*)(long)p->pid, p))
+		warn("Failed to add pid %d to the pid_hash", p->pid);
 }
 
 /* Creates a process from the specified file, argvs, and envps.  Tempted to get
@@ -478,10 +459,9 @@ static void __proc_free(struct kref *kref)
 			cache_color_free(llc_cache, p->cache_colors_map);
 		cache_colors_map_free(p->cache_colors_map);
 	}
-	/* Remove us from the pid_hash and give our PID back (in that order). */
-	spin_lock(&pid_hash_lock);
-	hash_ret = hashtable_remove(pid_hash, (void*)(long)p->pid);
-	spin_unlock(&pid_hash_lock);
+	/* Remove us from the pid_hash and give our PID back (in that order).  This
+	 * waits on any pid2proc() that might have seen us. */
+	hash_ret = chash_remove(pid_hash, (void*)(long)p->pid);
 	/* might not be in the hash/ready, if we failed during proc creation */
 	if (hash_ret)
 		put_free_pid(p->pid);
@@ -542,7 +522,7 @@ static void __set_proc_current(struct proc *p)
 	/* If the process wasn't here, then we need to load its address space. */
 	if (p != pcpui->cur_proc) {
 		proc_incref(p, 1);
-		lcr3(p->env_cr3);
+		proc_load_cr3(pcpui->cur_proc, p);
 		/* This is "leaving the process context" of the previous proc.  The
 		 * previous lcr3 unloaded the previous proc's context.  This should
 		 * rarely happen, since we usually proactively leave process context,
@@ -878,6 +858,10 @@ void proc_destroy(struct proc *p)
 	 * abortable sleepers are already prevented via the DYING state.  (signalled
 	 * DYING, no new sleepers will block, and now we wake all old sleepers). */
 	abort_all_sysc(p);
+#ifdef CONFIG_ARSC_SERVER
+	/* Stop the pollers from picking up any more of our ring syscalls */
+	arsc_proc_destroy(p);
+#endif /* CONFIG_ARSC_SERVER */
 	/* we need to close files here, and not in free, since we could have a
 	 * refcnt indirectly related to one of our files.  specifically, if we have
 	 * a parent sleeping on our pipe, that parent won't wake up to decref until
@@ -1793,10 +1777,7 @@ struct proc *switch_to(struct proc *new_p)
 	/* If we aren't the proc already, then switch to it */
 	if (old_proc != new_p) {
 		pcpui->cur_proc = new_p;				/* uncounted ref */
-		if (new_p)
-			lcr3(new_p->env_cr3);
-		else
-			lcr3(boot_cr3);
+		proc_load_cr3(old_proc, new_p);
 	}
 	return old_proc;
 }
@@ -1808,49 +1789,89 @@ void switch_back(struct proc *new_p, struct proc *old_proc)
 	struct per_cpu_info *pcpui = &per_cpu_info[core_id()];
 	if (old_proc != new_p) {
 		pcpui->cur_proc = old_proc;
-		if (old_proc)
-			lcr3(old_proc->env_cr3);
-		else
-			lcr3(boot_cr3);
+		proc_load_cr3(new_p, old_proc);
+	}
+}
+
+/* Loads new_p's address space (or the kernel's, if new_p is 0) in place of
+ * old_p's on this core, keeping track of which cores have which address spaces
+ * loaded.  We set our bit in tlb_cores before tlb_load_proc() looks at tlb_gen,
+ * and proc_tlbshootdown() bumps tlb_gen before looking at tlb_cores, so either
+ * we see the new gen (and flush), or the shootdown sees us. */
+void proc_load_cr3(struct proc *old_p, struct proc *new_p)
+{
+	uint32_t coreid = core_id();
+	if (new_p) {
+		SET_BITMASK_BIT_ATOMIC(new_p->tlb_cores, coreid);
+		mb();
 	}
+	tlb_load_proc(new_p);
+	if (old_p && (old_p != new_p))
+		CLR_BITMASK_BIT_ATOMIC(old_p->tlb_cores, coreid);
 }
 
-/* Will send a TLB shootdown message to every vcore in the main address space
- * (aka, all vcores for now).  The message will take the start and end virtual
- * addresses as well, in case we want to be more clever about how much we
- * shootdown and batching our messages.  Should do the sanity about rounding up
- * and down in this function too.
+/* Flushes [start, end) from the TLB of every core that has p's address space
+ * loaded.  That includes our core, kthreads running syscalls, and SCPs, not
+ * just the MCP's online vcores.  Cores that load p later will see the new
+ * tlb_gen and flush if they need to (see tlb_load_proc()), so any number of
+ * shootdowns while a core isn't running p cost it at most one flush.
  *
- * Would be nice to have a broadcast kmsg at this point.  Note this may send a
- * message to the calling core (interrupting it, possibly while holding the
- * proc_lock).  We don't need to process routine messages since it's an
- * immediate message. */
-void proc_tlbshootdown(struct proc *p, uintptr_t start, uintptr_t end)
+ * Each remote core gets one immediate kmsg with the range, and we send them
+ * all in one multicast (in chunks, to keep our stack small).  Small ranges are
+ * flushed page by page, large ones with a full flush (tlb_flush_range()).  If
+ * acks is set, each remote core decrements it once it flushed. */
+static void __proc_tlbshootdown(struct proc *p, uintptr_t start, uintptr_t end,
+                                atomic_t *acks)
 {
-	/* TODO: need a better way to find cores running our address space.  we can
-	 * have kthreads running syscalls, async calls, processes being created. */
-	struct vcore *vc_i;
-	/* TODO: we might be able to avoid locking here in the future (we must hit
-	 * all online, and we can check __mapped).  it'll be complicated. */
-	spin_lock(&p->proc_lock);
-	switch (p->state) {
-		case (PROC_RUNNING_S):
-			tlbflush();
-			break;
-		case (PROC_RUNNING_M):
-			/* TODO: (TLB) sanity checks and rounding on the ranges */
-			TAILQ_FOREACH(vc_i, &p->online_vcs, list) {
-				send_kernel_message(vc_i->pcoreid, __tlbshootdown, start, end,
-				                    0, KMSG_IMMEDIATE);
-			}
-			break;
-		default:
-			/* TODO: til we fix shootdowns, there are some odd cases where we
-			 * have the address space loaded, but the state is in transition. */
-			if (p == current)
-				tlbflush();
+	uint32_t coreid = core_id();
+	uint32_t pc_arr[32];
+	uint32_t nr_pcs = 0;
+
+	start = ROUNDDOWN(start, PGSIZE);
+	end = ROUNDUP(end, PGSIZE);
+	atomic_inc(&p->tlb_gen);
+	mb();	/* bump the gen before reading tlb_cores.  see proc_load_cr3() */
+	for (int i = 0; i < num_cpus; i++) {
+		if (!GET_BITMASK_BIT(p->tlb_cores, i))
+			continue;
+		if (i == coreid) {
+			tlb_flush_range(start, end);
+			continue;
+		}
+		pc_arr[nr_pcs++] = i;
+		if (nr_pcs == ARRAY_SIZE(pc_arr)) {
+			if (acks)
+				atomic_add(acks, nr_pcs);
+			send_kernel_message_multi(pc_arr, nr_pcs, __tlbshootdown, start,
+			                          end, (long)acks, KMSG_IMMEDIATE);
+			nr_pcs = 0;
+		}
 	}
-	spin_unlock(&p->proc_lock);
+	if (nr_pcs) {
+		if (acks)
+			atomic_add(acks, nr_pcs);
+		send_kernel_message_multi(pc_arr, nr_pcs, __tlbshootdown, start, end,
+		                          (long)acks, KMSG_IMMEDIATE);
+	}
+}
+
+void proc_tlbshootdown(struct proc *p, uintptr_t start, uintptr_t end)
+{
+	__proc_tlbshootdown(p, start, end, 0);
+}
+
+/* Like proc_tlbshootdown(), but doesn't return until every core is done, for
+ * when stale TLB entries would let userspace write to pages the kernel is about
+ * to use, like pages going out on loan.  Needs IRQs on, and no locks the
+ * remote cores' IRQ handlers might want. */
+void proc_tlbshootdown_sync(struct proc *p, uintptr_t start, uintptr_t end)
+{
+	atomic_t acks;
+
+	atomic_init(&acks, 0);
+	__proc_tlbshootdown(p, start, end, &acks);
+	while (atomic_read(&acks))
+		cpu_relax();
 }
 
 /* Helper, used by __startcore and __set_curctx, which sets up cur_ctx to run a
@@ -2071,7 +2092,7 @@ void __startcore(uint32_t srcid, long a0, long a1, long a2)
 	 * with __proc_give_cores() and __proc_run_m(). */
 	if (!pcpui->cur_proc) {
 		pcpui->cur_proc = p_to_run;	/* install the ref to cur_proc */
-		lcr3(p_to_run->env_cr3);	/* load the page tables to match cur_proc */
+		proc_load_cr3(0, p_to_run);	/* load the page tables to match cur_proc */
 	} else {
 		proc_decref(p_to_run);		/* can't install, decref the extra one */
 	}
@@ -2208,8 +2229,12 @@ void __death(uint32_t srcid, long a0, long a1, long a2)
  * addresses from a0 to a1. */
 void __tlbshootdown(uint32_t srcid, long a0, long a1, long a2)
 {
-	/* TODO: (TLB) something more intelligent with the range */
-	tlbflush();
+	/* We might have switched to another address space since it was sent, in
+	 * which case this is just an extra flush.  The old one will get flushed
+	 * when we load it again, since its tlb_gen changed. */
+	tlb_flush_range((uintptr_t)a0, (uintptr_t)a1);
+	if (a2)
+		atomic_dec((atomic_t*)a2);
 }
 
 void print_allpids(void)
@@ -2230,9 +2255,7 @@ void print_allpids(void)
 	printk("     PID Name %-*s State      Parent    \n",
 	       PROC_PROGNAME_SZ - 5, "");
 	printk("------------------------------%s\n", dashes);
-	spin_lock(&pid_hash_lock);
-	hash_for_each(pid_hash, print_proc_state);
-	spin_unlock(&pid_hash_lock);
+	chash_for_each(pid_hash, print_proc_state);
 }
 
 void print_proc_info(pid_t pid)
@@ -2305,6 +2328,7 @@ void print_proc_info(pid_t pid)
 void check_my_owner(void)
 {
 	struct per_cpu_info *pcpui = &per_cpu_info[core_id()];
+	bool ownerless = FALSE;
 	void shazbot(void *item)
 	{
 		struct proc *p = (struct proc*)item;
@@ -2317,13 +2341,11 @@ void check_my_owner(void)
 			if (vc_i->pcoreid == core_id()) {
 				/* Immediate message was sent, we should get it when we enable
 				 * interrupts, which should cause us to skip cpu_halt() */
-				if (!STAILQ_EMPTY(&pcpui->immed_amsgs))
+				if (ACCESS_ONCE(pcpui->kmsgs.immed_amsgs))
 					continue;
 				printk("Owned pcore (%d) has no owner, by %p, vc %d!\n",
 				       core_id(), p, vcore2vcoreid(p, vc_i));
-				spin_unlock(&p->proc_lock);
-				spin_unlock(&pid_hash_lock);
-				monitor(0);
+				ownerless = TRUE;
 			}
 		}
 		spin_unlock(&p->proc_lock);
@@ -2331,9 +2353,10 @@ void check_my_owner(void)
 	assert(!irq_is_enabled());
 	extern int booting;
 	if (!booting && !pcpui->owning_proc) {
-		spin_lock(&pid_hash_lock);
-		hash_for_each(pid_hash, shazbot);
-		spin_unlock(&pid_hash_lock);
+		chash_for_each(pid_hash, shazbot);
+		/* Can't block in the middle of chash_for_each() */
+		if (ownerless)
+			monitor(0);
 	}
 }
 
@@ -2345,7 +2368,5 @@ void print_9ns(void)
 		struct proc *p = (struct proc*)item;
 		print_9ns_files(p);
 	}
-	spin_lock(&pid_hash_lock);
-	hash_for_each(pid_hash, print_proc_9ns);
-	spin_unlock(&pid_hash_lock);
+	chash_for_each(pid_hash, print_proc_9ns);
 }
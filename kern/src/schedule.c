@@ -19,11 +19,12 @@
 #include <alarm.h>
 #include <sys/queue.h>
 #include <kmalloc.h>
+#include <arsc_server.h>
 
 /* Process Lists.  'unrunnable' is a holding list for SCPs that are running or
- * waiting or otherwise not considered for sched decisions. */
+ * waiting or otherwise not considered for sched decisions.  Runnable SCPs are
+ * on the runqs, below. */
 struct proc_list unrunnable_scps = TAILQ_HEAD_INITIALIZER(unrunnable_scps);
-struct proc_list runnable_scps = TAILQ_HEAD_INITIALIZER(runnable_scps);
 /* mcp lists.  we actually could get by with one list and a TAILQ_CONCAT, but
  * I'm expecting to want the flexibility of the pointers later. */
 struct proc_list all_mcps_1 = TAILQ_HEAD_INITIALIZER(all_mcps_1);
@@ -31,22 +32,97 @@ struct proc_list all_mcps_2 = TAILQ_HEAD_INITIALIZER(all_mcps_2);
 struct proc_list *primary_mcps = &all_mcps_1;
 struct proc_list *secondary_mcps = &all_mcps_2;
 
+/* Runnable SCPs wait on a run queue for an LL core, which is a min-heap of procs
+ * by vruntime.  An SCP's vruntime is how much CPU it has had, in ticks, scaled
+ * by its weight (from its nice value), so the SCP with the smallest vruntime is
+ * the furthest behind its fair share.  That's who runs next, and on the tick,
+ * it preempts the running SCP once it is scp_gran_ticks behind.  vruntimes are
+ * relative to their runq's min_vruntime, which only goes up.
+ *
+ * The runqs are indexed by pcoreid (only the LL cores' are used) and protected
+ * by the proclist_lock.  Every heap has room for every proc. */
+struct scp_runq {
+	struct proc					**heap;
+	int							nr;
+	int							size;
+	uint64_t					min_vruntime;
+	/* The SCP we last started here, to decide on preempting it */
+	bool						running;
+	uint64_t					cur_vruntime;	/* as of cur_start */
+	uint64_t					cur_start;
+	int							cur_weight;
+	/* Scheduling latency: from runnable to running */
+	uint64_t					nr_runs;
+	uint64_t					lat_ticks;
+	uint64_t					max_lat_ticks;
+};
+static struct scp_runq *scp_runqs;
+static int *ll_cores;
+static int nr_ll_cores;
+/* Runnable SCPs on all runqs, for unlocked peeks */
+static int nr_runnable_scps;
+/* Procs the ksched knows about, which is how big the heaps need to be */
+static int nr_sched_procs;
+
+/* A waiting SCP preempts the running one once it is this far behind it (in nice
+ * 0 time), and a waking SCP gets at most this much credit for having slept. */
+#define SCP_GRAN_USEC 1000
+#define SCP_SLEEP_CREDIT_USEC 5000
+static uint64_t scp_gran_ticks;
+static uint64_t scp_credit_ticks;
+
+/* Weights for nice -20 through 19.  Each step is about 10% of the CPU between
+ * two procs. */
+#define NICE_0_WEIGHT 1024
+static const int nice_weights[SCHED_NICE_MAX - SCHED_NICE_MIN + 1] = {
+	88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+	 9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+	 1024,   820,   655,   526,   423,   335,   272,   215,   172,   137,
+	  110,    87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+
 /* The pcores in the system.  (array gets alloced in init()).  */
 struct sched_pcore *all_pcores;
 
-/* TAILQ of all unallocated, idle (CG) cores */
-struct sched_pcore_tailq idlecores = TAILQ_HEAD_INITIALIZER(idlecores);
+/* How many pcores have spc->idle set: unallocated, idle (CG) cores */
+atomic_t nr_idle_cores;
+
+/* Set by next_core(): the idle core to give out next, or -1 */
+static int next_pcore_hint = -1;
+
+/* Scratch counts for placing a proc's cores, indexed by the topology IDs in
+ * core_topo (each field by its own kind of ID).  Rebuilt for every
+ * __core_request(), protected by the ksched_poker (only one MCP ksched runs at
+ * a time). */
+struct topo_counts {
+	uint8_t						llc_idle;		/* idle cores in this LLC */
+	uint8_t						phys_busy;		/* non-idle hyperthreads */
+	bool						llc_mine;		/* the proc has a core here */
+	bool						socket_mine;
+	bool						phys_mine;
+};
+static struct topo_counts *topo_counts;
 
 /* Helper, defined below */
-static void __core_request(struct proc *p, uint32_t amt_needed);
+static uint32_t __core_request(struct proc *p, uint32_t amt_needed);
+static void __placement_prep(struct proc *p);
+static struct sched_pcore *__pick_idle_core(struct proc *p);
+static bool claim_idle_core(struct sched_pcore *spc);
+static struct sched_pcore *claim_hinted_core(void);
+static struct sched_pcore *claim_first_idle_core(void);
+static void make_core_idle(struct sched_pcore *spc);
 static void __put_idle_cores(struct proc *p, uint32_t *pc_arr, uint32_t num);
 static void add_to_list(struct proc *p, struct proc_list *list);
 static void remove_from_list(struct proc *p, struct proc_list *list);
+static void remove_from_any_list(struct proc *p);
+static void runq_add(struct proc *p, int pcoreid);
+static void runq_remove(struct proc *p);
 static void switch_lists(struct proc *p, struct proc_list *old,
                          struct proc_list *new);
 static uint32_t spc2pcoreid(struct sched_pcore *spc);
 static struct sched_pcore *pcoreid2spc(uint32_t pcoreid);
 static bool is_ll_core(uint32_t pcoreid);
+static void set_core_idle_policy(uint32_t pcoreid);
 static void __prov_track_alloc(struct proc *p, uint32_t pcoreid);
 static void __prov_track_dealloc(struct proc *p, uint32_t pcoreid);
 static void __prov_track_dealloc_bulk(struct proc *p, uint32_t *pc_arr,
@@ -69,32 +145,78 @@ static uint32_t get_cores_needed(struct proc *p);
  * struct that can handle the posting of different types of work. */
 struct poke_tracker ksched_poker = {0, 0, __run_mcp_ksched};
 
-/* this 'big ksched lock' protects a bunch of things, which i may make fine
- * grained: */
-/* - protects the integrity of proc tailqs/structures, as well as the membership
- * of a proc on those lists.  proc lifetime within the ksched but outside this
- * lock is protected by the proc kref. */
-//spinlock_t proclist_lock = SPINLOCK_INITIALIZER; /* subsumed by bksl */
-/* - protects the provisioning assignment, membership of sched_pcores in
- * provision lists, and the integrity of all prov lists (the lists of each
- * proc).  does NOT protect spc->alloc_proc. */
-//spinlock_t prov_lock = SPINLOCK_INITIALIZER;
-/* - protects allocation structures: spc->alloc_proc, the integrity and
- * membership of the idelcores tailq. */
-//spinlock_t alloc_lock = SPINLOCK_INITIALIZER;
-spinlock_t sched_lock = SPINLOCK_INITIALIZER;
-
-/* Alarm struct, for our example 'timer tick' */
+/* The ksched's locks.  Lock ordering: proclist_lock, then prov_lock.  We don't
+ * hold either while calling into the proc code.
+ *
+ * - proclist_lock protects the integrity of proc tailqs/structures, as well as
+ *   the membership of a proc on those lists.  proc lifetime within the ksched
+ *   but outside this lock is protected by the proc kref.
+ * - prov_lock protects the provisioning assignment, membership of sched_pcores
+ *   in provision lists, and the integrity of all prov lists (the lists of each
+ *   proc).  It also protects spc->alloc_proc, since that decides which of its
+ *   prov_proc's lists a pcore is on.
+ * - Idle cores don't need a lock.  A pcore is made idle (spc->idle) after it
+ *   is track_dealloc'd, and whoever atomically clears spc->idle owns it, and
+ *   must track_alloc it or make it idle again.  We make cores idle while
+ *   holding the prov_lock, so someone holding the prov_lock who sees a core
+ *   with no alloc_proc that they can't claim knows someone else claimed it. */
+spinlock_t proclist_lock = SPINLOCK_INITIALIZER;
+spinlock_t prov_lock = SPINLOCK_INITIALIZER;
+
+/* The ksched is event-driven: it runs when procs poke it, wake up, yield, die,
+ * or get provisioned.  The only timer is a deadline on the LL core (core 0),
+ * armed on demand when there is something to be fair about: SCPs waiting for a
+ * turn, or MCPs that wanted more cores than we could give them.  Once everyone
+ * is satisfied, it stops, and no core takes ksched timer interrupts. */
 struct alarm_waiter ksched_waiter;
+static atomic_t ksched_tick_armed;
 
 #define TIMER_TICK_USEC 10000 	/* 10msec */
 
-/* Helper: Sets up a timer tick on the calling core to go off 10 msec from now.
- * This assumes the calling core is an LL core, etc. */
-static void set_ksched_alarm(void)
+/* How long an idle core provisioned to an MCP spins before it MWAITs */
+#define KSCHED_IDLE_POLL_USEC 50
+
+/* Set when the last MCP ksched pass left some proc wanting cores */
+static bool ksched_unmet_demand;
+
+/* Set while a __ksched_kick is on its way to the LL core */
+static atomic_t ksched_kick_pending;
+
+/* Helper: arms the deadline alarm on the LL core to go off 10 msec from now,
+ * unless it is already armed.  Can be called from any core.  The read keeps
+ * wakeups from bouncing the flag's cache line while the alarm is pending. */
+static void arm_ksched_tick(void)
 {
+	if (atomic_read(&ksched_tick_armed))
+		return;
+	if (atomic_swap(&ksched_tick_armed, TRUE))
+		return;
 	set_awaiter_rel(&ksched_waiter, TIMER_TICK_USEC);
-	set_alarm(&per_cpu_info[core_id()].tchain, &ksched_waiter);
+	set_alarm(&per_cpu_info[0].tchain, &ksched_waiter);
+}
+
+/* Helper: whether there's anything the deadline alarm needs to come back for.
+ * This peeks at the runnable list without the proclist_lock; anyone who adds to
+ * it arms the alarm afterwards. */
+static bool ksched_needs_tick(void)
+{
+	return ACCESS_ONCE(nr_runnable_scps) || ksched_unmet_demand;
+}
+
+static void __ksched_kick(uint32_t srcid, long a0, long a1, long a2)
+{
+	atomic_set(&ksched_kick_pending, FALSE);
+	poke(&ksched_poker, 0);
+}
+
+/* Something changed that the MCP ksched should look at, like cores coming free.
+ * Our callers might hold proc locks, which the ksched grabs, so we run it soon
+ * from the LL core instead of here.  Kicks coalesce while one is pending. */
+static void kick_ksched(void)
+{
+	if (atomic_swap(&ksched_kick_pending, TRUE))
+		return;
+	send_kernel_message(0, __ksched_kick, 0, 0, 0, KMSG_ROUTINE);
 }
 
 /* Need a kmsg to just run the sched, but not to rearm */
@@ -103,51 +225,68 @@ static void __just_sched(uint32_t srcid, long a0, long a1, long a2)
 	run_scheduler();
 }
 
-/* RKM alarm, to run the scheduler tick (not in interrupt context) and reset the
- * alarm.  Note that interrupts will be disabled, but this is not the same as
- * interrupt context.  We're a routine kmsg, which means the core is in a
- * quiescent state. */
+/* RKM alarm, to run the scheduler deadline (not in interrupt context) and
+ * rearm the alarm if there's still work.  Note that interrupts will be
+ * disabled, but this is not the same as interrupt context.  We're a routine
+ * kmsg, which means the core is in a quiescent state. */
 static void __ksched_tick(struct alarm_waiter *waiter)
 {
+	/* The alarm fired, so it is no longer armed.  Clear this before we look for
+	 * work, so anyone adding work after we look will rearm it. */
+	atomic_set(&ksched_tick_armed, FALSE);
 	/* TODO: imagine doing some accounting here */
 	run_scheduler();
-	/* Set our alarm to go off, incrementing from our last tick (instead of
-	 * setting it relative to now, since some time has passed since the alarm
-	 * first went off.  Note, this may be now or in the past! */
-	set_awaiter_inc(&ksched_waiter, TIMER_TICK_USEC);
-	set_alarm(&per_cpu_info[core_id()].tchain, &ksched_waiter);
+	if (ksched_needs_tick())
+		arm_ksched_tick();
 }
 
 void schedule_init(void)
 {
-	spin_lock(&sched_lock);
+	spin_lock(&prov_lock);
 	/* init provisioning stuff */
 	all_pcores = kmalloc(sizeof(struct sched_pcore) * num_cpus, 0);
 	memset(all_pcores, 0, sizeof(struct sched_pcore) * num_cpus);
+	topo_counts = kmalloc(sizeof(struct topo_counts) * num_cpus, 0);
+	scp_runqs = kzmalloc(sizeof(struct scp_runq) * num_cpus, 0);
+	ll_cores = kmalloc(sizeof(int) * num_cpus, 0);
+	nr_ll_cores = 0;
+	for (int i = 0; i < num_cpus; i++) {
+		if (is_ll_core(i))
+			ll_cores[nr_ll_cores++] = i;
+	}
+	scp_gran_ticks = usec2tsc(SCP_GRAN_USEC);
+	scp_credit_ticks = usec2tsc(SCP_SLEEP_CREDIT_USEC);
 	assert(!core_id());		/* want the alarm on core0 for now */
 	init_awaiter(&ksched_waiter, __ksched_tick);
-	set_ksched_alarm();
-	/* init the idlecore list.  if they turned off hyperthreading, give them the
+	atomic_init(&ksched_tick_armed, FALSE);
+	atomic_init(&ksched_kick_pending, FALSE);
+	/* init the idle cores.  if they turned off hyperthreading, give them the
 	 * odds from 1..max-1.  otherwise, give them everything by 0 (default mgmt
 	 * core).  TODO: (CG/LL) better LL/CG mgmt */
+	atomic_init(&nr_idle_cores, 0);
 #ifndef CONFIG_DISABLE_SMT
 	for (int i = 1; i < num_cpus; i++)
-		TAILQ_INSERT_TAIL(&idlecores, pcoreid2spc(i), alloc_next);
+		make_core_idle(pcoreid2spc(i));
 #else
 	assert(!(num_cpus % 2));
 	for (int i = 1; i < num_cpus; i += 2)
-		TAILQ_INSERT_TAIL(&idlecores, pcoreid2spc(i), alloc_next);
+		make_core_idle(pcoreid2spc(i));
 #endif /* CONFIG_DISABLE_SMT */
 #ifdef CONFIG_ARSC_SERVER
-	struct sched_pcore *a_core = TAILQ_FIRST(&idlecores);
-	assert(a_core);
-	TAILQ_REMOVE(&idlecores, a_core, alloc_next);
-	send_kernel_message(spc2pcoreid(a_core), arsc_server, 0, 0, 0,
-	                    KMSG_ROUTINE);
-	warn("Using core %d for the ARSCs - there are probably issues with this.",
-	     spc2pcoreid(a_core));
+	/* The ARSC pollers get dedicated cores, which never run procs */
+	for (int i = 0; i < CONFIG_ARSC_POLLERS; i++) {
+		struct sched_pcore *a_core = claim_first_idle_core();
+		if (!a_core) {
+			warn("Out of cores for ARSC pollers, only have %d", i);
+			break;
+		}
+		arsc_add_poller(spc2pcoreid(a_core));
+		printk("Using core %d for ARSC polling\n", spc2pcoreid(a_core));
+	}
 #endif /* CONFIG_ARSC_SERVER */
-	spin_unlock(&sched_lock);
+	for (int i = 0; i < num_cpus; i++)
+		set_core_idle_policy(i);
+	spin_unlock(&prov_lock);
 	return;
 }
 
@@ -183,15 +322,216 @@ static void switch_lists(struct proc *p, struct proc_list *old,
 	add_to_list(p, new);
 }
 
-/* Removes from whatever list p is on */
+/* Removes from whatever list (or runq) p is on */
 static void remove_from_any_list(struct proc *p)
 {
+	if (p->ksched_data.runq_idx >= 0)
+		runq_remove(p);
 	if (p->ksched_data.cur_list) {
 		TAILQ_REMOVE(p->ksched_data.cur_list, p, ksched_data.proc_link);
 		p->ksched_data.cur_list = 0;
 	}
 }
 
+int sched_nice_weight(int nice)
+{
+	return nice_weights[nice - SCHED_NICE_MIN];
+}
+
+static int scp_weight(struct proc *p)
+{
+	return sched_nice_weight(p->ksched_data.nice);
+}
+
+static uint64_t scale_vruntime(uint64_t ticks, int weight)
+{
+	return ticks * NICE_0_WEIGHT / weight;
+}
+
+/* Charges p for the CPU it used since we last charged it.  The proc code
+ * accounts an SCP's time on vcore 0. */
+static void scp_charge(struct proc *p)
+{
+	uint64_t total = vcore_account_gettotal(p, 0);
+
+	p->ksched_data.vruntime += scale_vruntime(total -
+	                                          p->ksched_data.ticks_charged,
+	                                          scp_weight(p));
+	p->ksched_data.ticks_charged = total;
+}
+
+/* How far the SCP running on rq's core has gotten, counting its current run */
+static uint64_t scp_cur_vruntime(struct scp_runq *rq)
+{
+	return rq->cur_vruntime + scale_vruntime(read_tsc() - rq->cur_start,
+	                                         rq->cur_weight);
+}
+
+static void runq_set(struct scp_runq *rq, int idx, struct proc *p)
+{
+	rq->heap[idx] = p;
+	p->ksched_data.runq_idx = idx;
+}
+
+static bool runq_before(struct proc *a, struct proc *b)
+{
+	return a->ksched_data.vruntime < b->ksched_data.vruntime;
+}
+
+static void runq_sift_up(struct scp_runq *rq, int idx)
+{
+	struct proc *p = rq->heap[idx];
+	int parent;
+
+	while (idx) {
+		parent = (idx - 1) / 2;
+		if (!runq_before(p, rq->heap[parent]))
+			break;
+		runq_set(rq, idx, rq->heap[parent]);
+		idx = parent;
+	}
+	runq_set(rq, idx, p);
+}
+
+static void runq_sift_down(struct scp_runq *rq, int idx)
+{
+	struct proc *p = rq->heap[idx];
+	int child;
+
+	while ((child = 2 * idx + 1) < rq->nr) {
+		if ((child + 1 < rq->nr) &&
+		    runq_before(rq->heap[child + 1], rq->heap[child]))
+			child++;
+		if (!runq_before(rq->heap[child], p))
+			break;
+		runq_set(rq, idx, rq->heap[child]);
+		idx = child;
+	}
+	runq_set(rq, idx, p);
+}
+
+/* Helper: puts p in rq's heap.  Hold the proclist_lock. */
+static void __runq_insert(struct scp_runq *rq, struct proc *p)
+{
+	assert(rq->nr < rq->size);
+	runq_set(rq, rq->nr++, p);
+	runq_sift_up(rq, rq->nr - 1);
+}
+
+/* Helper: takes p out of rq's heap, wherever it is.  Hold the proclist_lock. */
+static void __runq_remove(struct scp_runq *rq, struct proc *p)
+{
+	int idx = p->ksched_data.runq_idx;
+	struct proc *last;
+
+	assert(rq->heap[idx] == p);
+	p->ksched_data.runq_idx = -1;
+	last = rq->heap[--rq->nr];
+	if (last == p)
+		return;
+	runq_set(rq, idx, last);
+	runq_sift_up(rq, idx);
+	runq_sift_down(rq, last->ksched_data.runq_idx);
+}
+
+/* Puts p on LL core pcoreid's runq, charging it for whatever it ran since it
+ * was last on one.  p keeps its lag behind (or ahead of) the min_vruntime of
+ * the runq it was last on, but sleepers only get so much credit.  New procs
+ * start even with everyone else.  Hold the proclist_lock. */
+static void runq_add(struct proc *p, int pcoreid)
+{
+	struct sched_proc_data *sd = &p->ksched_data;
+	struct scp_runq *rq = &scp_runqs[pcoreid];
+	int64_t lag = 0;
+
+	assert(sd->runq_idx < 0);
+	scp_charge(p);
+	if (sd->runq >= 0)
+		lag = sd->vruntime - scp_runqs[sd->runq].min_vruntime;
+	lag = MAX(lag, -(int64_t)scp_credit_ticks);
+	if ((lag < 0) && (-lag > rq->min_vruntime))
+		lag = -rq->min_vruntime;
+	sd->vruntime = rq->min_vruntime + lag;
+	sd->runq = pcoreid;
+	__runq_insert(rq, p);
+	nr_runnable_scps++;
+}
+
+/* Takes p off its runq.  Hold the proclist_lock. */
+static void runq_remove(struct proc *p)
+{
+	__runq_remove(&scp_runqs[p->ksched_data.runq], p);
+	nr_runnable_scps--;
+}
+
+/* Picks the runq a waking SCP should wait on: the least loaded LL core's,
+ * preferring the one it ran on last.  Hold the proclist_lock. */
+static int scp_pick_runq(struct proc *p)
+{
+	int best = ll_cores[0], load, best_load = -1;
+	struct scp_runq *rq;
+
+	for (int i = 0; i < nr_ll_cores; i++) {
+		rq = &scp_runqs[ll_cores[i]];
+		load = rq->nr + (rq->running ? 1 : 0);
+		if ((best_load < 0) || (load < best_load) ||
+		    ((load == best_load) && (ll_cores[i] == p->ksched_data.runq))) {
+			best = ll_cores[i];
+			best_load = load;
+		}
+	}
+	return best;
+}
+
+/* Migration: LL core pcoreid has nothing to run, so it takes the most overdue
+ * SCP from the busiest other runq.  Hold the proclist_lock. */
+static void scp_steal(int pcoreid)
+{
+	struct scp_runq *busiest = 0, *rq;
+	struct proc *p;
+
+	for (int i = 0; i < nr_ll_cores; i++) {
+		rq = &scp_runqs[ll_cores[i]];
+		if ((ll_cores[i] == pcoreid) || !rq->nr)
+			continue;
+		if (!busiest || (rq->nr > busiest->nr))
+			busiest = rq;
+	}
+	if (!busiest)
+		return;
+	p = busiest->heap[0];
+	runq_remove(p);
+	runq_add(p, pcoreid);
+}
+
+/* Makes sure every runq's heap can hold nr_procs.  This might block, so don't
+ * hold the proclist_lock. */
+static void scp_runqs_reserve(int nr_procs)
+{
+	struct scp_runq *rq;
+	struct proc **heap, **old_heap;
+	int size;
+
+	for (int i = 0; i < nr_ll_cores; i++) {
+		rq = &scp_runqs[ll_cores[i]];
+		if (ACCESS_ONCE(rq->size) >= nr_procs)
+			continue;
+		size = MAX(nr_procs, 2 * ACCESS_ONCE(rq->size));
+		heap = kmalloc(sizeof(struct proc*) * size, KMALLOC_WAIT);
+		spin_lock(&proclist_lock);
+		/* Someone else might have grown it while we allocated */
+		if (rq->size < size) {
+			memcpy(heap, rq->heap, sizeof(struct proc*) * rq->nr);
+			old_heap = rq->heap;
+			rq->heap = heap;
+			rq->size = size;
+			heap = old_heap;
+		}
+		spin_unlock(&proclist_lock);
+		kfree(heap);
+	}
+}
+
 /************** Process Management Callbacks **************/
 /* a couple notes:
  * - the proc lock is NOT held for any of these calls.  currently, there is no
@@ -204,25 +544,39 @@ static void remove_from_any_list(struct proc *p)
  *   DYING */
 void __sched_proc_register(struct proc *p)
 {
+	int nr_procs;
+
 	assert(p->state != PROC_DYING);	/* shouldn't be abel to happen yet */
 	/* one ref for the proc's existence, cradle-to-grave */
 	proc_incref(p, 1);	/* need at least this OR the 'one for existing' */
-	spin_lock(&sched_lock);
+	/* no one else can see p's ksched data yet */
 	TAILQ_INIT(&p->ksched_data.prov_alloc_me);
 	TAILQ_INIT(&p->ksched_data.prov_not_alloc_me);
+	p->ksched_data.placement = CORE_PLACE_COMPACT;
+	p->ksched_data.nice = 0;
+	p->ksched_data.vruntime = 0;
+	p->ksched_data.ticks_charged = 0;
+	p->ksched_data.runq = -1;
+	p->ksched_data.runq_idx = -1;
+	spin_lock(&proclist_lock);
+	nr_procs = ++nr_sched_procs;
+	spin_unlock(&proclist_lock);
+	/* Before anyone can wake p and put it on a runq */
+	scp_runqs_reserve(nr_procs);
+	spin_lock(&proclist_lock);
 	add_to_list(p, &unrunnable_scps);
-	spin_unlock(&sched_lock);
+	spin_unlock(&proclist_lock);
 }
 
 /* Returns 0 if it succeeded, an error code otherwise. */
 void __sched_proc_change_to_m(struct proc *p)
 {
-	spin_lock(&sched_lock);
+	spin_lock(&proclist_lock);
 	/* Need to make sure they aren't dying.  if so, we already dealt with their
 	 * list membership, etc (or soon will).  taking advantage of the 'immutable
 	 * state' of dying (so long as refs are held). */
 	if (p->state == PROC_DYING) {
-		spin_unlock(&sched_lock);
+		spin_unlock(&proclist_lock);
 		return;
 	}
 	/* Catch user bugs */
@@ -235,11 +589,12 @@ void __sched_proc_change_to_m(struct proc *p)
 	remove_from_list(p, &unrunnable_scps);
 	//remove_from_any_list(p); 	/* ^^ instead of this */
 	add_to_list(p, primary_mcps);
-	spin_unlock(&sched_lock);
+	spin_unlock(&proclist_lock);
 	//poke_ksched(p, RES_CORES);
 }
 
-/* Helper for the destroy CB : unprovisions any pcores for the given list */
+/* Helper for the destroy CB : unprovisions any pcores for the given list.  They
+ * go back to idling the way unprovisioned cores do.  Hold the prov_lock. */
 static void unprov_pcore_list(struct sched_pcore_tailq *list_head)
 {
 	struct sched_pcore *spc_i;
@@ -248,8 +603,10 @@ static void unprov_pcore_list(struct sched_pcore_tailq *list_head)
 	 * them), and since the INSERTs don't care what list you were on before
 	 * (chummy with the implementation).  Pretty sure this is right.  If there's
 	 * suspected list corruption, be safer here. */
-	TAILQ_FOREACH(spc_i, list_head, prov_next)
+	TAILQ_FOREACH(spc_i, list_head, prov_next) {
 		spc_i->prov_proc = 0;
+		set_core_idle_policy(spc2pcoreid(spc_i));
+	}
 	TAILQ_INIT(list_head);
 }
 
@@ -260,20 +617,25 @@ static void unprov_pcore_list(struct sched_pcore_tailq *list_head)
  * __proc_free will be called (when the last one is done). */
 void __sched_proc_destroy(struct proc *p, uint32_t *pc_arr, uint32_t nr_cores)
 {
-	spin_lock(&sched_lock);
+	spin_lock(&proclist_lock);
+	/* Remove from whatever list we are on (if any - might not be on one if it
+	 * was in the middle of __run_mcp_sched) */
+	remove_from_any_list(p);
+	nr_sched_procs--;
+	spin_unlock(&proclist_lock);
+	spin_lock(&prov_lock);
 	/* Unprovision any cores.  Note this is different than track_dealloc.
 	 * The latter does bookkeeping when an allocation changes.  This is a
 	 * bulk *provisioning* change. */
 	unprov_pcore_list(&p->ksched_data.prov_alloc_me);
 	unprov_pcore_list(&p->ksched_data.prov_not_alloc_me);
-	/* Remove from whatever list we are on (if any - might not be on one if it
-	 * was in the middle of __run_mcp_sched) */
-	remove_from_any_list(p);
 	if (nr_cores) {
-		__put_idle_cores(p, pc_arr, nr_cores);
 		__prov_track_dealloc_bulk(p, pc_arr, nr_cores);
+		__put_idle_cores(p, pc_arr, nr_cores);
 	}
-	spin_unlock(&sched_lock);
+	spin_unlock(&prov_lock);
+	if (nr_cores && ksched_unmet_demand)
+		kick_ksched();
 	/* Drop the cradle-to-the-grave reference, jet-li */
 	proc_decref(p);
 }
@@ -281,46 +643,52 @@ void __sched_proc_destroy(struct proc *p, uint32_t *pc_arr, uint32_t nr_cores)
 /* ksched callbacks.  p just woke up and is UNLOCKED. */
 void __sched_mcp_wakeup(struct proc *p)
 {
-	spin_lock(&sched_lock);
-	if (p->state == PROC_DYING) {
-		spin_unlock(&sched_lock);
+	/* unlocked peek: they could be dying right after this too, and the ksched
+	 * will deal with that. */
+	if (p->state == PROC_DYING)
 		return;
-	}
 	/* could try and prioritize p somehow (move it to the front of the list). */
-	spin_unlock(&sched_lock);
-	/* note they could be dying at this point too. */
 	poke(&ksched_poker, p);
 }
 
 /* ksched callbacks.  p just woke up and is UNLOCKED. */
 void __sched_scp_wakeup(struct proc *p)
 {
-	spin_lock(&sched_lock);
+	struct scp_runq *rq;
+	int ll_core;
+	bool preempt;
+
+	spin_lock(&proclist_lock);
 	if (p->state == PROC_DYING) {
-		spin_unlock(&sched_lock);
+		spin_unlock(&proclist_lock);
 		return;
 	}
 	/* might not be on a list if it is new.  o/w, it should be unrunnable */
 	remove_from_any_list(p);
-	add_to_list(p, &runnable_scps);
-	spin_unlock(&sched_lock);
-	/* we could be on a CG core, and all the mgmt cores could be halted.  if we
-	 * don't tell one of them about the new proc, they will sleep until the
-	 * timer tick goes off. */
-	if (!management_core()) {
-		/* TODO: pick a better core and only send if halted.
-		 *
-		 * FYI, a POKE on x86 might lose a rare race with halt code, since the
-		 * poke handler does not abort halts.  if this happens, the next timer
-		 * IRQ would wake up the core.
-		 *
-		 * ideally, we'd know if a specific mgmt core is sleeping and wake it
-		 * up.  o/w, we could interrupt an already-running mgmt core that won't
-		 * get to our new proc anytime soon.  also, by poking core 0, a
-		 * different mgmt core could remain idle (and this process would sleep)
-		 * until its tick goes off */
-		send_ipi(0, I_POKE_CORE);
+	ll_core = scp_pick_runq(p);
+	rq = &scp_runqs[ll_core];
+	p->ksched_data.runnable_tsc = read_tsc();
+	runq_add(p, ll_core);
+	/* If p is far enough behind whoever is running there, it can have the core
+	 * now instead of on the tick.  Good for interactive SCPs. */
+	preempt = rq->running && (scp_cur_vruntime(rq) >
+	                          p->ksched_data.vruntime + scp_gran_ticks);
+	spin_unlock(&proclist_lock);
+	/* p might have to wait for a turn on the LL core.  If a deadline is already
+	 * pending, p waits for that one; we don't push it out or take a new one. */
+	arm_ksched_tick();
+	if (preempt) {
+		send_kernel_message(ll_core, __just_sched, 0, 0, 0, KMSG_ROUTINE);
+		return;
 	}
+	/* we could be on a CG core, and the LL core could be halted.  if we don't
+	 * tell it about the new proc, it will sleep until the timer tick goes off.
+	 *
+	 * FYI, a POKE on x86 might lose a rare race with halt code, since the poke
+	 * handler does not abort halts.  if this happens, the next timer IRQ would
+	 * wake up the core.  TODO: only send if it is halted. */
+	if (ll_core != core_id())
+		send_ipi(ll_core, I_POKE_CORE);
 }
 
 /* Callback to return a core to the ksched, which tracks it as idle and
@@ -331,91 +699,168 @@ void __sched_scp_wakeup(struct proc *p)
 void __sched_put_idle_core(struct proc *p, uint32_t coreid)
 {
 	struct sched_pcore *spc = pcoreid2spc(coreid);
-	spin_lock(&sched_lock);
-	TAILQ_INSERT_TAIL(&idlecores, spc, alloc_next);
+	spin_lock(&prov_lock);
 	__prov_track_dealloc(p, coreid);
-	spin_unlock(&sched_lock);
+	make_core_idle(spc);
+	spin_unlock(&prov_lock);
+	if (ksched_unmet_demand)
+		kick_ksched();
 }
 
-/* Helper for put_idle and core_req.  Note this does not track_dealloc.  When we
- * get rid of / revise proc_preempt_all and put_idle_cores, we can get rid of
- * this.  (the ksched will never need it - only external callers). */
-static void __put_idle_cores(struct proc *p, uint32_t *pc_arr, uint32_t num)
+/* Helper: tries to claim an idle pcore.  If we get it, we must track_alloc it
+ * or make it idle again. */
+static bool claim_idle_core(struct sched_pcore *spc)
 {
-	struct sched_pcore *spc_i;
-	for (int i = 0; i < num; i++) {
-		spc_i = pcoreid2spc(pc_arr[i]);
-		TAILQ_INSERT_TAIL(&idlecores, spc_i, alloc_next);
+	if (!ACCESS_ONCE(spc->idle))
+		return FALSE;
+	if (!atomic_cas_u32(&spc->idle, TRUE, FALSE))
+		return FALSE;
+	atomic_dec(&nr_idle_cores);
+	return TRUE;
+}
+
+/* Helper: claims the core next_core() asked for, if it is still idle. */
+static struct sched_pcore *claim_hinted_core(void)
+{
+	int hint = ACCESS_ONCE(next_pcore_hint);
+
+	if (hint < 0)
+		return 0;
+	next_pcore_hint = -1;
+	if (claim_idle_core(pcoreid2spc(hint)))
+		return pcoreid2spc(hint);
+	return 0;
+}
+
+/* Helper: claims the next_core() hint, or else the lowest idle pcore.  Returns
+ * 0 if there are none. */
+static struct sched_pcore *claim_first_idle_core(void)
+{
+	struct sched_pcore *spc = claim_hinted_core();
+
+	if (spc)
+		return spc;
+	if (!atomic_read(&nr_idle_cores))
+		return 0;
+	for (int i = 0; i < num_cpus; i++) {
+		if (claim_idle_core(pcoreid2spc(i)))
+			return pcoreid2spc(i);
 	}
+	return 0;
+}
+
+/* Helper: makes a pcore available to be claimed.  It must already be
+ * track_dealloc'd, and the caller holds the prov_lock. */
+static void make_core_idle(struct sched_pcore *spc)
+{
+	atomic_inc(&nr_idle_cores);
+	wmb();	/* the dealloc and the count happen before anyone can claim it */
+	spc->idle = TRUE;
+}
+
+/* Helper for put_idle and core_req.  Note this does not track_dealloc: do that
+ * first.  Hold the prov_lock. */
+static void __put_idle_cores(struct proc *p, uint32_t *pc_arr, uint32_t num)
+{
+	for (int i = 0; i < num; i++)
+		make_core_idle(pcoreid2spc(pc_arr[i]));
 }
 
 /* Callback, bulk interface for put_idle.  Note this one also calls track_dealloc,
  * which the internal version does not.  The proclock is held for this. */
 void __sched_put_idle_cores(struct proc *p, uint32_t *pc_arr, uint32_t num)
 {
-	spin_lock(&sched_lock);
-	/* TODO: when we revise this func, look at __put_idle */
-	__put_idle_cores(p, pc_arr, num);
+	spin_lock(&prov_lock);
 	__prov_track_dealloc_bulk(p, pc_arr, num);
-	spin_unlock(&sched_lock);
-	/* could trigger a sched decision here */
+	__put_idle_cores(p, pc_arr, num);
+	spin_unlock(&prov_lock);
+	if (ksched_unmet_demand)
+		kick_ksched();
 }
 
 /* mgmt/LL cores should call this to schedule the calling core and give it to an
- * SCP.  will also prune the dead SCPs from the list.  hold the lock before
- * calling.  returns TRUE if it scheduled a proc. */
+ * SCP.  hold the proclist_lock before calling.  returns TRUE if it scheduled a
+ * proc. */
 static bool __schedule_scp(void)
 {
 	// TODO: sort out lock ordering (proc_run_s also locks)
 	struct proc *p;
 	uint32_t pcoreid = core_id();
 	struct per_cpu_info *pcpui = &per_cpu_info[pcoreid];
+	struct scp_runq *rq = &scp_runqs[pcoreid];
+	uint64_t now;
 	int8_t state = 0;
-	/* if there are any runnables, run them here and put any currently running
-	 * SCP on the tail of the runnable queue. */
-	if ((p = TAILQ_FIRST(&runnable_scps))) {
-		/* protect owning proc, cur_ctx, etc.  note this nests with the
-		 * calls in proc_yield_s */
-		disable_irqsave(&state);
-		/* someone is currently running, dequeue them */
-		if (pcpui->owning_proc) {
-			spin_lock(&pcpui->owning_proc->proc_lock);
-			/* process might be dying, with a KMSG to clean it up waiting on
-			 * this core.  can't do much, so we'll attempt to restart */
-			if (pcpui->owning_proc->state == PROC_DYING) {
-				send_kernel_message(core_id(), __just_sched, 0, 0, 0,
-				                    KMSG_ROUTINE);
-				spin_unlock(&pcpui->owning_proc->proc_lock);
-				enable_irqsave(&state);
-				return FALSE;
-			}
-			printd("Descheduled %d in favor of %d\n", pcpui->owning_proc->pid,
-			       p->pid);
-			__proc_set_state(pcpui->owning_proc, PROC_RUNNABLE_S);
-			/* Saving FP state aggressively.  Odds are, the SCP was hit by an
-			 * IRQ and has a HW ctx, in which case we must save. */
-			__proc_save_fpu_s(pcpui->owning_proc);
-			__proc_save_context_s(pcpui->owning_proc, pcpui->cur_ctx);
-			vcore_account_offline(pcpui->owning_proc, 0); /* VC# */
+
+	if (!pcpui->owning_proc) {
+		/* Whoever we last ran blocked, yielded, or died */
+		rq->running = FALSE;
+		if (!rq->nr)
+			scp_steal(pcoreid);
+	}
+	if (!rq->nr)
+		return FALSE;
+	p = rq->heap[0];
+	/* The running SCP keeps the core til it's ahead of p by a bit */
+	if (pcpui->owning_proc && rq->running &&
+	    (scp_cur_vruntime(rq) < p->ksched_data.vruntime + scp_gran_ticks)) {
+		arm_ksched_tick();
+		return FALSE;
+	}
+	/* protect owning proc, cur_ctx, etc.  note this nests with the
+	 * calls in proc_yield_s */
+	disable_irqsave(&state);
+	/* someone is currently running, put them back on the runq */
+	if (pcpui->owning_proc) {
+		spin_lock(&pcpui->owning_proc->proc_lock);
+		/* process might be dying, with a KMSG to clean it up waiting on
+		 * this core.  can't do much, so we'll attempt to restart */
+		if (pcpui->owning_proc->state == PROC_DYING) {
+			send_kernel_message(core_id(), __just_sched, 0, 0, 0,
+			                    KMSG_ROUTINE);
 			spin_unlock(&pcpui->owning_proc->proc_lock);
-			/* round-robin the SCPs (inserts at the end of the queue) */
-			switch_lists(pcpui->owning_proc, &unrunnable_scps, &runnable_scps);
-			clear_owning_proc(pcoreid);
-			/* Note we abandon core.  It's not strictly necessary.  If
-			 * we didn't, the TLB would still be loaded with the old
-			 * one, til we proc_run_s, and the various paths in
-			 * proc_run_s would pick it up.  This way is a bit safer for
-			 * future changes, but has an extra (empty) TLB flush.  */
-			abandon_core();
-		} 
-		/* Run the new proc */
-		switch_lists(p, &runnable_scps, &unrunnable_scps);
-		printd("PID of the SCP i'm running: %d\n", p->pid);
-		proc_run_s(p);	/* gives it core we're running on */
-		enable_irqsave(&state);
-		return TRUE;
+			enable_irqsave(&state);
+			return FALSE;
+		}
+		printd("Descheduled %d in favor of %d\n", pcpui->owning_proc->pid,
+		       p->pid);
+		__proc_set_state(pcpui->owning_proc, PROC_RUNNABLE_S);
+		/* Saving FP state aggressively.  Odds are, the SCP was hit by an
+		 * IRQ and has a HW ctx, in which case we must save. */
+		__proc_save_fpu_s(pcpui->owning_proc);
+		/* this also does the vcore accounting */
+		__proc_save_context_s(pcpui->owning_proc, pcpui->cur_ctx);
+		spin_unlock(&pcpui->owning_proc->proc_lock);
+		remove_from_list(pcpui->owning_proc, &unrunnable_scps);
+		pcpui->owning_proc->ksched_data.runnable_tsc = read_tsc();
+		runq_add(pcpui->owning_proc, pcoreid);
+		clear_owning_proc(pcoreid);
+		/* Note we abandon core.  It's not strictly necessary.  If
+		 * we didn't, the TLB would still be loaded with the old
+		 * one, til we proc_run_s, and the various paths in
+		 * proc_run_s would pick it up.  This way is a bit safer for
+		 * future changes, but has an extra (empty) TLB flush.  */
+		abandon_core();
 	}
-	return FALSE;
+	/* Run the new proc */
+	runq_remove(p);
+	add_to_list(p, &unrunnable_scps);
+	rq->min_vruntime = MAX(rq->min_vruntime, p->ksched_data.vruntime);
+	now = read_tsc();
+	rq->nr_runs++;
+	rq->lat_ticks += now - p->ksched_data.runnable_tsc;
+	rq->max_lat_ticks = MAX(rq->max_lat_ticks,
+	                        now - p->ksched_data.runnable_tsc);
+	rq->running = TRUE;
+	rq->cur_vruntime = p->ksched_data.vruntime;
+	rq->cur_start = now;
+	rq->cur_weight = scp_weight(p);
+	/* if anyone is still waiting, they'll get a turn on the deadline */
+	if (rq->nr)
+		arm_ksched_tick();
+	printd("PID of the SCP i'm running: %d\n", p->pid);
+	proc_run_s(p);	/* gives it core we're running on */
+	enable_irqsave(&state);
+	return TRUE;
 }
 
 /* Returns how many new cores p needs.  This doesn't lock the proc, so your
@@ -463,8 +908,9 @@ static void __run_mcp_ksched(void *arg)
 	struct proc *p, *temp;
 	uint32_t amt_needed;
 	struct proc_list *temp_mcp_list;
+	bool unmet_demand = FALSE;
 	/* locking to protect the MCP lists' integrity and membership */
-	spin_lock(&sched_lock);
+	spin_lock(&proclist_lock);
 	/* 2-pass scheme: check each proc on the primary list (FCFS).  if they need
 	 * nothing, put them on the secondary list.  if they need something, rip
 	 * them off the list, service them, and if they are still not dying, put
@@ -491,15 +937,15 @@ static void __run_mcp_ksched(void *arg)
 			/* now it won't die, but it could get removed from lists and have
 			 * its stuff unprov'd when we unlock */
 			proc_incref(p, 1);
-			/* GIANT WARNING: __core_req will unlock the sched lock for a bit.
-			 * It will return with it locked still.  We could unlock before we
-			 * pass in, but they will relock right away. */
-			// notionally_unlock(&ksched_lock);	/* for mouse-eyed viewers */
-			__core_request(p, amt_needed);
-			// notionally_lock(&ksched_lock);
+			/* core_req doesn't need the proc lists, and it calls out to the
+			 * proc code, so we don't hold the lock while it runs. */
+			spin_unlock(&proclist_lock);
+			if (__core_request(p, amt_needed) < amt_needed)
+				unmet_demand = TRUE;
+			spin_lock(&proclist_lock);
 			/* Peeking at the state is okay, since we hold a ref.  Once it is
 			 * DYING, it'll remain DYING until we decref.  And if there is a
-			 * concurrent death, that will spin on the ksched lock (which we
+			 * concurrent death, that will spin on the proclist lock (which we
 			 * hold, and which protects the proc lists). */
 			if (p->state != PROC_DYING)
 				add_to_list(p, secondary_mcps);
@@ -515,7 +961,12 @@ static void __run_mcp_ksched(void *arg)
 	temp_mcp_list = primary_mcps;
 	primary_mcps = secondary_mcps;
 	secondary_mcps = temp_mcp_list;
-	spin_unlock(&sched_lock);
+	/* if someone didn't get what they wanted, we'll try again when cores come
+	 * free, and on the deadline, in case they never do. */
+	ksched_unmet_demand = unmet_demand;
+	spin_unlock(&proclist_lock);
+	if (unmet_demand)
+		arm_ksched_tick();
 }
 
 /* Something has changed, and for whatever reason the scheduler should
@@ -531,9 +982,9 @@ void run_scheduler(void)
 	 * run again, so merely a poke is sufficient. */
 	poke(&ksched_poker, 0);
 	if (management_core()) {
-		spin_lock(&sched_lock);
+		spin_lock(&proclist_lock);
 		__schedule_scp();
-		spin_unlock(&sched_lock);
+		spin_unlock(&proclist_lock);
 	}
 }
 
@@ -558,9 +1009,9 @@ void cpu_bored(void)
 	bool new_proc = FALSE;
 	if (!management_core())
 		return;
-	spin_lock(&sched_lock);
+	spin_lock(&proclist_lock);
 	new_proc = __schedule_scp();
-	spin_unlock(&sched_lock);
+	spin_unlock(&proclist_lock);
 	/* if we just scheduled a proc, we need to manually restart it, instead of
 	 * returning.  if we return, the core will halt. */
 	if (new_proc) {
@@ -592,81 +1043,81 @@ uint32_t max_vcores(struct proc *p)
 }
 
 /* This deals with a request for more cores.  The amt of new cores needed is
- * passed in.  The ksched lock is held, but we are free to unlock if we want
- * (and we must, if calling out of the ksched to anything high-level).
+ * passed in, and we return how many we came up with.  No ksched locks are
+ * held: we grab the prov_lock when we need it,
+ * and must not hold it when calling out of the ksched to anything high-level.
  *
  * Side note: if we want to warn, then we can't deal with this proc's prov'd
  * cores until we wait til the alarm goes off.  would need to put all
  * alarmed cores on a list and wait til the alarm goes off to do the full
  * preempt.  and when those cores come in voluntarily, we'd need to know to
  * give them to this proc. */
-static void __core_request(struct proc *p, uint32_t amt_needed)
+static uint32_t __core_request(struct proc *p, uint32_t amt_needed)
 {
-	uint32_t nr_to_grant = 0;
+	uint32_t nr_to_grant = 0, nr_prov;
 	uint32_t corelist[num_cpus];
-	struct sched_pcore *spc_i, *temp;
+	struct sched_pcore *spc_i;
 	struct proc *proc_to_preempt;
 	bool success;
-	/* we come in holding the ksched lock, and we hold it here to protect
-	 * allocations and provisioning. */
+	/* the prov lock protects p's prov lists and the alloc_procs. */
+	spin_lock(&prov_lock);
 	/* get all available cores from their prov_not_alloc list.  the list might
 	 * change when we unlock (new cores added to it, or the entire list emptied,
-	 * but no core allocations will happen (we hold the poke)). */
+	 * but no other core allocations will happen (we hold the poke)). */
 	while (!TAILQ_EMPTY(&p->ksched_data.prov_not_alloc_me)) {
 		if (nr_to_grant == amt_needed)
 			break;
 		/* picking the next victim (first on the not_alloc list) */
 		spc_i = TAILQ_FIRST(&p->ksched_data.prov_not_alloc_me);
 		/* someone else has this proc's pcore, so we need to try to preempt.
-		 * after this block, the core will be tracked dealloc'd and on the idle
-		 * list (regardless of whether we had to preempt or not) */
+		 * after this block, the core will be tracked dealloc'd (regardless of
+		 * whether we had to preempt or not) */
 		if (spc_i->alloc_proc) {
 			proc_to_preempt = spc_i->alloc_proc;
 			/* would break both preemption and maybe the later decref */
 			assert(proc_to_preempt != p);
 			/* need to keep a valid, external ref when we unlock */
 			proc_incref(proc_to_preempt, 1);
-			spin_unlock(&sched_lock);
+			spin_unlock(&prov_lock);
 			/* sending no warning time for now - just an immediate preempt. */
 			success = proc_preempt_core(proc_to_preempt, spc2pcoreid(spc_i), 0);
-			/* reaquire locks to protect provisioning and idle lists */
-			spin_lock(&sched_lock);
+			/* reaquire locks to protect provisioning and alloc_procs */
+			spin_lock(&prov_lock);
 			if (success) {
 				/* we preempted it before the proc could yield or die.
 				 * alloc_proc should not have changed (it'll change in death and
-				 * idle CBs).  the core is not on the idle core list.  (if we
-				 * ever have proc alloc lists, it'll still be on the old proc's
-				 * list). */
+				 * idle CBs).  the core is not idle.  (if we ever have proc
+				 * alloc lists, it'll still be on the old proc's list). */
 				assert(spc_i->alloc_proc);
 				/* regardless of whether or not it is still prov to p, we need
 				 * to note its dealloc.  we are doing some excessive checking of
 				 * p == prov_proc, but using this helper is a lot clearer. */
 				__prov_track_dealloc(proc_to_preempt, spc2pcoreid(spc_i));
-				/* here, we rely on the fact that we are the only preemptor.  we
-				 * assume no one else preempted it, so we know it is available*/
-				TAILQ_INSERT_TAIL(&idlecores, spc_i, alloc_next);
+				/* we never made it idle, so it's ours.  if it isn't prov to p
+				 * anymore (rare race), let someone else have it. */
+				if (spc_i->prov_proc != p) {
+					make_core_idle(spc_i);
+					proc_decref(proc_to_preempt);
+					continue;
+				}
 			} else {
 				/* the preempt failed, which should only happen if the pcore was
 				 * unmapped (could be dying, could be yielding, but NOT
 				 * preempted).  whoever unmapped it also triggered (or will soon
-				 * trigger) a track_dealloc and put it on the idle list.  our
-				 * signal for this is spc_i->alloc_proc being 0.  We need to
-				 * spin and let whoever is trying to free the core grab the
-				 * ksched lock.  We could use an 'ignore_next_idle' flag per
-				 * sched_pcore, but it's not critical anymore.
+				 * trigger) a track_dealloc and made it idle.  our signal for
+				 * this is spc_i->alloc_proc being 0.  We need to spin and let
+				 * whoever is trying to free the core grab the prov lock.
 				 *
 				 * Note, we're relying on us being the only preemptor - if the
 				 * core was unmapped by *another* preemptor, there would be no
 				 * way of knowing the core was made idle *yet* (the success
-				 * branch in another thread).  likewise, if there were another
-				 * allocator, the pcore could have been put on the idle list and
-				 * then quickly removed/allocated. */
+				 * branch in another thread). */
 				cmb();
 				while (spc_i->alloc_proc) {
 					/* this loop should be very rare */
-					spin_unlock(&sched_lock);
+					spin_unlock(&prov_lock);
 					udelay(1);
-					spin_lock(&sched_lock);
+					spin_lock(&prov_lock);
 				}
 			}
 			/* no longer need to keep p_to_pre alive */
@@ -675,16 +1126,17 @@ static void __core_request(struct proc *p, uint32_t amt_needed)
 			 * might get it later, or maybe we'll give it to its rightful proc*/
 			if (spc_i->prov_proc != p)
 				continue;
+			if (!success && !claim_idle_core(spc_i))
+				break;
+		} else if (!claim_idle_core(spc_i)) {
+			/* Idle cores are made idle under the prov lock, so since it's
+			 * dealloc'd, someone else claimed it and is waiting on the lock to
+			 * track it.  We'll try again next time. */
+			break;
 		}
-		/* at this point, the pcore is idle, regardless of how we got here
-		 * (successful preempt, failed preempt, or it was idle in the first
-		 * place.  the core is still provisioned.  lets pull from the idle list
-		 * and add it to the pc_arr for p.  here, we rely on the fact that we
-		 * are the only allocator (spc_i is still idle, despite unlocking). */
-		TAILQ_REMOVE(&idlecores, spc_i, alloc_next);
 		/* At this point, we have the core, ready to try to give it to the proc.
-		 * It is on no alloc lists, and is track_dealloc'd() (regardless of how
-		 * we got here).
+		 * It is not idle, and is track_dealloc'd() (regardless of how we got
+		 * here).
 		 *
 		 * We'll give p its cores via a bulk list, which is better for the proc
 		 * mgmt code (when going from runnable to running). */
@@ -692,23 +1144,27 @@ static void __core_request(struct proc *p, uint32_t amt_needed)
 		nr_to_grant++;
 		__prov_track_alloc(p, spc2pcoreid(spc_i));
 	}
-	/* Try to get cores from the idle list that aren't prov to me (FCFS) */
-	TAILQ_FOREACH_SAFE(spc_i, &idlecores, alloc_next, temp) {
-		if (nr_to_grant == amt_needed)
+	spin_unlock(&prov_lock);
+	/* Claim cores from the idle ones that aren't prov to me, placed near the
+	 * ones p already has.  These are lockless; we track them in bulk. */
+	nr_prov = nr_to_grant;
+	if (nr_to_grant < amt_needed)
+		__placement_prep(p);
+	while (nr_to_grant < amt_needed) {
+		spc_i = __pick_idle_core(p);
+		if (!spc_i)
 			break;
-		TAILQ_REMOVE(&idlecores, spc_i, alloc_next);
 		corelist[nr_to_grant] = spc2pcoreid(spc_i);
 		nr_to_grant++;
-		__prov_track_alloc(p, spc2pcoreid(spc_i));
+	}
+	if (nr_to_grant > nr_prov) {
+		spin_lock(&prov_lock);
+		for (int i = nr_prov; i < nr_to_grant; i++)
+			__prov_track_alloc(p, corelist[i]);
+		spin_unlock(&prov_lock);
 	}
 	/* Now, actually give them out */
 	if (nr_to_grant) {
-		/* Need to unlock before calling out to proc code.  We are somewhat
-		 * relying on being the only one allocating 'thread' here, since another
-		 * allocator could have seen these cores (if they are prov to some proc)
-		 * and could be trying to give them out (and assuming they are already
-		 * on the idle list). */
-		spin_unlock(&sched_lock);
 		/* give them the cores.  this will start up the extras if RUNNING_M. */
 		spin_lock(&p->proc_lock);
 		/* if they fail, it is because they are WAITING or DYING.  we could give
@@ -718,11 +1174,12 @@ static void __core_request(struct proc *p, uint32_t amt_needed)
 		 * just need to check at some point in the ksched loop. */
 		if (__proc_give_cores(p, corelist, nr_to_grant)) {
 			spin_unlock(&p->proc_lock);
-			/* we failed, put the cores and track their dealloc.  lock is
+			/* we failed, track their dealloc and make them idle.  lock is
 			 * protecting those structures. */
-			spin_lock(&sched_lock);
-			__put_idle_cores(p, corelist, nr_to_grant);
+			spin_lock(&prov_lock);
 			__prov_track_dealloc_bulk(p, corelist, nr_to_grant);
+			__put_idle_cores(p, corelist, nr_to_grant);
+			spin_unlock(&prov_lock);
 		} else {
 			/* at some point after giving cores, call proc_run_m() (harmless on
 			 * RUNNING_Ms).  You can give small groups of cores, then run them
@@ -730,11 +1187,101 @@ static void __core_request(struct proc *p, uint32_t amt_needed)
 			 * for bulk preempted processes). */
 			__proc_run_m(p);
 			spin_unlock(&p->proc_lock);
-			/* main mcp_ksched wants this held (it came to __core_req held) */
-			spin_lock(&sched_lock);
 		}
 	}
-	/* note the ksched lock is still held */
+	return nr_to_grant;
+}
+
+/* Helper: sets up topo_counts for picking p's cores.  Any core that isn't idle
+ * counts as busy, including LL cores and those we don't hand out. */
+static void __placement_prep(struct proc *p)
+{
+	struct core_topo *topo;
+
+	if (p->ksched_data.placement == CORE_PLACE_ANY)
+		return;
+	memset(topo_counts, 0, sizeof(struct topo_counts) * num_cpus);
+	for (int i = 0; i < num_cpus; i++) {
+		topo = &core_topo[i];
+		topo_counts[topo->phys_core].phys_busy++;
+		if (pcoreid2spc(i)->alloc_proc == p) {
+			topo_counts[topo->llc].llc_mine = TRUE;
+			topo_counts[topo->socket].socket_mine = TRUE;
+			topo_counts[topo->phys_core].phys_mine = TRUE;
+		}
+	}
+	for (int i = 0; i < num_cpus; i++) {
+		if (!ACCESS_ONCE(pcoreid2spc(i)->idle))
+			continue;
+		topo = &core_topo[i];
+		topo_counts[topo->phys_core].phys_busy--;
+		topo_counts[topo->llc].llc_idle++;
+	}
+}
+
+/* Helper: scores an idle core for p; higher is better.  Hyperthreads matter
+ * most: under COMPACT, we'd rather not share a physical core with anyone
+ * (including p), and under COMPACT_SMT, we'd rather share one with p.  Then we
+ * want to be near p's other cores: the same LLC, then the same socket.  Last,
+ * we'd like an LLC with room for p to grow into. */
+static int placement_score(struct proc *p, uint32_t pcoreid)
+{
+	struct core_topo *topo = &core_topo[pcoreid];
+	int smt_score, near_score;
+
+	if (p->ksched_data.placement == CORE_PLACE_COMPACT_SMT)
+		smt_score = topo_counts[topo->phys_core].phys_mine ? 2 :
+		            !topo_counts[topo->phys_core].phys_busy;
+	else
+		smt_score = !topo_counts[topo->phys_core].phys_busy;
+	if (topo_counts[topo->llc].llc_mine)
+		near_score = 2;
+	else if (topo_counts[topo->socket].socket_mine)
+		near_score = 1;
+	else
+		near_score = 0;
+	return (smt_score << 16) | (near_score << 8) |
+	       topo_counts[topo->llc].llc_idle;
+}
+
+/* Helper: claims the idle core that best fits p's placement policy, and notes
+ * that p is getting it.  Ties go to the lowest pcoreid.  Returns 0 if there are
+ * no idle cores.  Call __placement_prep() first.  The counts are a snapshot; if
+ * cores come and go while we look, we just place a little worse. */
+static struct sched_pcore *__pick_idle_core(struct proc *p)
+{
+	struct sched_pcore *spc_i, *best;
+	struct core_topo *topo;
+	int score, best_score;
+
+	if (p->ksched_data.placement == CORE_PLACE_ANY)
+		return claim_first_idle_core();
+	best = claim_hinted_core();
+	while (!best) {
+		best_score = -1;
+		for (int i = 0; i < num_cpus; i++) {
+			spc_i = pcoreid2spc(i);
+			if (!ACCESS_ONCE(spc_i->idle))
+				continue;
+			score = placement_score(p, i);
+			if (score > best_score) {
+				best = spc_i;
+				best_score = score;
+			}
+		}
+		if (!best)
+			return 0;
+		/* someone else might have claimed it since we looked */
+		if (!claim_idle_core(best))
+			best = 0;
+	}
+	topo = &core_topo[spc2pcoreid(best)];
+	topo_counts[topo->phys_core].phys_busy++;
+	topo_counts[topo->phys_core].phys_mine = TRUE;
+	topo_counts[topo->llc].llc_idle--;
+	topo_counts[topo->llc].llc_mine = TRUE;
+	topo_counts[topo->socket].socket_mine = TRUE;
+	return best;
 }
 
 /* TODO: need more thorough CG/LL management.  For now, core0 is the only LL
@@ -748,8 +1295,33 @@ static bool is_ll_core(uint32_t pcoreid)
 	return FALSE;
 }
 
+/* Returns a core for the idx'th of a set of kernel jobs that each want their own
+ * core, like a NIC's queues.  Only the LL cores take device IRQs; the CG cores
+ * are for MCPs, which shouldn't be interrupted.  Once each LL core has a job,
+ * we wrap around and they double up. */
+int sched_irq_core(int idx)
+{
+	return ll_cores[idx % nr_ll_cores];
+}
+
+/* Picks how pcoreid waits when it idles.  A core provisioned to an MCP will
+ * likely be handed back to it soon, so it spins for a bit.  Other CG cores
+ * MWAIT, which saves the IPI when we give them out.  The LL core halts; it gets
+ * plenty of IRQs anyway.  Hold the prov_lock. */
+static void set_core_idle_policy(uint32_t pcoreid)
+{
+	int mode = IDLE_MWAIT;
+
+	if (is_ll_core(pcoreid))
+		mode = IDLE_HALT;
+	else if (pcoreid2spc(pcoreid)->prov_proc)
+		mode = IDLE_POLL;
+	set_cpu_idle_mode(pcoreid, mode, KSCHED_IDLE_POLL_USEC);
+}
+
 /* Helper, makes sure the prov/alloc structures track the pcore properly when it
- * is allocated to p.  Might make this take a sched_pcore * in the future. */
+ * is allocated to p.  Might make this take a sched_pcore * in the future.  Hold
+ * the prov_lock. */
 static void __prov_track_alloc(struct proc *p, uint32_t pcoreid)
 {
 	struct sched_pcore *spc;
@@ -765,7 +1337,7 @@ static void __prov_track_alloc(struct proc *p, uint32_t pcoreid)
 }
 
 /* Helper, makes sure the prov/alloc structures track the pcore properly when it
- * is deallocated from p. */
+ * is deallocated from p.  Hold the prov_lock. */
 static void __prov_track_dealloc(struct proc *p, uint32_t pcoreid)
 {
 	struct sched_pcore *spc;
@@ -808,10 +1380,8 @@ int provision_core(struct proc *p, uint32_t pcoreid)
 		return -1;
 	}
 	spc = pcoreid2spc(pcoreid);
-	/* Note the sched lock protects the spc tailqs for all procs in this code.
-	 * If we need a finer grained sched lock, this is one place where we could
-	 * have a different lock */
-	spin_lock(&sched_lock);
+	/* Note the prov lock protects the spc tailqs for all procs in this code. */
+	spin_lock(&prov_lock);
 	/* If the core is already prov to someone else, take it away.  (last write
 	 * wins, some other layer or new func can handle permissions). */
 	if (spc->prov_proc) {
@@ -835,24 +1405,114 @@ int provision_core(struct proc *p, uint32_t pcoreid)
 		}
 	}
 	spc->prov_proc = p;
-	spin_unlock(&sched_lock);
+	set_core_idle_policy(pcoreid);
+	spin_unlock(&prov_lock);
+	/* p might want to preempt pcoreid now */
+	if (p)
+		kick_ksched();
+	return 0;
+}
+
+int __sched_claim_idle_core(struct proc *p)
+{
+	struct sched_pcore *spc = claim_first_idle_core();
+
+	if (!spc)
+		return -1;
+	spin_lock(&prov_lock);
+	__prov_track_alloc(p, spc2pcoreid(spc));
+	spin_unlock(&prov_lock);
+	return spc2pcoreid(spc);
+}
+
+int sched_set_placement(struct proc *p, int policy)
+{
+	if (!p || policy < 0 || policy >= NR_CORE_PLACEMENTS) {
+		set_errno(EINVAL);
+		return -1;
+	}
+	/* Only affects cores p gets from now on */
+	spin_lock(&prov_lock);
+	p->ksched_data.placement = policy;
+	spin_unlock(&prov_lock);
+	return 0;
+}
+
+int sched_set_nice(struct proc *p, int nice)
+{
+	struct sched_proc_data *sd;
+	struct scp_runq *rq;
+
+	if (!p || nice < SCHED_NICE_MIN || nice > SCHED_NICE_MAX) {
+		set_errno(EINVAL);
+		return -1;
+	}
+	sd = &p->ksched_data;
+	spin_lock(&proclist_lock);
+	/* Charge what it already ran at the old weight.  Only a proc that isn't on
+	 * a runq could have run since it was last charged, so this won't move
+	 * anyone in a heap. */
+	scp_charge(p);
+	sd->nice = nice;
+	/* If p is running on an LL core, that core's preemption checks are still
+	 * going by the old weight.  Restart them from here with the new one. */
+	if (sd->runq >= 0) {
+		rq = &scp_runqs[sd->runq];
+		if (rq->running && (per_cpu_info[sd->runq].owning_proc == p)) {
+			rq->cur_vruntime = scp_cur_vruntime(rq);
+			rq->cur_start = read_tsc();
+			rq->cur_weight = scp_weight(p);
+		}
+	}
+	spin_unlock(&proclist_lock);
 	return 0;
 }
 
+int __sched_runq_sort(struct proc **procs, int nr, int nr_drop)
+{
+	struct scp_runq rq = {0};
+
+	rq.heap = kmalloc(nr * sizeof(struct proc*), KMALLOC_WAIT);
+	rq.size = nr;
+	spin_lock(&proclist_lock);
+	for (int i = 0; i < nr; i++)
+		__runq_insert(&rq, procs[i]);
+	for (int i = 0; i < nr_drop; i++)
+		__runq_remove(&rq, procs[i]);
+	for (int i = 0; i < nr - nr_drop; i++) {
+		procs[i] = rq.heap[0];
+		__runq_remove(&rq, procs[i]);
+	}
+	spin_unlock(&proclist_lock);
+	kfree(rq.heap);
+	return nr - nr_drop;
+}
+
 /************** Debugging **************/
 void sched_diag(void)
 {
 	struct proc *p;
-	spin_lock(&sched_lock);
-	TAILQ_FOREACH(p, &runnable_scps, ksched_data.proc_link)
-		printk("Runnable _S PID: %d\n", p->pid);
+	struct scp_runq *rq;
+
+	spin_lock(&proclist_lock);
+	for (int i = 0; i < nr_ll_cores; i++) {
+		rq = &scp_runqs[ll_cores[i]];
+		printk("LL core %d: %d runnable, %llu runs, latency %llu usec avg, "
+		       "%llu usec max\n", ll_cores[i], rq->nr, rq->nr_runs,
+		       rq->nr_runs ? tsc2usec(rq->lat_ticks / rq->nr_runs) : 0,
+		       tsc2usec(rq->max_lat_ticks));
+		for (int j = 0; j < rq->nr; j++)
+			printk("Runnable _S PID: %d, nice %d, vruntime %llu\n",
+			       rq->heap[j]->pid, rq->heap[j]->ksched_data.nice,
+			       rq->heap[j]->ksched_data.vruntime - rq->min_vruntime);
+	}
 	TAILQ_FOREACH(p, &unrunnable_scps, ksched_data.proc_link)
 		printk("Unrunnable _S PID: %d\n", p->pid);
 	TAILQ_FOREACH(p, primary_mcps, ksched_data.proc_link)
 		printk("Primary MCP PID: %d\n", p->pid);
 	TAILQ_FOREACH(p, secondary_mcps, ksched_data.proc_link)
 		printk("Secondary MCP PID: %d\n", p->pid);
-	spin_unlock(&sched_lock);
+	spin_unlock(&proclist_lock);
 	return;
 }
 
@@ -860,10 +1520,16 @@ void print_idlecoremap(void)
 {
 	struct sched_pcore *spc_i;
 	/* not locking, so we can look at this without deadlocking. */
-	printk("Idle cores (unlocked!):\n");
-	TAILQ_FOREACH(spc_i, &idlecores, alloc_next)
-		printk("Core %d, prov to %d (%p)\n", spc2pcoreid(spc_i),
+	printk("Idle cores (unlocked!), %d of them:\n",
+	       atomic_read(&nr_idle_cores));
+	for (int i = 0; i < num_cpus; i++) {
+		spc_i = pcoreid2spc(i);
+		if (!spc_i->idle)
+			continue;
+		printk("Core %d (socket %d, LLC %d, phys %d), prov to %d (%p)\n", i,
+		       core_topo[i].socket, core_topo[i].llc, core_topo[i].phys_core,
 		       spc_i->prov_proc ? spc_i->prov_proc->pid : 0, spc_i->prov_proc);
+	}
 }
 
 void print_resources(struct proc *p)
@@ -883,9 +1549,7 @@ void print_all_resources(void)
 	{
 		print_resources((struct proc*)item);
 	}
-	spin_lock(&pid_hash_lock);
-	hash_for_each(pid_hash, __print_resources);
-	spin_unlock(&pid_hash_lock);
+	chash_for_each(pid_hash, __print_resources);
 }
 
 void print_prov_map(void)
@@ -919,19 +1583,8 @@ void print_proc_prov(struct proc *p)
 
 void next_core(uint32_t pcoreid)
 {
-	struct sched_pcore *spc_i;
-	bool match = FALSE;
-	spin_lock(&sched_lock);
-	TAILQ_FOREACH(spc_i, &idlecores, alloc_next) {
-		if (spc2pcoreid(spc_i) == pcoreid) {
-			match = TRUE;
-			break;
-		}
-	}
-	if (match) {
-		TAILQ_REMOVE(&idlecores, spc_i, alloc_next);
-		TAILQ_INSERT_HEAD(&idlecores, spc_i, alloc_next);
-		printk("Pcore %d will be given out next (from the idles)\n", pcoreid);
-	}
-	spin_unlock(&sched_lock);
+	if (!(pcoreid < num_cpus) || !pcoreid2spc(pcoreid)->idle)
+		return;
+	next_pcore_hint = pcoreid;
+	printk("Pcore %d will be given out next (from the idles)\n", pcoreid);
 }
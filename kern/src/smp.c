@@ -22,8 +22,10 @@
 #include <trace.h>
 #include <kdebug.h>
 #include <kmalloc.h>
+#include <time.h>
 
 struct per_cpu_info per_cpu_info[MAX_NUM_CPUS];
+struct core_topo core_topo[MAX_NUM_CPUS];
 
 // tracks number of global waits on smp_calls, must be <= NUM_HANDLER_WRAPPERS
 atomic_t outstanding_calls = 0;
@@ -46,6 +48,81 @@ static void try_run_proc(void)
 	}
 }
 
+static bool idle_has_mwait;
+
+static bool rkmsg_pending(struct per_cpu_info *pcpui)
+{
+	return pcpui->routine_fifo || ACCESS_ONCE(pcpui->kmsgs.routine_amsgs);
+}
+
+/* Waits for an RKM or an IRQ, per our idle mode.  Like cpu_halt(), call this
+ * with IRQs disabled; they are enabled on return.
+ *
+ * While polling or MWAITing, we tell senders to not bother with an IPI for
+ * RKMs.  Either they see polling and we see their message, or they IPI us
+ * (maybe needlessly).  IRQs are on the whole time, and handle_irq() changes our
+ * state from IDLE, which is how we tell that one came in and that smp_idle
+ * needs to take another look around (like it would after a halt). */
+static void idle_wait(struct per_cpu_info *pcpui)
+{
+	int mode = ACCESS_ONCE(pcpui->idle_mode);
+	uint64_t deadline;
+
+	if (mode == IDLE_HALT) {
+		cpu_halt();
+		return;
+	}
+	pcpui->kmsgs.polling = TRUE;
+	mb();	/* set polling before checking for RKMs, pairs with __send_kmsg */
+	if (mode == IDLE_POLL) {
+		deadline = read_tsc() + ACCESS_ONCE(pcpui->idle_poll_ticks);
+		enable_irq();
+		while (!rkmsg_pending(pcpui) &&
+		       (ACCESS_ONCE(pcpui->cpu_state) == CPU_STATE_IDLE) &&
+		       (read_tsc() < deadline))
+			cpu_relax();
+		disable_irq();
+	}
+	if (!rkmsg_pending(pcpui) && (pcpui->cpu_state == CPU_STATE_IDLE)) {
+		if (idle_has_mwait) {
+			cpu_monitor(&pcpui->kmsgs);
+			/* A push after our last check but before the monitor wouldn't
+			 * wake us */
+			if (!rkmsg_pending(pcpui))
+				cpu_mwait();
+			disable_irq();
+		} else {
+			/* Can't wait on the queue, so senders need to IPI us again */
+			pcpui->kmsgs.polling = FALSE;
+			mb();
+			if (!rkmsg_pending(pcpui))
+				cpu_halt();
+			disable_irq();
+		}
+	}
+	pcpui->kmsgs.polling = FALSE;
+	enable_irq();
+}
+
+/* Sets how coreid waits when it idles: IDLE_HALT, IDLE_MWAIT, or IDLE_POLL,
+ * which spins for poll_usec before MWAITing.  Machines without MWAIT halt
+ * instead.  The core picks up the change the next time it goes idle. */
+int set_cpu_idle_mode(uint32_t coreid, int mode, uint64_t poll_usec)
+{
+	struct per_cpu_info *pcpui;
+
+	if ((coreid >= num_cpus) || (mode < 0) || (mode >= NR_IDLE_MODES))
+		return -EINVAL;
+	pcpui = &per_cpu_info[coreid];
+	idle_has_mwait = cpu_has_mwait();
+	if ((mode == IDLE_MWAIT) && !idle_has_mwait)
+		mode = IDLE_HALT;
+	pcpui->idle_poll_ticks = usec2tsc(poll_usec);
+	wmb();	/* the core reads the mode first */
+	pcpui->idle_mode = mode;
+	return 0;
+}
+
 /* All cores end up calling this whenever there is nothing left to do or they
  * don't know explicitly what to do.  Non-zero cores call it when they are done
  * booting.  Other cases include after getting a DEATH IPI.
@@ -65,12 +142,13 @@ static void __attribute__((noinline, noreturn)) __smp_idle(void)
 		process_routine_kmsg();
 		try_run_proc();
 		cpu_bored();		/* call out to the ksched */
-		/* cpu_halt() atomically turns on interrupts and halts the core.
+		/* cpu_halt() atomically turns on interrupts and halts the core (as
+		 * does cpu_mwait(), and polling checks for RKMs with IRQs on).
 		 * Important to do this, since we could have a RKM come in via an
 		 * interrupt right while PRKM is returning, and we wouldn't catch
 		 * it. */
 		__set_cpu_state(pcpui, CPU_STATE_IDLE);
-		cpu_halt();
+		idle_wait(pcpui);
 		/* interrupts are back on now (given our current semantics) */
 	}
 	assert(0);
@@ -104,10 +182,14 @@ void smp_percpu_init(void)
 	pcpui->cur_kthread = kthread;
 	per_cpu_info[coreid].spare = 0;
 	/* Init relevant lists */
-	spinlock_init_irqsave(&per_cpu_info[coreid].immed_amsg_lock);
-	STAILQ_INIT(&per_cpu_info[coreid].immed_amsgs);
-	spinlock_init_irqsave(&per_cpu_info[coreid].routine_amsg_lock);
-	STAILQ_INIT(&per_cpu_info[coreid].routine_amsgs);
+	pcpui->kmsgs.immed_amsgs = 0;
+	pcpui->kmsgs.routine_amsgs = 0;
+	pcpui->kmsgs.returns = 0;
+	atomic_init(&pcpui->kmsgs.ipi_pending, 0);
+	pcpui->kmsgs.polling = FALSE;
+	pcpui->routine_fifo = 0;
+	pcpui->kmsg_cache = 0;
+	pcpui->nr_kmsg_cache = 0;
 	/* Initialize the per-core timer chain */
 	init_timer_chain(&per_cpu_info[coreid].tchain, set_pcpu_alarm_interrupt);
 #ifdef CONFIG_KTHREAD_POISON
@@ -124,6 +206,9 @@ void smp_percpu_init(void)
 	/* Core 0 is in the KERNEL state, called from smp_boot.  The other cores are
 	 * too, at least on x86, where we were called from asm (woken by POKE). */
 	pcpui->cpu_state = CPU_STATE_KERNEL;
+	/* Halt when idle, til the ksched says otherwise */
+	pcpui->idle_mode = IDLE_HALT;
+	pcpui->idle_poll_ticks = 0;
 	/* Enable full lock debugging, after all pcpui work is done */
 	pcpui->__lock_checking_enabled = 1;
 }
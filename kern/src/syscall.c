@@ -27,7 +27,6 @@
 #include <stdio.h>
 #include <frontend.h>
 #include <colored_caches.h>
-#include <hashtable.h>
 #include <bitmask.h>
 #include <vfs.h>
 #include <devfs.h>
@@ -35,6 +34,9 @@
 #include <arsc_server.h>
 #include <event.h>
 #include <termios.h>
+#include <fdtap.h>
+#include <netmap.h>
+#include <sys/uio.h>
 
 /* Tracing Globals */
 int systrace_flags = 0;
@@ -996,6 +998,8 @@ static int prov_resource(struct proc *target, unsigned int res_type,
 			/* in the off chance we have a kernel scheduler that can't
 			 * provision, we'll need to change this. */
 			return provision_core(target, res_val);
+		case (RES_CORE_PLACEMENT):
+			return sched_set_placement(target, res_val);
 		default:
 			printk("[kernel] received provisioning for unknown resource %d\n",
 			       res_type);
@@ -1241,6 +1245,262 @@ static intreg_t sys_write(struct proc *p, int fd, const void *buf, int len)
 
 }
 
+/* Copies in the user's iovecs, checking that each buffer is user memory we can
+ * read, or write if to_user.  Returns a kmalloc'd array, or 0 with errno set. */
+static struct iovec *copy_in_iov(struct proc *p, const struct iovec *u_iov,
+                                 int iovcnt, bool to_user)
+{
+	struct iovec *iov;
+	size_t total = 0;
+
+	if ((iovcnt <= 0) || (iovcnt > UIO_MAXIOV)) {
+		set_errno(EINVAL);
+		return 0;
+	}
+	iov = kmalloc(iovcnt * sizeof(struct iovec), 0);
+	if (!iov) {
+		set_errno(ENOMEM);
+		return 0;
+	}
+	if (memcpy_from_user_errno(p, iov, u_iov, iovcnt * sizeof(struct iovec))) {
+		kfree(iov);
+		return 0;
+	}
+	for (int i = 0; i < iovcnt; i++) {
+		/* the total has to fit in our return value */
+		if (iov[i].iov_len > ((size_t)~0 >> 1) - total) {
+			kfree(iov);
+			set_errno(EINVAL);
+			return 0;
+		}
+		total += iov[i].iov_len;
+		if (to_user ? !is_user_rwaddr(iov[i].iov_base, iov[i].iov_len)
+		            : !is_user_raddr(iov[i].iov_base, iov[i].iov_len)) {
+			kfree(iov);
+			set_errno(EFAULT);
+			return 0;
+		}
+	}
+	return iov;
+}
+
+/* Backs readv and preadv.  Reads at *offp if offp is set, without changing the
+ * FD's offset. */
+static intreg_t do_readv(struct proc *p, int fd, const struct iovec *u_iov,
+                         int iovcnt, off64_t *offp)
+{
+	struct iovec *iov;
+	struct file *file;
+	ssize_t ret;
+
+	if (!iovcnt)
+		return 0;
+	iov = copy_in_iov(p, u_iov, iovcnt, TRUE);
+	if (!iov)
+		return -1;
+	file = get_file_from_fd(&p->open_files, fd);
+	/* VFS */
+	if (file) {
+		if (!file->f_op->read) {
+			kref_put(&file->f_kref);
+			kfree(iov);
+			set_errno(EINVAL);
+			return -1;
+		}
+		if (!offp)
+			offp = &file->f_pos;
+		if (file->f_op->readv)
+			ret = file->f_op->readv(file, iov, iovcnt, offp);
+		else
+			ret = generic_file_readv(file, iov, iovcnt, offp);
+		kref_put(&file->f_kref);
+	} else {
+		/* plan9 */
+		ret = offp ? syspreadv(fd, iov, iovcnt, *offp)
+		           : sysreadv(fd, iov, iovcnt);
+	}
+	kfree(iov);
+	return ret;
+}
+
+/* Backs writev and pwritev, like do_readv(). */
+static intreg_t do_writev(struct proc *p, int fd, const struct iovec *u_iov,
+                          int iovcnt, off64_t *offp)
+{
+	struct iovec *iov;
+	struct file *file;
+	ssize_t ret;
+
+	if (!iovcnt)
+		return 0;
+	iov = copy_in_iov(p, u_iov, iovcnt, FALSE);
+	if (!iov)
+		return -1;
+	file = get_file_from_fd(&p->open_files, fd);
+	/* VFS */
+	if (file) {
+		if (!file->f_op->write) {
+			kref_put(&file->f_kref);
+			kfree(iov);
+			set_errno(EINVAL);
+			return -1;
+		}
+		if (!offp)
+			offp = &file->f_pos;
+		if (file->f_op->writev)
+			ret = file->f_op->writev(file, iov, iovcnt, offp);
+		else
+			ret = generic_file_writev(file, iov, iovcnt, offp);
+		kref_put(&file->f_kref);
+	} else {
+		/* plan9 */
+		ret = offp ? syspwritev(fd, iov, iovcnt, *offp)
+		           : syswritev(fd, iov, iovcnt);
+	}
+	kfree(iov);
+	return ret;
+}
+
+static intreg_t sys_readv(struct proc *p, int fd, const struct iovec *iov,
+                          int iovcnt)
+{
+	return do_readv(p, fd, iov, iovcnt, 0);
+}
+
+static intreg_t sys_writev(struct proc *p, int fd, const struct iovec *iov,
+                           int iovcnt)
+{
+	return do_writev(p, fd, iov, iovcnt, 0);
+}
+
+static intreg_t sys_preadv(struct proc *p, int fd, const struct iovec *iov,
+                           int iovcnt, off64_t offset)
+{
+	if (offset < 0) {
+		set_errno(EINVAL);
+		return -1;
+	}
+	return do_readv(p, fd, iov, iovcnt, &offset);
+}
+
+static intreg_t sys_pwritev(struct proc *p, int fd, const struct iovec *iov,
+                            int iovcnt, off64_t offset)
+{
+	if (offset < 0) {
+		set_errno(EINVAL);
+		return -1;
+	}
+	return do_writev(p, fd, iov, iovcnt, &offset);
+}
+
+/* Builds a block that points at [off, off + len) of file's page cache pages,
+ * loading them if needed.  Returns 0 and sets errno on failure. */
+static struct block *file_pages_to_block(struct file *file, off64_t off,
+                                         size_t len)
+{
+	struct block *b;
+	struct page *page;
+	size_t pg_amt;
+	uint32_t pg_off;
+	int error;
+
+	/* allocb's header space is only available via padblock, but we also want
+	 * some room for pullupblock for the protocol headers, like qwrite. */
+	b = allocb(64);
+	for (size_t done = 0; done < len; done += pg_amt) {
+		pg_off = (off + done) & (PGSIZE - 1);
+		pg_amt = MIN(PGSIZE - pg_off, len - done);
+		error = pm_load_page(file->f_mapping, (off + done) >> PGSHIFT, &page);
+		if (error) {
+			freeb(b);
+			set_errno(-error);
+			return 0;
+		}
+		/* the block keeps its own ref on the page, even if it gets evicted */
+		block_append_page(b, page, pg_off, pg_amt);
+		pm_put_page(page);
+	}
+	return b;
+}
+
+/* Sends up to count bytes of in_fd, starting at *u_offset (or in_fd's file
+ * position, if u_offset is 0), to out_fd without copying: the blocks we write
+ * point at the page cache pages, and hold refs on them until whoever ends up
+ * with the block (e.g. the NIC) frees it.  in_fd must be a regular VFS file, and
+ * out_fd a 9ns chan, like a network conversation's data file. */
+static intreg_t sys_sendfile(struct proc *p, int out_fd, int in_fd,
+                             off64_t *u_offset, size_t count)
+{
+	struct file *file, *out_file;
+	struct block *b;
+	off64_t off;
+	size_t chunk, sent = 0;
+	long ret = 0;
+
+	/* VFS files can only be written from user buffers */
+	out_file = get_file_from_fd(&p->open_files, out_fd);
+	if (out_file) {
+		kref_put(&out_file->f_kref);
+		set_errno(EINVAL);
+		return -1;
+	}
+	file = get_file_from_fd(&p->open_files, in_fd);
+	if (!file) {
+		set_errno(EBADF);
+		return -1;
+	}
+	if (!S_ISREG(file->f_dentry->d_inode->i_mode)) {
+		kref_put(&file->f_kref);
+		set_errno(EINVAL);
+		return -1;
+	}
+	if (u_offset) {
+		if (memcpy_from_user_errno(p, &off, u_offset, sizeof(off64_t))) {
+			kref_put(&file->f_kref);
+			return -1;
+		}
+	} else {
+		off = ACCESS_ONCE(file->f_pos);
+	}
+	if (off < 0) {
+		kref_put(&file->f_kref);
+		set_errno(EINVAL);
+		return -1;
+	}
+	if (off >= file->f_dentry->d_inode->i_size)
+		count = 0;
+	else
+		count = MIN(count, file->f_dentry->d_inode->i_size - off);
+	while (sent < count) {
+		/* one block per write, like qwrite() */
+		chunk = MIN(count - sent, qiomaxatomic);
+		b = file_pages_to_block(file, off, chunk);
+		if (!b) {
+			ret = -1;
+			break;
+		}
+		ret = sysbwrite(out_fd, b);
+		if (ret < 0)
+			break;
+		sent += ret;
+		off += ret;
+		/* Stop on a short write, like write() would return one */
+		if (ret < chunk)
+			break;
+	}
+	if (u_offset) {
+		if (memcpy_to_user_errno(p, u_offset, &off, sizeof(off64_t)))
+			ret = -1;
+	} else {
+		file->f_pos = off;
+	}
+	kref_put(&file->f_kref);
+	/* like write(), report partial progress instead of the error */
+	if (ret < 0 && !sent)
+		return -1;
+	return sent;
+}
+
 /* Checks args/reads in the path, opens the file, and inserts it into the
  * process's open file list. */
 static intreg_t sys_open(struct proc *p, const char *path, size_t path_l,
@@ -2166,6 +2426,65 @@ static intreg_t sys_dup_fds_to(struct proc *p, unsigned int pid,
 	return ret;
 }
 
+/* Adds or removes FD taps.  Returns how many requests succeeded, stopping at
+ * the first failure (errno says why), or -1 if the first one failed. */
+static intreg_t sys_tap_fds(struct proc *p, struct fd_tap_req *tap_reqs,
+                           size_t nr_reqs)
+{
+	struct fd_tap_req req;
+	int ret;
+	size_t done;
+
+	if (!nr_reqs)
+		return 0;
+	for (done = 0; done < nr_reqs; done++) {
+		if (memcpy_from_user_errno(p, &req, &tap_reqs[done],
+		                           sizeof(struct fd_tap_req)))
+			break;
+		switch (req.cmd) {
+			case FDTAP_CMD_ADD:
+				ret = add_fd_tap(p, &req);
+				break;
+			case FDTAP_CMD_REM:
+				ret = remove_fd_tap(p, req.fd);
+				break;
+			default:
+				set_errno(EINVAL);
+				ret = -1;
+		}
+		if (ret)
+			break;
+	}
+	return done ? done : -1;
+}
+
+/* Registers (or unregisters) user-mapped rings for one of fd's queues.  See
+ * ros/netmap.h. */
+static intreg_t sys_netmap_reg(struct proc *p, int fd,
+                               struct netmap_req *u_req)
+{
+	struct netmap_req req;
+
+	if (memcpy_from_user_errno(p, &req, u_req, sizeof(struct netmap_req)))
+		return -1;
+	switch (req.cmd) {
+		case NETMAP_CMD_REG:
+			return netmap_reg(p, fd, &req);
+		case NETMAP_CMD_UNREG:
+			return netmap_unreg(p, fd, req.qidx);
+		default:
+			set_errno(EINVAL);
+			return -1;
+	}
+}
+
+/* Hands the slots the process is done with to the NIC and collects the ones
+ * the NIC is done with, for the rings in flags (NETMAP_SYNC_*). */
+static intreg_t sys_netmap_sync(struct proc *p, int fd, int qidx, int flags)
+{
+	return netmap_sync(p, fd, qidx, flags);
+}
+
 /************** Syscall Invokation **************/
 
 const struct sys_table_entry syscall_table[] = {
@@ -2241,6 +2560,14 @@ const struct sys_table_entry syscall_table[] = {
 	[SYS_fwstat] ={(syscall_t)sys_fwstat, "fwstat"},
 	[SYS_rename] ={(syscall_t)sys_rename, "rename"},
 	[SYS_dup_fds_to] = {(syscall_t)sys_dup_fds_to, "dup_fds_to"},
+	[SYS_sendfile] = {(syscall_t)sys_sendfile, "sendfile"},
+	[SYS_tap_fds] = {(syscall_t)sys_tap_fds, "tap_fds"},
+	[SYS_readv] = {(syscall_t)sys_readv, "readv"},
+	[SYS_writev] = {(syscall_t)sys_writev, "writev"},
+	[SYS_preadv] = {(syscall_t)sys_preadv, "preadv"},
+	[SYS_pwritev] = {(syscall_t)sys_pwritev, "pwritev"},
+	[SYS_netmap_reg] = {(syscall_t)sys_netmap_reg, "netmap_reg"},
+	[SYS_netmap_sync] = {(syscall_t)sys_netmap_sync, "netmap_sync"},
 };
 const int max_syscall = sizeof(syscall_table)/sizeof(syscall_table[0]);
 /* Executes the given syscall.
@@ -2484,6 +2811,12 @@ bool syscall_uses_fd(struct syscall *sysc, int fd)
 	switch (sysc->num) {
 		case (SYS_read):
 		case (SYS_write):
+		case (SYS_readv):
+		case (SYS_writev):
+		case (SYS_preadv):
+		case (SYS_pwritev):
+		case (SYS_netmap_reg):
+		case (SYS_netmap_sync):
 		case (SYS_close):
 		case (SYS_fstat):
 		case (SYS_fcntl):
@@ -31,7 +31,6 @@ struct pb_kernel_test pb_kernel_tests[] = {
 	PB_K_TEST_REG(smp_call_functions, CONFIG_TEST_smp_call_functions),
 	PB_K_TEST_REG(slab,               CONFIG_TEST_slab),
 	PB_K_TEST_REG(kmalloc,            CONFIG_TEST_kmalloc),
-	PB_K_TEST_REG(hashtable,          CONFIG_TEST_hashtable),
 	PB_K_TEST_REG(bcq,                CONFIG_TEST_bcq),
 	PB_K_TEST_REG(ucq,                CONFIG_TEST_ucq),
 	PB_K_TEST_REG(vm_regions,         CONFIG_TEST_vm_regions),
@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <kdebug.h>
 #include <kmalloc.h>
+#include <bitmask.h>
 
 void reflect_unhandled_trap(unsigned int trap_nr, unsigned int err,
                             unsigned long aux)
@@ -53,47 +54,172 @@ error_out:
 
 struct kmem_cache *kernel_msg_cache;
 
+/* Max nr of freed kmsgs a core keeps for its own sends */
+#define KMSG_PCPU_CACHE_SZ		64
+
 void kernel_msg_init(void)
 {
 	kernel_msg_cache = kmem_cache_create("kernel_msgs",
 	                   sizeof(struct kernel_message), ARCH_CL_SIZE, 0, 0, 0);
 }
 
-uint32_t send_kernel_message(uint32_t dst, amr_t pc, long arg0, long arg1,
-                             long arg2, int type)
+/* Takes the kmsgs other cores gave back to us into our cache, trimming it
+ * back to size.  Only we take from our returns list, so there's no ABA problem
+ * with the pushes.  Called with IRQs disabled. */
+static void kmsg_reclaim(struct per_cpu_info *pcpui)
+{
+	struct kernel_message *kmsg, *next;
+
+	if (!ACCESS_ONCE(pcpui->kmsgs.returns))
+		return;
+	kmsg = (struct kernel_message*)atomic_swap((atomic_t*)&pcpui->kmsgs.returns,
+	                                           0);
+	for (; kmsg; kmsg = next) {
+		next = kmsg->next;
+		if (pcpui->nr_kmsg_cache >= KMSG_PCPU_CACHE_SZ) {
+			kmem_cache_free(kernel_msg_cache, kmsg);
+			continue;
+		}
+		kmsg->next = pcpui->kmsg_cache;
+		pcpui->kmsg_cache = kmsg;
+		pcpui->nr_kmsg_cache++;
+	}
+}
+
+/* Returns a list of n kmsgs, from our cache if we can, in one pass.  Whoever
+ * runs them gives them back to us (kmsg_free()), so even one-way senders get
+ * their messages back. */
+static struct kernel_message *kmsg_alloc(int n)
+{
+	struct per_cpu_info *pcpui;
+	struct kernel_message *kmsg, *list = 0;
+	int8_t irq_state = 0;
+	int i;
+
+	disable_irqsave(&irq_state);
+	pcpui = &per_cpu_info[core_id()];
+	for (i = 0; i < n; i++) {
+		if (!pcpui->kmsg_cache)
+			kmsg_reclaim(pcpui);
+		kmsg = pcpui->kmsg_cache;
+		if (!kmsg)
+			break;
+		pcpui->kmsg_cache = kmsg->next;
+		pcpui->nr_kmsg_cache--;
+		kmsg->next = list;
+		list = kmsg;
+	}
+	enable_irqsave(&irq_state);
+	for (; i < n; i++) {
+		kmsg = kmem_cache_alloc(kernel_msg_cache, 0);
+		kmsg->next = list;
+		list = kmsg;
+	}
+	return list;
+}
+
+static void kmsg_push(struct kernel_message **list, struct kernel_message *kmsg)
+{
+	struct kernel_message *old;
+	do {
+		old = ACCESS_ONCE(*list);
+		kmsg->next = old;
+	} while (!atomic_cas_ptr((void**)list, old, kmsg));
+}
+
+/* Called by the destination core once it is done with kmsg.  The sender
+ * allocated it, and srcid is still the sender's core, so it goes back there. */
+static void kmsg_free(struct kernel_message *kmsg)
+{
+	kmsg_push(&per_cpu_info[kmsg->srcid].kmsgs.returns, kmsg);
+}
+
+/* Takes every message off list, returning them in the order they were sent.
+ * Only the list's core can do this, so there's no ABA problem with the pushes.
+ */
+static struct kernel_message *kmsg_take_all(struct kernel_message **list)
+{
+	struct kernel_message *kmsg, *next, *fifo = 0;
+	/* Avoid the atomic if the list appears empty (lockless peek is okay) */
+	if (!ACCESS_ONCE(*list))
+		return 0;
+	kmsg = (struct kernel_message*)atomic_swap((atomic_t*)list, 0);
+	for (; kmsg; kmsg = next) {
+		next = kmsg->next;
+		kmsg->next = fifo;
+		fifo = kmsg;
+	}
+	return fifo;
+}
+
+/* Queues k_msg, from kmsg_alloc(), for dst.  Returns TRUE if the caller needs to
+ * IPI dst. */
+static bool __send_kmsg(struct kernel_message *k_msg, uint32_t dst, amr_t pc,
+                        long arg0, long arg1, long arg2, int type)
 {
-	kernel_message_t *k_msg;
+	struct kernel_msg_queue *kmq = &per_cpu_info[dst].kmsgs;
+	uint32_t srcid = core_id();
 	assert(pc);
-	// note this will be freed on the destination core
-	k_msg = kmem_cache_alloc(kernel_msg_cache, 0);
-	k_msg->srcid = core_id();
+	/* srcid is also where dst will give k_msg back to */
+	k_msg->srcid = srcid;
 	k_msg->dstid = dst;
 	k_msg->pc = pc;
 	k_msg->arg0 = arg0;
 	k_msg->arg1 = arg1;
 	k_msg->arg2 = arg2;
+	/* Once it is pushed, dst could run and free k_msg at any time */
 	switch (type) {
 		case KMSG_IMMEDIATE:
-			spin_lock_irqsave(&per_cpu_info[dst].immed_amsg_lock);
-			STAILQ_INSERT_TAIL(&per_cpu_info[dst].immed_amsgs, k_msg, link);
-			spin_unlock_irqsave(&per_cpu_info[dst].immed_amsg_lock);
+			kmsg_push(&kmq->immed_amsgs, k_msg);
 			break;
 		case KMSG_ROUTINE:
-			spin_lock_irqsave(&per_cpu_info[dst].routine_amsg_lock);
-			STAILQ_INSERT_TAIL(&per_cpu_info[dst].routine_amsgs, k_msg, link);
-			spin_unlock_irqsave(&per_cpu_info[dst].routine_amsg_lock);
+			kmsg_push(&kmq->routine_amsgs, k_msg);
 			break;
 		default:
 			panic("Unknown type of kernel message!");
 	}
-	/* since we touched memory the other core will touch (the lock), we don't
-	 * need an wmb_f() */
 	/* if we're sending a routine message locally, we don't want/need an IPI */
-	if ((dst != k_msg->srcid) || (type == KMSG_IMMEDIATE))
+	if ((dst == srcid) && (type == KMSG_ROUTINE))
+		return FALSE;
+	/* An idle dst watching its queue saw our push.  It only does that for RKMs;
+	 * immediates still need the IRQ.  Pairs with the mb in idle_wait(). */
+	if ((type == KMSG_ROUTINE) && ACCESS_ONCE(kmq->polling))
+		return FALSE;
+	/* If dst already has an IPI on the way, its handler hasn't cleared the flag
+	 * yet, and it will see our message (the push and swap are both mbs). */
+	return !atomic_swap(&kmq->ipi_pending, 1);
+}
+
+uint32_t send_kernel_message(uint32_t dst, amr_t pc, long arg0, long arg1,
+                             long arg2, int type)
+{
+	if (__send_kmsg(kmsg_alloc(1), dst, pc, arg0, arg1, arg2, type))
 		send_ipi(dst, I_KERNEL_MSG);
 	return 0;
 }
 
+void send_kernel_message_multi(uint32_t *pc_arr, uint32_t num, amr_t pc,
+                               long arg0, long arg1, long arg2, int type)
+{
+	DECL_BITMASK(need_ipi, MAX_NUM_CPUS);
+	struct kernel_message *kmsgs, *next;
+
+	CLR_BITMASK(need_ipi, MAX_NUM_CPUS);
+	/* Each target's message sits on its own list, so we still need one per
+	 * target, but we get them all from our cache at once. */
+	kmsgs = kmsg_alloc(num);
+	for (int i = 0; i < num; i++) {
+		next = kmsgs->next;
+		if (__send_kmsg(kmsgs, pc_arr[i], pc, arg0, arg1, arg2, type))
+			SET_BITMASK_BIT(need_ipi, pc_arr[i]);
+		kmsgs = next;
+	}
+	for (int i = 0; i < num; i++) {
+		if (GET_BITMASK_BIT(need_ipi, pc_arr[i]))
+			send_ipi(pc_arr[i], I_KERNEL_MSG);
+	}
+}
+
 /* Kernel message IPI/IRQ handler.
  *
  * This processes immediate messages, and that's it (it used to handle routines
@@ -107,35 +233,32 @@ void handle_kmsg_ipi(struct hw_trapframe *hw_tf, void *data)
 {
 	struct per_cpu_info *pcpui = &per_cpu_info[core_id()];
 	struct kernel_message *kmsg_i, *temp;
-	/* Avoid locking if the list appears empty (lockless peak is okay) */
-	if (STAILQ_EMPTY(&pcpui->immed_amsgs))
-		return;
-	/* The lock serves as a cmb to force a re-read of the head of the list */
-	spin_lock_irqsave(&pcpui->immed_amsg_lock);
-	STAILQ_FOREACH_SAFE(kmsg_i, &pcpui->immed_amsgs, link, temp) {
-		pcpui_trace_kmsg(pcpui, (uintptr_t)kmsg_i->pc);
-		kmsg_i->pc(kmsg_i->srcid, kmsg_i->arg0, kmsg_i->arg1, kmsg_i->arg2);
-		STAILQ_REMOVE(&pcpui->immed_amsgs, kmsg_i, kernel_message, link);
-		kmem_cache_free(kernel_msg_cache, (void*)kmsg_i);
+	/* Senders IPI us again for anything they queue from here on.  The mb keeps
+	 * us from reading the lists before the flag is clear. */
+	atomic_set(&pcpui->kmsgs.ipi_pending, 0);
+	mb();
+	while ((kmsg_i = kmsg_take_all(&pcpui->kmsgs.immed_amsgs))) {
+		for (; kmsg_i; kmsg_i = temp) {
+			temp = kmsg_i->next;
+			pcpui_trace_kmsg(pcpui, (uintptr_t)kmsg_i->pc);
+			kmsg_i->pc(kmsg_i->srcid, kmsg_i->arg0, kmsg_i->arg1,
+			           kmsg_i->arg2);
+			kmsg_free(kmsg_i);
+		}
 	}
-	spin_unlock_irqsave(&pcpui->immed_amsg_lock);
 }
 
 /* Helper function, gets the next routine KMSG (RKM).  Returns 0 if the list was
- * empty. */
+ * empty.  IRQs are disabled by our caller. */
 static kernel_message_t *get_next_rkmsg(struct per_cpu_info *pcpui)
 {
-	struct kernel_message *kmsg;
-	/* Avoid locking if the list appears empty (lockless peak is okay) */
-	if (STAILQ_EMPTY(&pcpui->routine_amsgs))
-		return 0;
-	/* The lock serves as a cmb to force a re-read of the head of the list.
-	 * IRQs are disabled by our caller. */
-	spin_lock(&pcpui->routine_amsg_lock);
-	kmsg = STAILQ_FIRST(&pcpui->routine_amsgs);
-	if (kmsg)
-		STAILQ_REMOVE_HEAD(&pcpui->routine_amsgs, link);
-	spin_unlock(&pcpui->routine_amsg_lock);
+	struct kernel_message *kmsg = pcpui->routine_fifo;
+	if (!kmsg) {
+		kmsg = kmsg_take_all(&pcpui->kmsgs.routine_amsgs);
+		if (!kmsg)
+			return 0;
+	}
+	pcpui->routine_fifo = kmsg->next;
 	return kmsg;
 }
 
@@ -161,7 +284,7 @@ void process_routine_kmsg(void)
 	while ((kmsg = get_next_rkmsg(pcpui))) {
 		/* Copy in, and then free, in case we don't return */
 		msg_cp = *kmsg;
-		kmem_cache_free(kernel_msg_cache, (void*)kmsg);
+		kmsg_free(kmsg);
 		assert(msg_cp.dstid == pcoreid);	/* caught a brutal bug with this */
 		set_rkmsg(pcpui);					/* we're now in early RKM ctx */
 		/* The kmsg could block.  If it does, we want the kthread code to know
@@ -197,23 +320,24 @@ void process_routine_kmsg(void)
 }
 
 /* extremely dangerous and racy: prints out the immed and routine kmsgs for a
- * specific core (so possibly remotely) */
+ * specific core (so possibly remotely).  The lists are newest first, other
+ * than the routines the core already took off its list. */
 void print_kmsgs(uint32_t coreid)
 {
 	struct per_cpu_info *pcpui = &per_cpu_info[coreid];
-	void __print_kmsgs(struct kernel_msg_list *list, char *type)
+	void __print_kmsgs(struct kernel_message *kmsg_i, char *type)
 	{
 		char *fn_name;
-		struct kernel_message *kmsg_i;
-		STAILQ_FOREACH(kmsg_i, list, link) {
+		for (; kmsg_i; kmsg_i = kmsg_i->next) {
 			fn_name = get_fn_name((long)kmsg_i->pc);
 			printk("%s KMSG on %d from %d to run %p(%s)\n", type,
 			       kmsg_i->dstid, kmsg_i->srcid, kmsg_i->pc, fn_name); 
 			kfree(fn_name);
 		}
 	}
-	__print_kmsgs(&pcpui->immed_amsgs, "Immedte");
-	__print_kmsgs(&pcpui->routine_amsgs, "Routine");
+	__print_kmsgs(pcpui->kmsgs.immed_amsgs, "Immedte");
+	__print_kmsgs(pcpui->routine_fifo, "Routine");
+	__print_kmsgs(pcpui->kmsgs.routine_amsgs, "Routine");
 }
 
 /* Debugging stuff */
@@ -222,16 +346,14 @@ void kmsg_queue_stat(void)
 	struct kernel_message *kmsg;
 	bool immed_emp, routine_emp;
 	for (int i = 0; i < num_cpus; i++) {
-		spin_lock_irqsave(&per_cpu_info[i].immed_amsg_lock);
-		immed_emp = STAILQ_EMPTY(&per_cpu_info[i].immed_amsgs);
-		spin_unlock_irqsave(&per_cpu_info[i].immed_amsg_lock);
-		spin_lock_irqsave(&per_cpu_info[i].routine_amsg_lock);
-		routine_emp = STAILQ_EMPTY(&per_cpu_info[i].routine_amsgs);
-		spin_unlock_irqsave(&per_cpu_info[i].routine_amsg_lock);
-		printk("Core %d's immed_emp: %d, routine_emp %d\n", i, immed_emp,
-               routine_emp);
-		if (!immed_emp) {
-			kmsg = STAILQ_FIRST(&per_cpu_info[i].immed_amsgs);
+		immed_emp = !per_cpu_info[i].kmsgs.immed_amsgs;
+		routine_emp = !per_cpu_info[i].routine_fifo &&
+		              !per_cpu_info[i].kmsgs.routine_amsgs;
+		printk("Core %d's immed_emp: %d, routine_emp %d, ipi_pending %d\n", i,
+		       immed_emp, routine_emp,
+		       atomic_read(&per_cpu_info[i].kmsgs.ipi_pending));
+		kmsg = per_cpu_info[i].kmsgs.immed_amsgs;
+		if (kmsg) {
 			printk("Immed msg on core %d:\n", i);
 			printk("\tsrc:  %d\n", kmsg->srcid);
 			printk("\tdst:  %d\n", kmsg->dstid);
@@ -240,8 +362,10 @@ void kmsg_queue_stat(void)
 			printk("\targ1: %p\n", kmsg->arg1);
 			printk("\targ2: %p\n", kmsg->arg2);
 		}
-		if (!routine_emp) {
-			kmsg = STAILQ_FIRST(&per_cpu_info[i].routine_amsgs);
+		kmsg = per_cpu_info[i].routine_fifo;
+		if (!kmsg)
+			kmsg = per_cpu_info[i].kmsgs.routine_amsgs;
+		if (kmsg) {
 			printk("Routine msg on core %d:\n", i);
 			printk("\tsrc:  %d\n", kmsg->srcid);
 			printk("\tdst:  %d\n", kmsg->dstid);
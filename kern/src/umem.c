@@ -34,6 +34,7 @@ int memcpy_from_user(struct proc *p, void *dest, const void *DANGEROUS va,
 	const void *DANGEROUS start, *DANGEROUS end;
 	size_t num_pages, i;
 	pte_t *pte;
+	struct page *u_page;
 	uintptr_t perm = PTE_P | PTE_USER_RO;
 	size_t bytes_copied = 0;
 
@@ -55,8 +56,11 @@ int memcpy_from_user(struct proc *p, void *dest, const void *DANGEROUS va,
 		if (!(*pte & PTE_P))
 			if (handle_page_fault(p, (uintptr_t)start + i * PGSIZE, PROT_READ))
 				return -EFAULT;
-
-		void *kpage = KADDR(PTE_ADDR(*pte));
+		/* look up the page again: the fault might have mapped a jumbo */
+		u_page = page_lookup(p->env_pgdir, (void*)start + i * PGSIZE, 0);
+		if (!u_page)
+			return -EFAULT;
+		void *kpage = page2kva(u_page);
 		const void *src_start = i > 0 ? kpage : kpage + (va - start);
 		void *dst_start = dest + bytes_copied;
 		size_t copy_len = PGSIZE;
@@ -100,6 +104,7 @@ int memcpy_to_user(struct proc *p, void *va, const void *src, size_t len)
 	const void *DANGEROUS start, *DANGEROUS end;
 	size_t num_pages, i;
 	pte_t *pte;
+	struct page *u_page;
 	uintptr_t perm = PTE_P | PTE_USER_RW;
 	size_t bytes_copied = 0;
 
@@ -116,12 +121,25 @@ int memcpy_to_user(struct proc *p, void *va, const void *src, size_t len)
 		pte = pgdir_walk(p->env_pgdir, start + i * PGSIZE, 0);
 		if (!pte)
 			return -EFAULT;
-		if ((*pte & PTE_P) && (*pte & PTE_USER_RW) != PTE_USER_RW)
-			return -EFAULT;
+		if ((*pte & PTE_P) && (*pte & PTE_USER_RW) != PTE_USER_RW) {
+			/* Read-only pages in a writable anon VMR are out on loan (see
+			 * loan_user_pages()).  Break the loan, like a user write would. */
+			if (!user_page_on_loan(p, (uintptr_t)start + i * PGSIZE))
+				return -EFAULT;
+			if (handle_page_fault(p, (uintptr_t)start + i * PGSIZE, PROT_WRITE))
+				return -EFAULT;
+			pte = pgdir_walk(p->env_pgdir, start + i * PGSIZE, 0);
+			if (!pte || (*pte & PTE_USER_RW) != PTE_USER_RW)
+				return -EFAULT;
+		}
 		if (!(*pte & PTE_P))
 			if (handle_page_fault(p, (uintptr_t)start + i * PGSIZE, PROT_WRITE))
 				return -EFAULT;
-		void *kpage = KADDR(PTE_ADDR(*pte));
+		/* look up the page again: the fault might have mapped a jumbo */
+		u_page = page_lookup(p->env_pgdir, (void*)start + i * PGSIZE, 0);
+		if (!u_page)
+			return -EFAULT;
+		void *kpage = page2kva(u_page);
 		void *dst_start = i > 0 ? kpage : kpage + (va - start);
 		const void *src_start = src + bytes_copied;
 		size_t copy_len = PGSIZE;
@@ -140,6 +140,15 @@ char *file_name(struct file *file)
 	return file->f_dentry->d_name.name;
 }
 
+static struct dentry *dcache_get_fast(struct super_block *sb,
+                                      struct dentry *parent, struct qstr *name,
+                                      bool *negative);
+static struct dentry *dcache_get_locked(struct super_block *sb,
+                                        struct dentry *what_i_want);
+static struct dentry *__dcache_lookup_lockless(struct super_block *sb,
+                                               struct dentry *parent,
+                                               struct qstr *name);
+
 /* Some issues with this, coupled closely to fs_lookup.
  *
  * Note the use of __dentry_free, instead of kref_put.  In those cases, we don't
@@ -148,12 +157,23 @@ char *file_name(struct file *file)
 static struct dentry *do_lookup(struct dentry *parent, char *name)
 {
 	struct dentry *result, *query;
+	struct qstr name_q = {.name = name, .len = strlen(name)};
+	bool negative = FALSE;
+
+	/* Most lookups are hits on dentries in use, which we can get without
+	 * building a query dentry or locking the dcache. */
+	name_q.hash = parent->d_op->d_hash(parent, &name_q);
+	result = dcache_get_fast(parent->d_sb, parent, &name_q, &negative);
+	if (result)
+		return result;
+	if (negative)
+		return 0;
 	query = get_dentry(parent->d_sb, parent, name);
 	if (!query) {
 		warn("OOM in do_lookup(), probably wasn't expected\n");
 		return 0;
 	}
-	result = dcache_get(parent->d_sb, query); 
+	result = dcache_get_locked(parent->d_sb, query);
 	if (result) {
 		__dentry_free(query);
 		return result;
@@ -313,6 +333,70 @@ static void stash_nd_name(struct nameidata *nd, char *name)
 	nd->last.hash = nd->dentry->d_op->d_hash(nd->dentry, &nd->last);
 }
 
+/* Walks as many of the intermediate directories of link as it can, starting
+ * from nd->dentry, without any locks or krefs.  It only handles the common case:
+ * dirs that are in use in the dcache of nd's FS, with no mounts, symlinks, or
+ * ..'s.  It stops before the last component and before anything it can't
+ * handle, and link_path_walk() picks up from there.  On success, nd holds the
+ * last dir we got to, and we return where the rest of the path starts.  If the
+ * dcache changed while we walked, we leave nd alone and return link. */
+static char *link_path_walk_lockless(char *link, struct nameidata *nd)
+{
+	struct super_block *sb = nd->dentry->d_sb;
+	struct dentry *dir = nd->dentry, *child;
+	struct chash_reader *rd;
+	struct qstr name;
+	char *orig_link = link, *next_slash, *next;
+	seq_ctr_t seq;
+
+	rd = chash_read_lock();
+	seq = ACCESS_ONCE(sb->s_dcache_seq);
+	while ((next_slash = strchr(link, '/'))) {
+		for (next = next_slash; *next == '/'; next++)
+			;
+		/* trailing slashes mean this is the last link */
+		if (*next == '\0')
+			break;
+		if (check_perms(dir->d_inode, nd->intent))
+			break;
+		if (!strncmp("./", link, 2)) {
+			link = next;
+			continue;
+		}
+		if (!strncmp("../", link, 3))
+			break;
+		name.name = link;
+		name.len = next_slash - link;
+		name.hash = dir->d_op->d_hash(dir, &name);
+		child = __dcache_lookup_lockless(sb, dir, &name);
+		if (!child || (child->d_flags & DENTRY_NEGATIVE) ||
+		    child->d_mount_point || !child->d_inode ||
+		    !S_ISDIR(child->d_inode->i_mode))
+			break;
+		dir = child;
+		link = next;
+	}
+	if (dir == nd->dentry) {
+		chash_read_unlock(rd);
+		return link;
+	}
+	/* Dirs with cached children are in use, so this rarely fails */
+	if (!kref_get_not_zero(&dir->d_kref, 1)) {
+		chash_read_unlock(rd);
+		return orig_link;
+	}
+	if (seqctr_retry(seq, ACCESS_ONCE(sb->s_dcache_seq))) {
+		chash_read_unlock(rd);
+		kref_put(&dir->d_kref);
+		return orig_link;
+	}
+	chash_read_unlock(rd);
+	/* Same FS, so nd->mnt doesn't change */
+	kref_put(&nd->dentry->d_kref);
+	nd->dentry = dir;
+	return link;
+}
+
 /* Resolves the links in a basic path walk.  0 for success, -EWHATEVER
  * otherwise.  The final lookup is returned via nd. */
 static int link_path_walk(char *path, struct nameidata *nd)
@@ -340,6 +424,9 @@ static int link_path_walk(char *path, struct nameidata *nd)
 		/* o/w, we're good */
 		return 0;
 	}
+	/* Zip through the dirs we already know about, then do the rest the slow
+	 * way (misses, mounts, symlinks, etc). */
+	link = link_path_walk_lockless(link, nd);
 	/* iterate through each intermediate link of the path.  in general, nd
 	 * tracks where we are in the path, as far as dentries go.  once we have the
 	 * next dentry, we try to update nd based on that dentry.  link is the part
@@ -530,23 +617,25 @@ out:
 
 /* Superblock functions */
 
-/* Dentry "hash" function for the hash table to use.  Since we already have the
- * hash in the qstr, we don't need to rehash.  Also, note we'll be using the
- * dentry in question as both the key and the value. */
-static size_t __dcache_hash(void *k)
+/* The dcache is a chash of dentries, keyed on the parent and the name, which
+ * lookups search without any locks.  Changes happen under the s_dcache_lock and
+ * bump the s_dcache_seq, so that a lockless lookup (or a whole path walk) can
+ * tell if anything changed while it looked, and retry the slow way. */
+#define DCACHE_INIT_SZ 128
+
+static size_t dcache_hash(void *k)
 {
-	return (size_t)((struct dentry*)k)->d_name.hash;
+	return ((struct dentry*)k)->d_name.hash;
 }
 
-/* Dentry cache hashtable equality function.  This means we need to pass in some
- * minimal dentry when doing a lookup. */
-static ssize_t __dcache_eq(void *k1, void *k2)
+static bool dcache_match(struct dentry *dentry, struct dentry *parent,
+                         struct qstr *name);
+
+static ssize_t dcache_eq(void *k1, void *k2)
 {
-	if (((struct dentry*)k1)->d_parent != ((struct dentry*)k2)->d_parent)
-		return 0;
-	/* TODO: use the FS-specific string comparison */
-	return !strcmp(((struct dentry*)k1)->d_name.name,
-	               ((struct dentry*)k2)->d_name.name);
+	struct dentry *d1 = (struct dentry*)k1;
+
+	return dcache_match((struct dentry*)k2, d1->d_parent, &d1->d_name);
 }
 
 /* Helper to alloc and initialize a generic superblock.  This handles all the
@@ -563,11 +652,12 @@ struct super_block *get_sb(void)
 	TAILQ_INIT(&sb->s_io_wb);
 	TAILQ_INIT(&sb->s_lru_d);
 	TAILQ_INIT(&sb->s_files);
-	sb->s_dcache = create_hashtable(100, __dcache_hash, __dcache_eq);
-	sb->s_icache = create_hashtable(100, __generic_hash, __generic_eq);
+	sb->s_dcache = chash_create(DCACHE_INIT_SZ, dcache_hash, dcache_eq);
+	sb->s_dcache_seq = 0;
+	sb->s_icache = chash_create(100, __generic_hash, __generic_eq);
+	assert(sb->s_dcache && sb->s_icache);
 	spinlock_init(&sb->s_lru_lock);
 	spinlock_init(&sb->s_dcache_lock);
-	spinlock_init(&sb->s_icache_lock);
 	sb->s_fs_info = 0; // can override somewhere else
 	return sb;
 }
@@ -707,6 +797,7 @@ void dentry_release(struct kref *kref)
 	printd("'Releasing' dentry %p: %s\n", dentry, dentry->d_name.name);
 	/* DYING dentries (recently unlinked / rmdir'd) just get freed */
 	if (dentry->d_flags & DENTRY_DYING) {
+		/* dcache_remove() already waited on any lockless lookups */
 		__dentry_free(dentry);
 		return;
 	}
@@ -782,33 +873,84 @@ struct dentry *lookup_dentry(char *path, int flags)
 	return dentry;
 }
 
-/* Get a dentry from the dcache.  At a minimum, we need the name hash and parent
- * in what_i_want, though most uses will probably be from a get_dentry() call.
- * We pass in the SB in the off chance that we don't want to use a get'd dentry.
- *
- * The unusual variable name (instead of just "key" or something) is named after
- * ex-SPC Castro's porn folder.  Caller deals with the memory for what_i_want.
- *
- * If the dentry is negative, we don't return the actual result - instead, we
- * set the negative flag in 'what i want'.  The reason is we don't want to
- * kref_get() and then immediately put (causing dentry_release()).  This also
- * means that dentry_release() should never get someone who wasn't USED (barring
- * the race, which it handles).  And we don't need to ever have a dentry set as
- * USED and NEGATIVE (which is always wrong, but would be needed for a cleaner
- * dentry_release()).
- *
- * This is where we do the "kref resurrection" - we are returning a kref'd
- * object, even if it wasn't kref'd before.  This means the dcache does NOT hold
- * krefs (it is a weak/internal ref), but it is a source of kref generation.  We
- * sync up with the possible freeing of the dentry by locking the table.  See
- * Doc/kref for more info. */
-struct dentry *dcache_get(struct super_block *sb, struct dentry *what_i_want)
+static bool dcache_match(struct dentry *dentry, struct dentry *parent,
+                         struct qstr *name)
+{
+	/* TODO: use the FS-specific string comparison */
+	return (dentry->d_parent == parent) &&
+	       (dentry->d_name.hash == name->hash) &&
+	       (dentry->d_name.len == name->len) &&
+	       !strncmp(dentry->d_name.name, name->name, name->len);
+}
+
+struct dcache_query {
+	struct dentry				*parent;
+	struct qstr					*name;
+};
+
+static bool dcache_query_match(void *query, void *k)
+{
+	struct dcache_query *q = (struct dcache_query*)query;
+
+	return dcache_match((struct dentry*)k, q->parent, q->name);
+}
+
+/* Finds name in parent without any locks.  Call this from within a
+ * chash_read_lock(), and only trust the answer until chash_read_unlock() and
+ * if the s_dcache_seq hasn't changed since before the lookup. */
+static struct dentry *__dcache_lookup_lockless(struct super_block *sb,
+                                               struct dentry *parent,
+                                               struct qstr *name)
+{
+	struct dcache_query q = {parent, name};
+
+	return chash_lookup_fn(sb->s_dcache, name->hash, &q, dcache_query_match);
+}
+
+/* Lockless half of dcache_get().  Returns a kref'd dentry if name is in parent
+ * and already in use.  Returns 0 and sets *negative if we know there is no such
+ * name.  Otherwise (a miss, an unused dentry that needs resurrecting, or a
+ * concurrent change), returns 0 and the caller needs to do it the slow way. */
+static struct dentry *dcache_get_fast(struct super_block *sb,
+                                      struct dentry *parent, struct qstr *name,
+                                      bool *negative)
+{
+	struct chash_reader *rd;
+	struct dentry *found;
+	seq_ctr_t seq;
+
+	rd = chash_read_lock();
+	seq = ACCESS_ONCE(sb->s_dcache_seq);
+	found = __dcache_lookup_lockless(sb, parent, name);
+	if (found && (found->d_flags & DENTRY_NEGATIVE)) {
+		if (!seqctr_retry(seq, ACCESS_ONCE(sb->s_dcache_seq)))
+			*negative = TRUE;
+		found = 0;
+	} else if (found && !kref_get_not_zero(&found->d_kref, 1)) {
+		found = 0;	/* unused, so it's on the LRU */
+	} else if (found && seqctr_retry(seq, ACCESS_ONCE(sb->s_dcache_seq))) {
+		/* We got a ref, but can't trust that it's still the right dentry.
+		 * The put has to happen outside the read lock. */
+		chash_read_unlock(rd);
+		kref_put(&found->d_kref);
+		return 0;
+	}
+	chash_read_unlock(rd);
+	return found;
+}
+
+/* Slow half of dcache_get(), which can also resurrect unused dentries */
+static struct dentry *dcache_get_locked(struct super_block *sb,
+                                        struct dentry *what_i_want)
 {
 	struct dentry *found;
+	struct chash_reader *rd;
 	/* This lock protects the hash, as well as ensures the returned object
 	 * doesn't get deleted/freed out from under us */
 	spin_lock(&sb->s_dcache_lock);
-	found = hashtable_search(sb->s_dcache, what_i_want);
+	rd = chash_read_lock();
+	found = chash_lookup(sb->s_dcache, what_i_want);
+	chash_read_unlock(rd);
 	if (found) {
 		if (found->d_flags & DENTRY_NEGATIVE) {
 			what_i_want->d_flags |= DENTRY_NEGATIVE;
@@ -831,15 +973,53 @@ struct dentry *dcache_get(struct super_block *sb, struct dentry *what_i_want)
 	return found;
 }
 
+/* Get a dentry from the dcache.  At a minimum, we need the name hash and parent
+ * in what_i_want, though most uses will probably be from a get_dentry() call.
+ * We pass in the SB in the off chance that we don't want to use a get'd dentry.
+ *
+ * The unusual variable name (instead of just "key" or something) is named after
+ * ex-SPC Castro's porn folder.  Caller deals with the memory for what_i_want.
+ *
+ * If the dentry is negative, we don't return the actual result - instead, we
+ * set the negative flag in 'what i want'.  The reason is we don't want to
+ * kref_get() and then immediately put (causing dentry_release()).  This also
+ * means that dentry_release() should never get someone who wasn't USED (barring
+ * the race, which it handles).  And we don't need to ever have a dentry set as
+ * USED and NEGATIVE (which is always wrong, but would be needed for a cleaner
+ * dentry_release()).
+ *
+ * This is where we do the "kref resurrection" - we are returning a kref'd
+ * object, even if it wasn't kref'd before.  This means the dcache does NOT hold
+ * krefs (it is a weak/internal ref), but it is a source of kref generation.  We
+ * sync up with the possible freeing of the dentry by locking the table.  See
+ * Doc/kref for more info.  Dentries that are in use (or negative) are found
+ * without the lock. */
+struct dentry *dcache_get(struct super_block *sb, struct dentry *what_i_want)
+{
+	struct dentry *found;
+	bool negative = FALSE;
+
+	found = dcache_get_fast(sb, what_i_want->d_parent, &what_i_want->d_name,
+	                        &negative);
+	if (found)
+		return found;
+	if (negative) {
+		what_i_want->d_flags |= DENTRY_NEGATIVE;
+		return 0;
+	}
+	return dcache_get_locked(sb, what_i_want);
+}
+
 /* Adds a dentry to the dcache.  Note the *dentry is both the key and the value.
  * If the value was already in there (which can happen iff it was negative), for
  * now we'll remove it and put the new one in there. */
 void dcache_put(struct super_block *sb, struct dentry *key_val)
 {
 	struct dentry *old;
-	int retval;
+	struct chash_entry *dead = 0;
 	spin_lock(&sb->s_dcache_lock);
-	old = hashtable_remove(sb->s_dcache, key_val);
+	__seq_start_write(&sb->s_dcache_seq);
+	old = chash_remove_deferred(sb->s_dcache, key_val, &dead);
 	/* if it is old and non-negative, our caller lost a race with someone else
 	 * adding the dentry.  but since we yanked it out, like a bunch of idiots,
 	 * we still have to put it back.  should be fairly rare. */
@@ -853,25 +1033,35 @@ void dcache_put(struct super_block *sb, struct dentry *key_val)
 		/* TODO: this seems suspect.  isn't this the same memory as key_val?
 		 * in which case, we just adjust the flags (remove NEG) and reinsert? */
 		assert(old != key_val); // checking TODO comment
-		__dentry_free(old);
+	} else {
+		old = 0;
 	}
-	/* this returns 0 on failure (TODO: Fix this ghetto shit) */
- 	retval = hashtable_insert(sb->s_dcache, key_val, key_val);
-	assert(retval);
+	if (!chash_insert(sb->s_dcache, key_val, key_val))
+		warn("Failed to add %s to the dcache", key_val->d_name.name);
+	__seq_end_write(&sb->s_dcache_seq);
 	spin_unlock(&sb->s_dcache_lock);
+	/* Wait on any lockless lookups that saw old */
+	chash_free_dead(dead);
+	if (old)
+		__dentry_free(old);
 }
 
 /* Will remove and return the dentry.  Caller deallocs the key, but the retval
  * won't have a reference.  * Returns 0 if it wasn't found.  Callers can't
  * assume much - they should not use the reference they *get back*, (if they
  * already had one for key, they can use that).  There may be other users out
- * there. */
+ * there.  Lockless lookups are done with the dentry by the time we return, so the
+ * caller can free it. */
 struct dentry *dcache_remove(struct super_block *sb, struct dentry *key)
 {
 	struct dentry *retval;
+	struct chash_entry *dead = 0;
 	spin_lock(&sb->s_dcache_lock);
-	retval = hashtable_remove(sb->s_dcache, key);
+	__seq_start_write(&sb->s_dcache_seq);
+	retval = chash_remove_deferred(sb->s_dcache, key, &dead);
+	__seq_end_write(&sb->s_dcache_seq);
 	spin_unlock(&sb->s_dcache_lock);
+	chash_free_dead(dead);
 	return retval;
 }
 
@@ -880,29 +1070,35 @@ struct dentry *dcache_remove(struct super_block *sb, struct dentry *key)
  * the hash lock for the time we traverse the LRU list - this prevents someone
  * from getting a kref from the dcache, which could cause us trouble (we rip
  * someone off the list, who isn't unused, and they try to rip them off the
- * list). */
+ * list).  Lockless lookups only kref dentries that are already in use, so they
+ * can't resurrect anything on the LRU. */
 void dcache_prune(struct super_block *sb, bool negative_only)
 {
 	struct dentry *d_i, *temp;
 	struct dentry_tailq victims = TAILQ_HEAD_INITIALIZER(victims);
+	struct chash_entry *dead = 0;
 
 	spin_lock(&sb->s_dcache_lock);
 	spin_lock(&sb->s_lru_lock);
+	__seq_start_write(&sb->s_dcache_seq);
 	TAILQ_FOREACH_SAFE(d_i, &sb->s_lru_d, d_lru, temp) {
 		if (!(d_i->d_flags & DENTRY_USED)) {
 			if (negative_only && !(d_i->d_flags & DENTRY_NEGATIVE))
 				continue;
 			/* another place where we'd be better off with tools, not sol'ns */
-			hashtable_remove(sb->s_dcache, d_i);
+			chash_remove_deferred(sb->s_dcache, d_i, &dead);
 			TAILQ_REMOVE(&sb->s_lru_d, d_i, d_lru);
 			TAILQ_INSERT_HEAD(&victims, d_i, d_lru);
 		}
 	}
+	__seq_end_write(&sb->s_dcache_seq);
 	spin_unlock(&sb->s_lru_lock);
 	spin_unlock(&sb->s_dcache_lock);
 	/* Now do the actual freeing, outside of the hash/LRU list locks.  This is
 	 * necessary since __dentry_free() will decref its parent, which may get
-	 * released and try to add itself to the LRU. */
+	 * released and try to add itself to the LRU.  First we wait, once for the
+	 * lot, on any lockless lookups of the victims. */
+	chash_free_dead(dead);
 	TAILQ_FOREACH_SAFE(d_i, &victims, d_lru, temp) {
 		TAILQ_REMOVE(&victims, d_i, d_lru);
 		assert(!kref_refcnt(&d_i->d_kref));
@@ -912,6 +1108,15 @@ void dcache_prune(struct super_block *sb, bool negative_only)
 	 * could loop back until that list is empty, if we care about this. */
 }
 
+/* Runs func on every dentry in the dcache, with the dcache locked.  Func can't
+ * block. */
+void dcache_for_each(struct super_block *sb, void (*func)(struct dentry *))
+{
+	spin_lock(&sb->s_dcache_lock);
+	chash_for_each(sb->s_dcache, (void (*)(void*))func);
+	spin_unlock(&sb->s_dcache_lock);
+}
+
 /* Inode Functions */
 
 /* Creates and initializes a new inode.  Generic fields are filled in.
@@ -1142,33 +1347,34 @@ void print_kstat(struct kstat *kstat)
 struct inode *icache_get(struct super_block *sb, unsigned long ino)
 {
 	/* This is the same style as in pid2proc, it's the "safely create a strong
-	 * reference from a weak one, so long as other strong ones exist" pattern */
-	spin_lock(&sb->s_icache_lock);
-	struct inode *inode = hashtable_search(sb->s_icache, (void*)ino);
+	 * reference from a weak one, so long as other strong ones exist" pattern.
+	 * The read lock keeps the inode from being freed until we're done. */
+	struct chash_reader *rd = chash_read_lock();
+	struct inode *inode = chash_lookup(sb->s_icache, (void*)ino);
 	if (inode)
 		if (!kref_get_not_zero(&inode->i_kref, 1))
 			inode = 0;
-	spin_unlock(&sb->s_icache_lock);
+	chash_read_unlock(rd);
 	return inode;
 }
 
 void icache_put(struct super_block *sb, struct inode *inode)
 {
-	spin_lock(&sb->s_icache_lock);
+	struct chash_reader *rd = chash_read_lock();
 	/* there's a race in load_ino() that could trigger this */
-	assert(!hashtable_search(sb->s_icache, (void*)inode->i_ino));
-	hashtable_insert(sb->s_icache, (void*)inode->i_ino, inode);
-	spin_unlock(&sb->s_icache_lock);
+	assert(!chash_lookup(sb->s_icache, (void*)inode->i_ino));
+	chash_read_unlock(rd);
+	if (!chash_insert(sb->s_icache, (void*)inode->i_ino, inode))
+		warn("Failed to add inode %d to the icache", inode->i_ino);
 }
 
 struct inode *icache_remove(struct super_block *sb, unsigned long ino)
 {
 	struct inode *inode;
 	/* Presumably these hashtable removals could be easier since callers
-	 * actually know who they are (same with the pid2proc hash) */
-	spin_lock(&sb->s_icache_lock);
-	inode = hashtable_remove(sb->s_icache, (void*)ino);
-	spin_unlock(&sb->s_icache_lock);
+	 * actually know who they are (same with the pid2proc hash).  This waits on
+	 * any icache_get() that might have seen the inode. */
+	inode = chash_remove(sb->s_icache, (void*)ino);
 	assert(inode && !kref_refcnt(&inode->i_kref));
 	return inode;
 }
@@ -1187,7 +1393,7 @@ ssize_t generic_file_read(struct file *file, char *buf, size_t count,
 	off64_t page_off;
 	unsigned long first_idx, last_idx;
 	size_t copy_amt;
-	char *buf_end;
+	char *buf_start = buf, *buf_end;
 	/* read in offset, in case of a concurrent reader/writer, so we don't screw
 	 * up our math for count, the idxs, etc. */
 	off64_t orig_off = ACCESS_ONCE(*offset);
@@ -1218,7 +1424,11 @@ ssize_t generic_file_read(struct file *file, char *buf, size_t count,
 		 * user_mem_check, then free, and also to make a distinction between
 		 * when the kernel wants a read/write (TODO: KFOP) */
 		if (current) {
-			memcpy_to_user(current, buf, page2kva(page) + page_off, copy_amt);
+			if (memcpy_to_user(current, buf, page2kva(page) + page_off,
+			                   copy_amt)) {
+				pm_put_page(page);
+				break;
+			}
 		} else {
 			memcpy(buf, page2kva(page) + page_off, copy_amt);
 		}
@@ -1226,7 +1436,14 @@ ssize_t generic_file_read(struct file *file, char *buf, size_t count,
 		page_off = 0;
 		pm_put_page(page);	/* it's still in the cache, we just don't need it */
 	}
-	assert(buf == buf_end);
+	if (buf != buf_end) {
+		/* The user's buffer faulted.  Report what we got, like a short read. */
+		if (buf == buf_start) {
+			set_errno(EFAULT);
+			return -1;
+		}
+		count = buf - buf_start;
+	}
 	/* could have concurrent file ops that screw with offset, so userspace isn't
 	 * safe.  but at least it'll be a value that one of the concurrent ops could
 	 * have produced (compared to *offset_changed_concurrently += count. */
@@ -1299,6 +1516,46 @@ ssize_t generic_file_write(struct file *file, const char *buf, size_t count,
 	return count;
 }
 
+/* Reads into each of the count buffers in vector in turn, starting at *offset,
+ * which is increased accordingly, with the file's f_op->read.  Stops early on a
+ * short read, e.g. at EOF.  Returns the number of bytes transfered, or -1 if the
+ * first read failed.  Most filesystems will use this for their f_op->readv. */
+ssize_t generic_file_readv(struct file *file, const struct iovec *vector,
+                           unsigned long count, off64_t *offset)
+{
+	ssize_t ret, sofar = 0;
+
+	for (unsigned long i = 0; i < count; i++) {
+		ret = file->f_op->read(file, vector[i].iov_base, vector[i].iov_len,
+		                       offset);
+		if (ret < 0)
+			return sofar ? sofar : ret;
+		sofar += ret;
+		if (ret < vector[i].iov_len)
+			break;
+	}
+	return sofar;
+}
+
+/* Writes each of the count buffers in vector in turn, like generic_file_readv.
+ * Note that with O_APPEND, each buffer is appended separately. */
+ssize_t generic_file_writev(struct file *file, const struct iovec *vector,
+                            unsigned long count, off64_t *offset)
+{
+	ssize_t ret, sofar = 0;
+
+	for (unsigned long i = 0; i < count; i++) {
+		ret = file->f_op->write(file, vector[i].iov_base, vector[i].iov_len,
+		                        offset);
+		if (ret < 0)
+			return sofar ? sofar : ret;
+		sofar += ret;
+		if (ret < vector[i].iov_len)
+			break;
+	}
+	return sofar;
+}
+
 /* Directories usually use this for their read method, which is the way glibc
  * currently expects us to do a readdir (short of doing linux's getdents).  Will
  * probably need work, based on whatever real programs want. */
@@ -2249,6 +2506,8 @@ struct file *dentry_open(struct dentry *dentry, int flags)
 	if (!file)
 		return 0;
 	file->f_mode = desired_mode;
+	if (desired_mode & S_IWUSR)
+		atomic_inc(&inode->i_writecount);
 	/* Add to the list of all files of this SB */
 	TAILQ_INSERT_TAIL(&inode->i_sb->s_files, file, f_list);
 	kref_get(&dentry->d_kref, 1);
@@ -2262,6 +2521,7 @@ struct file *dentry_open(struct dentry *dentry, int flags)
 	file->f_uid = inode->i_uid;
 	file->f_gid = inode->i_gid;
 	file->f_error = 0;
+	file->f_last_writer = FALSE;
 //	struct event_poll_tailq		f_ep_links;
 	spinlock_init(&file->f_ep_lock);
 	file->f_privdata = 0;						/* prob overriden by the fs */
@@ -2287,6 +2547,11 @@ void file_release(struct kref *kref)
 
 	/* TODO: fsync (BLK).  also, we may want to parallelize the blocking that
 	 * could happen in here (spawn kernel threads)... */
+	/* Writers come off the count first, so the FS's release knows whether it
+	 * was the last one without racing with other opens and closes */
+	if (file->f_mode & S_IWUSR)
+		file->f_last_writer =
+		        atomic_sub_and_test(&file->f_dentry->d_inode->i_writecount, 1);
 	file->f_op->release(file->f_dentry->d_inode, file);
 	/* Clean up the other refs we hold */
 	kref_put(&file->f_dentry->d_kref);
@@ -0,0 +1,107 @@
+/* Syscall rate: trapping versus the ARSC rings.
+ *
+ * Usage: arsc_rate [NR_CALLS] [BATCH] [NR_RINGS]
+ *
+ * First we trap into the kernel NR_CALLS times for a null syscall.  Then we
+ * submit NR_CALLS null syscalls on NR_RINGS rings, BATCH at a time on each
+ * ring, and wait for each batch to come back.  The kernel's poller cores run
+ * the ring syscalls, so we never trap.  Needs a kernel built with
+ * CONFIG_ARSC_SERVER. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <parlib.h>
+#include <arc.h>
+#include <sys/time.h>
+
+static unsigned long long usec_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000000ULL +
+	       (end.tv_usec - start->tv_usec);
+}
+
+static void print_rate(const char *name, long nr_calls,
+                       unsigned long long usec)
+{
+	if (!usec)
+		usec = 1;
+	printf("%s: %ld syscalls in %llu usec, %llu nsec each, %llu per sec\n",
+	       name, nr_calls, usec, usec * 1000 / nr_calls,
+	       nr_calls * 1000000ULL / usec);
+}
+
+int main(int argc, char **argv)
+{
+	long nr_calls = 1000000;
+	int batch = 32, nr_rings = 1;
+	struct arsc_channel *chans;
+	struct syscall *syscs;
+	syscall_desc_t **descs;
+	syscall_req_t req = {REQ_alloc, NULL, NULL, NULL};
+	struct timeval start;
+	long nr_done = 0;
+
+	if (argc > 1)
+		nr_calls = strtol(argv[1], 0, 10);
+	if (argc > 2)
+		batch = strtol(argv[2], 0, 10);
+	if (argc > 3)
+		nr_rings = strtol(argv[3], 0, 10);
+	if (nr_calls <= 0 || batch <= 0 || nr_rings <= 0) {
+		printf("Usage: %s [NR_CALLS] [BATCH] [NR_RINGS]\n", argv[0]);
+		exit(-1);
+	}
+
+	gettimeofday(&start, 0);
+	for (long i = 0; i < nr_calls; i++)
+		sys_null();
+	print_rate("Trap", nr_calls, usec_since(&start));
+
+	chans = calloc(nr_rings, sizeof(struct arsc_channel));
+	if (!chans) {
+		perror("calloc");
+		exit(-1);
+	}
+	for (int i = 0; i < nr_rings; i++) {
+		if (init_arc(&chans[i])) {
+			perror("init_arc");
+			exit(-1);
+		}
+	}
+	if (batch > RING_SIZE(&chans[0].sysfr)) {
+		batch = RING_SIZE(&chans[0].sysfr);
+		printf("Ring only holds %d, using that for the batch size\n", batch);
+	}
+	syscs = calloc(nr_rings * batch, sizeof(struct syscall));
+	descs = calloc(nr_rings * batch, sizeof(syscall_desc_t*));
+	if (!syscs || !descs) {
+		perror("calloc");
+		exit(-1);
+	}
+
+	gettimeofday(&start, 0);
+	while (nr_done < nr_calls) {
+		for (int i = 0; i < nr_rings * batch; i++) {
+			syscs[i].num = SYS_null;
+			syscs[i].flags = 0;
+			req.sc = &syscs[i];
+			if (async_syscall(&chans[i / batch], &req, &descs[i])) {
+				perror("async_syscall");
+				exit(-1);
+			}
+		}
+		for (int i = 0; i < nr_rings * batch; i++) {
+			waiton_syscall(descs[i]);
+			free(descs[i]);
+		}
+		nr_done += nr_rings * batch;
+	}
+	print_rate("Rings", nr_done, usec_since(&start));
+	free(descs);
+	free(syscs);
+	free(chans);
+	return 0;
+}
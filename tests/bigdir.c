@@ -0,0 +1,100 @@
+/* Creates and looks up lots of files in a single directory, to measure how
+ * directory operations scale with directory size (e.g. ext2 with and without
+ * the hashed directory index).
+ *
+ * Usage: bigdir [DIR] [NR_FILES]
+ *
+ * DIR defaults to /mnt/bigdir (ext2 is mounted at /mnt) and will be created if
+ * it doesn't exist.  It prints the average cost of each op every 10% of the
+ * way, so you can see if the per-op cost grows with the dir. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static unsigned long long usec_diff(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000ULL +
+	       (end->tv_usec - start->tv_usec);
+}
+
+/* Runs op on names [0, nr_files), printing the per-op time for each tenth */
+static void run_phase(const char *phase, const char *dir, int nr_files,
+                      const char *prefix, int (*op)(const char *path))
+{
+	char path[256];
+	struct timeval start, chunk_start, end;
+	int chunk = nr_files / 10 ? nr_files / 10 : 1;
+	int failures = 0;
+
+	printf("%s:\n", phase);
+	gettimeofday(&start, 0);
+	chunk_start = start;
+	for (int i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/%s%08d", dir, prefix, i);
+		if (op(path))
+			failures++;
+		if ((i + 1) % chunk == 0) {
+			gettimeofday(&end, 0);
+			printf("\t%8d files: %6llu usec/op\n", i + 1,
+			       usec_diff(&chunk_start, &end) / chunk);
+			chunk_start = end;
+		}
+	}
+	gettimeofday(&end, 0);
+	printf("\ttotal %llu usec, %llu usec/op, %d unexpected results\n",
+	       usec_diff(&start, &end), usec_diff(&start, &end) / nr_files,
+	       failures);
+}
+
+static int create_op(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	return 0;
+}
+
+static int stat_op(const char *path)
+{
+	struct stat st;
+	return stat(path, &st);
+}
+
+/* Expects the file to not be there */
+static int stat_missing_op(const char *path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 || errno != ENOENT;
+}
+
+int main(int argc, char **argv)
+{
+	char *dir = "/mnt/bigdir";
+	int nr_files = 100000;
+
+	if (argc > 1)
+		dir = argv[1];
+	if (argc > 2)
+		nr_files = atoi(argv[2]);
+	if (nr_files <= 0) {
+		printf("Usage: %s [DIR] [NR_FILES]\n", argv[0]);
+		exit(-1);
+	}
+	if (mkdir(dir, 0777) && errno != EEXIST) {
+		perror("mkdir");
+		exit(-1);
+	}
+	printf("Using %d files in %s\n", nr_files, dir);
+	run_phase("Create", dir, nr_files, "f", create_op);
+	run_phase("Lookup (existing)", dir, nr_files, "f", stat_op);
+	/* These miss in the dcache, so they always go down to the FS */
+	run_phase("Lookup (missing)", dir, nr_files, "nope", stat_missing_op);
+	return 0;
+}
@@ -0,0 +1,122 @@
+/* Event coalescing benchmark.
+ *
+ * Usage: event_coalesce [NR_EVENTS]
+ *
+ * A receiver thread spins on one vcore while we send it NR_EVENTS kernel
+ * events from another, one syscall (sys_notify) each, to an ev_q that IPIs the
+ * receiver's vcore.  Without coalescing, every event is its own message and
+ * alert, so the receiver handles every one separately.  With EVENT_COALESCE,
+ * events that arrive before the receiver drains its mbox just set a bit, and
+ * only the first one alerts it, so the handler runs once per alert instead of
+ * once per event. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <parlib.h>
+#include <vcore.h>
+#include <event.h>
+#include <sys/time.h>
+
+static int rcv_vcoreid = -1;
+static bool done;
+static unsigned long nr_handled;
+static unsigned long nr_msgs;
+
+static unsigned long long usec_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000000ULL +
+	       (end.tv_usec - start->tv_usec);
+}
+
+/* Runs in the receiver's vcore context.  Coalesced events come in as bits. */
+static void count_handler(struct event_msg *ev_msg, unsigned int ev_type,
+                          void *data)
+{
+	nr_handled++;
+	if (ev_msg)
+		nr_msgs++;
+}
+
+static void *receiver(void *arg)
+{
+	rcv_vcoreid = vcore_id();
+	while (!ACCESS_ONCE(done))
+		cpu_relax();
+	return 0;
+}
+
+static void run_test(int nr_events, int ev_flags)
+{
+	struct event_queue *ev_q;
+	struct event_mbox *mbox;
+	struct event_msg msg = {0};
+	struct timeval start;
+	unsigned long long usec;
+	pthread_t rcv_thread;
+
+	done = FALSE;
+	rcv_vcoreid = -1;
+	nr_handled = 0;
+	nr_msgs = 0;
+	pthread_create(&rcv_thread, NULL, receiver, NULL);
+	while (ACCESS_ONCE(rcv_vcoreid) == -1)
+		pthread_yield();
+	ev_q = get_event_q_vcpd(rcv_vcoreid, EVENT_VCORE_PRIVATE);
+	ev_q->ev_flags = EVENT_IPI | EVENT_VCORE_PRIVATE | ev_flags;
+	ev_q->ev_vcore = rcv_vcoreid;
+	mbox = ev_q->ev_mbox;
+	register_kevent_q(ev_q, EV_FREE_APPLE_PIE);
+
+	gettimeofday(&start, 0);
+	for (int i = 0; i < nr_events; i++) {
+		msg.ev_arg2 = i;
+		sys_notify(getpid(), EV_FREE_APPLE_PIE, &msg);
+	}
+	/* Wait for the receiver to catch up */
+	if (ev_flags & EVENT_COALESCE) {
+		while (!mbox_is_empty(mbox))
+			cpu_relax();
+	} else {
+		while (ACCESS_ONCE(nr_msgs) < nr_events)
+			cpu_relax();
+	}
+	usec = usec_since(&start);
+	clear_kevent_q(EV_FREE_APPLE_PIE);
+	done = TRUE;
+	pthread_join(rcv_thread, NULL);
+	put_event_q(ev_q);
+
+	if (!usec)
+		usec = 1;
+	printf("%s: %d events in %llu usec (%llu nsec each), %lu handler runs, "
+	       "%lu.%03lu per event\n",
+	       ev_flags & EVENT_COALESCE ? "Coalesced" : "One msg each", nr_events,
+	       usec, usec * 1000 / nr_events, nr_handled,
+	       nr_handled / nr_events, nr_handled * 1000 / nr_events % 1000);
+}
+
+int main(int argc, char **argv)
+{
+	int nr_events = 100000;
+
+	if (argc > 1)
+		nr_events = strtol(argv[1], 0, 10);
+	if (nr_events <= 0) {
+		printf("Usage: %s [NR_EVENTS]\n", argv[0]);
+		exit(-1);
+	}
+	pthread_can_vcore_request(FALSE);	/* 2LS won't manage vcores */
+	pthread_lib_init();					/* gives us one vcore */
+	if (vcore_request(1)) {
+		printf("Failed to get a second vcore\n");
+		exit(-1);
+	}
+	register_ev_handler(EV_FREE_APPLE_PIE, count_handler, 0);
+	run_test(nr_events, 0);
+	run_test(nr_events, EVENT_COALESCE);
+	return 0;
+}
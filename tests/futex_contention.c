@@ -0,0 +1,157 @@
+/* Futex contention benchmark.
+ *
+ * Usage: futex_contention [NR_PAIRS] [NR_LOOPS] [NR_VCORES] [NR_WAITERS]
+ *
+ * Pairs of threads hand a token back and forth, each pair with its own futex
+ * word, blocking in FUTEX_WAIT until it is their turn.  The pairs have nothing
+ * to do with each other, so with per-address hash buckets, the handoffs per
+ * second should scale with the number of pairs (and vcores), instead of
+ * serializing on one futex lock.
+ *
+ * Then NR_WAITERS threads wait on a condvar-like futex, and we time waking all
+ * of them with FUTEX_WAKE versus waking one and requeueing the rest onto a
+ * mutex-like futex with FUTEX_CMP_REQUEUE, the way a condvar broadcast would. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include <futex.h>
+#include <parlib.h>
+#include <vcore.h>
+#include <sys/time.h>
+
+struct futex_pair {
+	int							turn;
+	int							nr_loops;
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+static struct futex_pair *pairs;
+
+static unsigned long long usec_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000000ULL +
+	       (end.tv_usec - start->tv_usec);
+}
+
+/* Side 0 goes when turn is 0, then hands off to side 1, and vice versa */
+static void *pingpong_thread(void *arg)
+{
+	long side = (long)arg & 1;
+	struct futex_pair *pr = &pairs[(long)arg >> 1];
+
+	for (int i = 0; i < pr->nr_loops; i++) {
+		while (ACCESS_ONCE(pr->turn) != side)
+			futex(&pr->turn, FUTEX_WAIT, !side, NULL, NULL, 0);
+		pr->turn = !side;
+		futex(&pr->turn, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+	return 0;
+}
+
+static int cv_seq;
+static int mtx_word;
+static atomic_t nr_cv_waiting;
+
+/* Waits for the 'broadcast', then for the 'mutex' if we were requeued */
+static void *cv_thread(void *arg)
+{
+	int seq = ACCESS_ONCE(cv_seq);
+
+	atomic_inc(&nr_cv_waiting);
+	while (ACCESS_ONCE(cv_seq) == seq)
+		futex(&cv_seq, FUTEX_WAIT, seq, NULL, NULL, 0);
+	/* Requeued waiters get woken from mtx_word, one after another */
+	futex(&mtx_word, FUTEX_WAKE, 1, NULL, NULL, 0);
+	return 0;
+}
+
+static unsigned long long run_broadcast(int nr_waiters, bool requeue)
+{
+	pthread_t *threads = malloc(sizeof(pthread_t) * nr_waiters);
+	struct timeval start;
+	unsigned long long usec;
+	int seq;
+
+	atomic_init(&nr_cv_waiting, 0);
+	for (int i = 0; i < nr_waiters; i++)
+		pthread_create(&threads[i], NULL, cv_thread, NULL);
+	while (atomic_read(&nr_cv_waiting) < nr_waiters)
+		pthread_yield();
+	/* Let the last ones block */
+	for (int i = 0; i < 10; i++)
+		pthread_yield();
+	gettimeofday(&start, 0);
+	seq = __sync_add_and_fetch(&cv_seq, 1);
+	if (requeue)
+		futex(&cv_seq, FUTEX_CMP_REQUEUE, 1, (struct timespec*)(long)INT_MAX,
+		      &mtx_word, seq);
+	else
+		futex(&cv_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	for (int i = 0; i < nr_waiters; i++)
+		pthread_join(threads[i], NULL);
+	usec = usec_since(&start);
+	free(threads);
+	return usec;
+}
+
+int main(int argc, char **argv)
+{
+	int nr_pairs = 4, nr_loops = 100000, nr_vcores = 0, nr_waiters = 100;
+	pthread_t *threads;
+	struct timeval start;
+	unsigned long long usec;
+
+	if (argc > 1)
+		nr_pairs = strtol(argv[1], 0, 10);
+	if (argc > 2)
+		nr_loops = strtol(argv[2], 0, 10);
+	if (argc > 3)
+		nr_vcores = strtol(argv[3], 0, 10);
+	if (argc > 4)
+		nr_waiters = strtol(argv[4], 0, 10);
+	if (nr_pairs <= 0 || nr_loops <= 0 || nr_waiters <= 0) {
+		printf("Usage: %s [NR_PAIRS] [NR_LOOPS] [NR_VCORES] [NR_WAITERS]\n",
+		       argv[0]);
+		exit(-1);
+	}
+	if (nr_vcores) {
+		pthread_can_vcore_request(FALSE);	/* 2LS won't manage vcores */
+		pthread_lib_init();					/* gives us one vcore */
+		vcore_request(nr_vcores - 1);
+	}
+
+	if (posix_memalign((void**)&pairs, ARCH_CL_SIZE,
+	                   sizeof(struct futex_pair) * nr_pairs)) {
+		perror("posix_memalign");
+		exit(-1);
+	}
+	threads = malloc(sizeof(pthread_t) * nr_pairs * 2);
+	for (int i = 0; i < nr_pairs; i++) {
+		pairs[i].turn = 0;
+		pairs[i].nr_loops = nr_loops;
+	}
+	gettimeofday(&start, 0);
+	for (long i = 0; i < nr_pairs * 2; i++)
+		pthread_create(&threads[i], NULL, pingpong_thread, (void*)i);
+	for (int i = 0; i < nr_pairs * 2; i++)
+		pthread_join(threads[i], NULL);
+	usec = usec_since(&start);
+	if (!usec)
+		usec = 1;
+	printf("%d pairs, %d vcores: %llu handoffs in %llu usec, %llu per msec\n",
+	       nr_pairs, nr_vcores ? nr_vcores : 1,
+	       (unsigned long long)nr_pairs * nr_loops * 2, usec,
+	       (unsigned long long)nr_pairs * nr_loops * 2 * 1000 / usec);
+	free(threads);
+	free(pairs);
+
+	printf("%d waiters: wake all took %llu usec\n", nr_waiters,
+	       run_broadcast(nr_waiters, FALSE));
+	printf("%d waiters: wake one and requeue took %llu usec\n", nr_waiters,
+	       run_broadcast(nr_waiters, TRUE));
+	return 0;
+}
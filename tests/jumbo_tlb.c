@@ -0,0 +1,114 @@
+/* Random accesses over a big anonymous mapping, to show what jumbo pages do for
+ * TLB misses.  With 4KB pages, nearly every access misses in the TLB once the
+ * mapping is much bigger than the TLB's reach; with 2MB or 1GB pages, far
+ * fewer do.
+ *
+ * Usage: jumbo_tlb [SIZE_MB] [NR_ACCESSES] [huge|auto|small]
+ *
+ * huge asks for jumbos with MAP_HUGE (including 1GB pages, if the machine has
+ * them), auto gets the kernel's default for a large anonymous mapping (2MB
+ * pages), and small forces 4KB pages.  The kernel only gives jumbos on its own
+ * to big VMRs, so small builds the region out of chunks that are too small and
+ * that won't merge (alternating MAP_NORESERVE).  The default is 4GB, so make
+ * sure the machine has the memory. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define SMALL_CHUNK_SZ (8UL << 20)
+
+static unsigned long long usec_diff(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000ULL +
+	       (end->tv_usec - start->tv_usec);
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+static char *map_region(size_t size, char *mode)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+	char *region, *chunk;
+
+	if (!strcmp(mode, "huge"))
+		flags |= MAP_HUGE;
+	if (strcmp(mode, "small")) {
+		region = mmap(0, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+		return region == MAP_FAILED ? 0 : region;
+	}
+	/* Reserve the whole range, then replace it chunk by chunk */
+	region = mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED)
+		return 0;
+	for (size_t i = 0; i < size; i += SMALL_CHUNK_SZ) {
+		chunk = mmap(region + i, SMALL_CHUNK_SZ, PROT_READ | PROT_WRITE,
+		             flags | MAP_FIXED |
+		             ((i / SMALL_CHUNK_SZ) % 2 ? MAP_NORESERVE : 0), -1, 0);
+		if (chunk == MAP_FAILED)
+			return 0;
+	}
+	return region;
+}
+
+int main(int argc, char **argv)
+{
+	size_t size_mb = 4096;
+	long nr_accesses = 10000000;
+	char *mode = "auto";
+	struct timeval start, end;
+	unsigned long long usec;
+	uint64_t seed = 0x123456789abcdefULL, sum = 0;
+	uint64_t *words;
+	size_t nr_words, size;
+
+	if (argc > 1)
+		size_mb = strtoul(argv[1], 0, 10);
+	if (argc > 2)
+		nr_accesses = strtol(argv[2], 0, 10);
+	if (argc > 3)
+		mode = argv[3];
+	if (!size_mb || nr_accesses <= 0 || (strcmp(mode, "huge") &&
+	    strcmp(mode, "auto") && strcmp(mode, "small"))) {
+		printf("Usage: %s [SIZE_MB] [NR_ACCESSES] [huge|auto|small]\n",
+		       argv[0]);
+		exit(-1);
+	}
+	size = size_mb << 20;
+	size = (size + SMALL_CHUNK_SZ - 1) & ~(SMALL_CHUNK_SZ - 1);
+
+	gettimeofday(&start, 0);
+	words = (uint64_t*)map_region(size, mode);
+	gettimeofday(&end, 0);
+	if (!words) {
+		perror("mmap");
+		exit(-1);
+	}
+	printf("%s: mapped and populated %lu MB in %llu usec\n", mode,
+	       size >> 20, usec_diff(&start, &end));
+
+	nr_words = size / sizeof(uint64_t);
+	gettimeofday(&start, 0);
+	for (long i = 0; i < nr_accesses; i++)
+		sum += words[xorshift64(&seed) % nr_words]++;
+	gettimeofday(&end, 0);
+	usec = usec_diff(&start, &end);
+	if (!usec)
+		usec = 1;
+	printf("%s: %ld random accesses in %llu usec, %llu ns/access (sum %lu)\n",
+	       mode, nr_accesses, usec, usec * 1000 / nr_accesses, sum);
+	munmap(words, size);
+	return 0;
+}
@@ -0,0 +1,320 @@
+/* Copyright (c) 2015 The Regents of the University of California
+ * See LICENSE for details.
+ *
+ * mutex_test: microbenchmark for pthread mutex and condvar handoffs.
+ *
+ * Unlike lock_test, the workers are uthreads that can outnumber the vcores, so
+ * the locks need to sleep as well as spin.  'mutex' is the adaptive pthread
+ * mutex, 'spinpdr' is a pure spinlock for comparison, and 'cond' passes a token
+ * around the workers in order, with each handoff being a cond broadcast (which
+ * morphs the waiters onto the mutex).  We report acquisitions per second and
+ * the acquire latency distribution, including the tail. */
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <argp.h>
+
+#include <tsc-compat.h>
+#include <measure.h>
+
+/* OS dependent #incs */
+#include <parlib.h>
+#include <vcore.h>
+#include <timing.h>
+#include <spinlock.h>
+#include <arch/arch.h>
+
+const char *argp_program_version = "mutex_test v0.1";
+const char *argp_program_bug_address = "<akaros@lists.eecs.berkeley.edu>";
+
+static char doc[] = "mutex_test -- pthread mutex handoff benchmarking";
+static char args_doc[] = "-w NUM -l NUM -t LOCK";
+
+static struct argp_option options[] = {
+	{"workers",		'w', "NUM",	OPTION_NO_USAGE, "Number of threads"},
+	{0, 0, 0, 0, ""},
+	{"loops",		'l', "NUM",	OPTION_NO_USAGE, "Number of loops per worker"},
+	{0, 0, 0, 0, ""},
+	{"type",		't', "LOCK",OPTION_NO_USAGE, "Type of lock to use.  "
+	                                             "Options:\n"
+	                                             "\tmutex\n"
+	                                             "\tspinpdr\n"
+	                                             "\tcond"},
+	{0, 0, 0, 0, "Other options (not mandatory):"},
+	{"vcores",		'v', "NUM",	0, "Number of vcores (default: workers)"},
+	{"hold",		'h', "NSEC",	0, "nsec to hold the lock"},
+	{"delay",		'd', "NSEC",	0, "nsec to delay between grabs"},
+	{"print",		'p', "ROWS",	0, "Print ROWS of throughput"},
+	{ 0 }
+};
+
+struct prog_args {
+	int							nr_threads;
+	int							nr_loops;
+	int							nr_vcores;
+	int							hold_time;
+	int							delay_time;
+	int							nr_print_rows;
+	void *(*lock_type)(void *arg);
+};
+struct prog_args pargs = {0};
+
+struct time_stamp {
+	uint64_t pre;
+	uint64_t acq;
+};
+struct time_stamp **times;
+pthread_barrier_t start_test;
+
+pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+struct spin_pdr_lock spdr_lock = SPINPDR_INITIALIZER;
+pthread_cond_t cv = PTHREAD_COND_INITIALIZER;
+unsigned long turn;
+
+#define lock_func(lock_name, lock_cmd, unlock_cmd)                             \
+void *lock_name##_thread(void *arg)                                            \
+{                                                                              \
+	long thread_id = (long)arg;                                                \
+	int hold_time = ACCESS_ONCE(pargs.hold_time);                              \
+	int delay_time = ACCESS_ONCE(pargs.delay_time);                            \
+	int nr_loops = ACCESS_ONCE(pargs.nr_loops);                                \
+	struct time_stamp *this_time;                                              \
+	uint64_t pre_lock;                                                         \
+                                                                               \
+	pthread_barrier_wait(&start_test);                                         \
+	for (int i = 0; i < nr_loops; i++) {                                       \
+		pre_lock = read_tsc_serialized();                                      \
+                                                                               \
+		lock_cmd                                                               \
+                                                                               \
+		this_time = &times[thread_id][i];                                      \
+		this_time->acq = read_tsc_serialized();                                \
+		this_time->pre = pre_lock;                                             \
+		if (hold_time)                                                         \
+			ndelay(hold_time);                                                 \
+                                                                               \
+		unlock_cmd                                                             \
+                                                                               \
+		if (delay_time)                                                        \
+			ndelay(delay_time);                                                \
+	}                                                                          \
+	return arg;                                                                \
+}
+
+lock_func(mutex,
+          pthread_mutex_lock(&mtx);,
+          pthread_mutex_unlock(&mtx);)
+lock_func(spinpdr,
+          spin_pdr_lock(&spdr_lock);,
+          spin_pdr_unlock(&spdr_lock);)
+/* Each worker waits for its turn, so every handoff wakes up everyone waiting,
+ * and all but one of them go right back to sleep on the mutex. */
+lock_func(cond,
+          pthread_mutex_lock(&mtx);
+          while (turn % pargs.nr_threads != thread_id)
+              pthread_cond_wait(&cv, &mtx);,
+          turn++;
+          pthread_cond_broadcast(&cv);
+          pthread_mutex_unlock(&mtx);)
+
+static int get_acq_latency(void **data, int i, int j, uint64_t *sample)
+{
+	struct time_stamp **times = (struct time_stamp**)data;
+	/* 0 for initial time means we didn't measure */
+	if (times[i][j].pre == 0)
+		return -1;
+	*sample = times[i][j].acq - times[i][j].pre - get_tsc_overhead();
+	return 0;
+}
+
+static int get_acq_timestamp(void **data, int i, int j, uint64_t *sample)
+{
+	struct time_stamp **times = (struct time_stamp**)data;
+	/* 0 for initial time means we didn't measure */
+	if (times[i][j].pre == 0)
+		return -1;
+	*sample = times[i][j].acq;
+	return 0;
+}
+
+static void os_prep_work(int nr_vcores)
+{
+	if (nr_vcores > max_vcores()) {
+		printf("Too many vcores (%d) requested, can't get more than %d\n",
+		       nr_vcores, max_vcores());
+		exit(-1);
+	}
+	pthread_can_vcore_request(FALSE);	/* 2LS won't manage vcores */
+	pthread_lib_init();					/* gives us one vcore */
+	if (vcore_request(nr_vcores - 1)) {
+		printf("Failed to request %d more vcores, currently have %d\n",
+		       nr_vcores - 1, num_vcores());
+		exit(-1);
+	}
+}
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+	struct prog_args *pargs = state->input;
+	switch (key) {
+		case 'w':
+			pargs->nr_threads = atoi(arg);
+			if (pargs->nr_threads < 0) {
+				printf("Negative nr_threads...\n\n");
+				argp_usage(state);
+			}
+			break;
+		case 'l':
+			pargs->nr_loops = atoi(arg);
+			if (pargs->nr_loops < 0) {
+				printf("Negative nr_loops...\n\n");
+				argp_usage(state);
+			}
+			break;
+		case 'v':
+			pargs->nr_vcores = atoi(arg);
+			if (pargs->nr_vcores < 0) {
+				printf("Negative nr_vcores...\n\n");
+				argp_usage(state);
+			}
+			break;
+		case 'h':
+			pargs->hold_time = atoi(arg);
+			if (pargs->hold_time < 0) {
+				printf("Negative hold_time...\n\n");
+				argp_usage(state);
+			}
+			break;
+		case 'd':
+			pargs->delay_time = atoi(arg);
+			if (pargs->delay_time < 0) {
+				printf("Negative delay_time...\n\n");
+				argp_usage(state);
+			}
+			break;
+		case 'p':
+			pargs->nr_print_rows = atoi(arg);
+			if (pargs->nr_print_rows < 0) {
+				printf("Negative print_rows...\n\n");
+				argp_usage(state);
+			}
+			break;
+		case 't':
+			if (!strcmp("mutex", arg)) {
+				pargs->lock_type = mutex_thread;
+				break;
+			}
+			if (!strcmp("spinpdr", arg)) {
+				pargs->lock_type = spinpdr_thread;
+				break;
+			}
+			if (!strcmp("cond", arg)) {
+				pargs->lock_type = cond_thread;
+				break;
+			}
+			printf("Unknown locktype %s\n\n", arg);
+			argp_usage(state);
+			break;
+		case ARGP_KEY_ARG:
+			printf("Warning, extra argument %s ignored\n\n", arg);
+			break;
+		case ARGP_KEY_END:
+			if (!pargs->nr_threads) {
+				printf("Must select a number of threads.\n\n");
+				argp_usage(state);
+				break;
+			}
+			if (!pargs->nr_loops) {
+				printf("Must select a number of loops.\n\n");
+				argp_usage(state);
+				break;
+			}
+			if (!pargs->lock_type) {
+				printf("Must select a type of lock.\n\n");
+				argp_usage(state);
+				break;
+			}
+			if (!pargs->nr_vcores)
+				pargs->nr_vcores = pargs->nr_threads;
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argp = {options, parse_opt, args_doc, doc};
+
+int main(int argc, char** argv)
+{
+	pthread_t *worker_threads;
+	void *dummy_retval;
+	struct timeval start_tv = {0};
+	struct timeval end_tv = {0};
+	long usec_diff;
+	uint64_t starttsc;
+	int nr_threads, nr_loops;
+	struct sample_stats acq_stats;
+
+	argp_parse(&argp, argc, argv, 0, 0, &pargs);
+	nr_threads = pargs.nr_threads;
+	nr_loops = pargs.nr_loops;
+
+	worker_threads = malloc(sizeof(pthread_t) * nr_threads);
+	if (!worker_threads) {
+		perror("pthread_t malloc failed:");
+		exit(-1);
+	}
+	printf("Making %d workers of %d loops each, on %d vcores\n", nr_threads,
+	       nr_loops, pargs.nr_vcores);
+	pthread_barrier_init(&start_test, NULL, nr_threads);
+
+	times = malloc(sizeof(struct time_stamp *) * nr_threads);
+	assert(times);
+	for (int i = 0; i < nr_threads; i++) {
+		times[i] = malloc(sizeof(struct time_stamp) * nr_loops);
+		if (!times[i]) {
+			perror("Record keeping malloc");
+			exit(-1);
+		}
+		memset(times[i], 0, sizeof(struct time_stamp) * nr_loops);
+	}
+	os_prep_work(pargs.nr_vcores);
+	starttsc = read_tsc();
+	for (long i = 0; i < nr_threads; i++) {
+		if (pthread_create(&worker_threads[i], NULL, pargs.lock_type,
+		                   (void*)i))
+			perror("pth_create failed");
+	}
+	if (gettimeofday(&start_tv, 0))
+		perror("Start time error...");
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(worker_threads[i], &dummy_retval);
+	if (gettimeofday(&end_tv, 0))
+		perror("End time error...");
+
+	printf("Acquire times (TSC Ticks)\n---------------------------\n");
+	acq_stats.get_sample = get_acq_latency;
+	compute_stats((void**)times, nr_threads, nr_loops, &acq_stats);
+
+	usec_diff = (end_tv.tv_sec - start_tv.tv_sec) * 1000000 +
+	            (end_tv.tv_usec - start_tv.tv_usec);
+	if (!usec_diff)
+		usec_diff = 1;
+	printf("Time to run: %ld usec\n", usec_diff);
+	printf("Acquisitions/sec: %llu\n",
+	       (unsigned long long)nr_threads * nr_loops * 1000000 / usec_diff);
+	printf("Tail acquire latency (99%%): %llu usec\n",
+	       tsc2usec(acq_stats.lat_99));
+
+	printf("\nLock throughput:\n-----------------\n");
+	print_throughput((void**)times, usec_diff / 1000 + 1, msec2tsc(1),
+	                 pargs.nr_print_rows,
+	                 starttsc, nr_threads,
+	                 nr_loops, get_acq_timestamp);
+	printf("Done, exiting\n");
+	return 0;
+}
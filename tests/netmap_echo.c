@@ -0,0 +1,114 @@
+/* Ethernet reflector on a netmapped NIC queue.
+ *
+ * Usage: netmap_echo [ETHERDIR] [QUEUE] [NR_PKTS]
+ *
+ * Takes over QUEUE (default 0) of the NIC at ETHERDIR (default /net/ether0)
+ * and sends every good frame that arrives on it back where it came from, with
+ * its MAC addresses swapped, until it has reflected NR_PKTS of them (default
+ * forever).  The frames never leave the region we registered: we poll with
+ * syncs, copy each rx buffer to a tx slot, and the NIC does the rest.
+ *
+ * On a NIC with one queue, this takes the whole NIC away from the kernel while
+ * it runs.  With more, only the flows RSS sends to QUEUE come to us. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <parlib.h>
+#include <sys/time.h>
+
+static unsigned long long usec_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000000ULL +
+	       (end.tv_usec - start->tv_usec);
+}
+
+static void print_rate(long nr_pkts, long nr_syncs, unsigned long long usec)
+{
+	if (!usec)
+		usec = 1;
+	printf("Reflected %ld pkts in %llu usec with %ld syncs, %llu pkts/sec\n",
+	       nr_pkts, usec, nr_syncs, nr_pkts * 1000000ULL / usec);
+}
+
+static void reflect(uint8_t *rx_buf, uint8_t *tx_buf, uint16_t len)
+{
+	memcpy(tx_buf, rx_buf + 6, 6);
+	memcpy(tx_buf + 6, rx_buf, 6);
+	memcpy(tx_buf + 12, rx_buf + 12, len - 12);
+}
+
+int main(int argc, char **argv)
+{
+	char path[128];
+	const char *dir = argc > 1 ? argv[1] : "/net/ether0";
+	int qidx = argc > 2 ? strtol(argv[2], 0, 10) : 0;
+	long max_pkts = argc > 3 ? strtol(argv[3], 0, 10) : 0;
+	long nr_pkts = 0, nr_syncs = 0;
+	struct netmap_req req = {0};
+	struct netmap_ring *rx, *tx;
+	struct netmap_slot *slot;
+	struct timeval start;
+	uint8_t *region;
+	uint32_t n = NETMAP_NR_SLOTS;
+	int fd;
+
+	if ((qidx < 0) || (max_pkts < 0)) {
+		printf("Usage: %s [ETHERDIR] [QUEUE] [NR_PKTS]\n", argv[0]);
+		exit(-1);
+	}
+	snprintf(path, sizeof(path), "%s/clone", dir);
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		perror(path);
+		exit(-1);
+	}
+	if (posix_memalign((void**)&region, PGSIZE, NETMAP_REGION_SZ)) {
+		perror("posix_memalign");
+		exit(-1);
+	}
+	req.cmd = NETMAP_CMD_REG;
+	req.qidx = qidx;
+	req.region = region;
+	if (sys_netmap_reg(fd, &req)) {
+		perror("netmap_reg");
+		exit(-1);
+	}
+	rx = (struct netmap_ring*)(region + NETMAP_RX_RING);
+	tx = (struct netmap_ring*)(region + NETMAP_TX_RING);
+	printf("Reflecting on %s queue %d\n", dir, qidx);
+	gettimeofday(&start, 0);
+	while (!max_pkts || (nr_pkts < max_pkts)) {
+		if (sys_netmap_sync(fd, qidx, NETMAP_SYNC_RX | NETMAP_SYNC_TX)) {
+			perror("netmap_sync");
+			exit(-1);
+		}
+		nr_syncs++;
+		/* For each frame, we need a tx slot.  If we're out, we leave the rest
+		 * for the next sync, which will have reaped some. */
+		while ((rx->head != rx->tail) && (tx->head != tx->tail)) {
+			slot = &rx->slot[rx->head];
+			if (!(slot->flags & NETMAP_SLOT_ERR) && (slot->len >= 14)) {
+				reflect(region + NETMAP_RX_BUF(rx->head),
+				        region + NETMAP_TX_BUF(tx->head), slot->len);
+				tx->slot[tx->head].len = slot->len;
+				tx->head = (tx->head + 1) % n;
+				nr_pkts++;
+			}
+			rx->head = (rx->head + 1) % n;
+		}
+	}
+	print_rate(nr_pkts, nr_syncs, usec_since(&start));
+	/* Closing the FD would do this too */
+	req.cmd = NETMAP_CMD_UNREG;
+	if (sys_netmap_reg(fd, &req))
+		perror("netmap_unreg");
+	close(fd);
+	free(region);
+	return 0;
+}
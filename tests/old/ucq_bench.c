@@ -0,0 +1,114 @@
+/* UCQ consumer microbenchmark.
+ *
+ * Usage: ucq_bench [NR_MSGS] [NR_ROUNDS] [BATCH]
+ *
+ * Each round, the kernel fills a ucq with NR_MSGS messages (we sys_notify
+ * ourselves, untimed), then we time draining it three ways: one message at a
+ * time with get_ucq_msg() (a CAS and an atomic inc per message), BATCH at a
+ * time with get_ucq_msgs() (one of each per batch), and BATCH at a time from a
+ * single-consumer ucq (no atomics at all). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <parlib.h>
+#include <event.h>
+#include <ucq.h>
+#include <sys/time.h>
+
+static unsigned long long usec_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000000ULL +
+	       (end.tv_usec - start->tv_usec);
+}
+
+static void fill_ucq(struct event_queue *ev_q, int nr_msgs)
+{
+	struct event_msg msg = {0};
+
+	register_kevent_q(ev_q, EV_FREE_APPLE_PIE);
+	for (int i = 0; i < nr_msgs; i++) {
+		msg.ev_arg2 = i;
+		sys_notify(getpid(), EV_FREE_APPLE_PIE, &msg);
+	}
+	clear_kevent_q(EV_FREE_APPLE_PIE);
+}
+
+/* Returns usec to drain nr_msgs from ucq, batch at a time (0 for one-by-one) */
+static unsigned long long drain_ucq(struct ucq *ucq, int nr_msgs, int batch,
+                                   struct event_msg *msgs)
+{
+	struct timeval start;
+	int nr_got = 0, ret;
+
+	gettimeofday(&start, 0);
+	while (nr_got < nr_msgs) {
+		if (!batch) {
+			if (get_ucq_msg(ucq, &msgs[0]))
+				break;
+			ret = 1;
+		} else {
+			ret = get_ucq_msgs(ucq, msgs, batch);
+			if (!ret)
+				break;
+		}
+		for (int i = 0; i < ret; i++)
+			assert(msgs[i].ev_arg2 == nr_got + i);
+		nr_got += ret;
+	}
+	assert(nr_got == nr_msgs);
+	return usec_since(&start);
+}
+
+static void print_rate(const char *name, long nr_msgs, unsigned long long usec)
+{
+	if (!usec)
+		usec = 1;
+	printf("%s: %ld msgs in %llu usec, %llu nsec each\n", name, nr_msgs, usec,
+	       usec * 1000 / nr_msgs);
+}
+
+int main(int argc, char **argv)
+{
+	int nr_msgs = 10000, nr_rounds = 10, batch = 32;
+	struct event_queue *ev_q = get_big_event_q();
+	struct event_queue *single_ev_q = get_big_event_q();
+	struct ucq *ucq = &ev_q->ev_mbox->ev_msgs;
+	struct ucq *single_ucq = &single_ev_q->ev_mbox->ev_msgs;
+	unsigned long long one_usec = 0, batch_usec = 0, single_usec = 0;
+	struct event_msg *msgs;
+
+	if (argc > 1)
+		nr_msgs = strtol(argv[1], 0, 10);
+	if (argc > 2)
+		nr_rounds = strtol(argv[2], 0, 10);
+	if (argc > 3)
+		batch = strtol(argv[3], 0, 10);
+	if (nr_msgs <= 0 || nr_rounds <= 0 || batch <= 0) {
+		printf("Usage: %s [NR_MSGS] [NR_ROUNDS] [BATCH]\n", argv[0]);
+		exit(-1);
+	}
+	msgs = malloc(sizeof(struct event_msg) * batch);
+	assert(msgs);
+	/* Kernel messages only, no IPIs or INDIRs */
+	ev_q->ev_flags = 0;
+	single_ev_q->ev_flags = 0;
+	ucq_set_single_consumer(single_ucq);
+
+	for (int i = 0; i < nr_rounds; i++) {
+		fill_ucq(ev_q, nr_msgs);
+		one_usec += drain_ucq(ucq, nr_msgs, 0, msgs);
+		fill_ucq(ev_q, nr_msgs);
+		batch_usec += drain_ucq(ucq, nr_msgs, batch, msgs);
+		fill_ucq(single_ev_q, nr_msgs);
+		single_usec += drain_ucq(single_ucq, nr_msgs, batch, msgs);
+	}
+	print_rate("One at a time", (long)nr_msgs * nr_rounds, one_usec);
+	print_rate("Batched", (long)nr_msgs * nr_rounds, batch_usec);
+	print_rate("Batched, single consumer", (long)nr_msgs * nr_rounds,
+	           single_usec);
+	free(msgs);
+	return 0;
+}
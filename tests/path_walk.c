@@ -0,0 +1,112 @@
+/* Measures how path lookups scale across cores: each thread stat()s (or opens
+ * and closes) the same path in a loop, and we print the total ops/sec for 1, 2,
+ * 4, ... up to NR_THREADS threads, one thread per vcore.  With a scalable
+ * dcache, the total rate should grow with the number of threads.
+ *
+ * Usage: path_walk [NR_THREADS] [NR_LOOPS] [stat|open] [PATH]
+ *
+ * To build on linux, cd into tests and run:
+ * $ gcc -O2 -std=gnu99 -fno-stack-protector -g path_walk.c -lpthread */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "misc-compat.h" /* OS dependent #incs */
+
+#define MAX_NR_TEST_THREADS 1000
+
+int nr_threads = 8;
+int nr_loops = 100000;
+bool use_open = FALSE;
+char *path = "/lib/libc.so.6";
+
+pthread_t my_threads[MAX_NR_TEST_THREADS];
+int nr_failures[MAX_NR_TEST_THREADS];
+volatile bool ready;
+
+void *lookup_thread(void *arg)
+{
+	long id = (long)arg;
+	struct stat st;
+	int fd;
+
+	while (!ready)
+		cpu_relax();
+	for (int i = 0; i < nr_loops; i++) {
+		if (use_open) {
+			fd = open(path, O_RDONLY);
+			if (fd < 0)
+				nr_failures[id]++;
+			else
+				close(fd);
+		} else {
+			if (stat(path, &st))
+				nr_failures[id]++;
+		}
+	}
+	return 0;
+}
+
+static void run_test(int nr_running)
+{
+	struct timeval start_tv, end_tv;
+	long usec_diff;
+	long nr_ops = (long)nr_running * nr_loops;
+	int failures = 0;
+
+	ready = FALSE;
+	for (long i = 0; i < nr_running; i++) {
+		nr_failures[i] = 0;
+		if (pthread_create(&my_threads[i], NULL, &lookup_thread, (void*)i))
+			perror("pth_create failed");
+	}
+	gettimeofday(&start_tv, 0);
+	ready = TRUE;
+	for (int i = 0; i < nr_running; i++) {
+		pthread_join(my_threads[i], NULL);
+		failures += nr_failures[i];
+	}
+	gettimeofday(&end_tv, 0);
+	usec_diff = (end_tv.tv_sec - start_tv.tv_sec) * 1000000 +
+	            (end_tv.tv_usec - start_tv.tv_usec);
+	if (!usec_diff)
+		usec_diff = 1;
+	printf("%4d threads: %9ld ops/sec total, %8ld ops/sec/thread, "
+	       "%d failures\n", nr_running, nr_ops * 1000000 / usec_diff,
+	       nr_ops * 1000000 / usec_diff / nr_running, failures);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		nr_threads = strtol(argv[1], 0, 10);
+	if (argc > 2)
+		nr_loops = strtol(argv[2], 0, 10);
+	if (argc > 3)
+		use_open = !strcmp(argv[3], "open");
+	if (argc > 4)
+		path = argv[4];
+	nr_threads = MIN(MAX(nr_threads, 1), MAX_NR_TEST_THREADS);
+	printf("%s of %s, %d loops per thread, up to %d threads\n",
+	       use_open ? "open/close" : "stat", path, nr_loops, nr_threads);
+
+#ifdef __ros__
+	/* One thread per vcore, so the lookups are actually in parallel */
+	pthread_can_vcore_request(FALSE);
+	pthread_need_tls(FALSE);
+	pthread_lib_init();
+	vcore_request(nr_threads - 1);
+#endif /* __ros__ */
+
+	for (int i = 1; i < nr_threads; i *= 2)
+		run_test(i);
+	run_test(nr_threads);
+	return 0;
+}
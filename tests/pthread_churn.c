@@ -0,0 +1,99 @@
+/* pthread create/join throughput.
+ *
+ * Usage: pthread_churn [NR_THREADS] [NR_ROUNDS] [NR_VCORES]
+ *
+ * Each round creates NR_THREADS short-lived threads and joins them all.  The
+ * first round has to map fresh stacks and TLSs; later rounds should get them
+ * from the 2LS's caches, so the difference between the two is what the caches
+ * buy us. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <parlib.h>
+#include <vcore.h>
+#include <sys/time.h>
+
+static __thread long tls_counter;
+
+static void *churn_thread(void *arg)
+{
+	/* Touch the TLS and the stack, like a real thread would */
+	volatile char buf[256];
+
+	buf[0] = (char)(long)arg;
+	tls_counter += buf[0];
+	return (void*)tls_counter;
+}
+
+static unsigned long long usec_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000000ULL +
+	       (end.tv_usec - start->tv_usec);
+}
+
+static unsigned long long run_round(pthread_t *threads, int nr_threads)
+{
+	struct timeval start;
+
+	gettimeofday(&start, 0);
+	for (long i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, churn_thread, (void*)i)) {
+			perror("pthread_create");
+			exit(-1);
+		}
+	}
+	for (int i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	return usec_since(&start);
+}
+
+int main(int argc, char **argv)
+{
+	int nr_threads = 100, nr_rounds = 100, nr_vcores = 0;
+	pthread_t *threads;
+	unsigned long long cold_usec, warm_usec = 0;
+
+	if (argc > 1)
+		nr_threads = strtol(argv[1], 0, 10);
+	if (argc > 2)
+		nr_rounds = strtol(argv[2], 0, 10);
+	if (argc > 3)
+		nr_vcores = strtol(argv[3], 0, 10);
+	if (nr_threads <= 0 || nr_rounds < 2) {
+		printf("Usage: %s [NR_THREADS] [NR_ROUNDS >= 2] [NR_VCORES]\n",
+		       argv[0]);
+		exit(-1);
+	}
+	if (nr_vcores) {
+		pthread_can_vcore_request(FALSE);	/* 2LS won't manage vcores */
+		pthread_lib_init();					/* gives us one vcore */
+		vcore_request(nr_vcores - 1);
+	}
+	threads = malloc(sizeof(pthread_t) * nr_threads);
+	if (!threads) {
+		perror("malloc");
+		exit(-1);
+	}
+	cold_usec = run_round(threads, nr_threads);
+	for (int i = 1; i < nr_rounds; i++)
+		warm_usec += run_round(threads, nr_threads);
+	if (!cold_usec)
+		cold_usec = 1;
+	if (!warm_usec)
+		warm_usec = 1;
+	printf("Cold round: %d create/joins in %llu usec, %llu nsec each\n",
+	       nr_threads, cold_usec, cold_usec * 1000 / nr_threads);
+	printf("Warm rounds: %llu create/joins in %llu usec, %llu nsec each, "
+	       "%llu per sec\n",
+	       (unsigned long long)nr_threads * (nr_rounds - 1), warm_usec,
+	       warm_usec * 1000 / ((unsigned long long)nr_threads *
+	                           (nr_rounds - 1)),
+	       (unsigned long long)nr_threads * (nr_rounds - 1) * 1000000 /
+	       warm_usec);
+	free(threads);
+	return 0;
+}
@@ -0,0 +1,178 @@
+/* Pipe and TCP loopback throughput, for zero-copy qio.
+ *
+ * Usage: qio_zcopy [MB] [PORT]
+ *
+ * For each transfer size, a writer thread sends MB megabytes from a
+ * page-aligned buffer through a pipe, then through a TCP connection to ourselves
+ * (on PORT, PORT + 1, ...), and a reader thread reads them into another
+ * page-aligned buffer.  Transfers of at
+ * least qiozerocopymin (64KB) lend the writer's pages to the queue instead of
+ * copying them, and a reader whose buffer lines up with whole pages gets them
+ * remapped instead of copied.  The small sizes copy, for comparison.
+ *
+ * Before each write, the writer stamps every page of its buffer with that
+ * page's position in the stream, like it was producing new data, and the
+ * reader checks the stamps.  That write breaks the loan on any page the kernel
+ * still has, so the numbers include the cost of the copy-on-write. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <parlib.h>
+#include <iplib.h>
+#include <sys/time.h>
+
+static size_t sizes[] = {4096, 16384, 65536, 262144, 1048576};
+static size_t total;
+static size_t xfer_sz;
+static int bad_stamps;
+
+static unsigned long long usec_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000000ULL +
+	       (end.tv_usec - start->tv_usec);
+}
+
+static void print_rate(const char *name, unsigned long long usec)
+{
+	if (!usec)
+		usec = 1;
+	printf("%s: %7zu byte xfers, %zu MB in %llu usec, %llu MB/sec\n", name,
+	       xfer_sz, total >> 20, usec, total * 1000000ULL / usec >> 20);
+}
+
+static void *alloc_buf(void)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, PGSIZE, xfer_sz)) {
+		perror("posix_memalign");
+		exit(-1);
+	}
+	/* fault it in now; we can only lend pages that are there */
+	memset(buf, 0, xfer_sz);
+	return buf;
+}
+
+static void *writer(void *arg)
+{
+	int fd = (long)arg;
+	unsigned long *buf = alloc_buf();
+	unsigned long pg_idx = 0;
+
+	for (size_t sent = 0; sent < total; sent += xfer_sz) {
+		for (size_t off = 0; off < xfer_sz; off += PGSIZE)
+			buf[off / sizeof(unsigned long)] = pg_idx++;
+		if (write(fd, buf, xfer_sz) != xfer_sz) {
+			perror("write");
+			exit(-1);
+		}
+	}
+	free(buf);
+	return 0;
+}
+
+static void reader(int fd)
+{
+	unsigned long *buf = alloc_buf();
+	unsigned long pg_idx = 0;
+	size_t got;
+	ssize_t ret;
+
+	for (size_t rcvd = 0; rcvd < total; rcvd += xfer_sz) {
+		for (got = 0; got < xfer_sz; got += ret) {
+			ret = read(fd, (void*)buf + got, xfer_sz - got);
+			if (ret <= 0) {
+				perror("read");
+				exit(-1);
+			}
+		}
+		for (size_t off = 0; off < xfer_sz; off += PGSIZE) {
+			if (buf[off / sizeof(unsigned long)] != pg_idx++)
+				bad_stamps++;
+		}
+	}
+	free(buf);
+}
+
+static void run_pipe(void)
+{
+	int pipefd[2];
+	pthread_t wrt;
+	struct timeval start;
+
+	if (pipe(pipefd)) {
+		perror("pipe");
+		exit(-1);
+	}
+	gettimeofday(&start, 0);
+	pthread_create(&wrt, NULL, writer, (void*)(long)pipefd[1]);
+	reader(pipefd[0]);
+	pthread_join(wrt, NULL);
+	print_rate("Pipe", usec_since(&start));
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+
+static void run_tcp(int port)
+{
+	char addr[64], adir[40], ldir[40];
+	int afd, lcfd, dfd, cfd;
+	pthread_t wrt;
+	struct timeval start;
+
+	snprintf(addr, sizeof(addr), "tcp!*!%d", port);
+	afd = announce(addr, adir);
+	if (afd < 0) {
+		perror("announce");
+		exit(-1);
+	}
+	snprintf(addr, sizeof(addr), "tcp!127.0.0.1!%d", port);
+	cfd = dial(addr, 0, 0, 0);
+	if (cfd < 0) {
+		perror("dial");
+		exit(-1);
+	}
+	lcfd = listen(adir, ldir);
+	dfd = lcfd < 0 ? -1 : accept(lcfd, ldir);
+	if (dfd < 0) {
+		perror("listen/accept");
+		exit(-1);
+	}
+	gettimeofday(&start, 0);
+	pthread_create(&wrt, NULL, writer, (void*)(long)cfd);
+	reader(dfd);
+	pthread_join(wrt, NULL);
+	print_rate("TCP ", usec_since(&start));
+	close(cfd);
+	close(dfd);
+	close(lcfd);
+	close(afd);
+}
+
+int main(int argc, char **argv)
+{
+	int port = argc > 2 ? strtol(argv[2], 0, 10) : 5555;
+
+	total = (argc > 1 ? strtoul(argv[1], 0, 10) : 256) << 20;
+	if (!total) {
+		printf("Usage: %s [MB] [PORT]\n", argv[0]);
+		exit(-1);
+	}
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		xfer_sz = sizes[i];
+		total = total / xfer_sz * xfer_sz;
+		run_pipe();
+		run_tcp(port + i);	/* skip the last run's TIME_WAIT */
+	}
+	if (bad_stamps) {
+		printf("%d pages had the wrong contents!\n", bad_stamps);
+		exit(-1);
+	}
+	return 0;
+}
@@ -0,0 +1,115 @@
+/* Serves a file to one TCP client, either with sendfile() (zero-copy from the
+ * page cache) or with read() and write(), and prints the throughput.  Connect
+ * with something that discards the data, e.g. from linux:
+ *
+ * $ nc AKAROS_IP 8000 > /dev/null
+ *
+ * Usage: sendfile [FILE] [PORT] [NR_LOOPS] [copy]
+ *
+ * The file is sent NR_LOOPS times in a row.  The first pass pulls it into the
+ * page cache, so use a few loops to see the steady-state difference. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include <parlib.h>
+#include <iplib.h>
+
+#define COPY_BUF_SZ (64 * 1024)
+
+static char copy_buf[COPY_BUF_SZ];
+
+static ssize_t send_copy(int dfd, int ffd, size_t len)
+{
+	ssize_t sent = 0, n;
+
+	while (sent < len) {
+		n = read(ffd, copy_buf, COPY_BUF_SZ);
+		if (n <= 0)
+			break;
+		if (write(dfd, copy_buf, n) != n)
+			return -1;
+		sent += n;
+	}
+	return sent;
+}
+
+int main(int argc, char **argv)
+{
+	char *path = "/bin/busybox";
+	char *port = "8000";
+	int nr_loops = 4;
+	bool use_copy = FALSE;
+	char addr[64], adir[40], ldir[40];
+	int afd, lcfd, dfd, ffd;
+	struct stat st;
+	struct timeval start, end;
+	unsigned long long usec;
+	ssize_t ret;
+	off_t off;
+
+	if (argc > 1)
+		path = argv[1];
+	if (argc > 2)
+		port = argv[2];
+	if (argc > 3)
+		nr_loops = atoi(argv[3]);
+	if (argc > 4)
+		use_copy = !strcmp(argv[4], "copy");
+	ffd = open(path, O_RDONLY);
+	if (ffd < 0 || fstat(ffd, &st)) {
+		perror(path);
+		exit(-1);
+	}
+	snprintf(addr, sizeof(addr), "tcp!*!%s", port);
+	afd = announce(addr, adir);
+	if (afd < 0) {
+		perror("Announce failure");
+		exit(-1);
+	}
+	printf("Waiting for a connection on port %s\n", port);
+	lcfd = listen(adir, ldir);
+	if (lcfd < 0) {
+		perror("Listen failure");
+		exit(-1);
+	}
+	dfd = accept(lcfd, ldir);
+	if (dfd < 0) {
+		perror("Accept failure");
+		exit(-1);
+	}
+	for (int i = 0; i < nr_loops; i++) {
+		gettimeofday(&start, 0);
+		if (use_copy) {
+			lseek(ffd, 0, SEEK_SET);
+			ret = send_copy(dfd, ffd, st.st_size);
+		} else {
+			off = 0;
+			ret = sendfile(dfd, ffd, &off, st.st_size);
+		}
+		gettimeofday(&end, 0);
+		if (ret != st.st_size) {
+			printf("Short send: %ld of %ld bytes\n", ret, st.st_size);
+			perror("send");
+			break;
+		}
+		usec = (end.tv_sec - start.tv_sec) * 1000000ULL +
+		       (end.tv_usec - start.tv_usec);
+		if (!usec)
+			usec = 1;
+		printf("%s: %ld bytes in %llu usec, %llu MB/s\n",
+		       use_copy ? "read/write" : "sendfile", ret, usec,
+		       (unsigned long long)ret / usec);
+	}
+	close(dfd);
+	close(lcfd);
+	close(afd);
+	close(ffd);
+	return 0;
+}
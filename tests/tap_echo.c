@@ -0,0 +1,146 @@
+/* Single-threaded echo server, multiplexing its connections with FD taps.
+ *
+ * Usage: tap_echo [PORT]
+ *
+ * We tap the announced conv's ctl file to hear about incoming calls, and each
+ * connection's data file to hear when it is readable.  All of the taps post to
+ * one event queue that only we consume, and we never block except in read()s
+ * and write()s we know won't wait long.  Try it with a few 'nc HOST PORT's.
+ *
+ * The data taps are edge triggered, so we read everything there is when one
+ * fires.  Events for an FD can still be in the queue after we close it, so
+ * each connection gets a generation number, which we put in its tap's data, so
+ * we can tell stale events from ones for a new connection on the same FD. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <parlib.h>
+#include <event.h>
+#include <ucq.h>
+#include <iplib.h>
+
+#define EV_TAP				NR_EVENT_TYPES	/* our own event type */
+#define MAX_CONNS			1024
+#define EV_BATCH			32
+
+static char adir[40];
+static unsigned long conn_gen[MAX_CONNS];	/* 0 means no connection */
+static unsigned long next_gen = 1;
+static unsigned long nr_conns;
+static char buf[64 * 1024];
+
+static int tap_fd(struct event_queue *ev_q, int fd, int filter, void *data)
+{
+	struct fd_tap_req req = {0};
+
+	req.fd = fd;
+	req.cmd = FDTAP_CMD_ADD;
+	req.filter = filter;
+	req.ev_id = EV_TAP;
+	req.ev_q = ev_q;
+	req.data = data;
+	return sys_tap_fds(&req, 1) == 1 ? 0 : -1;
+}
+
+/* Accepts the call we were told about.  It's already waiting, so listen won't
+ * block. */
+static void new_conn(struct event_queue *ev_q)
+{
+	char ldir[40];
+	int lcfd, dfd;
+
+	lcfd = listen(adir, ldir);
+	if (lcfd < 0) {
+		perror("listen");
+		return;
+	}
+	dfd = accept(lcfd, ldir);
+	close(lcfd);
+	if (dfd < 0) {
+		perror("accept");
+		return;
+	}
+	if (dfd >= MAX_CONNS) {
+		printf("Too many connections, dropping FD %d\n", dfd);
+		close(dfd);
+		return;
+	}
+	conn_gen[dfd] = next_gen++;
+	if (tap_fd(ev_q, dfd, FDTAP_FILT_READABLE | FDTAP_FILT_EDGE,
+	           (void*)conn_gen[dfd])) {
+		perror("tap data");
+		conn_gen[dfd] = 0;
+		close(dfd);
+		return;
+	}
+	nr_conns++;
+	printf("Connection %lu on FD %d, %lu open\n", conn_gen[dfd], dfd,
+	       nr_conns);
+}
+
+static void close_conn(int fd)
+{
+	/* Closing the FD removes its tap */
+	close(fd);
+	conn_gen[fd] = 0;
+	nr_conns--;
+	printf("Closed FD %d, %lu open\n", fd, nr_conns);
+}
+
+static void handle_tap(struct event_queue *ev_q, struct event_msg *msg)
+{
+	int fd = msg->ev_arg4;
+	long ret;
+
+	if (!msg->ev_arg3) {
+		new_conn(ev_q);
+		return;
+	}
+	if ((fd >= MAX_CONNS) || (conn_gen[fd] != (unsigned long)msg->ev_arg3))
+		return;	/* stale */
+	ret = read(fd, buf, sizeof(buf));
+	if (ret <= 0) {
+		close_conn(fd);
+		return;
+	}
+	if (write(fd, buf, ret) != ret)
+		close_conn(fd);
+}
+
+int main(int argc, char **argv)
+{
+	char addr[64];
+	int afd, nr_msgs;
+	struct event_queue *ev_q;
+	struct ucq *ucq;
+	struct event_msg msgs[EV_BATCH];
+
+	snprintf(addr, sizeof(addr), "tcp!*!%s", argc > 1 ? argv[1] : "23");
+	afd = announce(addr, adir);
+	if (afd < 0) {
+		perror("announce");
+		exit(-1);
+	}
+	printf("Announced %s on %s\n", addr, adir);
+	/* Kernel messages only, which we poll for */
+	ev_q = get_big_event_q();
+	ev_q->ev_flags = 0;
+	ucq = &ev_q->ev_mbox->ev_msgs;
+	ucq_set_single_consumer(ucq);
+	/* Level triggered: one event per incoming call.  Data 0 means 'ctl' */
+	if (tap_fd(ev_q, afd, FDTAP_FILT_READABLE, 0)) {
+		perror("tap ctl");
+		exit(-1);
+	}
+	while (1) {
+		nr_msgs = get_ucq_msgs(ucq, msgs, EV_BATCH);
+		if (!nr_msgs) {
+			cpu_relax();
+			continue;
+		}
+		for (int i = 0; i < nr_msgs; i++)
+			handle_tap(ev_q, &msgs[i]);
+	}
+	return 0;
+}
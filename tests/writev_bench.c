@@ -0,0 +1,182 @@
+/* Scatter/gather write benchmark.
+ *
+ * Usage: writev_bench [NR_MSGS] [BODY_SZ] [PORT]
+ *
+ * Sends NR_MSGS messages, each a 64 byte header plus a BODY_SZ byte body, to a
+ * reader thread, over a pipe and then over TCP loopback (on PORT).  We send
+ * them three ways: a write() for the header and another for the body, copying
+ * both into one buffer and writing that (what glibc's writev used to do), and
+ * one writev().  Over TCP, writev hands the header and body to the conversation
+ * as one block, like the copy does, so they can go out in one segment. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <parlib.h>
+#include <iplib.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+
+#define HDR_SZ				64
+
+enum {
+	TWO_WRITES,
+	COPY_WRITE,
+	WRITEV,
+};
+
+static const char *method_names[] = {"2 writes", "copy+write", "writev"};
+static long nr_msgs = 100000;
+static size_t body_sz = 1024;
+static char hdr[HDR_SZ];
+static char *body, *copy_buf;
+
+static unsigned long long usec_since(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, 0);
+	return (end.tv_sec - start->tv_sec) * 1000000ULL +
+	       (end.tv_usec - start->tv_usec);
+}
+
+static void print_rate(const char *name, int method, unsigned long long usec)
+{
+	if (!usec)
+		usec = 1;
+	printf("%s %10s: %ld msgs in %llu usec, %llu nsec each, %llu MB/sec\n",
+	       name, method_names[method], nr_msgs, usec, usec * 1000 / nr_msgs,
+	       nr_msgs * (HDR_SZ + body_sz) * 1000000ULL / usec >> 20);
+}
+
+static void *reader(void *arg)
+{
+	int fd = (long)arg;
+	size_t total = nr_msgs * (HDR_SZ + body_sz);
+	char buf[16384];
+	ssize_t ret;
+
+	for (size_t got = 0; got < total; got += ret) {
+		ret = read(fd, buf, MIN(sizeof(buf), total - got));
+		if (ret <= 0) {
+			perror("read");
+			exit(-1);
+		}
+	}
+	return 0;
+}
+
+static void send_msgs(int fd, int method)
+{
+	struct iovec iov[2] = {{hdr, HDR_SZ}, {body, body_sz}};
+	size_t msg_sz = HDR_SZ + body_sz;
+	ssize_t ret;
+
+	for (long i = 0; i < nr_msgs; i++) {
+		switch (method) {
+		case TWO_WRITES:
+			ret = write(fd, hdr, HDR_SZ);
+			if (ret == HDR_SZ)
+				ret += write(fd, body, body_sz);
+			break;
+		case COPY_WRITE:
+			memcpy(copy_buf, hdr, HDR_SZ);
+			memcpy(copy_buf + HDR_SZ, body, body_sz);
+			ret = write(fd, copy_buf, msg_sz);
+			break;
+		case WRITEV:
+			ret = writev(fd, iov, 2);
+			break;
+		}
+		if (ret != msg_sz) {
+			perror("write");
+			exit(-1);
+		}
+	}
+}
+
+static void run_test(const char *name, int wfd, int rfd, int method)
+{
+	pthread_t rdr;
+	struct timeval start;
+
+	gettimeofday(&start, 0);
+	pthread_create(&rdr, NULL, reader, (void*)(long)rfd);
+	send_msgs(wfd, method);
+	pthread_join(rdr, NULL);
+	print_rate(name, method, usec_since(&start));
+}
+
+static void run_pipe(int method)
+{
+	int pipefd[2];
+
+	if (pipe(pipefd)) {
+		perror("pipe");
+		exit(-1);
+	}
+	run_test("Pipe", pipefd[1], pipefd[0], method);
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+
+static void run_tcp(int port, int method)
+{
+	char addr[64], adir[40], ldir[40];
+	int afd, lcfd, dfd, cfd;
+
+	snprintf(addr, sizeof(addr), "tcp!*!%d", port);
+	afd = announce(addr, adir);
+	if (afd < 0) {
+		perror("announce");
+		exit(-1);
+	}
+	snprintf(addr, sizeof(addr), "tcp!127.0.0.1!%d", port);
+	cfd = dial(addr, 0, 0, 0);
+	if (cfd < 0) {
+		perror("dial");
+		exit(-1);
+	}
+	lcfd = listen(adir, ldir);
+	dfd = lcfd < 0 ? -1 : accept(lcfd, ldir);
+	if (dfd < 0) {
+		perror("listen/accept");
+		exit(-1);
+	}
+	run_test("TCP ", cfd, dfd, method);
+	close(cfd);
+	close(dfd);
+	close(lcfd);
+	close(afd);
+}
+
+int main(int argc, char **argv)
+{
+	int port = 5555;
+
+	if (argc > 1)
+		nr_msgs = strtol(argv[1], 0, 10);
+	if (argc > 2)
+		body_sz = strtoul(argv[2], 0, 10);
+	if (argc > 3)
+		port = strtol(argv[3], 0, 10);
+	if ((nr_msgs <= 0) || !body_sz) {
+		printf("Usage: %s [NR_MSGS] [BODY_SZ] [PORT]\n", argv[0]);
+		exit(-1);
+	}
+	body = malloc(body_sz);
+	copy_buf = malloc(HDR_SZ + body_sz);
+	if (!body || !copy_buf) {
+		perror("malloc");
+		exit(-1);
+	}
+	memset(hdr, 'h', HDR_SZ);
+	memset(body, 'b', body_sz);
+	for (int i = TWO_WRITES; i <= WRITEV; i++)
+		run_pipe(i);
+	for (int i = TWO_WRITES; i <= WRITEV; i++)
+		run_tcp(port + i, i);	/* skip the last run's TIME_WAIT */
+	return 0;
+}
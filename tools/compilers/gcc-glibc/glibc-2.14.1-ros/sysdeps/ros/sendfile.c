@@ -0,0 +1,38 @@
+/* Copyright (C) 2014 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307 USA.  */
+
+#include <sys/sendfile.h>
+#include <sys/types.h>
+#include <ros/syscall.h>
+
+/* Send COUNT bytes from IN_FD (a file) to OUT_FD (e.g. a network conversation)
+   without copying them through userspace.  If OFFSET is not null, start at
+   *OFFSET and update it, instead of using IN_FD's file position.  */
+ssize_t
+sendfile (int out_fd, int in_fd, off_t *offset, size_t count)
+{
+  off64_t off64;
+  ssize_t ret;
+
+  if (!offset)
+    return ros_syscall(SYS_sendfile, out_fd, in_fd, 0, count, 0, 0);
+  off64 = *offset;
+  ret = ros_syscall(SYS_sendfile, out_fd, in_fd, &off64, count, 0, 0);
+  *offset = off64;
+  return ret;
+}
@@ -1,6 +1,8 @@
 #include <sys/vcore-tls.h>
 #include <vcore.h>
 #include <ldsodefs.h>
+#include <stdlib.h>
+#include <string.h>
 
 void set_tls_desc(void* addr, int vcoreid)
 {
@@ -37,13 +39,28 @@ void free_tls(void *tcb)
 	_dl_deallocate_tls(tcb, TRUE);
 }
 
-/* Reinitialize / reset / refresh a TLS to its initial values.  This doesn't do
- * it properly yet, it merely frees and re-allocates the TLS, which is why we're
- * slightly ghetto and return the pointer you should use for the TCB. */
+/* Reinitialize / reset / refresh a TLS to its initial values, in place.  Like
+ * NPTL does for its cached stacks, we free any dynamically allocated TLS
+ * blocks, clear the DTV, and reinit the static blocks from the TLS images.  We
+ * still return the pointer you should use for the TCB, in case this ever needs
+ * to reallocate. */
 void *reinit_tls(void *tcb)
 {
-	/* TODO: keep this in sync with the methods used in
-	 * allocate_transition_tls() */
-	free_tls(tcb);
-	return allocate_tls();
+	dtv_t *dtv = GET_DTV(tcb);
+
+	for (size_t i = 0; i < dtv[-1].counter; i++)
+		if (!dtv[1 + i].pointer.is_static
+		    && dtv[1 + i].pointer.val != TLS_DTV_UNALLOCATED)
+			free(dtv[1 + i].pointer.val);
+	memset(dtv, 0, (dtv[-1].counter + 1) * sizeof(dtv_t));
+	tcb = _dl_allocate_tls_init(tcb);
+	if (!tcb)
+		return 0;
+#ifdef TLS_TCB_AT_TP
+	/* Keep this in sync with allocate_tls() */
+	tcbhead_t *head = (tcbhead_t*)tcb;
+	head->tcb = tcb;
+	head->self = tcb;
+#endif
+	return tcb;
 }
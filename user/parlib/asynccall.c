@@ -17,18 +17,27 @@ async_desc_t* current_async_desc;
 
 struct arsc_channel global_ac;
 
-void init_arc(struct arsc_channel* ac)
+static void init_arc_pools(void)
+{
+	//TODO: eventually rethink about desc pools, they are here but no longer necessary
+	POOL_INIT(&syscall_desc_pool, MAX_SYSCALLS);
+	POOL_INIT(&async_desc_pool, MAX_ASYNCCALLS);
+}
+
+int init_arc(struct arsc_channel* ac)
 {
 	// Set up the front ring for the general syscall ring
 	// and the back ring for the general sysevent ring
 	mcs_lock_init(&ac->aclock);
-	ac->ring_page = (syscall_sring_t*)sys_init_arsc();
+	ac->ring_page = (syscall_sring_t*)sys_init_arsc(ac->ev_q);
+	if (!ac->ring_page)
+		return -1;
 
 	FRONT_RING_INIT(&ac->sysfr, ac->ring_page, SYSCALLRINGSIZE);
 	//BACK_RING_INIT(&syseventbackring, &(__procdata.syseventring), SYSEVENTRINGSIZE);
-	//TODO: eventually rethink about desc pools, they are here but no longer necessary
-	POOL_INIT(&syscall_desc_pool, MAX_SYSCALLS);
-	POOL_INIT(&async_desc_pool, MAX_ASYNCCALLS);
+	// Channels share the desc pools
+	run_once(init_arc_pools());
+	return 0;
 }
 
 // Wait on all syscalls within this async call.  TODO - timeout or something?
@@ -129,6 +138,8 @@ int async_syscall(arsc_channel_t* chan, syscall_req_t* req, syscall_desc_t** des
 	struct mcs_lock_qnode local_qn = {0};
 	mcs_lock_lock(&(chan->aclock), &local_qn);
 	if (RING_FULL(fr)) {
+		mcs_lock_unlock(&chan->aclock, &local_qn);
+		free(desc);
 		errno = EBUSY;
 		return -1;
 	}
@@ -172,8 +183,10 @@ syscall_desc_t* arc_call(long int num, ...)
   	p_sysc->arg5 = va_arg(vl,long int);
   	va_end(vl);
 	syscall_req_t arc = {REQ_alloc,NULL, NULL, p_sysc};
-	async_syscall(&SYS_CHANNEL, &arc, &desc);
-	printf ( "%d pushed at %p \n", desc);
+	if (async_syscall(&SYS_CHANNEL, &arc, &desc)) {
+		free(p_sysc);
+		return 0;
+	}
 	return desc;
 }
 
@@ -197,7 +210,6 @@ int waiton_syscall(syscall_desc_t* desc)
 		errno = EFAIL;
 		return -1;
 	}
-	printf("waiting %d\n", vcore_id());
 	syscall_rsp_t* rsp = RING_GET_RESPONSE(fr, desc->idx);
 
 	// ignoring the ring push response from the kernel side now
@@ -244,6 +244,11 @@ int handle_mbox(struct event_mbox *ev_mbox)
 	if (ev_mbox->ev_check_bits) {
 		do {
 			ev_mbox->ev_check_bits = TRUE;	/* in case we don't return */
+			/* Let EVENT_COALESCE senders alert us again.  The swap is a full
+			 * barrier: any sender that saw the old count set its bit before
+			 * counting, so we'll see its bit below. */
+			if (atomic_read(&ev_mbox->ev_nr_coalesced))
+				atomic_swap(&ev_mbox->ev_nr_coalesced, 0);
 			cmb();
 			BITMASK_FOREACH_SET(ev_mbox->ev_bitmap, MAX_NR_EVENT, bit_handler,
 			                    TRUE);
@@ -303,7 +308,12 @@ int handle_events(uint32_t vcoreid)
 }
 
 /* Handles the events on ev_q IAW the event_handlers[].  If the ev_q is
- * application specific, then this will dispatch/handle based on its flags. */
+ * application specific, then this will dispatch/handle based on its flags.
+ *
+ * EVENT_COALESCE ev_qs arrive as bits, and the kernel won't alert us again
+ * until handle_mbox() clears the mbox's coalesce count.  Handlers get a 0 msg
+ * once per burst, and need to go find out what happened.  JUSTHANDLEIT
+ * handlers for such ev_qs should drain with handle_mbox() too. */
 void handle_event_q(struct event_queue *ev_q)
 {
 	/* If the program wants to handle the ev_q on its own: */
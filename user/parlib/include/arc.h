@@ -15,11 +15,15 @@
 #include <ros/ring_syscall.h>
 #include <mcs.h>
 
+/* Each channel is its own ring in the kernel, and a process can have several.
+ * Set ev_q before init_arc() to get an EV_ARSC for each batch of completions
+ * (ev_arg2 is the number done, ev_arg3 the ring_page). */
 struct arsc_channel {
 	mcs_lock_t aclock;
 	syscall_sring_t* ring_page;
 	syscall_front_ring_t sysfr;
-}; 
+	struct event_queue *ev_q;
+};
 
 typedef struct arsc_channel arsc_channel_t;
 
@@ -74,8 +78,9 @@ POOL_TYPE_DEFINE(async_desc_t, async_desc_pool, MAX_ASYNCCALLS);
 extern syscall_desc_pool_t syscall_desc_pool;
 extern async_desc_pool_t async_desc_pool;
 
-/* Initialize front and back rings of syscall/event ring */
-void init_arc(struct arsc_channel* ac);
+/* Initialize front and back rings of syscall/event ring.  Returns -1 if the
+ * kernel couldn't give us a ring. */
+int init_arc(struct arsc_channel* ac);
 
 int async_syscall(arsc_channel_t* chan, syscall_req_t* req, syscall_desc_t** desc_ptr2);
 
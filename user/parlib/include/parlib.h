@@ -14,6 +14,8 @@
 #include <ros/syscall.h>
 #include <ros/procinfo.h>
 #include <ros/procdata.h>
+#include <ros/fdtap.h>
+#include <ros/netmap.h>
 #include <signal.h>
 #include <stdint.h>
 #include <errno.h>
@@ -50,13 +52,16 @@ int         sys_notify(int pid, unsigned int ev_type, struct event_msg *u_msg);
 int         sys_self_notify(uint32_t vcoreid, unsigned int ev_type,
                             struct event_msg *u_msg, bool priv);
 int         sys_halt_core(unsigned int usec);
-void*		sys_init_arsc();
+void*		sys_init_arsc(struct event_queue *ev_q);
 int         sys_block(unsigned int usec);
 int         sys_change_vcore(uint32_t vcoreid, bool enable_my_notif);
 int         sys_change_to_m(void);
 int         sys_poke_ksched(int pid, unsigned int res_type);
 int         sys_abort_sysc(struct syscall *sysc);
 int         sys_abort_sysc_fd(int fd);
+int         sys_tap_fds(struct fd_tap_req *tap_reqs, size_t nr_reqs);
+int         sys_netmap_reg(int fd, struct netmap_req *req);
+int         sys_netmap_sync(int fd, int qidx, int flags);
 
 long		syscall_async(struct syscall *sysc, unsigned long num, ...);
 
@@ -99,9 +99,9 @@ int sys_halt_core(unsigned int usec)
 	return ros_syscall(SYS_halt_core, usec, 0, 0, 0, 0, 0);
 }
 
-void* sys_init_arsc()
+void* sys_init_arsc(struct event_queue *ev_q)
 {
-	return (void*)ros_syscall(SYS_init_arsc, 0, 0, 0, 0, 0, 0);
+	return (void*)ros_syscall(SYS_init_arsc, ev_q, 0, 0, 0, 0, 0);
 }
 
 int sys_block(unsigned int usec)
@@ -173,6 +173,22 @@ int sys_abort_sysc_fd(int fd)
 	return ros_syscall(SYS_abort_sysc_fd, fd, 0, 0, 0, 0, 0);
 }
 
+/* Returns how many requests succeeded, or -1 if the first one failed. */
+int sys_tap_fds(struct fd_tap_req *tap_reqs, size_t nr_reqs)
+{
+	return ros_syscall(SYS_tap_fds, tap_reqs, nr_reqs, 0, 0, 0, 0);
+}
+
+int sys_netmap_reg(int fd, struct netmap_req *req)
+{
+	return ros_syscall(SYS_netmap_reg, fd, req, 0, 0, 0, 0);
+}
+
+int sys_netmap_sync(int fd, int qidx, int flags)
+{
+	return ros_syscall(SYS_netmap_sync, fd, qidx, flags, 0, 0, 0);
+}
+
 long syscall_async(struct syscall *sysc, unsigned long num, ...)
 {
 	va_list args;
@@ -31,6 +31,7 @@ void ucq_init_raw(struct ucq *ucq, uintptr_t pg1, uintptr_t pg2)
 	ucq->prod_overflow = FALSE;
 	atomic_set(&ucq->nr_extra_pgs, 0);
 	atomic_set(&ucq->spare_pg, pg2);
+	ucq->u_single_cons = FALSE;
 	static_assert(sizeof(struct spin_pdr_lock) <= sizeof(ucq->u_lock));
 	spin_pdr_init((struct spin_pdr_lock*)(&ucq->u_lock));
 	ucq->ucq_ready = TRUE;
@@ -59,101 +60,148 @@ void ucq_free_pgs(struct ucq *ucq)
 	munmap((void*)pg2, PGSIZE);
 }
 
-/* Consumer side, returns 0 on success and fills *msg with the ev_msg.  If the
- * ucq is empty, it will return -1. */
-int get_ucq_msg(struct ucq *ucq, struct event_msg *msg)
+/* Makes ucq single-consumer: only one thread or vcore will ever consume from
+ * it, such as a vcore's private mbox.  Consumers then skip the cons_idx CAS, the
+ * nr_cons counting, and the u_lock.  The kernel's side is unchanged.  Call this
+ * before anyone consumes. */
+void ucq_set_single_consumer(struct ucq *ucq)
+{
+	ucq->u_single_cons = TRUE;
+}
+
+/* Slow path for when cons_idx ran off the end of its page, and the ucq isn't
+ * empty.  Moves cons_idx to the next page and gives up the old one.  When we
+ * return, cons_idx is on a good slot (unless the ucq is overflowing again), and
+ * the caller should start over. */
+static void ucq_next_cons_page(struct ucq *ucq)
 {
 	uintptr_t my_idx;
 	struct ucq_page *old_page, *other_page;
-	struct msg_container *my_msg;
 	struct spin_pdr_lock *ucq_lock = (struct spin_pdr_lock*)(&ucq->u_lock);
+	bool single = ucq->u_single_cons;
+
+	if (!single)
+		spin_pdr_lock(ucq_lock);
+	/* Reread the idx, in case someone else fixed things up while we
+	 * were waiting/fighting for the lock */
+	my_idx = atomic_read(&ucq->cons_idx);
+	if (slot_is_good(my_idx)) {
+		/* Someone else fixed it already, let's just try to get out */
+		if (!single)
+			spin_pdr_unlock(ucq_lock);
+		return;
+	}
+	/* At this point, the slot is bad, and all other possible consumers are
+	 * spinning on the lock.  Time to fix things up: Set the counter to the
+	 * next page, and free the old one. */
+	/* First, we need to wait and make sure the kernel has posted the next
+	 * page.  Worst case, we know that the kernel is working on it, since
+	 * prod_idx != cons_idx */
+	old_page = (struct ucq_page*)PTE_ADDR(my_idx);
+	while (!old_page->header.cons_next_pg)
+		cpu_relax();
+	/* Now set the counter to the next page */
+	assert(!PGOFF(old_page->header.cons_next_pg));
+	atomic_set(&ucq->cons_idx, old_page->header.cons_next_pg);
+	/* Side note: at this point, any *new* consumers coming in will grab
+	 * slots based off the new counter index (cons_idx) */
+	/* Now free up the old page.  Need to make sure all other consumers are
+	 * done.  We spin til enough are done, like an inverted refcnt.  A single
+	 * consumer is the only one, and it is done. */
+	while (!single &&
+	       (atomic_read(&old_page->header.nr_cons) < NR_MSG_PER_PAGE)) {
+		/* spinning on userspace here, specifically, another vcore and we
+		 * don't know who it is.  This will spin a bit, then make sure they
+		 * aren't preeempted */
+		cpu_relax_vc(vcore_id());	/* pass in self to check everyone else*/
+	}
+	/* Now the page is done.  0 its metadata and give it up. */
+	old_page->header.cons_next_pg = 0;
+	atomic_set(&old_page->header.nr_cons, 0);
+	/* We want to "free" the page.  We'll try and set it as the spare.  If
+	 * there is already a spare, we'll free that one. */
+	other_page = (struct ucq_page*)atomic_swap(&ucq->spare_pg,
+	                                           (long)old_page);
+	assert(!PGOFF(other_page));
+	if (other_page) {
+		munmap(other_page, PGSIZE);
+		atomic_dec(&ucq->nr_extra_pgs);
+	}
+	/* All fixed up, unlock.  Other consumers may lock and check to make
+	 * sure things are done. */
+	if (!single)
+		spin_pdr_unlock(ucq_lock);
+}
+
+/* Consumer side, dequeues up to max messages into msgs, and returns how many
+ * it got.  0 means the ucq was empty.  We only take messages from one page, so
+ * we can claim all of them at once with one CAS on cons_idx (or none, for a
+ * single consumer).  Everything the producers reserved on that page will be
+ * written, so we can claim up to prod_idx, or the end of the page if prod_idx
+ * moved on. */
+int get_ucq_msgs(struct ucq *ucq, struct event_msg *msgs, int max)
+{
+	uintptr_t my_idx, prod_idx, end_idx;
+	struct ucq_page *my_page;
+	struct msg_container *my_msg;
+	int nr;
 
-	do {
-loop_top:
+	if (max <= 0)
+		return 0;
+	while (1) {
 		cmb();
 		my_idx = atomic_read(&ucq->cons_idx);
+		prod_idx = atomic_read(&ucq->prod_idx);
 		/* The ucq is empty if the consumer and producer are on the same 'next'
 		 * slot. */
-		if (my_idx == atomic_read(&ucq->prod_idx))
-			return -1;
+		if (my_idx == prod_idx)
+			return 0;
 		/* Is the slot we want good?  If not, we're going to need to try and
-		 * move on to the next page.  If it is, we bypass all of this and try to
-		 * CAS on us getting my_idx. */
-		if (slot_is_good(my_idx))
-			goto claim_slot;
-		/* Slot is bad, let's try and fix it */
-		spin_pdr_lock(ucq_lock);
-		/* Reread the idx, in case someone else fixed things up while we
-		 * were waiting/fighting for the lock */
-		my_idx = atomic_read(&ucq->cons_idx);
-		if (slot_is_good(my_idx)) {
-			/* Someone else fixed it already, let's just try to get out */
-			spin_pdr_unlock(ucq_lock);
-			/* Make sure this new slot has a producer (ucq isn't empty) */
-			if (my_idx == atomic_read(&ucq->prod_idx))
-				return -1;
-			goto claim_slot;
+		 * move on to the next page, then start over. */
+		if (!slot_is_good(my_idx)) {
+			ucq_next_cons_page(ucq);
+			continue;
 		}
-		/* At this point, the slot is bad, and all other possible consumers are
-		 * spinning on the lock.  Time to fix things up: Set the counter to the
-		 * next page, and free the old one. */
-		/* First, we need to wait and make sure the kernel has posted the next
-		 * page.  Worst case, we know that the kernel is working on it, since
-		 * prod_idx != cons_idx */
-		old_page = (struct ucq_page*)PTE_ADDR(my_idx);
-		while (!old_page->header.cons_next_pg)
-			cpu_relax();
-		/* Now set the counter to the next page */
-		assert(!PGOFF(old_page->header.cons_next_pg));
-		atomic_set(&ucq->cons_idx, old_page->header.cons_next_pg);
-		/* Side note: at this point, any *new* consumers coming in will grab
-		 * slots based off the new counter index (cons_idx) */
-		/* Now free up the old page.  Need to make sure all other consumers are
-		 * done.  We spin til enough are done, like an inverted refcnt. */
-		while (atomic_read(&old_page->header.nr_cons) < NR_MSG_PER_PAGE) {
-			/* spinning on userspace here, specifically, another vcore and we
-			 * don't know who it is.  This will spin a bit, then make sure they
-			 * aren't preeempted */
-			cpu_relax_vc(vcore_id());	/* pass in self to check everyone else*/
-		}
-		/* Now the page is done.  0 its metadata and give it up. */
-		old_page->header.cons_next_pg = 0;
-		atomic_set(&old_page->header.nr_cons, 0);
-		/* We want to "free" the page.  We'll try and set it as the spare.  If
-		 * there is already a spare, we'll free that one. */
-		other_page = (struct ucq_page*)atomic_swap(&ucq->spare_pg,
-		                                           (long)old_page);
-		assert(!PGOFF(other_page));
-		if (other_page) {
-			munmap(other_page, PGSIZE);
-			atomic_dec(&ucq->nr_extra_pgs);
+		end_idx = PTE_ADDR(my_idx) + NR_MSG_PER_PAGE;
+		if ((PTE_ADDR(prod_idx) == PTE_ADDR(my_idx)) && (prod_idx < end_idx))
+			end_idx = prod_idx;
+		nr = MIN(end_idx - my_idx, (uintptr_t)max);
+		if (ucq->u_single_cons) {
+			atomic_set(&ucq->cons_idx, my_idx + nr);
+			break;
 		}
-		/* All fixed up, unlock.  Other consumers may lock and check to make
-		 * sure things are done. */
-		spin_pdr_unlock(ucq_lock);
-		/* Now that everything is fixed, try again from the top */
-		goto loop_top;
-claim_slot:
-		cmb();	/* so we can goto claim_slot */
-		/* If we're still here, my_idx is good, and we'll try to claim it.  If
-		 * we fail, we need to repeat the whole process. */
-	} while (!atomic_cas(&ucq->cons_idx, my_idx, my_idx + 1));
-	assert(slot_is_good(my_idx));
-	/* Now we have a good slot that we can consume */
-	my_msg = slot2msg(my_idx);
-	/* linux would put an rmb_depends() here */
-	/* Wait til the msg is ready (kernel sets this flag) */
-	while (!my_msg->ready)
-		cpu_relax();
-	rmb();	/* order the ready read before the contents */
-	/* Copy out */
-	*msg = my_msg->ev_msg;
-	/* Unset this for the next usage of the container */
-	my_msg->ready = FALSE;
-	wmb();	/* post the ready write before incrementing */
-	/* Increment nr_cons, showing we're done */
-	atomic_inc(&((struct ucq_page*)PTE_ADDR(my_idx))->header.nr_cons);
-	return 0;
+		/* If we fail, someone else got some of them; start over. */
+		if (atomic_cas(&ucq->cons_idx, my_idx, my_idx + nr))
+			break;
+	}
+	/* Now we have a run of good slots that we can consume */
+	for (int i = 0; i < nr; i++) {
+		my_msg = slot2msg(my_idx + i);
+		/* linux would put an rmb_depends() here */
+		/* Wait til the msg is ready (kernel sets this flag) */
+		while (!my_msg->ready)
+			cpu_relax();
+		rmb();	/* order the ready read before the contents */
+		/* Copy out */
+		msgs[i] = my_msg->ev_msg;
+		/* Unset this for the next usage of the container */
+		my_msg->ready = FALSE;
+	}
+	/* Single consumers never wait on nr_cons.  Everyone else has to know we're
+	 * done with our slots before the page can be reused. */
+	if (!ucq->u_single_cons) {
+		wmb();	/* post the ready writes before incrementing */
+		my_page = (struct ucq_page*)PTE_ADDR(my_idx);
+		atomic_fetch_and_add(&my_page->header.nr_cons, nr);
+	}
+	return nr;
+}
+
+/* Consumer side, returns 0 on success and fills *msg with the ev_msg.  If the
+ * ucq is empty, it will return -1. */
+int get_ucq_msg(struct ucq *ucq, struct event_msg *msg)
+{
+	return get_ucq_msgs(ucq, msg, 1) ? 0 : -1;
 }
 
 bool ucq_is_empty(struct ucq *ucq)
@@ -4,7 +4,9 @@
 #include <vcore.h>
 #include <uthread.h>
 #include <event.h>
+#include <spinlock.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* Which operations we'll call for the 2LS.  Will change a bit with Lithe.  For
  * now, there are no defaults.  2LSs can override sched_ops. */
@@ -24,6 +26,22 @@ static int __uthread_reinit_tls(struct uthread *uthread);
 static void __uthread_free_tls(struct uthread *uthread);
 static void __run_current_uthread_raw(void);
 
+/* Recycled TLS regions, so short-lived uthreads don't pay for a fresh TLS.
+ * Each vcore keeps a few, and the rest go to a shared depot, since uthreads
+ * often exit on a different vcore than the one that made them. */
+#define UTH_TLS_CACHE_SZ 16
+#define UTH_TLS_DEPOT_SZ 128
+
+struct uth_tls_cache {
+	unsigned int				nr;
+	void						*descs[UTH_TLS_CACHE_SZ];
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+static struct uth_tls_cache *tls_caches;	/* per vcore, set in lib_init */
+static struct spin_pdr_lock tls_depot_lock = SPINPDR_INITIALIZER;
+static unsigned int tls_depot_nr;
+static void *tls_depot[UTH_TLS_DEPOT_SZ];
+
 static void handle_vc_preempt(struct event_msg *ev_msg, unsigned int ev_type,
                               void *data);
 static void handle_vc_indir(struct event_msg *ev_msg, unsigned int ev_type,
@@ -78,6 +96,11 @@ void uthread_lib_init(struct uthread *uthread)
 	init_once_racy(return);
 	vcore_init();
 	uthread_manage_thread0(uthread);
+	if (!posix_memalign((void**)&tls_caches, ARCH_CL_SIZE,
+	                    sizeof(struct uth_tls_cache) * max_vcores()))
+		memset(tls_caches, 0, sizeof(struct uth_tls_cache) * max_vcores());
+	else
+		tls_caches = 0;	/* no caching, just alloc and free */
 	register_ev_handler(EV_EVENT, handle_ev_ev, 0);
 	/* Receive preemption events.  Note that this merely tells the kernel how to
 	 * send the messages, and does not necessarily provide storage space for the
@@ -1025,11 +1048,64 @@ static inline bool __uthread_has_tls(struct uthread *uthread)
 	return uthread->tls_desc != UTH_TLSDESC_NOTLS;
 }
 
+/* TLS cache helpers.  The per-vcore caches are only touched with notifs
+ * disabled (or from vcore context), so we don't migrate mid-access. */
+static void *uth_tls_cache_get(void)
+{
+	struct uth_tls_cache *tc;
+	void *tls_desc = 0;
+
+	if (!tls_caches)
+		return 0;
+	uth_disable_notifs();
+	tc = &tls_caches[vcore_id()];
+	if (tc->nr)
+		tls_desc = tc->descs[--tc->nr];
+	uth_enable_notifs();
+	if (tls_desc)
+		return tls_desc;
+	spin_pdr_lock(&tls_depot_lock);
+	if (tls_depot_nr)
+		tls_desc = tls_depot[--tls_depot_nr];
+	spin_pdr_unlock(&tls_depot_lock);
+	return tls_desc;
+}
+
+/* Returns TRUE if we kept tls_desc for later */
+static bool uth_tls_cache_put(void *tls_desc)
+{
+	struct uth_tls_cache *tc;
+	bool kept = FALSE;
+
+	if (!tls_caches)
+		return FALSE;
+	uth_disable_notifs();
+	tc = &tls_caches[vcore_id()];
+	if (tc->nr < UTH_TLS_CACHE_SZ) {
+		tc->descs[tc->nr++] = tls_desc;
+		kept = TRUE;
+	}
+	uth_enable_notifs();
+	if (kept)
+		return TRUE;
+	spin_pdr_lock(&tls_depot_lock);
+	if (tls_depot_nr < UTH_TLS_DEPOT_SZ) {
+		tls_depot[tls_depot_nr++] = tls_desc;
+		kept = TRUE;
+	}
+	spin_pdr_unlock(&tls_depot_lock);
+	return kept;
+}
+
 /* TLS helpers */
 static int __uthread_allocate_tls(struct uthread *uthread)
 {
+	void *tls_desc;
+
 	assert(!uthread->tls_desc);
-	uthread->tls_desc = allocate_tls();
+	tls_desc = uth_tls_cache_get();
+	/* A recycled TLS still has the old uthread's values in it */
+	uthread->tls_desc = tls_desc ? reinit_tls(tls_desc) : allocate_tls();
 	if (!uthread->tls_desc) {
 		errno = ENOMEM;
 		return -1;
@@ -1049,6 +1125,7 @@ static int __uthread_reinit_tls(struct uthread *uthread)
 
 static void __uthread_free_tls(struct uthread *uthread)
 {
-	free_tls(uthread->tls_desc);
+	if (!uth_tls_cache_put(uthread->tls_desc))
+		free_tls(uthread->tls_desc);
 	uthread->tls_desc = NULL;
 }
@@ -108,6 +108,8 @@ void vcore_init(void)
 		ucq_init_raw(&vcpd_of(i)->ev_mbox_private.ev_msgs,
 		             mmap_block + (4 * i + 2) * PGSIZE,
 		             mmap_block + (4 * i + 3) * PGSIZE);
+		/* Only vcore i ever drains its private mbox */
+		ucq_set_single_consumer(&vcpd_of(i)->ev_mbox_private.ev_msgs);
 	}
 	atomic_init(&vc_req_being_handled, 0);
 	assert(!in_vcore_context());
@@ -7,13 +7,17 @@
 #include <stdio.h>
 #include <errno.h>
 #include <slab.h>
-#include <mcs.h>
+#include <spinlock.h>
 #include <alarm.h>
 
 static inline int futex_wake(int *uaddr, int count);
 static inline int futex_wait(int *uaddr, int val, uint64_t ms_timeout);
+static inline int futex_requeue(int *uaddr, int count, int *uaddr2,
+                                int nr_requeue, bool cmp, int val);
 static void *timer_thread(void *arg);
 
+struct futex_bucket;
+
 struct futex_element {
   TAILQ_ENTRY(futex_element) link;
   pthread_t pthread;
@@ -21,37 +25,87 @@ struct futex_element {
   uint64_t us_timeout;
   struct alarm_waiter awaiter;
   bool timedout;
+  // The bucket we're waiting in, or NULL once we've been taken off of it.
+  // Requeue can move us to another bucket, so only trust this while holding
+  // its lock.
+  struct futex_bucket *bucket;
 };
 TAILQ_HEAD(futex_queue, futex_element);
 
-struct futex_data {
-  struct mcs_pdr_lock lock;
+// Waiters are hashed by uaddr into buckets, each with its own lock, so that
+// wakes only look at (and contend with) waiters whose addresses collide.
+#define FUTEX_HASH_SHIFT 8
+#define NR_FUTEX_BUCKETS (1 << FUTEX_HASH_SHIFT)
+
+struct futex_bucket {
+  struct spin_pdr_lock lock;
   struct futex_queue queue;
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+struct futex_data {
+  struct futex_bucket buckets[NR_FUTEX_BUCKETS];
 };
 static struct futex_data __futex;
 
 static inline void futex_init()
 {
-  mcs_pdr_init(&__futex.lock);
-  TAILQ_INIT(&__futex.queue);
+  for (int i = 0; i < NR_FUTEX_BUCKETS; i++) {
+    spin_pdr_init(&__futex.buckets[i].lock);
+    TAILQ_INIT(&__futex.buckets[i].queue);
+  }
+}
+
+// Fibonacci hashing of the word address
+static struct futex_bucket *futex_hash(int *uaddr)
+{
+  uint32_t hash = (uint32_t)((uintptr_t)uaddr >> 2) * 0x9e3779b1U;
+  return &__futex.buckets[hash >> (32 - FUTEX_HASH_SHIFT)];
+}
+
+// Locks both buckets, in address order so two requeuers can't deadlock.
+static void futex_lock_two(struct futex_bucket *b1, struct futex_bucket *b2)
+{
+  if (b1 == b2) {
+    spin_pdr_lock(&b1->lock);
+  } else if (b1 < b2) {
+    spin_pdr_lock(&b1->lock);
+    spin_pdr_lock(&b2->lock);
+  } else {
+    spin_pdr_lock(&b2->lock);
+    spin_pdr_lock(&b1->lock);
+  }
+}
+
+static void futex_unlock_two(struct futex_bucket *b1, struct futex_bucket *b2)
+{
+  spin_pdr_unlock(&b1->lock);
+  if (b1 != b2)
+    spin_pdr_unlock(&b2->lock);
 }
 
 static void __futex_timeout(struct alarm_waiter *awaiter) {
-  struct futex_element *__e = NULL;
   struct futex_element *e = (struct futex_element*)awaiter->data;
+  struct futex_bucket *b;
+  bool removed = false;
   //printf("timeout fired: %p\n", e->uaddr);
 
-  // Atomically remove the timed-out element from the futex queue if we won the
-  // race against actually completing.
-  mcs_pdr_lock(&__futex.lock);
-  TAILQ_FOREACH(__e, &__futex.queue, link)
-    if (__e == e) break;
-  if (__e != NULL)
-    TAILQ_REMOVE(&__futex.queue, e, link);
-  mcs_pdr_unlock(&__futex.lock);
+  // Atomically remove the timed-out element from its bucket if we won the
+  // race against actually completing.  A requeue could move e while we wait
+  // for the lock, so make sure we locked the bucket e is still in.
+  while ((b = ACCESS_ONCE(e->bucket))) {
+    spin_pdr_lock(&b->lock);
+    if (e->bucket == b) {
+      TAILQ_REMOVE(&b->queue, e, link);
+      e->bucket = NULL;
+      removed = true;
+      spin_pdr_unlock(&b->lock);
+      break;
+    }
+    spin_pdr_unlock(&b->lock);
+  }
 
   // If we removed it, restart it outside the lock
-  if (__e != NULL) {
+  if (removed) {
     e->timedout = true;
     //printf("timeout: %p\n", e->uaddr);
     uthread_runnable((struct uthread*)e->pthread);
@@ -67,13 +121,14 @@ static void __futex_timeout(struct alarm_waiter *awaiter) {
 static void __futex_block(struct uthread *uthread, void *arg) {
   pthread_t pthread = (pthread_t)uthread;
   struct futex_element *e = (struct futex_element*)arg;
+  struct futex_bucket *b = e->bucket;
 
   // Set the remaining properties of the futex element
   e->pthread = pthread;
   e->timedout = false;
 
-  // Insert the futex element into the queue
-  TAILQ_INSERT_TAIL(&__futex.queue, e, link);
+  // Insert the futex element into its bucket
+  TAILQ_INSERT_TAIL(&b->queue, e, link);
 
   // Set an alarm for the futex timeout if applicable
   if(e->us_timeout != (uint64_t)-1) {
@@ -88,14 +143,16 @@ static void __futex_block(struct uthread *uthread, void *arg) {
   __pthread_generic_yield(pthread);
   pthread->state = PTH_BLK_MUTEX;
 
-  // Unlock the pdr_lock 
-  mcs_pdr_unlock(&__futex.lock);
+  // Unlock the bucket.  Once we do, a waker can run us.
+  spin_pdr_unlock(&b->lock);
 }
 
 static inline int futex_wait(int *uaddr, int val, uint64_t us_timeout)
 {
+  struct futex_bucket *b = futex_hash(uaddr);
+
   // Atomically do the following...
-  mcs_pdr_lock(&__futex.lock);
+  spin_pdr_lock(&b->lock);
   // If the value of *uaddr matches val
   if(*uaddr == val) {
     //printf("wait: %p, %d\n", uaddr, us_timeout);
@@ -103,9 +160,10 @@ static inline int futex_wait(int *uaddr, int val, uint64_t us_timeout)
     struct futex_element e;
     e.uaddr = uaddr;
     e.us_timeout = us_timeout;
+    e.bucket = b;
     // Yield the uthread...
     // We set the remaining properties of the futex element, set the timeout
-    // timer, and unlock the pdr lock on the other side.  It is important that
+    // timer, and unlock the bucket on the other side.  It is important that
     // we do the unlock on the other side, because (unlike linux, etc.) its
     // possible to get interrupted and drop into vcore context right after
     // releasing the lock.  If that vcore code then calls futex_wake(), we
@@ -128,40 +186,40 @@ static inline int futex_wait(int *uaddr, int val, uint64_t us_timeout)
       return -1;
     }
   } else {
-      mcs_pdr_unlock(&__futex.lock);
+      spin_pdr_unlock(&b->lock);
   }
   return 0;
 }
 
-static inline int futex_wake(int *uaddr, int count)
+// Takes up to count waiters on uaddr out of b and puts them on q.  Returns how
+// many it took.  Hold b's lock.
+static int __futex_take(struct futex_bucket *b, int *uaddr, int count,
+                        struct futex_queue *q)
 {
-  int max = count;
-  struct futex_element *e,*n = NULL;
-  struct futex_queue q = TAILQ_HEAD_INITIALIZER(q);
+  struct futex_element *e, *n;
+  int taken = 0;
 
-  // Atomically grab all relevant futex blockers
-  // from the global futex queue
-  mcs_pdr_lock(&__futex.lock);
-  e = TAILQ_FIRST(&__futex.queue);
-  while(e != NULL) {
-    if(count > 0) {
-      n = TAILQ_NEXT(e, link);
-      if(e->uaddr == uaddr) {
-        TAILQ_REMOVE(&__futex.queue, e, link);
-        TAILQ_INSERT_TAIL(&q, e, link);
-        count--;
-      }
-      e = n;
-    }
-    else break;
+  for (e = TAILQ_FIRST(&b->queue); e && (taken < count); e = n) {
+    n = TAILQ_NEXT(e, link);
+    if (e->uaddr != uaddr)
+      continue;
+    TAILQ_REMOVE(&b->queue, e, link);
+    e->bucket = NULL;
+    TAILQ_INSERT_TAIL(q, e, link);
+    taken++;
   }
-  mcs_pdr_unlock(&__futex.lock);
+  return taken;
+}
 
-  // Unblock them outside the lock
-  e = TAILQ_FIRST(&q);
+// Runs everyone on q.  Call this outside the bucket locks.
+static void __futex_run_all(struct futex_queue *q)
+{
+  struct futex_element *e, *n;
+
+  e = TAILQ_FIRST(q);
   while(e != NULL) {
     n = TAILQ_NEXT(e, link);
-    TAILQ_REMOVE(&q, e, link);
+    TAILQ_REMOVE(q, e, link);
     // Cancel the timeout if one was set
     if(e->us_timeout != (uint64_t)-1) {
       // Try and unset the alarm.  If this fails, then we have already
@@ -169,7 +227,7 @@ static inline int futex_wake(int *uaddr, int count)
       // set awaiter->data to NULL so that the bottom half of wake can
       // proceed. Either we set awaiter->data to NULL or __futex_timeout
       // does. The fact that we made it here though, means that WE are the
-      // one who removed e from the queue, so we are basically just
+      // one who removed e from its bucket, so we are basically just
       // deciding who should set awaiter->data to NULL to indicate that
       // there are no more references to it.
       if(unset_alarm(&e->awaiter)) {
@@ -177,11 +235,62 @@ static inline int futex_wake(int *uaddr, int count)
         e->awaiter.data = NULL;
       }
     }
-    //printf("wake: %p\n", uaddr);
+    //printf("wake: %p\n", e->uaddr);
     uthread_runnable((struct uthread*)e->pthread);
     e = n;
   }
-  return max-count;
+}
+
+static inline int futex_wake(int *uaddr, int count)
+{
+  struct futex_bucket *b = futex_hash(uaddr);
+  struct futex_queue q = TAILQ_HEAD_INITIALIZER(q);
+  int woken;
+
+  // Atomically grab all relevant futex blockers from uaddr's bucket
+  spin_pdr_lock(&b->lock);
+  woken = __futex_take(b, uaddr, count, &q);
+  spin_pdr_unlock(&b->lock);
+  // Unblock them outside the lock
+  __futex_run_all(&q);
+  return woken;
+}
+
+// Wakes up to count waiters on uaddr, and moves up to nr_requeue more over to
+// wait on uaddr2, without waking them.  With cmp, only does this if *uaddr is
+// still val.  Returns the number woken plus the number moved.
+static inline int futex_requeue(int *uaddr, int count, int *uaddr2,
+                                int nr_requeue, bool cmp, int val)
+{
+  struct futex_bucket *b1 = futex_hash(uaddr);
+  struct futex_bucket *b2 = futex_hash(uaddr2);
+  struct futex_queue q = TAILQ_HEAD_INITIALIZER(q);
+  struct futex_element *e, *n;
+  int woken, moved = 0;
+
+  futex_lock_two(b1, b2);
+  if (cmp && (*uaddr != val)) {
+    futex_unlock_two(b1, b2);
+    errno = EAGAIN;
+    return -1;
+  }
+  woken = __futex_take(b1, uaddr, count, &q);
+  for (e = TAILQ_FIRST(&b1->queue); e && (moved < nr_requeue); e = n) {
+    n = TAILQ_NEXT(e, link);
+    if (e->uaddr != uaddr)
+      continue;
+    e->uaddr = uaddr2;
+    moved++;
+    // Staying in the same bucket, just for a different address
+    if (b1 == b2)
+      continue;
+    TAILQ_REMOVE(&b1->queue, e, link);
+    TAILQ_INSERT_TAIL(&b2->queue, e, link);
+    e->bucket = b2;
+  }
+  futex_unlock_two(b1, b2);
+  __futex_run_all(&q);
+  return woken + moved;
 }
 
 int futex(int *uaddr, int op, int val,
@@ -190,23 +299,27 @@ int futex(int *uaddr, int op, int val,
 {
   // Round to the nearest micro-second
   uint64_t us_timeout = (uint64_t)-1;
-  assert(uaddr2 == NULL);
-  assert(val3 == 0);
-  if(timeout != NULL) {
-    us_timeout = timeout->tv_sec*1000000L + timeout->tv_nsec/1000L;
-    assert(us_timeout > 0);
-  }
 
   run_once(futex_init());
   switch(op) {
     case FUTEX_WAIT:
+      assert(uaddr2 == NULL);
+      assert(val3 == 0);
+      if(timeout != NULL) {
+        us_timeout = timeout->tv_sec*1000000L + timeout->tv_nsec/1000L;
+        assert(us_timeout > 0);
+      }
       return futex_wait(uaddr, val, us_timeout);
     case FUTEX_WAKE:
       return futex_wake(uaddr, val);
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE:
+      // Like Linux, the timeout argument carries the number to requeue
+      return futex_requeue(uaddr, val, uaddr2, (int)(long)timeout,
+                           op == FUTEX_CMP_REQUEUE, val3);
     default:
       errno = ENOSYS;
       return -1;
   }
   return -1;
 }
-
@@ -5,9 +5,16 @@
 
 enum {
 	FUTEX_WAIT,
-	FUTEX_WAKE
+	FUTEX_WAKE,
+	FUTEX_REQUEUE,
+	FUTEX_CMP_REQUEUE
 };
 
+/* For the REQUEUE ops, val is how many waiters on uaddr to wake, and the rest
+ * (up to the number passed as the timeout pointer, like on Linux) move over to
+ * wait on uaddr2.  CMP_REQUEUE fails with EAGAIN unless *uaddr == val3.
+ * Returns how many were woken plus how many were moved. */
+
 int futex(int *uaddr, int op, int val, const struct timespec *timeout,
           int *uaddr2, int val3);
 
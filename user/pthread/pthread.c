@@ -32,6 +32,26 @@ bool need_tls = TRUE;
  * overflow.  Init'd in pth_init(). */
 struct sysc_mgmt *sysc_mgmt = 0;
 
+/* Recycled thread stacks.  Stacks come in power-of-two size classes, starting
+ * at PTHREAD_STACK_SIZE, so any cached stack fits anyone in its class.  Each
+ * vcore caches a few per class, and the rest go to a shared depot.  Bigger
+ * stacks aren't cached.  Every stack has a guard page below it. */
+#define PTH_STACK_NR_CLASSES 4
+#define PTH_STACK_CACHE_SZ 8
+#define PTH_STACK_DEPOT_SZ 64
+
+struct pth_stack_cache {
+	unsigned int				nr[PTH_STACK_NR_CLASSES];
+	void						*stackbots[PTH_STACK_NR_CLASSES]
+	                                      [PTH_STACK_CACHE_SZ];
+} __attribute__((aligned(ARCH_CL_SIZE)));
+
+/* Array of per-vcore stack caches.  Init'd in pthread_lib_init(). */
+static struct pth_stack_cache *stack_caches = 0;
+static struct spin_pdr_lock stack_depot_lock = SPINPDR_INITIALIZER;
+static unsigned int stack_depot_nr[PTH_STACK_NR_CLASSES];
+static void *stack_depot[PTH_STACK_NR_CLASSES][PTH_STACK_DEPOT_SZ];
+
 /* Helper / local functions */
 static int get_next_pid(void);
 static inline void spin_to_sleep(unsigned int spins, unsigned int *spun);
@@ -245,6 +265,9 @@ void __attribute__((noreturn)) pth_sched_entry(void)
 			vcore_yield(FALSE);
 	} while (1);
 	assert(new_thread->state == PTH_RUNNABLE);
+	/* Lock spinners look at these to see if we're still on a core */
+	new_thread->vcoreid = vcoreid;
+	new_thread->state = PTH_RUNNING;
 	/* Prep the pthread to run any pending posix signal handlers registered
      * via pthread_kill once it is restored. */
 	__pthread_prep_for_pending_posix_signals(new_thread);
@@ -508,21 +531,110 @@ int pthread_attr_destroy(pthread_attr_t *a)
 	return 0;
 }
 
+/* Returns the size class for a stack of stacksize, or -1 if it's too big */
+static int stack_size_class(size_t stacksize)
+{
+	for (int i = 0; i < PTH_STACK_NR_CLASSES; i++)
+		if (stacksize <= (PTHREAD_STACK_SIZE << i))
+			return i;
+	return -1;
+}
+
+/* Stack cache helpers.  The per-vcore caches are only touched with notifs
+ * disabled (or from vcore context), so we don't migrate mid-access. */
+static void *stack_cache_get(int class)
+{
+	struct pth_stack_cache *sc;
+	void *stackbot = 0;
+
+	if (!stack_caches)
+		return 0;
+	uth_disable_notifs();
+	sc = &stack_caches[vcore_id()];
+	if (sc->nr[class])
+		stackbot = sc->stackbots[class][--sc->nr[class]];
+	uth_enable_notifs();
+	if (stackbot)
+		return stackbot;
+	spin_pdr_lock(&stack_depot_lock);
+	if (stack_depot_nr[class])
+		stackbot = stack_depot[class][--stack_depot_nr[class]];
+	spin_pdr_unlock(&stack_depot_lock);
+	return stackbot;
+}
+
+/* Returns TRUE if we kept stackbot for later */
+static bool stack_cache_put(int class, void *stackbot)
+{
+	struct pth_stack_cache *sc;
+	bool kept = FALSE;
+
+	if (!stack_caches)
+		return FALSE;
+	uth_disable_notifs();
+	sc = &stack_caches[vcore_id()];
+	if (sc->nr[class] < PTH_STACK_CACHE_SZ) {
+		sc->stackbots[class][sc->nr[class]++] = stackbot;
+		kept = TRUE;
+	}
+	uth_enable_notifs();
+	if (kept)
+		return TRUE;
+	spin_pdr_lock(&stack_depot_lock);
+	if (stack_depot_nr[class] < PTH_STACK_DEPOT_SZ) {
+		stack_depot[class][stack_depot_nr[class]++] = stackbot;
+		kept = TRUE;
+	}
+	spin_pdr_unlock(&stack_depot_lock);
+	return kept;
+}
+
 static void __pthread_free_stack(struct pthread_tcb *pt)
 {
-	int ret = munmap(pt->stacktop - pt->stacksize, pt->stacksize);
+	void *stackbot = pt->stacktop - pt->stacksize;
+	int class, ret;
+
+	/* thread0's stack came from the kernel, without a guard page */
+	if (pt->uthread.flags & UTHREAD_IS_THREAD0) {
+		ret = munmap(stackbot, pt->stacksize);
+		assert(!ret);
+		return;
+	}
+	class = stack_size_class(pt->stacksize);
+	if ((class >= 0) && stack_cache_put(class, stackbot))
+		return;
+	ret = munmap(stackbot - PGSIZE, pt->stacksize + PGSIZE);
 	assert(!ret);
 }
 
 static int __pthread_allocate_stack(struct pthread_tcb *pt)
 {
+	int class;
+	void *stackbot;
+
 	assert(pt->stacksize);
-	void* stackbot = mmap(0, pt->stacksize,
-	                      PROT_READ|PROT_WRITE|PROT_EXEC,
-	                      MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
+	class = stack_size_class(pt->stacksize);
+	if (class >= 0) {
+		pt->stacksize = PTHREAD_STACK_SIZE << class;
+		stackbot = stack_cache_get(class);
+		if (stackbot) {
+			pt->stacktop = stackbot + pt->stacksize;
+			return 0;
+		}
+	} else {
+		pt->stacksize = ROUNDUP(pt->stacksize, PGSIZE);
+	}
+	stackbot = mmap(0, pt->stacksize + PGSIZE,
+	                PROT_READ|PROT_WRITE|PROT_EXEC,
+	                MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
 	if (stackbot == MAP_FAILED)
 		return -1; // errno set by mmap
-	pt->stacktop = stackbot + pt->stacksize;
+	/* Catch overflows instead of scribbling on whatever is below us */
+	if (mprotect(stackbot, PGSIZE, PROT_NONE)) {
+		munmap(stackbot, pt->stacksize + PGSIZE);
+		return -1;
+	}
+	pt->stacktop = stackbot + PGSIZE + pt->stacksize;
 	return 0;
 }
 
@@ -590,6 +702,11 @@ void pthread_lib_init(void)
 	/* Set up the per-vcore structs to track outstanding syscalls */
 	sysc_mgmt = malloc(sizeof(struct sysc_mgmt) * max_vcores());
 	assert(sysc_mgmt);
+	/* Set up the per-vcore stack caches */
+	ret = posix_memalign((void**)&stack_caches, ARCH_CL_SIZE,
+	                     sizeof(struct pth_stack_cache) * max_vcores());
+	assert(!ret);
+	memset(stack_caches, 0, sizeof(struct pth_stack_cache) * max_vcores());
 #if 1   /* Independent ev_mboxes per vcore */
 	/* Get a block of pages for our per-vcore (but non-VCPD) ev_qs */
 	mmap_block = (uintptr_t)mmap(0, PGSIZE * 2 * max_vcores(),
@@ -851,6 +968,9 @@ int pthread_mutex_init(pthread_mutex_t* m, const pthread_mutexattr_t* attr)
 {
   m->attr = attr;
   atomic_init(&m->lock, 0);
+  m->owner = 0;
+  spin_pdr_init(&m->wait_lock);
+  TAILQ_INIT(&m->waiters);
   return 0;
 }
 
@@ -882,31 +1002,128 @@ static inline void spin_to_sleep(unsigned int spins, unsigned int *spun)
 	}
 }
 
-int pthread_mutex_lock(pthread_mutex_t* m)
+/* Statically initialized mutexes have a zeroed waiters queue.  Hold the
+ * wait_lock. */
+static void __mutex_waiters_init(pthread_mutex_t *m)
 {
-	unsigned int spinner = 0;
-	while(pthread_mutex_trylock(m))
-		while(*(volatile size_t*)&m->lock) {
-			cpu_relax();
-			spin_to_sleep(PTHREAD_MUTEX_SPINS, &spinner);
+	if (!m->waiters.tqh_last)
+		TAILQ_INIT(&m->waiters);
+}
+
+/* Returns TRUE if owner is running on a vcore that is on a pcore, meaning it is
+ * likely to unlock soon.  The owner could unlock and exit while we look, but
+ * pthread_tcbs are only freed back to malloc, so these reads are harmless, and
+ * the caller rechecks m->owner. */
+static bool mutex_owner_running(struct pthread_tcb *owner)
+{
+	uint32_t vcoreid;
+
+	if (ACCESS_ONCE(owner->state) != PTH_RUNNING)
+		return FALSE;
+	vcoreid = ACCESS_ONCE(owner->vcoreid);
+	return vcore_is_mapped(vcoreid) && !vcore_is_preempted(vcoreid);
+}
+
+/* Spins while the lock is held and spinning looks like it will pay off: the
+ * owner is running, and we haven't spun too long.  When we don't know the
+ * owner yet (it just locked), we give it a short grace period.  Returns TRUE if
+ * the lock looked free when we stopped. */
+static bool mutex_adaptive_spin(pthread_mutex_t *m)
+{
+	struct pthread_tcb *owner;
+	unsigned int spins = 0;
+
+	while (atomic_read(&m->lock)) {
+		owner = ACCESS_ONCE(m->owner);
+		if (owner) {
+			if (!mutex_owner_running(owner))
+				return FALSE;
+			if (spins++ >= PTHREAD_MUTEX_MAX_SPINS)
+				return FALSE;
+		} else if (spins++ >= PTHREAD_MUTEX_SPINS) {
+			return FALSE;
+		}
+		/* Our own vcore is going away, so don't hold it with a spin */
+		if (in_multi_mode() && __preempt_is_pending(vcore_id()))
+			return FALSE;
+		cpu_relax();
+	}
+	return TRUE;
+}
+
+/* Callback/bottom half of blocking on a mutex.  We still hold the wait_lock,
+ * which the unlocker needs to find us, so we can't miss our wakeup. */
+static void __pth_mutex_block_cb(struct uthread *uthread, void *arg)
+{
+	struct pthread_tcb *pthread = (struct pthread_tcb*)uthread;
+	pthread_mutex_t *m = (pthread_mutex_t*)arg;
+
+	__pthread_generic_yield(pthread);
+	pthread->state = PTH_BLK_MUTEX;
+	TAILQ_INSERT_TAIL(&m->waiters, pthread, next);
+	spin_pdr_unlock(&m->wait_lock);
+}
+
+/* Acquires m, leaving it marked as contended.  Anyone who has slept on m, or
+ * been moved onto it by a cond broadcast, must come back through here, since
+ * others may still be waiting behind them. */
+static void __pthread_mutex_lock_slow(pthread_mutex_t *m)
+{
+	while (1) {
+		if (mutex_adaptive_spin(m) && atomic_cas(&m->lock, 0, 2))
+			break;
+		spin_pdr_lock(&m->wait_lock);
+		if (atomic_swap(&m->lock, 2) == 0) {
+			spin_pdr_unlock(&m->wait_lock);
+			break;
 		}
-	/* normally we'd need a wmb() and a wrmb() after locking, but the
-	 * atomic_swap handles the CPU mb(), so just a cmb() is necessary. */
+		__mutex_waiters_init(m);
+		/* Unlocks the wait_lock on the other side */
+		uthread_yield(TRUE, __pth_mutex_block_cb, m);
+	}
+	m->owner = pthread_self();
+}
+
+int pthread_mutex_lock(pthread_mutex_t* m)
+{
+	/* The atomics handle the CPU mb(), so just a cmb() is necessary. */
+	if (atomic_cas(&m->lock, 0, 1)) {
+		m->owner = pthread_self();
+		cmb();
+		return 0;
+	}
+	__pthread_mutex_lock_slow(m);
 	cmb();
 	return 0;
 }
 
 int pthread_mutex_trylock(pthread_mutex_t* m)
 {
-  return atomic_swap(&m->lock, 1) == 0 ? 0 : EBUSY;
+  if (!atomic_cas(&m->lock, 0, 1))
+    return EBUSY;
+  m->owner = pthread_self();
+  return 0;
 }
 
 int pthread_mutex_unlock(pthread_mutex_t* m)
 {
+  struct pthread_tcb *pthread;
+
+  m->owner = 0;
   /* keep reads and writes inside the protected region */
   rwmb();
   wmb();
-  atomic_set(&m->lock, 0);
+  if (atomic_swap(&m->lock, 0) != 2)
+    return 0;
+  /* Someone may be asleep.  Wake one; it'll compete for the lock, and mark it
+   * contended again if there are more behind it. */
+  spin_pdr_lock(&m->wait_lock);
+  pthread = TAILQ_FIRST(&m->waiters);
+  if (pthread)
+    TAILQ_REMOVE(&m->waiters, pthread, next);
+  spin_pdr_unlock(&m->wait_lock);
+  if (pthread)
+    pth_thread_runnable((struct uthread*)pthread);
   return 0;
 }
 
@@ -919,6 +1136,7 @@ int pthread_cond_init(pthread_cond_t *c, const pthread_condattr_t *a)
 {
 	TAILQ_INIT(&c->waiters);
 	spin_pdr_init(&c->spdr_lock);
+	c->mutex = 0;
 	if (a) {
 		c->attr_pshared = a->pshared;
 		c->attr_clock = a->clock;
@@ -934,29 +1152,35 @@ int pthread_cond_destroy(pthread_cond_t *c)
 	return 0;
 }
 
+/* Wakes the first waiter and moves the rest onto the mutex's waiters (wait
+ * morphing).  They'd only wake up to sleep again on the mutex, which the first
+ * one is about to grab.  The first one reacquires with the mutex marked
+ * contended, so its unlock will pass the mutex down the line. */
 int pthread_cond_broadcast(pthread_cond_t *c)
 {
-	unsigned int nr_woken = 0;	/* assuming less than 4 bil threads */
 	struct pthread_queue restartees = TAILQ_HEAD_INITIALIZER(restartees);
-	struct pthread_tcb *pthread_i;
+	struct pthread_tcb *first;
+	pthread_mutex_t *m;
+
 	spin_pdr_lock(&c->spdr_lock);
 	/* moves all items from waiters onto the end of restartees */
-	TAILQ_CONCAT(&restartees, &c->waiters, next);
+	if (c->waiters.tqh_last)
+		TAILQ_CONCAT(&restartees, &c->waiters, next);
+	m = c->mutex;
 	spin_pdr_unlock(&c->spdr_lock);
-	/* Do the work of pth_thread_runnable().  We're in uth context here, but I
-	 * think it's okay.  When we need to (when locking) we drop into VC ctx, as
-	 * far as the kernel and other cores are concerned. */
-	TAILQ_FOREACH(pthread_i, &restartees, next) {
-		pthread_i->state = PTH_RUNNABLE;
-		nr_woken++;
+	first = TAILQ_FIRST(&restartees);
+	if (!first)
+		return 0;
+	TAILQ_REMOVE(&restartees, first, next);
+	if (!TAILQ_EMPTY(&restartees)) {
+		/* They are still PTH_BLK_MUTEX, off the active list, so this is just
+		 * like they blocked on m themselves. */
+		spin_pdr_lock(&m->wait_lock);
+		__mutex_waiters_init(m);
+		TAILQ_CONCAT(&m->waiters, &restartees, next);
+		spin_pdr_unlock(&m->wait_lock);
 	}
-	/* Amortize the lock grabbing over all restartees */
-	mcs_pdr_lock(&queue_lock);
-	threads_ready += nr_woken;
-	TAILQ_CONCAT(&ready_queue, &restartees, next);
-	mcs_pdr_unlock(&queue_lock);
-	if (can_adjust_vcores)
-		vcore_request(threads_ready);
+	pth_thread_runnable((struct uthread*)first);
 	return 0;
 }
 
@@ -995,7 +1219,10 @@ static void __pth_wait_cb(struct uthread *uthread, void *junk)
 	__pthread_generic_yield(pthread);
 	pthread->state = PTH_BLK_MUTEX;
 	spin_pdr_lock(&c->spdr_lock);
+	if (!c->waiters.tqh_last)
+		TAILQ_INIT(&c->waiters);
 	TAILQ_INSERT_TAIL(&c->waiters, pthread, next);
+	c->mutex = m;
 	spin_pdr_unlock(&c->spdr_lock);
 	pthread_mutex_unlock(m);
 }
@@ -1006,7 +1233,9 @@ int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m)
 	local_junk.c = c;
 	local_junk.m = m;
 	uthread_yield(TRUE, __pth_wait_cb, &local_junk);
-	pthread_mutex_lock(m);
+	/* We might have been moved onto m's waiters, with others behind us */
+	__pthread_mutex_lock_slow(m);
+	cmb();
 	return 0;
 }
 
@@ -34,6 +34,7 @@ struct pthread_tcb {
 	bool detached;
 	struct pthread_tcb *joiner;			/* raced on by exit and join */
 	uint32_t id;
+	uint32_t vcoreid;					/* where we last ran, for lock spinners */
 	uint32_t stacksize;
 	void *stacktop;
 	void *(*start_routine)(void*);
@@ -55,12 +56,13 @@ struct sysc_mgmt {
 
 #define PTHREAD_ONCE_INIT 0
 #define PTHREAD_BARRIER_SERIAL_THREAD 12345
-#define PTHREAD_MUTEX_INITIALIZER {0,0}
+#define PTHREAD_MUTEX_INITIALIZER {0, 0, 0, SPINPDR_INITIALIZER, {0}}
 #define PTHREAD_MUTEX_NORMAL 0
 #define PTHREAD_MUTEX_DEFAULT PTHREAD_MUTEX_NORMAL
 #define PTHREAD_MUTEX_SPINS 100 // totally arbitrary
+#define PTHREAD_MUTEX_MAX_SPINS 10000 // cap on spinning for a running owner
 #define PTHREAD_BARRIER_SPINS 100 // totally arbitrary
-#define PTHREAD_COND_INITIALIZER {0,{0},{0},0}
+#define PTHREAD_COND_INITIALIZER {{0}, SPINPDR_INITIALIZER, 0, 0, 0}
 #define PTHREAD_PROCESS_PRIVATE 0
 #define PTHREAD_PROCESS_SHARED 1
 
@@ -69,10 +71,17 @@ typedef struct
   int type;
 } pthread_mutexattr_t;
 
+/* lock is 0 (unlocked), 1 (locked), or 2 (locked, and there may be waiters).
+ * Lockers spin while the owner is running on a vcore, and otherwise sleep on
+ * waiters.  The waiters queue is lazily initialized, so that the static
+ * initializer works. */
 typedef struct
 {
   const pthread_mutexattr_t* attr;
   atomic_t lock;
+  struct pthread_tcb *owner;
+  struct spin_pdr_lock wait_lock;
+  struct pthread_queue waiters;
 } pthread_mutex_t;
 
 typedef struct
@@ -113,13 +122,15 @@ typedef struct
 
 /* Regarding the spinlock vs MCS, I don't expect this lock to be heavily
  * contended.  Most of the time, the caller already holds the mutex associated
- * with the cond var. */
+ * with the cond var.  mutex is the one the waiters are using, which broadcast
+ * moves them onto instead of waking them all. */
 typedef struct
 {
 	struct pthread_queue		waiters;
 	struct spin_pdr_lock 		spdr_lock;
 	int 						attr_pshared;
 	int 						attr_clock;
+	pthread_mutex_t				*mutex;
 } pthread_cond_t;
 
 typedef struct 